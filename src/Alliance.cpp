@@ -8,9 +8,8 @@
 #include "AllianceMgr.h"
 #include "spitfire.h"
 #include "Client.h"
+#include "storage.h"
 #include <Poco/Data/MySQL/MySQLException.h>
-#include <Poco/Data/RecordSet.h>
-#include <Poco/Data/Session.h>
 
 using namespace Poco::Data;
 using namespace Poco::Data::Keywords;
@@ -44,24 +43,13 @@ Alliance::~Alliance()
 
 bool Alliance::InsertToDB()
 {
-    typedef Poco::Tuple<std::string, std::string, std::string, int64_t> AllianceSave;
-    //name, founder, leader
-
-    AllianceSave savedata(m_name, m_founder, m_owner, Utils::time());
-
     try
     {
-        Poco::Data::Session ses(spitfire::GetSingleton().serverpool->get());
-        ses << "INSERT INTO `alliances` (name,founder,leader,created,note,intro,motd,allies,neutrals,enemies,members) VALUES (?,?,?,?,'','','','','','','');", use(savedata), now;
-
-        Statement lastinsert = (ses << "SELECT " + LAST_INSERT_ID);
-        lastinsert.execute();
-        RecordSet lsi(lastinsert);
-        lsi.moveFirst();
-        int64_t lsiv = lsi.value(LAST_INSERT_ID).convert<int64_t>();
-        if (lsiv > 0)
+        std::unique_ptr<storageconn> db = spitfire::GetSingleton().store->Connect();
+        int64_t id = db->CreateAlliance(m_name, m_founder, m_owner, Utils::time());
+        if (id > 0)
         {
-            m_allianceid = lsiv;
+            m_allianceid = id;
         }
         else
         {
@@ -77,11 +65,23 @@ bool Alliance::InsertToDB()
 }
 
 bool Alliance::DeleteFromDB()
+{
+    // Goes through the save queue behind any snapshot of this alliance
+    // already handed over, so a late save cannot put the row back
+    int64_t id = m_allianceid;
+    spitfire::GetSingleton().saves.Push({ [id](storageconn & db)
+    {
+        db.DeleteAlliance(id);
+    } });
+    return true;
+}
+
+bool Alliance::SaveToDB()
 {
     try
     {
-        Poco::Data::Session ses(spitfire::GetSingleton().serverpool->get());
-        ses << "DELETE FROM `alliances` WHERE id=?;", use(m_allianceid), now;
+        std::unique_ptr<storageconn> db = spitfire::GetSingleton().store->Connect();
+        SaveJob({ this })(*db);
         return true;
     }
     SQLCATCH3(0, spitfire::GetSingleton());
@@ -89,62 +89,42 @@ bool Alliance::DeleteFromDB()
     return false;
 }
 
-bool Alliance::SaveToDB()
+savejob Alliance::SaveJob(const std::vector<Alliance*> & alliances)
 {
-    typedef Poco::Tuple<std::string, std::string, std::string, std::string, std::string, std::string, std::string, std::string, std::string, std::string> AllianceSave;
-    //name, founder, leader, note, intro, motd, allies, neutrals, enemies, members
-
-
-    std::vector<Poco::Any> args;
-    std::stringstream ss;
-
-    std::string allies = "";
-    std::string neutrals = "";
-    std::string enemies = "";
-    std::string members = "";
-
-    for (int64_t id : m_allies)
-    {
-        args.push_back(id);
-        ss << "%?d|";
-    }
-    Poco::format(allies, ss.str(), args);
-
-    for (int64_t id : m_neutral)
+    std::vector<AllianceSave> rows;
+    rows.reserve(alliances.size());
+    for (Alliance * alliance : alliances)
     {
-        args.push_back(id);
-        ss << "%?d|";
+        rows.emplace_back(alliance->m_allianceid, alliance->m_name, alliance->m_founder, alliance->m_owner, alliance->m_note, alliance->m_intro, alliance->m_motd,
+            DBRelation(alliance->m_allies), DBRelation(alliance->m_neutral), DBRelation(alliance->m_enemies), alliance->DBMembers());
     }
-    Poco::format(neutrals, ss.str(), args);
+    uint32_t rowsper = spitfire::GetSingleton().saverows;
+    std::vector<int64_t> ids;
+    ids.reserve(alliances.size());
+    for (Alliance * alliance : alliances)
+        ids.push_back(alliance->m_allianceid);
 
-    for (int64_t id : m_enemies)
+    return savejob([rows, rowsper](storageconn & db) mutable
     {
-        args.push_back(id);
-        ss << "%?d|";
-    }
-    Poco::format(enemies, ss.str(), args);
-
-    for (stMember & member : m_members)
+        db.SaveAlliances(rows, rowsper);
+    }, [ids]()
     {
-        args.push_back(member.clientid);
-        args.push_back(member.rank);
-        ss << "%?d,%?d|";
-    }
-    Poco::format(members, ss.str(), args);
-
-    AllianceSave savedata(m_name, m_founder, m_owner, m_note, m_intro, m_motd, allies, neutrals, enemies, members);
-
+        for (int64_t id : ids)
+        {
+            if (Alliance * alliance = spitfire::GetSingleton().m_alliances->AllianceById(id))
+                alliance->MarkDirty();
+        }
+    });
+}
 
-    //name, founder, leader, note, intro, motd, allies, neutrals, enemies, members
-    try
+void Alliance::MarkDirty()
+{
+    spitfire::GetSingleton().Journal(this);
+    if (!m_dirty)
     {
-        Poco::Data::Session ses(spitfire::GetSingleton().serverpool->get());
-        ses << "UPDATE `alliances` SET name=?,founder=?,leader=?,note=?,intro=?,motd=?,allies=?,neutrals=?,enemies=?,members=? WHERE id=?;", use(savedata), use(m_allianceid), now;
-        return true;
+        m_dirty = true;
+        spitfire::GetSingleton().dirtyalliances.push_back(this);
     }
-    SQLCATCH3(0, spitfire::GetSingleton());
-
-    return false;
 }
 
 amf3object Alliance::ToObject()
@@ -314,6 +294,30 @@ void Alliance::ParseMembers(std::string str)
     }
 }
 
+std::string Alliance::DBMembers() const
+{
+    std::string res;
+    for (const stMember & member : m_members)
+    {
+        res += std::to_string(member.clientid);
+        res += ',';
+        res += std::to_string(member.rank);
+        res += '|';
+    }
+    return res;
+}
+
+std::string Alliance::DBRelation(const std::list<int64_t> & list)
+{
+    std::string res;
+    for (int64_t id : list)
+    {
+        res += std::to_string(id);
+        res += '|';
+    }
+    return res;
+}
+
 void Alliance::ParseRelation(std::list<int64_t> * list, std::string str)
 {
     if (str.length() > 0)
@@ -416,8 +420,5 @@ void Alliance::SendAllianceMessage(std::string msg, bool tv, bool nosender)
 
     obj["data"] = data;
 
-    for (Alliance::stMember & client : m_members)
-    {
-        spitfire::GetSingleton().SendObject(spitfire::GetSingleton().GetClient(client.clientid), obj);
-    }
+    spitfire::GetSingleton().Broadcast(stBroadcastTarget::ToAlliance(m_allianceid), obj);
 }
@@ -7,6 +7,7 @@
 #pragma once
 
 #include "structs.h"
+#include "savequeue.h"
 
 class spitfire;
 class Client;
@@ -34,6 +35,11 @@ public:
     amf3object ToObject();
 
     bool SaveToDB();
+    // Snapshot of the alliance rows for the save thread
+    static savejob SaveJob(const std::vector<Alliance*> & alliances);
+    // Queue this alliance for the next background save
+    void MarkDirty();
+    bool m_dirty = false;
     bool DeleteFromDB();
     bool InsertToDB();
 
@@ -53,6 +59,9 @@ public:
     bool RemoveMember(uint64_t clientid);
     void ParseMembers(std::string str);
     void ParseRelation(std::list<int64_t> * list, std::string str);
+    // Inverse of ParseMembers / ParseRelation
+    std::string DBMembers() const;
+    static std::string DBRelation(const std::list<int64_t> & list);
 
     void RequestJoin(Client * client, uint64_t timestamp);
     void UnRequestJoin(Client * client);
@@ -70,6 +70,11 @@ void AllianceMgr::DeleteAlliance(Alliance * alliance)
     }
     alliance->m_invites.clear();
     alliance->DeleteFromDB();
+    m_membersrank.Remove(alliance);
+    m_prestigerank.Remove(alliance);
+    m_honorrank.Remove(alliance);
+    m_names.Remove(alliance);
+    spitfire::GetSingleton().ForgetDirty(alliance);
     delete m_alliances[found];
     m_alliances[found] = nullptr;
     SortAlliances();
@@ -256,87 +261,48 @@ int16_t AllianceMgr::GetRelation(int64_t client1, int64_t client2)
         return DEF_NORELATION;
 }
 
-bool comparemembers(stAlliance first, stAlliance second)
-{
-    if (first.members > second.members)
-        return true;
-    else
-        return false;
-}
-bool compareprestige(stAlliance first, stAlliance second)
-{
-    if (first.prestige > second.prestige)
-        return true;
-    else
-        return false;
-}
-bool comparehonor(stAlliance first, stAlliance second)
-{
-    if (first.honor > second.honor)
-        return true;
-    else
-        return false;
-}
-
 void AllianceMgr::SortAlliances()
 {
-    m_membersrank.clear();
-    m_prestigerank.clear();
-    m_honorrank.clear();
+    // Alliance scores are member sums, so they are recomputed here; only the
+    // alliances whose totals moved get repositioned
+    m_membersrank.BeginSweep();
+    m_prestigerank.BeginSweep();
+    m_honorrank.BeginSweep();
 
-    stAlliance stmem;
-    stAlliance stpre;
-    stAlliance sthon;
     for (int i = 0; i < DEF_MAXALLIANCES; ++i)
     {
         if (m_alliances[i])
         {
-            sthon.honor = stpre.prestige = 0;
-            stmem.id = stpre.id = sthon.id = m_alliances[i]->m_allianceid;
-            stmem.members = m_alliances[i]->m_members.size();
-            m_alliances[i]->m_allicitycount = 0;
-            for (Alliance::stMember & member : m_alliances[i]->m_members)
+            Alliance * alliance = m_alliances[i];
+            double honor = 0;
+            double prestige = 0;
+            alliance->m_allicitycount = 0;
+            for (Alliance::stMember & member : alliance->m_members)
             {
                 Client * client = spitfire::GetSingleton().GetClient(member.clientid);
                 if (client)
                 {
-                    sthon.honor += client->honor;
-                    stpre.prestige += client->prestige;
-                    m_alliances[i]->m_allicitycount += client->citylist.size();
+                    honor += client->honor;
+                    prestige += client->prestige;
+                    alliance->m_allicitycount += client->citylist.size();
                 }
             }
-            stmem.ref = m_alliances[i];
-            stpre.ref = m_alliances[i];
-            sthon.ref = m_alliances[i];
-            m_membersrank.push_back(stmem);
-            m_prestigerank.push_back(stpre);
-            m_honorrank.push_back(sthon);
+            alliance->m_prestige = prestige;
+            alliance->m_honor = honor;
+            m_membersrank.Update(alliance, { double(alliance->m_members.size()), prestige }, alliance->m_allianceid);
+            m_prestigerank.Update(alliance, { prestige, 0 }, alliance->m_allianceid);
+            m_honorrank.Update(alliance, { honor, 0 }, alliance->m_allianceid);
+            m_names.Set(alliance, alliance->m_name);
         }
     }
 
-    m_membersrank.sort(compareprestige);
-    m_membersrank.sort(comparemembers);
-    m_prestigerank.sort(compareprestige);
-    m_honorrank.sort(comparehonor);
-
+    m_membersrank.EndSweep();
+    m_prestigerank.EndSweep();
+    m_honorrank.EndSweep();
 
-    int num = 1;
-    for (stAlliance & alliance : m_membersrank)
-    {
-        alliance.rank = alliance.ref->m_membersrank = num++;
-    }
-    num = 1;
-    for (stAlliance & alliance : m_prestigerank)
-    {
-        alliance.rank = alliance.ref->m_prestigerank = num++;
-        alliance.ref->m_prestige = alliance.prestige;
-    }
-    num = 1;
-    for (stAlliance & alliance : m_honorrank)
-    {
-        alliance.rank = alliance.ref->m_honorrank = num++;
-        alliance.ref->m_honor = alliance.honor;
-    }
+    m_membersrank.ForEach([](Alliance * alliance, int32_t rank) { alliance->m_membersrank = rank; });
+    m_prestigerank.ForEach([](Alliance * alliance, int32_t rank) { alliance->m_prestigerank = rank; });
+    m_honorrank.ForEach([](Alliance * alliance, int32_t rank) { alliance->m_honorrank = rank; });
 }
 
 Alliance * AllianceMgr::AllianceById(int64_t id)//util
@@ -7,8 +7,11 @@
 #pragma once
 
 #include <string.h>
+#include <utility>
 #include "structs.h"
 #include "defines.h"
+#include "ranktree.h"
+#include "nameindex.h"
 
 
 class spitfire;
@@ -17,6 +20,10 @@ class Client;
 
 #define DEF_MAXALLIANCES 1000
 
+// Alliance rankings score (primary, secondary); members ranks by member count
+// then prestige, the others leave the secondary at 0
+typedef ranktree<Alliance*, std::pair<double, double>> allianceranking;
+
 class AllianceMgr
 {
 public:
@@ -88,8 +95,9 @@ public:
 
     Alliance * m_alliances[DEF_MAXALLIANCES];
 
-    std::list<stAlliance> m_membersrank;
-    std::list<stAlliance> m_prestigerank;
-    std::list<stAlliance> m_honorrank;
+    allianceranking m_membersrank;
+    allianceranking m_prestigerank;
+    allianceranking m_honorrank;
+    nameindex<Alliance*> m_names;
 };
 
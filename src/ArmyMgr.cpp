@@ -0,0 +1,102 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#include "ArmyMgr.h"
+#include "spitfire.h"
+#include "Client.h"
+#include "PlayerCity.h"
+#include "Hero.h"
+
+
+stArmyMovement * ArmyMgr::Create()
+{
+    uint32_t slot;
+    uint32_t generation = 0;
+    if (!freeslots.empty())
+    {
+        slot = freeslots.back();
+        freeslots.pop_back();
+        generation = slab[slot].generation + 1;
+        slab[slot] = stArmyMovement();
+    }
+    else
+    {
+        slot = uint32_t(slab.size());
+        slab.emplace_back();
+    }
+    stArmyMovement * am = &slab[slot];
+    am->slot = slot;
+    am->generation = generation;
+    am->active = true;
+    am->hero = nullptr;
+    am->city = nullptr;
+    am->client = nullptr;
+    ++count;
+    return am;
+}
+
+void ArmyMgr::Add(stArmyMovement * am)
+{
+    am->client->armymovement.push_back(am);
+    if (am->city)
+        ((PlayerCity*)am->city)->armymovement.push_back(am);
+    tiles[am->targetfieldid].push_back(am);
+    Update(am);
+}
+
+void ArmyMgr::Update(stArmyMovement * am)
+{
+    dirty = true;
+    spitfire::GetSingleton().Journal(am);
+    if (am->direction == DIRECTION_STAY)
+        spitfire::GetSingleton().Unschedule(DEF_TIMEDARMY, am->slot, 0);
+    else
+        spitfire::GetSingleton().Schedule(DEF_TIMEDARMY, am->slot, 0, double(am->reachtime));
+}
+
+void ArmyMgr::Remove(stArmyMovement * am)
+{
+    if (!am->active)
+        return;
+    dirty = true;
+    spitfire::GetSingleton().JournalGone(am);
+
+    spitfire::GetSingleton().Unschedule(DEF_TIMEDARMY, am->slot, 0);
+
+    ownerarmylist::unlink(am);
+    cityarmylist::unlink(am);
+    targetarmylist::unlink(am);
+    if (am->tilelink.list)
+    {
+        tilearmylist::unlink(am);
+        auto iter = tiles.find(am->targetfieldid);
+        if (iter != tiles.end() && iter->second.empty())
+            tiles.erase(iter);
+    }
+
+    if (am->hero && am->hero->movement == am)
+        am->hero->movement = nullptr;
+
+    am->active = false;
+    am->client = nullptr;
+    freeslots.push_back(am->slot);
+    --count;
+}
+
+stArmyMovement * ArmyMgr::Get(uint32_t slot)
+{
+    if (slot >= slab.size() || !slab[slot].active)
+        return nullptr;
+    return &slab[slot];
+}
+
+const tilearmylist * ArmyMgr::AtTile(uint32_t tileid) const
+{
+    auto iter = tiles.find(tileid);
+    if (iter == tiles.end())
+        return nullptr;
+    return &iter->second;
+}
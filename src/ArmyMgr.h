@@ -0,0 +1,71 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#pragma once
+
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include "armylist.h"
+#include "defines.h"
+
+/// Owns every army on the map. Armies live in a slab with stable addresses
+/// and are linked into the owner's, origin city's and target tile's lists.
+/// Marching armies are scheduled for arrival on spitfire's timers keyed by
+/// their slot, so arrivals never scan the whole slab.
+class ArmyMgr
+{
+public:
+    ArmyMgr() = default;
+    ArmyMgr(const ArmyMgr &) = delete;
+    ArmyMgr & operator=(const ArmyMgr &) = delete;
+
+    /// Take a cleared army from the slab. Fill it in, then Add() it.
+    stArmyMovement * Create();
+
+    /// Link the army into its owner, origin city and target tile lists and
+    /// schedule its arrival
+    void Add(stArmyMovement * am);
+
+    /// Reschedule after direction or reachtime changed. Staying armies have no deadline.
+    void Update(stArmyMovement * am);
+
+    /// Unlink the army from every list and return its slot to the slab
+    void Remove(stArmyMovement * am);
+
+    /// Army in a slot, nullptr if the slot is free
+    stArmyMovement * Get(uint32_t slot);
+
+    /// Names one army for the life of the process: its slot and the slot's
+    /// generation, so a reused slot gets a new key
+    static uint64_t Key(const stArmyMovement * am) { return (uint64_t(am->generation) << 32) | am->slot; }
+
+    /// Set whenever an army is added, moved on or removed; cleared once the
+    /// armies table has been snapshotted for saving
+    bool dirty = false;
+
+    /// Armies targeting a tile, nullptr if there are none
+    const tilearmylist * AtTile(uint32_t tileid) const;
+
+    std::size_t Count() const { return count; }
+
+    template<typename F>
+    void ForEach(F f)
+    {
+        for (stArmyMovement & am : slab)
+        {
+            if (am.active)
+                f(&am);
+        }
+    }
+
+private:
+    std::deque<stArmyMovement> slab;
+    std::vector<uint32_t> freeslots;
+    std::unordered_map<uint32_t, tilearmylist> tiles;
+    std::size_t count = 0;
+};
@@ -105,6 +105,8 @@ bool City::SetBuilding(int16_t type, int8_t level, int16_t position, int16_t sta
         m_innerbuildings[position].status = status;
         m_innerbuildings[position].starttime = starttime;
         m_innerbuildings[position].endtime = endtime;
+        if ((type == B_TOWNHALL) && (this->m_type == CASTLE) && ((PlayerCity*)this)->m_client)
+            spitfire::GetSingleton().RankCastle((PlayerCity*)this);
         return true;
     }
     return false;
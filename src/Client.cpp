@@ -11,6 +11,8 @@
 #include "spitfire.h"
 #include "Tile.h"
 #include "City.h"
+#include "storage.h"
+#include "statecodec.h"
 // #include "AllianceMgr.h"
 // #include "Alliance.h"
 #include <Poco/Data/MySQL/MySQLException.h>
@@ -102,47 +104,51 @@ Alliance * Client::GetAlliance()
 std::string Client::DBBuffs()
 {
     std::string res;
-    std::stringstream ss;
-    std::vector<Poco::Any> args;
+    statewriter w(res);
 
-    for (stBuff buff : bufflist)
+    for (stBuff & buff : bufflist)
     {
-        args.push_back(buff.id);
-        args.push_back(buff.desc);
-        args.push_back(buff.endtime);
-        ss << "%?d,%?d,%?f|";
+        if (buff.id.length() == 0)
+            continue;
+        w.Str(buff.id);
+        w.Str(buff.desc);
+        w.Time(buff.endtime);
     }
-    Poco::format(res, ss.str(), args);
     return res;
 }
 
 std::string Client::DBResearch()
 {
-    std::stringstream ss;
+    std::string res;
+    statewriter w(res);
 
     for (int i = 0; i < 25; ++i)
     {
-        ss << i << "," << research[i].level << "," << research[i].castleid << "," << research[i].starttime << "," << research[i].endtime << "|";
+        // untouched techs are all zero, which is also what Parse leaves them at
+        if (research[i].level == 0 && research[i].castleid == 0 && research[i].endtime == 0)
+            continue;
+        w.Int(i);
+        w.Int(research[i].level);
+        w.Int(research[i].castleid);
+        w.Time(research[i].starttime);
+        w.Time(research[i].endtime);
     }
-    return ss.str();
+    return res;
 }
 
 std::string Client::DBItems()
 {
     std::string res;
-    std::stringstream ss;
-    std::vector<Poco::Any> args;
+    statewriter w(res);
 
     for (stItem & sitem : itemlist)
     {
         if (sitem.count > 0)
         {
-            args.push_back(sitem.id);
-            args.push_back(sitem.count);
-            ss << "%s,%?d|";
+            w.Str(sitem.id);
+            w.Int(sitem.count);
         }
     }
-    Poco::format(res, ss.str(), args);
     return res;
 }
 
@@ -166,16 +172,10 @@ std::string Client::DBCastleSign()
 
 bool Client::SaveToDB()
 {
-    typedef Poco::Tuple<std::string, std::string, std::string, std::string, int32_t, std::string, int32_t, std::string, std::string, int32_t, int16_t, uint64_t, double, double, double, bool, int8_t, std::string, int64_t, std::string> ClientSave;
-
-
-    ClientSave savedata(DBBuffs(), DBResearch(), DBItems(), DBMisc(), status, ipaddress, sex, flag, faceurl, allianceid, alliancerank, cents, prestige, honor, lastlogin, haschangedface, icon, allianceapply, allianceapplytime, DBCastleSign());
-
-
     try
     {
-        Poco::Data::Session ses(spitfire::GetSingleton().serverpool->get());
-        ses << "UPDATE `accounts` SET buffs=?,`research`=?,items=?,misc=?,`status`=?,ipaddress=?,sex=?,flag=?,faceurl=?,allianceid=?,alliancerank=?,cents=?,prestige=?,honor=?,lastlogin=?,changedface=?,icon=?,allianceapply=?,allianceapplytime=?,castlesign=? WHERE accountid=?;", use(savedata), use(accountid), now;
+        std::unique_ptr<storageconn> db = spitfire::GetSingleton().store->Connect();
+        SaveJob({ this })(*db);
         return true;
     }
     SQLCATCH3(0, spitfire::GetSingleton());
@@ -183,6 +183,90 @@ bool Client::SaveToDB()
     return false;
 }
 
+savejob Client::SaveJob(const std::vector<Client*> & clients)
+{
+    std::vector<AccountSave> rows;
+    rows.reserve(clients.size());
+    for (Client * c : clients)
+    {
+        rows.emplace_back(c->accountid, c->masteraccountid, c->playername, c->creation, c->DBBuffs(), c->DBResearch(), c->DBItems(), c->DBMisc(), c->status, c->ipaddress,
+            c->sex, c->flag, c->faceurl, c->allianceid, c->alliancerank, c->cents, c->prestige, c->honor, c->lastlogin, c->haschangedface, c->icon, c->allianceapply,
+            c->allianceapplytime, c->DBCastleSign());
+    }
+    uint32_t rowsper = spitfire::GetSingleton().saverows;
+    std::vector<int64_t> ids;
+    ids.reserve(clients.size());
+    for (Client * c : clients)
+        ids.push_back(c->accountid);
+
+    return savejob([rows, rowsper](storageconn & db) mutable
+    {
+        db.SaveAccounts(rows, rowsper);
+    }, [ids]()
+    {
+        for (int64_t id : ids)
+        {
+            if (Client * c = spitfire::GetSingleton().GetClient(id))
+                c->MarkDirty();
+        }
+    });
+}
+
+savejob Client::ReportsSaveJob()
+{
+    std::vector<ReportRow> reports;
+    reports.reserve(reportlist.size());
+    for (stReport & r : reportlist)
+        reports.emplace_back(accountid, r.armytype, r.back, r.attack, r.type_id, r.startpos, r.targetpos, r.title, r.guid, r.eventtime, r.isread);
+    int64_t id = accountid;
+    uint32_t rowsper = spitfire::GetSingleton().saverows;
+
+    return savejob([reports, id, rowsper](storageconn & db) mutable
+    {
+        db.SaveReports(id, reports, rowsper);
+    }, [id]()
+    {
+        if (Client * c = spitfire::GetSingleton().GetClient(id))
+            c->MarkReportsDirty();
+    });
+}
+
+void Client::MarkDirty()
+{
+    spitfire::GetSingleton().Journal(this);
+    if (!dirty && !reportsdirty)
+        spitfire::GetSingleton().dirtyclients.push_back(this);
+    dirty = true;
+}
+
+void Client::MarkReportsDirty()
+{
+    // the store holds the reports, saving the empty list would wipe them;
+    // reports for an evicted account go through spitfire::FileReport
+    if (evicted)
+    {
+        spitfire::GetSingleton().log->error("Reports of evicted account {} marked for saving.", accountid);
+        return;
+    }
+    spitfire::GetSingleton().JournalReports(this);
+    if (!dirty && !reportsdirty)
+        spitfire::GetSingleton().dirtyclients.push_back(this);
+    reportsdirty = true;
+}
+
+void Client::MarkReportFiled()
+{
+    if (evicted)
+    {
+        spitfire::GetSingleton().log->error("Report filed in the evicted reports of account {}.", accountid);
+        return;
+    }
+    spitfire::GetSingleton().JournalReport(accountid, reportlist.front());
+    if (!dirty && !reportsdirty)
+        spitfire::GetSingleton().dirtyclients.push_back(this);
+    reportsdirty = true;
+}
+
 amf3object  Client::ToObject()
 {
     amf3object obj = amf3object();
@@ -571,10 +655,7 @@ amf3object Client::PlayerInfo()
     obj["ranking"] = prestigerank;
     obj["titleId"] = title;
     obj["lastLoginTime"] = lastlogin;
-    population = 0;
-
-    for (int i = 0; i < citycount; ++i)
-        population += ((PlayerCity*)citylist.at(i))->m_population;
+    SumPopulation();
 
     obj["population"] = population;
     return obj;
@@ -582,6 +663,17 @@ amf3object Client::PlayerInfo()
 
 void Client::ParseBuffs(std::string str)
 {
+    if (statecodec::IsPacked(str))
+    {
+        statereader r(str);
+        std::string id, desc;
+        double endtime;
+        while (!r.AtEnd() && r.Str(id) && r.Str(desc) && r.Time(endtime))
+            SetBuff(id, desc, int64_t(endtime));
+        if (!r.Good())
+            spitfire::GetSingleton().log->error("Error in '{}' ParseBuffs()", playername);
+        return;
+    }
     if (str.length() > 0)
     {
         std::vector<std::string> bufftokens;
@@ -601,6 +693,20 @@ void Client::ParseBuffs(std::string str)
 }
 void Client::ParseResearch(std::string str)
 {
+    if (statecodec::IsPacked(str))
+    {
+        statereader r(str);
+        int64_t id, level, castleid;
+        double starttime, endtime;
+        while (!r.AtEnd() && r.Int(id) && r.Int(level) && r.Int(castleid) && r.Time(starttime) && r.Time(endtime))
+        {
+            if (id >= 0 && id < 25)
+                SetResearch(uint16_t(id), int16_t(level), int32_t(castleid), starttime, endtime);
+        }
+        if (!r.Good())
+            spitfire::GetSingleton().log->error("Error in '{}' ParseResearch()", playername);
+        return;
+    }
     if (str.length() > 0)
     {
         std::vector<std::string> researchtokens;
@@ -622,6 +728,20 @@ void Client::ParseResearch(std::string str)
 }
 void Client::ParseItems(std::string str)
 {
+    if (statecodec::IsPacked(str))
+    {
+        statereader r(str);
+        std::string id;
+        int64_t count;
+        while (!r.AtEnd() && r.Str(id) && r.Int(count))
+        {
+            if (id.length() > 0)
+                SetItem(id, count);
+        }
+        if (!r.Good())
+            spitfire::GetSingleton().log->error("Error in '{}' ParseItems()", playername);
+        return;
+    }
     if (str.length() > 0)
     {
         std::vector<std::string> itemtokens;
@@ -703,6 +823,7 @@ void Client::SetBuff(std::string type, std::string desc, int64_t endtime, int8_t
         {
             bufflist[i].endtime = endtime;
             BuffUpdate(type, desc, endtime);
+            spitfire::GetSingleton().ScheduleBuffs(this);
             return;
         }
     }
@@ -714,6 +835,7 @@ void Client::SetBuff(std::string type, std::string desc, int64_t endtime, int8_t
     bufflist.push_back(buff);
 
     BuffUpdate(type, desc, endtime, param);
+    spitfire::GetSingleton().ScheduleBuffs(this);
     return;
 }
 
@@ -852,11 +974,27 @@ int16_t Client::GetResearchLevel(int16_t id)
     return research[id].level;
 }
 
-void Client::CalculateResources()
+void Client::Prestige(double pres)
+{
+    prestige += pres;
+    if (prestige < 0)
+        prestige = 0;
+    if (prestige > 2100000000)
+        prestige = 2100000000;
+    spitfire::GetSingleton().RankClient(this);
+}
+
+void Client::SumPopulation()
 {
     population = 0;
     for (int i = 0; i < citycount; ++i)
         population += ((PlayerCity*)citylist.at(i))->m_population;
+    spitfire::GetSingleton().RankClient(this);
+}
+
+void Client::CalculateResources()
+{
+    SumPopulation();
 
     for (int i = 0; i < citylist.size(); ++i)
     {
@@ -872,9 +1010,9 @@ void Client::CalculateResources()
 void Client::PlayerInfoUpdate()
 {
     amf3object obj = amf3object();
-    obj["cmd"] = "server.PlayerInfoUpdate";
-    obj["data"] = amf3object();
-    amf3object & data = obj["data"];
+    obj[atoms::cmd] = "server.PlayerInfoUpdate";
+    obj[atoms::data] = amf3object();
+    amf3object & data = obj[atoms::data];
     data["playerInfo"] = PlayerInfo();
 
     spitfire::GetSingleton().SendObject(this, obj);
@@ -9,7 +9,13 @@
 #include "PlayerCity.h"
 #include "connection.h"
 #include "structs.h"
+#include "armylist.h"
 #include "defines.h"
+#include "savequeue.h"
+
+#include <atomic>
+#include <functional>
+#include <list>
 
 class spitfire;
 
@@ -33,19 +39,46 @@ public:
     amf3object PlayerInfo();
 
     bool SaveToDB();
+    // Snapshot of the account rows / of this account's report rows for the save thread
+    static savejob SaveJob(const std::vector<Client*> & clients);
+    savejob ReportsSaveJob();
+    // Queue this account (or its reports) for the next background save
+    void MarkDirty();
+    void MarkReportsDirty();
+    // Same after a report was put in front of reportlist; journals only that report
+    void MarkReportFiled();
+    bool dirty = false;
+    bool reportsdirty = false;
+
+    // An account offline for longer than hibernateafter sits out the
+    // periodic ticks until spitfire::Wake catches it up
+    bool hibernating = false;
+    uint64_t hibernatedat = 0;
+    // when the account was last online
+    uint64_t lastseen = 0;
+    // Its mail and reports are only in the store, see spitfire::Evict
+    bool evicted = false;
+    // flush stamp the last queued save of the reports commits with
+    uint64_t reportstamp = 0;
+    // mail and report writes posted to serverdb that have not run yet
+    std::atomic<uint32_t> pendingwrites{ 0 };
+    // spitfire::Fault is reading the histories back. Mail filed meanwhile
+    // waits in faultmail; faultreports holds reports the store may not have,
+    // filed meanwhile or whose insert failed. The next fault merges both.
+    bool faulting = false;
+    std::list<stMail> faultmail;
+    std::list<stReport> faultreports;
+    std::vector<std::function<void(bool)>> faultwaiters;
+    // place in spitfire::sleepers while hibernating and not evicted
+    std::list<Client*>::iterator sleeper;
 
     double Prestige() const
     {
         return prestige;
     }
-    void Prestige(double pres)
-    {
-        prestige += pres;
-        if (prestige < 0)
-            prestige = 0;
-        if (prestige > 2100000000)
-            prestige = 2100000000;
-    }
+    void Prestige(double pres);
+    // Totals the cities' population and repositions the client in the rankings
+    void SumPopulation();
 
     void ParseBuffs(std::string str);
     void ParseResearch(std::string str);
@@ -147,9 +180,9 @@ public:
         return nullptr;
     }
 
-    std::list<stArmyMovement*> armymovement;
-    std::list<stArmyMovement*> friendarmymovement;
-    std::list<stArmyMovement*> enemyarmymovement;
+    ownerarmylist armymovement;
+    targetarmylist friendarmymovement;
+    targetarmylist enemyarmymovement;
 
     void CalculateResources();
     void PlayerInfoUpdate();
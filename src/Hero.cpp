@@ -9,6 +9,7 @@
 #include "spitfire.h"
 #include "amf3.h"
 #include "defines.h"
+#include "storage.h"
 #include <Poco/Data/MySQL/MySQLException.h>
 
 using namespace Poco::Data::Keywords;
@@ -36,36 +37,28 @@ Hero::~Hero()
 
 bool Hero::InsertToDB()
 {
-    using HeroSave = Poco::Tuple<uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, double, double, int32_t, int32_t, uint32_t, std::string, int8_t>;
-
-
-    HeroSave savedata(m_basemanagement, m_basepower, m_basestratagem, m_power, m_poweradded, m_powerbuffadded,
-        m_stratagem, m_stratagemadded, m_stratagembuffadded, m_management, m_managementadded, m_managementbuffadded,
-        m_experience, m_upgradeexp, m_itemamount, m_itemid, m_level, m_logourl, m_loyalty);
-
+    // a new hero already has its id, so inserting is saving it
+    return SaveToDB();
+}
 
-    std::string troop;
-    //stArmyMovement * movement;
-    try
+bool Hero::DeleteFromDB()
+{
+    // Goes through the save queue behind any snapshot of this hero already
+    // handed over, so a late save cannot put the row back
+    uint64_t id = m_id;
+    spitfire::GetSingleton().saves.Push({ [id](storageconn & db)
     {
-        Poco::Data::Session ses(spitfire::GetSingleton().serverpool->get());
-        ses << "INSERT INTO `heroes` (basemanagement,basepower,basestratagem,power,poweradded,powerbuffadded,"
-            "stratagem,stratagemadded,stratagembuffadded,management,managementadded,managementbuffadded,"
-            "experience,upgradeexp,itemamount,itemid,level,logurl,loyalty,troop,name,castleid,ownerid,status,remainpoint,id) "
-            "VALUES (?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?);", use(savedata), use(troop), use(m_name), use(m_castleid), use(m_ownerid), use(m_status), use(m_remainpoint), use(m_id), now;
-        return true;
-    }
-    SQLCATCH3(0, spitfire::GetSingleton());
-
-    return false;
+        db.DeleteHero(id);
+    } });
+    return true;
 }
 
-bool Hero::DeleteFromDB()
+bool Hero::SaveToDB()
 {
     try
     {
-        Poco::Data::Session ses(spitfire::GetSingleton().serverpool->get());
-        ses << "DELETE FROM `heroes` WHERE id=?;", use(m_id), now;
+        std::unique_ptr<storageconn> db = spitfire::GetSingleton().store->Connect();
+        SaveJob({ this })(*db);
         return true;
     }
     SQLCATCH3(0, spitfire::GetSingleton());
@@ -73,29 +66,49 @@ bool Hero::DeleteFromDB()
     return false;
 }
 
-bool Hero::SaveToDB()
+savejob Hero::SaveJob(const std::vector<Hero*> & heroes)
 {
-    using HeroSave = Poco::Tuple<uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, double, double, int32_t, int32_t, uint32_t, std::string, int8_t>;
-
-
-    HeroSave savedata(m_basemanagement, m_basepower, m_basestratagem, m_power, m_poweradded, m_powerbuffadded,
-        m_stratagem, m_stratagemadded, m_stratagembuffadded, m_management, m_managementadded, m_managementbuffadded,
-        m_experience, m_upgradeexp, m_itemamount, m_itemid, m_level, m_logourl, m_loyalty);
-
-
-    std::string troop;
     //stArmyMovement * movement;
-    try
+    std::string troop;
+    std::vector<HeroSave> rows;
+    rows.reserve(heroes.size());
+    for (Hero * h : heroes)
     {
-        Poco::Data::Session ses(spitfire::GetSingleton().serverpool->get());
-        ses << "UPDATE `heroes` SET basemanagement=?,basepower=?,basestratagem=?,power=?,poweradded=?,powerbuffadded=?,"
-            "stratagem=?,stratagemadded=?,stratagembuffadded=?,management=?,managementadded=?,managementbuffadded=?,"
-            "experience=?,upgradeexp=?,itemamount=?,itemid=?,level=?,logurl=?,loyalty=?,troop=?,name=?,castleid=?,ownerid=?,status=?,remainpoint=? WHERE id=?;", use(savedata), use(troop), use(m_name), use(m_castleid), use(m_ownerid), use(m_status), use(m_remainpoint), use(m_id), now;
-        return true;
+        rows.emplace_back(h->m_id, h->m_basemanagement, h->m_basepower, h->m_basestratagem, h->m_power, h->m_poweradded, h->m_powerbuffadded,
+            h->m_stratagem, h->m_stratagemadded, h->m_stratagembuffadded, h->m_management, h->m_managementadded, h->m_managementbuffadded,
+            h->m_experience, h->m_upgradeexp, h->m_itemamount, h->m_itemid, h->m_level, h->m_logourl, h->m_loyalty,
+            troop, h->m_name, h->m_castleid, h->m_ownerid, h->m_status, h->m_remainpoint);
     }
-    SQLCATCH3(0, spitfire::GetSingleton());
+    uint32_t rowsper = spitfire::GetSingleton().saverows;
+    // castle and hero id
+    std::vector<std::pair<int64_t, uint64_t>> ids;
+    ids.reserve(heroes.size());
+    for (Hero * h : heroes)
+        ids.emplace_back(h->m_castleid, h->m_id);
+
+    return savejob([rows, rowsper](storageconn & db) mutable
+    {
+        db.SaveHeroes(rows, rowsper);
+    }, [ids]()
+    {
+        for (auto & id : ids)
+        {
+            Client * client = spitfire::GetSingleton().GetClientByCastle(id.first);
+            PlayerCity * city = client ? client->GetCity(id.first) : nullptr;
+            if (Hero * hero = city ? city->GetHero(id.second) : nullptr)
+                hero->MarkDirty();
+        }
+    });
+}
 
-    return false;
+void Hero::MarkDirty()
+{
+    spitfire::GetSingleton().Journal(this);
+    if (!m_dirty)
+    {
+        m_dirty = true;
+        spitfire::GetSingleton().dirtyheroes.push_back(this);
+    }
 }
 
 amf3object Hero::ToObject() const
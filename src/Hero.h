@@ -8,6 +8,7 @@
 
 #include <string>
 #include "structs.h"
+#include "savequeue.h"
 
 
 class Client;
@@ -48,6 +49,11 @@ public:
     stArmyMovement * movement;
 
     bool SaveToDB();
+    // Snapshot of the hero rows for the save thread
+    static savejob SaveJob(const std::vector<Hero*> & heroes);
+    // Queue this hero for the next background save
+    void MarkDirty();
+    bool m_dirty = false;
     bool InsertToDB();
     bool DeleteFromDB();
 
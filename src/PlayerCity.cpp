@@ -9,8 +9,12 @@
 #include "spitfire.h"
 #include "Hero.h"
 #include "defines.h"
+#include "storage.h"
+#include "statecodec.h"
 #include <Poco/Data/MySQL/MySQLException.h>
 #include <spdlog/fmt/fmt.h>
+#include <algorithm>
+#include <limits>
 
 using namespace Poco::Data::Keywords;
 
@@ -27,6 +31,8 @@ PlayerCity::PlayerCity(): m_availablepopulation(0)
     memset(&m_workpopulation, 0, sizeof(m_workpopulation));
     memset(&m_workrate, 0, sizeof(m_workrate));
     memset(&m_storepercent, 0, sizeof(m_storepercent));
+    memset(&m_rate, 0, sizeof(m_rate));
+    m_timers.updateresources = Utils::time();
 
     m_population = 0;
     m_maxpopulation = 50;
@@ -63,16 +69,10 @@ PlayerCity::~PlayerCity(void)
 
 bool PlayerCity::SaveToDB()
 {
-    using CitySave = Poco::Tuple<std::string, int8_t, bool, std::string, int32_t, std::string, std::string, std::string, std::string, std::string, std::string, std::string, bool, bool, double, double, double, double, double>;
-
-
-    CitySave savedata(DBMisc(), m_status, m_allowalliance, m_logurl, m_tileid, DBTransingtrades(), DBTroops(), DBTroopQueues(), m_cityname, DBBuildings(), DBFortifications(), DBTrades(), m_gooutforbattle, m_hasenemy, m_resources.gold, m_resources.food, m_resources.wood, m_resources.iron, m_resources.stone);
-
-
     try
     {
-        auto ses(spitfire::GetSingleton().serverpool->get());
-        ses << "UPDATE `cities` SET misc=?,status=?,allowalliance=?,logurl=?,fieldid=?,transingtrades=?,troop=?,troopqueues=?,name=?,buildings=?,fortification=?,trades=?,gooutforbattle=?,hasenemy=?,gold=?,food=?,wood=?,iron=?,stone=? WHERE id=?;", use(savedata), use(this->m_castleid), now;
+        std::unique_ptr<storageconn> db = spitfire::GetSingleton().store->Connect();
+        SaveJob({ this })(*db);
         return true;
     }
     SQLCATCH3(0, spitfire::GetSingleton());
@@ -80,25 +80,61 @@ bool PlayerCity::SaveToDB()
     return false;
 }
 
+savejob PlayerCity::SaveJob(const std::vector<PlayerCity*> & cities)
+{
+    std::vector<CitySave> rows;
+    rows.reserve(cities.size());
+    for (PlayerCity * c : cities)
+    {
+        rows.emplace_back(c->m_castleid, c->m_client->accountid, c->m_creation, c->DBMisc(), c->m_status, c->m_allowalliance, c->m_logurl, c->m_tileid, c->DBTransingtrades(),
+            c->DBTroops(), c->DBTroopQueues(), c->m_cityname, c->DBBuildings(), c->DBFortifications(), c->DBTrades(), c->m_gooutforbattle, c->m_hasenemy,
+            c->m_resources.gold, c->m_resources.food, c->m_resources.wood, c->m_resources.iron, c->m_resources.stone);
+    }
+    uint32_t rowsper = spitfire::GetSingleton().saverows;
+    std::vector<int64_t> ids;
+    ids.reserve(cities.size());
+    for (PlayerCity * c : cities)
+        ids.push_back(c->m_castleid);
+
+    return savejob([rows, rowsper](storageconn & db) mutable
+    {
+        db.SaveCities(rows, rowsper);
+    }, [ids]()
+    {
+        for (int64_t id : ids)
+        {
+            Client * client = spitfire::GetSingleton().GetClientByCastle(id);
+            if (PlayerCity * city = client ? client->GetCity(id) : nullptr)
+                city->MarkDirty();
+        }
+    });
+}
+
+void PlayerCity::MarkDirty()
+{
+    spitfire::GetSingleton().Journal(this);
+    if (!m_dirty)
+    {
+        m_dirty = true;
+        spitfire::GetSingleton().dirtycities.push_back(this);
+    }
+}
+
 std::string PlayerCity::DBTroopQueues() const
 {
-    std::stringstream ss;
-    std::vector<Poco::Any> z;
     std::string res;
+    statewriter w(res);
     for (const stTroopQueue& x : m_troopqueue) {
         if (x.queue.size() == 0) continue;
-        ss << "%?d,%?f";
-        z.emplace_back(x.positionid);
-        z.emplace_back(x.queue.front().endtime);
+        w.Int(x.positionid);
+        w.Time(x.queue.front().endtime);
+        w.Int(x.queue.size());
         for (const stTroopTrain& y : x.queue) {
-            z.emplace_back(y.troopid);
-            z.emplace_back(y.count);
-            z.emplace_back(y.costtime);
-            ss << ",%?d,%?d,%?f";
+            w.Int(y.troopid);
+            w.Int(y.count);
+            w.Time(y.costtime);
         }
-        ss << "|";
     }
-    Poco::format(res, ss.str(), z);
     return res;
 }
 int8_t PlayerCity::SetTroopQueue(int32_t position, int32_t troopid, int32_t count, int64_t costtime, int64_t endtime)
@@ -117,10 +153,25 @@ int8_t PlayerCity::SetTroopQueue(int32_t position, int32_t troopid, int32_t coun
     if (x->queue.size() > 0) z.endtime = 0;
     else z.endtime = Utils::time() + z.costtime;
     x->queue.push_back(z);
+    spitfire::GetSingleton().ScheduleTroopQueue(this, x);
     return true;
 }
 void PlayerCity::ParseTroopQueues(std::string str)
 {
+    if (statecodec::IsPacked(str)) {
+        statereader r(str);
+        int64_t position, entries, troopid, count;
+        double endtime, costtime;
+        while (!r.AtEnd() && r.Int(position) && r.Time(endtime) && r.Int(entries)) {
+            for (int64_t i = 0; i < entries && r.Int(troopid) && r.Int(count) && r.Time(costtime); ++i) {
+                if (SetTroopQueue(position, troopid, count, costtime, endtime)) endtime = 0;
+                else endtime += costtime;
+            }
+        }
+        if (!r.Good())
+            spitfire::GetSingleton().log->error("Error in castle {} ParseTroopQueues()", m_castleid);
+        return;
+    }
     if (str.length() > 0) {
         char* x = new char[str.length() + 1];
         memcpy(x, str.c_str(), str.length());
@@ -162,36 +213,27 @@ void PlayerCity::ParseTroopQueues(std::string str)
 std::string PlayerCity::DBBuildings() const
 {
     std::string res;
-    std::vector<Poco::Any> args;
-    std::stringstream ss;
+    statewriter w(res);
 
+    auto write = [&w](const stBuilding & building)
+    {
+        w.Int(building.type);
+        w.Int(building.level);
+        w.Int(building.id);
+        w.Int(building.status);
+        w.Time(building.starttime);
+        w.Time(building.endtime);
+    };
     for (auto i = -2; i < 32; ++i)
     {
         if (m_innerbuildings[i + 2].type > 0)
-        {
-            args.emplace_back(m_innerbuildings[i + 2].type);
-            args.emplace_back(m_innerbuildings[i + 2].level);
-            args.emplace_back(m_innerbuildings[i + 2].id);
-            args.emplace_back(m_innerbuildings[i + 2].status);
-            args.emplace_back(m_innerbuildings[i + 2].starttime);
-            args.emplace_back(m_innerbuildings[i + 2].endtime);
-            ss << "%?d,%?d,%?d,%?d,%f,%f|";
-        }
+            write(m_innerbuildings[i + 2]);
     }
     for (auto i = 0; i < 41; ++i)
     {
         if (m_outerbuildings[i].type > 0)
-        {
-            args.emplace_back(m_outerbuildings[i].type);
-            args.emplace_back(m_outerbuildings[i].level);
-            args.emplace_back(m_outerbuildings[i].id);
-            args.emplace_back(m_outerbuildings[i].status);
-            args.emplace_back(m_outerbuildings[i].starttime);
-            args.emplace_back(m_outerbuildings[i].endtime);
-            ss << "%?d,%?d,%?d,%?d,%f,%f|";
-        }
+            write(m_outerbuildings[i]);
     }
-    Poco::format(res, ss.str(), args);
     return res;
 }
 std::string PlayerCity::DBTransingtrades() const
@@ -209,45 +251,39 @@ std::string PlayerCity::DBTrades() const
 std::string PlayerCity::DBTroops() const
 {
     std::string res;
-    std::vector<Poco::Any> args;
-    args.emplace_back(TR_ARCHER);
-    args.emplace_back(m_troops.archer);
-    args.emplace_back(TR_WORKER);
-    args.emplace_back(m_troops.worker);
-    args.emplace_back(TR_WARRIOR);
-    args.emplace_back(m_troops.warrior);
-    args.emplace_back(TR_SCOUT);
-    args.emplace_back(m_troops.scout);
-    args.emplace_back(TR_PIKE);
-    args.emplace_back(m_troops.pike);
-    args.emplace_back(TR_SWORDS);
-    args.emplace_back(m_troops.sword);
-    args.emplace_back(TR_TRANSPORTER);
-    args.emplace_back(m_troops.transporter);
-    args.emplace_back(TR_BALLISTA);  // added ballista code
-    args.emplace_back(m_troops.ballista);
-    args.emplace_back(TR_RAM);
-    args.emplace_back(m_troops.ram);
-    args.emplace_back(TR_CATAPULT);
-    args.emplace_back(m_troops.catapult);
-    args.emplace_back(TR_CAVALRY);
-    args.emplace_back(m_troops.cavalry);
-    args.emplace_back(TR_CATAPHRACT);
-    args.emplace_back(m_troops.cataphract);
-    Poco::format(res, "%?d,%?d|%?d,%?d|%?d,%?d|%?d,%?d|%?d,%?d|%?d,%?d|%?d,%?d|%?d,%?d|%?d,%?d|%?d,%?d|%?d,%?d|%?d,%?d", args); // Added database format for ballista
+    statewriter w(res);
+
+    auto write = [&w](int32_t type, int64_t count)
+    {
+        if (count == 0)
+            return;
+        w.Int(type);
+        w.Int(count);
+    };
+    write(TR_ARCHER, m_troops.archer);
+    write(TR_WORKER, m_troops.worker);
+    write(TR_WARRIOR, m_troops.warrior);
+    write(TR_SCOUT, m_troops.scout);
+    write(TR_PIKE, m_troops.pike);
+    write(TR_SWORDS, m_troops.sword);
+    write(TR_TRANSPORTER, m_troops.transporter);
+    write(TR_BALLISTA, m_troops.ballista);
+    write(TR_RAM, m_troops.ram);
+    write(TR_CATAPULT, m_troops.catapult);
+    write(TR_CAVALRY, m_troops.cavalry);
+    write(TR_CATAPHRACT, m_troops.cataphract);
     return res;
 }
 
 std::string PlayerCity::DBFortifications() const
 {
     std::string res;
-    std::vector<Poco::Any> args;
-    args.emplace_back(m_forts.traps);
-    args.emplace_back(m_forts.abatis);
-    args.emplace_back(m_forts.towers);
-    args.emplace_back(m_forts.logs);
-    args.emplace_back(m_forts.trebs);
-    Poco::format(res, "%?d,%?d,%?d,%?d,%?d", args);
+    statewriter w(res);
+    w.Int(m_forts.traps);
+    w.Int(m_forts.abatis);
+    w.Int(m_forts.towers);
+    w.Int(m_forts.logs);
+    w.Int(m_forts.trebs);
     return res;
 }
 
@@ -330,6 +366,7 @@ amf3array PlayerCity::HeroArray()
 
 amf3object PlayerCity::Resources()
 {
+    SettleResources(Utils::time());
     amf3object obj = amf3object();
     obj["maxPopulation"] = m_maxpopulation;
     obj["taxIncome"] = m_production.gold;
@@ -487,6 +524,33 @@ amf3object PlayerCity::Fortifications() const
 
 void PlayerCity::ParseBuildings(std::string str)
 {
+    if (statecodec::IsPacked(str))
+    {
+        statereader r(str);
+        int64_t type, level, position, status;
+        double starttime, endtime;
+        while (!r.AtEnd() && r.Int(type) && r.Int(level) && r.Int(position) && r.Int(status) && r.Time(starttime) && r.Time(endtime))
+        {
+            SetBuilding(type, level, position, status, starttime, endtime);
+
+            if ((status == 1) || (status == 2))
+            {
+                stBuildingAction * ba = new stBuildingAction;
+
+                stTimedEvent te;
+                ba->city = this;
+                ba->client = this->m_client;
+                ba->positionid = position;
+                te.data = ba;
+                te.type = DEF_TIMEDBUILDING;
+
+                spitfire::GetSingleton().AddTimedEvent(te);
+            }
+        }
+        if (!r.Good())
+            spitfire::GetSingleton().log->error("Error in castle {} ParseBuildings()", m_castleid);
+        return;
+    }
     if (str.length() > 0)
     {
         char * str2 = new char[str.length() + 1];
@@ -555,6 +619,8 @@ void PlayerCity::ParseBuildings(std::string str)
 
 void PlayerCity::CalculateStats()
 {
+    // what was earned under the old production and storage
+    SettleResources(Utils::time());
     memset(&m_maxresources, 0, sizeof(m_maxresources));
     memset(&m_production, 0, sizeof(m_production));
     memset(&m_workpopulation, 0, sizeof(m_workpopulation));
@@ -705,6 +771,7 @@ void PlayerCity::CalculateStats()
     m_availablepopulation = m_population - workpop;
     m_productionefficiency = (m_population >= workpop) ? 100 : (float(m_population) / workpop * 100);
     m_production.gold = double(m_population) * (m_workrate.gold / 100);
+    RateResources();
 }
 
 void PlayerCity::CalculateResourceStats()
@@ -850,6 +917,16 @@ void PlayerCity::ParseTroops(std::string str)
 */
 void PlayerCity::ParseTroops(std::string str)
 {
+    if (statecodec::IsPacked(str))
+    {
+        statereader r(str);
+        int64_t ty, tr;
+        while (!r.AtEnd() && r.Int(ty) && r.Int(tr))
+            SetTroops(ty, (tr < 0) ? 0 : tr);
+        if (!r.Good())
+            spitfire::GetSingleton().log->error("Error in castle {} ParseTroops()", m_castleid);
+        return;
+    }
     if (str.length() > 0)
     {
         char * str2 = new char[str.length() + 1];
@@ -888,6 +965,16 @@ void PlayerCity::ParseTroops(std::string str)
 
 void PlayerCity::ParseFortifications(std::string str)
 {
+    if (statecodec::IsPacked(str))
+    {
+        statereader r(str);
+        int64_t traps = 0, abatis = 0, towers = 0, logs = 0, trebs = 0;
+        if (r.Int(traps) && r.Int(abatis) && r.Int(towers) && r.Int(logs) && r.Int(trebs))
+            City::SetForts(traps, abatis, towers, logs, trebs);
+        else
+            spitfire::GetSingleton().log->error("Error in castle {} ParseFortifications()", m_castleid);
+        return;
+    }
     if (str.length() > 0)
     {
         char * str2 = new char[str.length() + 1];
@@ -1000,78 +1087,57 @@ int16_t PlayerCity::GetEffectiveTechLevel(int16_t id)
     return 0;
 }
 
-//TODO: server is a bit slower than client for resource calculation
 void PlayerCity::CalculateResources()
 {
-    CalculateResourceStats();
-    uint64_t newtime, oldtime, diff;
-    newtime = Utils::time();
+    SettleResources(Utils::time());
+    RateResources();
+    MarkDirty();
+}
+
+// Amount after diff milliseconds at rate. Storage already over its cap
+// (plunder, items) neither grows nor gets clipped.
+static double Accrue(double amount, double rate, double cap, uint64_t diff)
+{
+    if (rate >= 0 && amount >= cap)
+        return amount;
+    double value = amount + rate * diff;
+    if (rate > 0 && value > cap)
+        value = cap;
+    return (value < 0) ? 0 : value;
+}
 
-    oldtime = m_timers.updateresources;
-    diff = newtime - oldtime;
+void PlayerCity::SettleResources(uint64_t ltime)
+{
+    // until the first RateResources there is nothing to accrue at, the
+    // loaded timestamp is kept so the time offline still counts
+    if (!m_rated || ltime <= m_timers.updateresources)
+        return;
+    uint64_t diff = ltime - uint64_t(m_timers.updateresources);
+    m_timers.updateresources = ltime;
+
+    m_resources.food = Accrue(m_resources.food, m_rate.food, m_maxresources.food, diff);
+    m_resources.wood = Accrue(m_resources.wood, m_rate.wood, m_maxresources.wood, diff);
+    m_resources.stone = Accrue(m_resources.stone, m_rate.stone, m_maxresources.stone, diff);
+    m_resources.iron = Accrue(m_resources.iron, m_rate.iron, m_maxresources.iron, diff);
+    m_resources.gold = Accrue(m_resources.gold, m_rate.gold, std::numeric_limits<double>::max(), diff);
+}
 
-    m_timers.updateresources = newtime;
+void PlayerCity::RateResources()
+{
+    CalculateResourceStats();
 
-    double add;
-    add = ((((m_production.food + m_resourcebaseproduction)*(m_productionefficiency / 100)) / 60 / 60 / 1000) * (1 + (m_resourcemanagement / 100)) * diff) - m_troopconsume;
-    if (m_maxresources.food > m_resources.food)
-    {
-        if (m_maxresources.food < m_resources.food + add)
-        {
-            m_resources.food = m_maxresources.food;
-        }
-        else
-        {
-            m_resources.food += add;
-        }
-    }
-    add = ((((m_production.wood + m_resourcebaseproduction)*(m_productionefficiency / 100)) / 60 / 60 / 1000) * (1 + (m_resourcemanagement / 100)) * diff);
-    if (m_maxresources.wood > m_resources.wood)
-    {
-        if (m_maxresources.wood < m_resources.wood + add)
-        {
-            m_resources.wood = m_maxresources.wood;
-        }
-        else
-        {
-            m_resources.wood += add;
-        }
-    }
-    add = ((((m_production.stone + m_resourcebaseproduction)*(m_productionefficiency / 100)) / 60 / 60 / 1000) * (1 + (m_resourcemanagement / 100)) * diff);
-    if (m_maxresources.stone > m_resources.stone)
-    {
-        if (m_maxresources.stone < m_resources.stone + add)
-        {
-            m_resources.stone = m_maxresources.stone;
-        }
-        else
-        {
-            m_resources.stone += add;
-        }
-    }
-    add = ((((m_production.iron + m_resourcebaseproduction)*(m_productionefficiency / 100)) / 60 / 60 / 1000) * (1 + (m_resourcemanagement / 100)) * diff);
-    if (m_maxresources.iron > m_resources.iron)
-    {
-        if (m_maxresources.iron < m_resources.iron + add)
-        {
-            m_resources.iron = m_maxresources.iron;
-        }
-        else
-        {
-            m_resources.iron += add;
-        }
-    }
+    double scale = (m_productionefficiency / 100) * (1 + (m_resourcemanagement / 100)) / 60 / 60 / 1000;
+    m_rate.food = (m_production.food + m_resourcebaseproduction) * scale - m_troopconsume / 60 / 60 / 1000;
+    m_rate.wood = (m_production.wood + m_resourcebaseproduction) * scale;
+    m_rate.stone = (m_production.stone + m_resourcebaseproduction) * scale;
+    m_rate.iron = (m_production.iron + m_resourcebaseproduction) * scale;
 
     int32_t herosalary = 0;
     for (auto & hero : m_heroes)
         if (hero)
             herosalary += hero->m_level * 20;
-
-
-    add = (m_production.gold - herosalary) * (double(diff) / 60 / 60 / 1000);
-    m_resources.gold += add;
-    if (m_resources.gold < 0)
-        m_resources.gold = 0;
+    m_rate.gold = (m_production.gold - herosalary) / 60 / 60 / 1000;
+    m_rated = true;
 }
 
 void PlayerCity::CastleUpdate()
@@ -1093,10 +1159,10 @@ void PlayerCity::ResourceUpdate()
     if (!m_client->connected)
         return;
     amf3object obj = amf3object();
-    obj["cmd"] = "server.ResourceUpdate";
-    obj["data"] = amf3object();
-    amf3object & data = obj["data"];
-    data["castleId"] = m_castleid;
+    obj[atoms::cmd] = "server.ResourceUpdate";
+    obj[atoms::data] = amf3object();
+    amf3object & data = obj[atoms::data];
+    data[atoms::castleId] = m_castleid;
     data["resource"] = Resources();
 
     spitfire::GetSingleton().SendObject(m_client, obj);
@@ -1209,50 +1275,71 @@ void PlayerCity::FortUpdate() const
 
 void PlayerCity::RecalculateCityStats()
 {
-    int targetpopulation = (m_maxpopulation * (double(((m_loyalty + m_grievance) > 100) ? 100 : (m_loyalty + m_grievance)) / 100));
-    int add = m_maxpopulation * 0.05;
-    if (m_population > targetpopulation)
-    {
-        if (m_population - add < targetpopulation)
-            m_population = targetpopulation;
-        else if (m_population - add < 0)
-            m_population = m_maxpopulation;
-        else
-            m_population -= add;
-    }
-    else if (m_population < targetpopulation)
-    {
-        if (m_population + add > targetpopulation)
-            m_population = targetpopulation;
-        else if (m_population + add > m_maxpopulation)
-            m_population = m_maxpopulation;
-        else
-            m_population += add;
-    }
-    else
-    {
-        //nothing, pop is as it should be
-    }
+    StepCityStats();
+    // the client accrues from the rates it was sent, only the city in
+    // view needs the new tax income
+    if (m_client && m_client->currentcityindex != -1 && m_client->citylist[m_client->currentcityindex] == this)
+        ResourceUpdate();
+}
 
-    int32_t targetloyalty = 100 - (((m_workrate.gold + m_grievance) > 100) ? 100 : (m_workrate.gold + m_grievance));
-    if (m_loyalty > 1)
+void PlayerCity::StepCityStats(uint64_t steps)
+{
+    SettleResources(Utils::time());
+    int32_t population = m_population;
+    int8_t loyalty = m_loyalty;
+    // population moves 5% and loyalty 1 per step, so both have long
+    // settled after a hundred
+    for (uint64_t i = std::min<uint64_t>(steps, 100); i > 0; --i)
     {
-        if (targetloyalty < m_loyalty)
+        int targetpopulation = (m_maxpopulation * (double(((m_loyalty + m_grievance) > 100) ? 100 : (m_loyalty + m_grievance)) / 100));
+        int add = m_maxpopulation * 0.05;
+        if (m_population > targetpopulation)
+        {
+            if (m_population - add < targetpopulation)
+                m_population = targetpopulation;
+            else if (m_population - add < 0)
+                m_population = m_maxpopulation;
+            else
+                m_population -= add;
+        }
+        else if (m_population < targetpopulation)
         {
-            m_loyalty--;
+            if (m_population + add > targetpopulation)
+                m_population = targetpopulation;
+            else if (m_population + add > m_maxpopulation)
+                m_population = m_maxpopulation;
+            else
+                m_population += add;
         }
-        else if (targetloyalty > m_loyalty)
+        else
         {
-            m_loyalty++;
+            //nothing, pop is as it should be
         }
-        else if (targetloyalty == m_loyalty)
+
+        int32_t targetloyalty = 100 - (((m_workrate.gold + m_grievance) > 100) ? 100 : (m_workrate.gold + m_grievance));
+        if (m_loyalty > 1)
         {
+            if (targetloyalty < m_loyalty)
+            {
+                m_loyalty--;
+            }
+            else if (targetloyalty > m_loyalty)
+            {
+                m_loyalty++;
+            }
+            else if (targetloyalty == m_loyalty)
+            {
 
+            }
         }
-    }
 
-    m_production.gold = m_population * (m_workrate.gold / 100);
-    ResourceUpdate();
+        m_production.gold = m_population * (m_workrate.gold / 100);
+    }
+    RateResources();
+    if (m_population != population && m_client)
+        spitfire::GetSingleton().RankCastle(this);
+    if (m_population != population || m_loyalty != loyalty)
+        MarkDirty();
 }
 
 amf3array PlayerCity::ResourceProduceData() const
@@ -1378,6 +1465,7 @@ int8_t PlayerCity::AddToBarracksQueue(int8_t position, int16_t troopid, int32_t
      else
          troops.endtime = Utils::time() + troops.costtime;
      queue->queue.push_back(troops);
+     spitfire::GetSingleton().ScheduleTroopQueue(this, queue);
     return 1;
 }
 int16_t PlayerCity::HeroCount()
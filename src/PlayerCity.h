@@ -8,6 +8,8 @@
 
 #include "City.h"
 #include "structs.h"
+#include "armylist.h"
+#include "savequeue.h"
 
 
 class Client;
@@ -50,6 +52,11 @@ public:
 
     double m_troopconsume;
 
+    // m_resources holds the amounts as of m_timers.updateresources, these
+    // are the per millisecond rates they accrue at from there
+    stResources m_rate;
+    bool m_rated = false;
+
     struct stTimers
     {
         double updateresources;
@@ -68,6 +75,11 @@ public:
     std::string DBMisc() const;
     std::string DBTroopQueues() const;
     bool SaveToDB();
+    // Snapshot of the city rows for the save thread
+    static savejob SaveJob(const std::vector<PlayerCity*> & cities);
+    // Queue this city for the next background save
+    void MarkDirty();
+    bool m_dirty = false;
 
     amf3object ToObject();
     amf3array Buildings() const;
@@ -94,8 +106,16 @@ public:
 
 
     void CalculateStats();
+    // Settle at the old rates and take new ones, for anything that changes
+    // production, storage, upkeep or salaries
     void CalculateResources();
+    // Brings m_resources forward to ltime at the current rates
+    void SettleResources(uint64_t ltime);
+    void RateResources();
     void RecalculateCityStats();
+    // Six minute steps of population and loyalty toward their targets; more
+    // than one when a hibernated city catches up
+    void StepCityStats(uint64_t steps = 1);
     void CalculateResourceStats();
 
 
@@ -115,7 +135,7 @@ public:
 
     std::vector<stTroopQueue> m_troopqueue;
 
-    std::list<stArmyMovement*> armymovement;
+    cityarmylist armymovement;
 
     int16_t HeroCount();
     stTroopQueue * GetBarracksQueue(int16_t position);
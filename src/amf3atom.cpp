@@ -0,0 +1,103 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#include "amf3atom.h"
+
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace
+{
+    struct atomtable
+    {
+        atomtable()
+        {
+#define AMF3_ATOM_NAME(n) Add(#n);
+            AMF3_HOT_ATOMS(AMF3_ATOM_NAME)
+#undef AMF3_ATOM_NAME
+        }
+
+        uint32_t Add(std::string_view name)
+        {
+            uint32_t id = uint32_t(names.size());
+            names.emplace_back(name);
+            ids.emplace(std::string_view(names.back()), id);
+            return id;
+        }
+
+        std::shared_mutex mtx;
+        // deque keeps every name at a stable address for the string_view keys
+        std::deque<std::string> names;
+        std::unordered_map<std::string_view, uint32_t> ids;
+    };
+
+    atomtable & table()
+    {
+        static atomtable t;
+        return t;
+    }
+}
+
+amf3atom amf3atomtable::Intern(std::string_view name)
+{
+    atomtable & t = table();
+    {
+        std::shared_lock<std::shared_mutex> l(t.mtx);
+        auto iter = t.ids.find(name);
+        if (iter != t.ids.end())
+            return amf3atom{ iter->second };
+    }
+
+    std::unique_lock<std::shared_mutex> l(t.mtx);
+    auto iter = t.ids.find(name);
+    if (iter != t.ids.end())
+        return amf3atom{ iter->second };
+    if (t.names.size() >= maxatoms)
+        throw std::length_error("amf3 atom table full");
+    return amf3atom{ t.Add(name) };
+}
+
+amf3atom amf3atomtable::InternLiteral(const char * name)
+{
+    struct cached
+    {
+        uint32_t id;
+        const std::string * name;
+    };
+    thread_local std::unordered_map<const char *, cached> cache;
+
+    auto iter = cache.find(name);
+    if (iter != cache.end() && *iter->second.name == name)
+        return amf3atom{ iter->second.id };
+
+    amf3atom atom = Intern(name);
+    // names live in a deque, so the reference stays valid
+    if (cache.size() >= maxatoms)
+        cache.clear();
+    cache[name] = cached{ atom.id, &Name(atom) };
+    return atom;
+}
+
+bool amf3atomtable::Find(std::string_view name, amf3atom & atom)
+{
+    atomtable & t = table();
+    std::shared_lock<std::shared_mutex> l(t.mtx);
+    auto iter = t.ids.find(name);
+    if (iter == t.ids.end())
+        return false;
+    atom.id = iter->second;
+    return true;
+}
+
+const std::string & amf3atomtable::Name(amf3atom atom)
+{
+    atomtable & t = table();
+    std::shared_lock<std::shared_mutex> l(t.mtx);
+    return t.names.at(atom.id);
+}
@@ -0,0 +1,82 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <string_view>
+
+// Property names looked up on hot paths. They are interned first, in this
+// order, so their ids are known at compile time (atoms::cmd etc).
+#define AMF3_HOT_ATOMS(X) \
+    X(cmd) \
+    X(data) \
+    X(castleId) \
+    X(ok) \
+    X(packageId) \
+    X(msg) \
+    X(errorMsg) \
+    X(inner) \
+    X(heroId) \
+    X(playerId) \
+    X(pageNo) \
+    X(pageSize) \
+    X(totalPage) \
+    X(id) \
+    X(name) \
+    X(status) \
+    X(level) \
+    X(typeId) \
+    X(positionId) \
+    X(startTime) \
+    X(endTime)
+
+/// Interned property name.
+struct amf3atom
+{
+    uint32_t id;
+
+    bool operator==(const amf3atom & rhs) const { return id == rhs.id; }
+    bool operator!=(const amf3atom & rhs) const { return id != rhs.id; }
+};
+
+namespace atoms
+{
+    enum : uint32_t
+    {
+#define AMF3_ATOM_ID(n) n##_id,
+        AMF3_HOT_ATOMS(AMF3_ATOM_ID)
+#undef AMF3_ATOM_ID
+        hotcount
+    };
+
+#define AMF3_ATOM_CONST(n) constexpr amf3atom n{ n##_id };
+    AMF3_HOT_ATOMS(AMF3_ATOM_CONST)
+#undef AMF3_ATOM_CONST
+}
+
+/// Process wide table of property names. Interning is thread safe, names are
+/// never removed. Only names the server uses are interned; names read off the
+/// wire are looked up, see amf3objectmap::AddWire. The cap is a backstop.
+class amf3atomtable
+{
+public:
+    /// Get the atom for a name, adding it if needed. Throws once the table is full.
+    static amf3atom Intern(std::string_view name);
+
+    /// Intern for names at a fixed address, such as string literals. Each
+    /// thread caches atoms by address, so repeat lookups take no lock and do
+    /// not hash the name; a hit is still checked against the name.
+    static amf3atom InternLiteral(const char * name);
+
+    /// Get the atom for a name without adding it. Returns false if never interned.
+    static bool Find(std::string_view name, amf3atom & atom);
+
+    static const std::string & Name(amf3atom atom);
+
+    static const uint32_t maxatoms = 65536;
+};
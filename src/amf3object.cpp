@@ -421,6 +421,11 @@ amf3object::operator amf3array&()
 }
 
 amf3object& amf3object::operator[](const char *key)
+{
+    return operator[](amf3atomtable::InternLiteral(key));
+}
+
+amf3object& amf3object::operator[](amf3atom key)
 {
     if ((type != Object) &&
         (type != Array) &&
@@ -434,13 +439,13 @@ amf3object& amf3object::operator[](const char *key)
     {
         type = Object;
         _object = std::make_shared<amf3objectmap>();
-        _object->Add(std::string(key));
+        _object->Add(key);
     }
-    else if (_object->Exists(std::string(key)) < 0)
+    else if (_object->Exists(key) < 0)
     {
-        _object->Add(std::string(key));
+        _object->Add(key);
     }
-    return _object->Get(std::string(key));
+    return _object->Get(key);
 }
 
 amf3object& amf3object::operator[](const double &key)
@@ -11,6 +11,8 @@
 #include <sstream>
 #include <memory>
 
+#include "amf3atom.h"
+
 class amf3array;
 class amf3objectmap;
 
@@ -125,6 +127,7 @@ public:
 
     //amf3object & operator[](const string &key);
     amf3object & operator[](const char *key);
+    amf3object & operator[](amf3atom key);
     amf3object & operator[](const double &key);
     amf3object & operator[](const uint32_t &key);
     amf3object & operator[](const int &key);
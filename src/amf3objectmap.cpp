@@ -23,6 +23,9 @@ amf3objectmap::amf3objectmap(amf3objectmap & objectmap)
     {
         properties.AddObj(objectmap.properties.propnames.at(i), objectmap.properties.GetObj(i));
     }
+    keys = objectmap.keys;
+    index = objectmap.index;
+    unnamedcount = objectmap.unnamedcount;
     selfdel = false;
 }
 
@@ -37,24 +40,136 @@ amf3objectmap::~amf3objectmap()
 
 }
 
-amf3object & amf3objectmap::Get(std::string key)
+static inline size_t atomslot(amf3atom key, size_t mask)
 {
-    return properties.GetObj(key);
+    return (key.id * 2654435761u) & mask;
 }
 
-void amf3objectmap::Add(std::string key, amf3object & obj)
+amf3object & amf3objectmap::Get(const std::string & key)
 {
-    properties.AddObj(key, obj);
+    int pos = Exists(key);
+    if (pos < 0)
+        throw "Key: " + key + " does not exist in object";
+    return properties.properties.at(pos);
 }
 
-void amf3objectmap::Add(std::string key)
+amf3object & amf3objectmap::Get(amf3atom key)
 {
-    properties.AddObj(key, amf3object());
+    int pos = Exists(key);
+    if (pos < 0)
+        throw "Key: " + amf3atomtable::Name(key) + " does not exist in object";
+    return properties.properties.at(pos);
 }
 
-int amf3objectmap::Exists(std::string key)
+void amf3objectmap::Add(const std::string & key, amf3object & obj)
 {
-    return properties.Exists(key);
+    Insert(amf3atomtable::Intern(key), key, obj);
+}
+
+void amf3objectmap::Add(const std::string & key)
+{
+    Insert(amf3atomtable::Intern(key), key, amf3object());
+}
+
+void amf3objectmap::Add(amf3atom key)
+{
+    Insert(key, amf3atomtable::Name(key), amf3object());
+}
+
+void amf3objectmap::AddWire(const std::string & key, amf3object & obj)
+{
+    amf3atom atom;
+    if (!amf3atomtable::Find(key, atom))
+        atom = unnamed;
+    Insert(atom, key, obj);
+}
+
+int amf3objectmap::Exists(const std::string & key)
+{
+    amf3atom atom;
+    // a name that was never interned can only be among the unnamed keys
+    if (!amf3atomtable::Find(key, atom))
+        return FindUnnamed(key);
+    return Exists(atom);
+}
+
+int amf3objectmap::Exists(amf3atom key)
+{
+    if (index.empty())
+    {
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            if (keys[i] == key)
+                return int(i);
+        }
+    }
+    else
+    {
+        size_t mask = index.size() - 1;
+        for (size_t slot = atomslot(key, mask); index[slot] != -1; slot = (slot + 1) & mask)
+        {
+            if (keys[index[slot]] == key)
+                return index[slot];
+        }
+    }
+    // the name may have been interned after the peer sent it
+    if (unnamedcount > 0)
+        return FindUnnamed(amf3atomtable::Name(key));
+    return -1;
+}
+
+int amf3objectmap::FindUnnamed(const std::string & name)
+{
+    for (size_t i = 0; i < keys.size() && unnamedcount > 0; ++i)
+    {
+        if (keys[i] == unnamed && properties.propnames[i] == name)
+            return int(i);
+    }
+    return -1;
+}
+
+void amf3objectmap::Insert(amf3atom key, const std::string & name, const amf3object & obj)
+{
+    properties.AddObj(name, obj);
+    keys.push_back(key);
+    if (key == unnamed)
+    {
+        // found by name, the index only holds atoms
+        ++unnamedcount;
+        return;
+    }
+
+    if (!index.empty())
+    {
+        if (keys.size() * 2 > index.size())
+            Reindex(index.size() * 2);
+        else
+            IndexAdd(int32_t(keys.size() - 1));
+    }
+    else if (keys.size() > LINEARMAX)
+    {
+        Reindex(32);
+    }
+}
+
+void amf3objectmap::IndexAdd(int32_t pos)
+{
+    size_t mask = index.size() - 1;
+    size_t slot = atomslot(keys[pos], mask);
+    for (; index[slot] != -1; slot = (slot + 1) & mask)
+    {
+        // duplicate names resolve to the first one added, same as a linear scan
+        if (keys[index[slot]] == keys[pos])
+            return;
+    }
+    index[slot] = pos;
+}
+
+void amf3objectmap::Reindex(size_t size)
+{
+    index.assign(size, -1);
+    for (size_t i = 0; i < keys.size(); ++i)
+        IndexAdd(int32_t(i));
 }
 
 bool amf3objectmap::IsEqual(amf3objectmap * obj)
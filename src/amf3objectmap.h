@@ -7,7 +7,9 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
+#include "amf3atom.h"
 #include "amf3classdef.h"
 #include "amf3reflist.h"
 
@@ -21,10 +23,16 @@ public:
     amf3objectmap();
     ~amf3objectmap(void);
 
-    amf3object & Get(std::string key);
-    void Add(std::string key, amf3object & obj);
-    void Add(std::string key);
-    int Exists(std::string key);
+    amf3object & Get(const std::string & key);
+    amf3object & Get(amf3atom key);
+    void Add(const std::string & key, amf3object & obj);
+    void Add(const std::string & key);
+    void Add(amf3atom key);
+    /// Add a property named by the peer. A name nothing interned yet is
+    /// kept as a plain string, so clients can not fill the atom table.
+    void AddWire(const std::string & key, amf3object & obj);
+    int Exists(const std::string & key);
+    int Exists(amf3atom key);
 
     bool IsEqual(amf3objectmap * obj);
 
@@ -33,4 +41,23 @@ public:
     amf3reflist<amf3object> properties;
     int flags;
     bool selfdel;
+
+    // parallel to properties, the interned name of each property, or
+    // unnamed for a wire name that was not interned
+    std::vector<amf3atom> keys;
+
+private:
+    static constexpr amf3atom unnamed{ 0xFFFFFFFFu };
+
+    void Insert(amf3atom key, const std::string & name, const amf3object & obj);
+    int FindUnnamed(const std::string & name);
+    void IndexAdd(int32_t pos);
+    void Reindex(size_t size);
+
+    // open addressed atom -> position table, only built once there are more
+    // than LINEARMAX properties. -1 marks an empty slot.
+    std::vector<int32_t> index;
+    static const size_t LINEARMAX = 8;
+    // number of keys that are unnamed
+    size_t unnamedcount = 0;
 };
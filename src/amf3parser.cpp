@@ -268,7 +268,7 @@ amf3objectmap * amf3parser::ReadAMF3Object(void)
         name = classdef.properties.at(i);
         tempobject = ReadNextObject();
         encapslist.AddObj(tempobject);
-        obj->Add(name, tempobject);
+        obj->AddWire(name, tempobject);
     }
     amf3object temp;
     if (classdef.dynamic)
@@ -277,7 +277,7 @@ amf3objectmap * amf3parser::ReadAMF3Object(void)
         while (key.length() != 0)
         {
             temp = ReadNextObject();
-            obj->Add(key, temp);
+            obj->AddWire(key, temp);
             encapslist.AddObj(temp);
             key = ReadString();
         }
@@ -5,17 +5,19 @@
 */
 
 #include <string.h>
+#include <stdexcept>
 
 #include "amf3writer.h"
 #include "amf3objectmap.h"
 
 
-amf3writer::amf3writer(char * stream)
+amf3writer::amf3writer(char * stream, int64_t capacity)
 {
     if (stream == 0)
         throw "Stream error";
     this->stream = stream;
     this->position = 0;
+    this->capacity = capacity;
 }
 
 
@@ -23,8 +25,15 @@ amf3writer::~amf3writer(void)
 {
 }
 
+void amf3writer::Reserve(int64_t length)
+{
+    if ((capacity >= 0) && (position + length > capacity))
+        throw std::length_error("amf3writer stream capacity exceeded");
+}
+
 void amf3writer::Write(Amf3TypeCode type)
 {
+    Reserve(1);
     stream[position++] = type;
 }
 
@@ -108,7 +117,7 @@ void amf3writer::Write(double number)
     Write(Number);
     TypelessWrite(number);
 }
-void amf3writer::Write(std::string str)
+void amf3writer::Write(const std::string & str)
 {
     Write(String);
     TypelessWrite(str);
@@ -131,6 +140,8 @@ void amf3writer::TypelessWrite(int integer)
 {
     integer &= ~(7 << 29);
 
+    Reserve(4);
+
     if ((integer & (0xFF << 21)) != 0)
     {
         stream[position++] = (uint8_t)(((integer >> 22) & 0x7f) | 0x80);
@@ -170,6 +181,7 @@ void amf3writer::TypelessWrite(double number)
         i++, j--;
     }
 
+    Reserve(8);
     stream[position++] = num[0];
     stream[position++] = num[1];
     stream[position++] = num[2];
@@ -179,7 +191,7 @@ void amf3writer::TypelessWrite(double number)
     stream[position++] = num[6];
     stream[position++] = num[7];
 }
-void amf3writer::TypelessWrite(std::string str)
+void amf3writer::TypelessWrite(const std::string & str)
 {
     if (str.length() == 0)
     {
@@ -187,25 +199,31 @@ void amf3writer::TypelessWrite(std::string str)
         return;
     }
 
-
-    std::map<int, std::string>::const_iterator iter;
-    iter = stringTable.begin();
-    for (int i = 0; i < stringTable.size(); ++iter, ++i)
+    auto ref = stringIndex.find(std::string_view(str));
+    if (ref != stringIndex.end())
     {
-        if (iter->second == str)
-        {
-            TypelessWrite(i << 1);
-            return;
-        }
+        TypelessWrite(ref->second << 1);
+        return;
     }
 
     //Need UTF8 code here...
     TypelessWrite((int)(str.length() << 1 | 1));
+    Reserve(str.length());
     memcpy(stream + position, str.c_str(), str.length());
     position += str.length();
 
-    stringTable.insert(std::pair<int32_t, std::string>(int32_t(stringTable.size()), str));
-    strlist.AddObj(str);
+    int32_t index = int32_t(stringTable.size());
+    auto stored = stringTable.emplace(index, str).first;
+    stringIndex.emplace(std::string_view(stored->second), index);
+}
+std::size_t amf3writer::HashClassdef(const amf3classdef & classdef)
+{
+    std::hash<std::string_view> hasher;
+    std::size_t h = hasher(classdef.name);
+    h = h * 31 + (classdef.dynamic ? 1 : 0) + (classdef.externalizable ? 2 : 0);
+    for (const std::string & property : classdef.properties)
+        h ^= hasher(property) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    return h;
 }
 void amf3writer::WriteDictionary(amf3reflist<amf3object> * reflist)
 {
@@ -247,20 +265,21 @@ void amf3writer::TypelessWrite(amf3objectmap * _object, const amf3object & obj)
         return;
 
     bool found = false;
-    std::map<int32_t, amf3classdef>::const_iterator iter;
-    iter = classdefTable.begin();
-    for (int32_t i = 0; i < classdefTable.size(); ++iter, ++i)
+    std::size_t cdhash = HashClassdef(obj._object->classdef);
+    auto range = classdefIndex.equal_range(cdhash);
+    for (auto ref = range.first; ref != range.second; ++ref)
     {
-        if ((iter->second).IsEqual(obj._object->classdef))
+        amf3classdef & classdef = classdefTable[ref->second];
+        if (classdef.IsEqual(obj._object->classdef))
         {
-            TypelessWrite((i << 2) | 1);
+            TypelessWrite((ref->second << 2) | 1);
             found = true;
             if (obj._object->anoncd)
             {
                 obj._object->selfdel = false;
                 //delete obj._value._object->classdef;
                 //obj._value._object->classdef = 0;
-                obj._object->classdef = iter->second;
+                obj._object->classdef = classdef;
             }
             break;
         }
@@ -268,9 +287,9 @@ void amf3writer::TypelessWrite(amf3objectmap * _object, const amf3object & obj)
 
     if (!found)
     {
-        typedef std::pair <int32_t, amf3classdef> Int_Pair;
-        classdefTable.insert(Int_Pair(int32_t(classdefTable.size()), obj._object->classdef));
-        deflist.AddObj(obj._object->classdef);
+        int32_t index = int32_t(classdefTable.size());
+        classdefTable.emplace(index, obj._object->classdef);
+        classdefIndex.emplace(cdhash, index);
 
         int flags = Inline | InlineClassDef;
         if (_object->classdef.externalizable)
@@ -294,7 +313,7 @@ void amf3writer::TypelessWrite(amf3objectmap * _object, const amf3object & obj)
 
     if (_object->classdef.externalizable)
     {
-        Write((amf3object&)_object->Get("inner"));
+        Write((amf3object&)_object->Get(atoms::inner));
         return;
     }
 
@@ -322,13 +341,13 @@ void amf3writer::TypelessWrite(amf3objectmap * _object, const amf3object & obj)
             if (booltest == false)
             {
             TypelessWrite((char*)_object->properties.propnames.at(i));
-            Write(_object->Get(_object->properties.propnames.at(i)));
+            Write(_object->Get(_object->keys.at(i)));
             }
             }
             else*/
             {
                 TypelessWrite(_object->properties.propnames.at(i));
-                Write((amf3object&)_object->Get(_object->properties.propnames.at(i)));
+                Write(_object->properties.properties.at(i));
             }
         }
         TypelessWrite("");
@@ -7,7 +7,9 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <map>
+#include <unordered_map>
 
 
 #include "amf3object.h"
@@ -17,7 +19,9 @@
 class amf3writer
 {
 public:
-    amf3writer(char * stream);
+    /// capacity < 0 leaves the stream unbounded, otherwise writing past it
+    /// throws std::length_error
+    amf3writer(char * stream, int64_t capacity = -1);
     ~amf3writer(void);
 
     bool CheckObjectTable(const amf3object & obj)
@@ -44,25 +48,34 @@ public:
     void Write(unsigned int integer);
     void Write(int integer);
     void Write(double number);
-    void Write(std::string str);
+    void Write(const std::string & str);
     void TypelessWrite(uint32_t integer);
     void TypelessWrite(int integer);
     void TypelessWrite(double number);
-    void TypelessWrite(std::string str);
+    void TypelessWrite(const std::string & str);
     void WriteDictionary(amf3reflist<amf3object> * reflist);
     void Write(amf3array * _array, const amf3object & obj);
     void Write(amf3objectmap * _object, const amf3object & obj);
     void TypelessWrite(amf3array * _array, const amf3object & obj);
     void TypelessWrite(amf3objectmap * _object, const amf3object & obj);
 
-    amf3reflist<std::string> strlist;
     amf3reflist<amf3object> objectlist;
     amf3reflist<amf3object> encapslist;
-    amf3reflist<amf3classdef> deflist;
     std::map<int, amf3object> objectTable;
     std::map<int, std::string> stringTable;
     std::map<int, amf3classdef> classdefTable;
 
+    // Reference lookups for the tables above. stringIndex keys view the
+    // strings owned by stringTable (map nodes never move), classdefIndex is
+    // keyed by HashClassdef and confirmed with amf3classdef::IsEqual.
+    std::unordered_map<std::string_view, int32_t> stringIndex;
+    std::unordered_multimap<std::size_t, int32_t> classdefIndex;
+
     char * stream;
     int64_t position;
+    int64_t capacity;
+
+private:
+    void Reserve(int64_t length);
+    static std::size_t HashClassdef(const amf3classdef & classdef);
 };
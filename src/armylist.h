@@ -0,0 +1,107 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+
+#include "structs.h"
+
+/// Intrusive doubly linked list of armies threaded through one stArmyLink
+/// member, so an army can sit in several lists at once and leave any of them
+/// in O(1). The lists do not own the armies, ArmyMgr does.
+template<stArmyLink stArmyMovement::*Link>
+class armylist
+{
+public:
+    class iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = stArmyMovement *;
+        using difference_type = std::ptrdiff_t;
+        using pointer = stArmyMovement **;
+        using reference = stArmyMovement *;
+
+        explicit iterator(stArmyMovement * am) : am(am) {}
+        stArmyMovement * operator*() const { return am; }
+        iterator & operator++() { am = (am->*Link).next; return *this; }
+        iterator operator++(int) { iterator t = *this; am = (am->*Link).next; return t; }
+        bool operator==(const iterator & b) const { return am == b.am; }
+        bool operator!=(const iterator & b) const { return am != b.am; }
+    private:
+        stArmyMovement * am;
+    };
+
+    armylist() = default;
+    armylist(const armylist &) = delete;
+    armylist & operator=(const armylist &) = delete;
+    ~armylist() { clear(); }
+
+    iterator begin() const { return iterator(head); }
+    iterator end() const { return iterator(nullptr); }
+    std::size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    /// Appends the army, moving it out of any other list using the same link
+    void push_back(stArmyMovement * am)
+    {
+        unlink(am);
+        stArmyLink & link = am->*Link;
+        link.prev = tail;
+        link.next = nullptr;
+        link.list = this;
+        if (tail)
+            (tail->*Link).next = am;
+        else
+            head = am;
+        tail = am;
+        ++count;
+    }
+
+    /// Removes the army if it is in this list
+    void remove(stArmyMovement * am)
+    {
+        if ((am->*Link).list != this)
+            return;
+        stArmyLink & link = am->*Link;
+        if (link.prev)
+            (link.prev->*Link).next = link.next;
+        else
+            head = link.next;
+        if (link.next)
+            (link.next->*Link).prev = link.prev;
+        else
+            tail = link.prev;
+        link.prev = link.next = nullptr;
+        link.list = nullptr;
+        --count;
+    }
+
+    void clear()
+    {
+        while (head)
+            remove(head);
+    }
+
+    /// Removes the army from whichever list of this kind holds it
+    static void unlink(stArmyMovement * am)
+    {
+        if ((am->*Link).list)
+            static_cast<armylist *>((am->*Link).list)->remove(am);
+    }
+
+private:
+    stArmyMovement * head = nullptr;
+    stArmyMovement * tail = nullptr;
+    std::size_t count = 0;
+};
+
+using ownerarmylist = armylist<&stArmyMovement::ownerlink>;
+using cityarmylist = armylist<&stArmyMovement::citylink>;
+using targetarmylist = armylist<&stArmyMovement::targetlink>;
+using tilearmylist = armylist<&stArmyMovement::tilelink>;
@@ -0,0 +1,71 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <Poco/Data/Session.h>
+#include <Poco/Data/Statement.h>
+
+/// Writes rows as multi-row INSERT statements instead of one statement per
+/// row. head is the statement up to and including VALUES, row the
+/// placeholder group of a single row such as "(?,?,'')", and tail whatever
+/// follows the values, typically an ON DUPLICATE KEY UPDATE clause.
+/// Rows are Poco::Tuples bound in placeholder order.
+class batchwriter
+{
+public:
+    batchwriter(std::string head, std::string row, std::string tail = "")
+        : head(std::move(head))
+        , row(std::move(row))
+        , tail(std::move(tail))
+    {
+    }
+
+    /// Issues one statement per rowsper rows
+    template<typename Row>
+    void Write(Poco::Data::Session & ses, std::vector<Row> & rows, std::size_t rowsper) const
+    {
+        rowsper = std::max<std::size_t>(rowsper, 1);
+        for (std::size_t first = 0; first < rows.size(); first += rowsper)
+        {
+            std::size_t last = std::min(rows.size(), first + rowsper);
+
+            Poco::Data::Statement stmt(ses);
+            stmt << Sql(last - first);
+            for (std::size_t i = first; i < last; ++i)
+                stmt.addBind(Poco::Data::Keywords::use(rows[i]));
+            stmt.execute();
+        }
+    }
+
+    /// The statement text for count rows
+    std::string Sql(std::size_t count) const
+    {
+        std::string sql;
+        sql.reserve(head.size() + (row.size() + 1) * count + tail.size() + 1);
+        sql += head;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            if (i != 0)
+                sql += ',';
+            sql += row;
+        }
+        sql += tail;
+        sql += ';';
+        return sql;
+    }
+
+private:
+    std::string head;
+    std::string row;
+    std::string tail;
+};
@@ -0,0 +1,77 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#include "bufferpool.h"
+
+const std::size_t bufferpool::sizeclasses[bufferpool::sizeclasscount] = { 512, 2048, 8192, 32768, 131072, 524288 };
+
+bufferpool & bufferpool::GetSingleton()
+{
+    static bufferpool pool;
+    return pool;
+}
+
+bufferpool::~bufferpool()
+{
+    for (auto & freelist : freelists)
+    {
+        for (netbuffer * buffer : freelist.buffers)
+            delete buffer;
+        freelist.buffers.clear();
+    }
+}
+
+netbuffer_ptr bufferpool::Get(std::size_t size)
+{
+    int8_t sc = 0;
+    while (sc < sizeclasscount && sizeclasses[sc] < size)
+        ++sc;
+
+    netbuffer * buffer = nullptr;
+    if (sc == sizeclasscount)
+    {
+        buffer = new netbuffer(size, -1);
+    }
+    else
+    {
+        {
+            std::lock_guard<std::mutex> l(freelists[sc].mtx);
+            if (!freelists[sc].buffers.empty())
+            {
+                buffer = freelists[sc].buffers.back();
+                freelists[sc].buffers.pop_back();
+            }
+        }
+        if (buffer == nullptr)
+            buffer = new netbuffer(sizeclasses[sc], sc);
+    }
+    buffer->size = 0;
+    return netbuffer_ptr(buffer, [this](netbuffer * b) { Release(b); });
+}
+
+netbuffer_ptr bufferpool::Grow(const netbuffer_ptr & buffer)
+{
+    if (buffer->sizeclass < 0)
+        return Get(buffer->capacity * 2);
+    if (buffer->sizeclass + 1 < sizeclasscount)
+        return Get(sizeclasses[buffer->sizeclass + 1]);
+    return Get(sizeclasses[sizeclasscount - 1] * 2);
+}
+
+void bufferpool::Release(netbuffer * buffer)
+{
+    if (buffer->sizeclass >= 0)
+    {
+        stFreeList & freelist = freelists[buffer->sizeclass];
+        std::lock_guard<std::mutex> l(freelist.mtx);
+        if (freelist.buffers.size() < maxfree)
+        {
+            freelist.buffers.push_back(buffer);
+            return;
+        }
+    }
+    delete buffer;
+}
@@ -0,0 +1,73 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/// Outbound packet buffer owned by a bufferpool size class.
+/// Shared between the sender and the connection's write queue and returned
+/// to its pool once the last reference is dropped.
+class netbuffer
+{
+public:
+    netbuffer(const netbuffer&) = delete;
+    netbuffer& operator=(const netbuffer&) = delete;
+
+    explicit netbuffer(std::size_t capacity, int8_t sizeclass)
+        : storage(new char[capacity])
+        , capacity(capacity)
+        , sizeclass(sizeclass)
+    {
+    }
+
+    char * data() const { return storage.get(); }
+
+    std::unique_ptr<char[]> storage;
+    std::size_t capacity;
+    // Bytes in use
+    std::size_t size = 0;
+    // Index of the owning size class, -1 if too large to be pooled
+    int8_t sizeclass;
+};
+
+typedef std::shared_ptr<netbuffer> netbuffer_ptr;
+
+/// Size classed free lists of netbuffers.
+class bufferpool
+{
+public:
+    static bufferpool & GetSingleton();
+
+    /// Get a buffer of at least size bytes. Buffers larger than the largest
+    /// size class are allocated on demand and not pooled.
+    netbuffer_ptr Get(std::size_t size);
+
+    /// Get a buffer of the next size class above the given buffer's.
+    netbuffer_ptr Grow(const netbuffer_ptr & buffer);
+
+    static const int8_t sizeclasscount = 6;
+    static const std::size_t sizeclasses[sizeclasscount];
+    // Max idle buffers kept per size class
+    static const std::size_t maxfree = 1024;
+
+private:
+    bufferpool() = default;
+    ~bufferpool();
+
+    void Release(netbuffer * buffer);
+
+    struct stFreeList
+    {
+        std::mutex mtx;
+        std::vector<netbuffer*> buffers;
+    };
+    stFreeList freelists[sizeclasscount];
+};
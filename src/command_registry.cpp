@@ -0,0 +1,132 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#include "command_registry.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+void command_registry::AddHandler(const char * cmdtype, const char * command, int32_t id, packetfactory create, bool checkclient)
+{
+    stCommandHandler handler;
+    handler.cmdtype = cmdtype;
+    handler.command = (command != nullptr) ? command : "";
+    handler.name = handler.cmdtype + "." + handler.command;
+    handler.id = id;
+    handler.create = create;
+    handler.checkclient = checkclient;
+
+    if (command == nullptr)
+    {
+        modules[handler.cmdtype] = handler;
+        return;
+    }
+
+    for (const stCommandHandler & h : handlers)
+    {
+        if (h.name == handler.name)
+            throw std::logic_error("Duplicate command registered: " + handler.name);
+    }
+    handlers.push_back(handler);
+}
+
+uint32_t command_registry::Hash(const std::string & key, uint32_t seed)
+{
+    // FNV-1a followed by a murmur3 finalizer so nearby seeds spread well
+    uint32_t h = 2166136261u ^ seed;
+    for (const char c : key)
+    {
+        h ^= uint8_t(c);
+        h *= 16777619u;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+void command_registry::Build()
+{
+    uint32_t slotcount = uint32_t(handlers.size() + handlers.size() / 4 + 1);
+    while (!TryBuild(slotcount))
+        slotcount += slotcount / 4 + 1;
+}
+
+bool command_registry::TryBuild(uint32_t slotcount)
+{
+    uint32_t bucketcount = std::max<uint32_t>(1, uint32_t(handlers.size() / 4));
+
+    std::vector<std::vector<int32_t>> buckets(bucketcount);
+    for (int32_t i = 0; i < int32_t(handlers.size()); ++i)
+        buckets[Hash(handlers[i].name, 0) % bucketcount].push_back(i);
+
+    // Place the largest buckets first while the table is still mostly empty
+    std::vector<uint32_t> order(bucketcount);
+    for (uint32_t i = 0; i < bucketcount; ++i)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&buckets](uint32_t a, uint32_t b)
+    {
+        return buckets[a].size() > buckets[b].size();
+    });
+
+    seeds.assign(bucketcount, 0);
+    slots.assign(slotcount, -1);
+
+    std::vector<uint32_t> positions;
+    for (uint32_t b : order)
+    {
+        const std::vector<int32_t> & bucket = buckets[b];
+        if (bucket.empty())
+            break;
+
+        bool placed = false;
+        for (uint32_t seed = 1; seed < 100000 && !placed; ++seed)
+        {
+            positions.clear();
+            placed = true;
+            for (int32_t index : bucket)
+            {
+                uint32_t pos = Hash(handlers[index].name, seed) % slotcount;
+                if ((slots[pos] != -1) || (std::find(positions.begin(), positions.end(), pos) != positions.end()))
+                {
+                    placed = false;
+                    break;
+                }
+                positions.push_back(pos);
+            }
+            if (placed)
+            {
+                seeds[b] = seed;
+                for (size_t i = 0; i < bucket.size(); ++i)
+                    slots[positions[i]] = bucket[i];
+            }
+        }
+        if (!placed)
+            return false;
+    }
+    return true;
+}
+
+const stCommandHandler * command_registry::Find(const std::string & cmd) const
+{
+    if (slots.empty())
+        return nullptr;
+    uint32_t seed = seeds[Hash(cmd, 0) % seeds.size()];
+    int32_t index = slots[Hash(cmd, seed) % slots.size()];
+    if ((index < 0) || (handlers[index].name != cmd))
+        return nullptr;
+    return &handlers[index];
+}
+
+const stCommandHandler * command_registry::FindModule(const std::string & cmdtype) const
+{
+    auto iter = modules.find(cmdtype);
+    if (iter == modules.end())
+        return nullptr;
+    return &iter->second;
+}
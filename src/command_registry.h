@@ -0,0 +1,76 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+class spitfire;
+class packet;
+class amf3object;
+struct request;
+
+typedef packet * (*packetfactory)(spitfire & server, request & req, amf3object & obj);
+
+struct stCommandHandler
+{
+    std::string name;       // full command, "cmdtype.command"
+    std::string cmdtype;
+    std::string command;
+    int32_t id;             // module command id, -1 for a module's fallback
+    packetfactory create;
+    bool checkclient;       // run packet::check() before process()
+};
+
+/// Maps full command strings to their handlers. Modules register their
+/// commands, then Build() lays them out in a perfect hash table (hash and
+/// displace) so a lookup costs two hashes and one string compare.
+class command_registry
+{
+public:
+    template <class T>
+    void Add(const char * cmdtype, const char * command, int32_t id, bool checkclient = true)
+    {
+        AddHandler(cmdtype, command, id, &Create<T>, checkclient);
+    }
+
+    /// Handler for any command of this cmdtype without an entry of its own.
+    template <class T>
+    void AddModule(const char * cmdtype, bool checkclient = true)
+    {
+        AddHandler(cmdtype, nullptr, -1, &Create<T>, checkclient);
+    }
+
+    void Build();
+
+    const stCommandHandler * Find(const std::string & cmd) const;
+    const stCommandHandler * FindModule(const std::string & cmdtype) const;
+
+    size_t size() const { return handlers.size(); }
+
+private:
+    template <class T>
+    static packet * Create(spitfire & server, request & req, amf3object & obj)
+    {
+        return new T(server, req, obj);
+    }
+
+    void AddHandler(const char * cmdtype, const char * command, int32_t id, packetfactory create, bool checkclient);
+    bool TryBuild(uint32_t slotcount);
+
+    static uint32_t Hash(const std::string & key, uint32_t seed);
+
+    std::vector<stCommandHandler> handlers;
+    std::unordered_map<std::string, stCommandHandler> modules;
+
+    // displacement seed per first level bucket
+    std::vector<uint32_t> seeds;
+    // handler index per slot, -1 when empty
+    std::vector<int32_t> slots;
+};
@@ -9,17 +9,19 @@
 #include "request_handler.h"
 #include "Client.h"
 #include "Utils.h"
+#include <string.h>
+#include <algorithm>
 #include <Poco/Data/MySQL/MySQLException.h>
 
 
 connection::connection(asio::ip::tcp::socket socket, request_handler& handler)
     : socket_(std::move(socket)),
     request_handler_(handler),
+    buffer_(READCHUNKSIZE),
     uid(0),
     client_(nullptr)
 {
     policy = false;
-    size = 0;
     lastpacketsent = lastpacketreceive = timeconnected = 0;
 }
 
@@ -36,9 +38,7 @@ void connection::start()
 
     spitfire::GetSingleton().PlayerCount(1);
 
-    asio::async_read(socket_, asio::buffer(buffer_.data(), 4), std::bind(&connection::handle_read_header, shared_from_this(),
-        std::placeholders::_1,
-        std::placeholders::_2));
+    do_read();
 }
 
 void connection::startpolicy()
@@ -51,7 +51,24 @@ void connection::startpolicy()
 
 void connection::stop()
 {
-    socket_.close();
+    spitfire & server = spitfire::GetSingleton();
+    auto self(shared_from_this());
+    socket_.get_io_service().dispatch([this, self]()
+    {
+        asio::error_code ignored_ec;
+        socket_.close(ignored_ec);
+    });
+    // Held until the client no longer points here, so anything sending to
+    // client->socket meanwhile writes to a closed socket, not freed memory
+    server.io_service_.post([this, self, &server]()
+    {
+        std::lock_guard<std::mutex> l(server.worldmtx);
+        detach();
+    });
+}
+
+void connection::detach()
+{
     if (client_)
     {
         uint32_t tc = 0;
@@ -73,41 +90,86 @@ void connection::stop()
         //             s->m_clients[num] = 0;
         //             return;
         //         }
-        client_->socket = 0;
-        client_->socknum = 0;
+        // a new login may have taken the client over already
+        if (client_->socket == this)
+        {
+            client_->socket = 0;
+            client_->socknum = 0;
+            // hibernation and eviction count from here
+            client_->lastseen = Utils::time();
+        }
         client_ = nullptr;
         //spitfire::GetSingleton().PlayerCount(-1);
-
-        //TODO: record last online time
     }
 }
 
 void connection::write(const char * data, const int32_t size)
+{
+    netbuffer_ptr buffer = bufferpool::GetSingleton().Get(size);
+    memcpy(buffer->data(), data, size);
+    buffer->size = size;
+    write(buffer);
+}
+
+void connection::write(netbuffer_ptr buffer)
 {
     if (!this)
         return;
     auto self(shared_from_this());
-    asio::async_write(socket_, asio::buffer(data, size),
-        [this, self, size](asio::error_code ec, std::size_t written)
+    // Writes can come from any shard or the timer thread. Hand the buffer to
+    // the io_service owning this socket.
+    socket_.get_io_service().post([this, self, buffer]()
+    {
+        writequeue_.push_back(buffer);
+        if (writing_.empty())
+            do_write();
+    });
+}
+
+void connection::do_write()
+{
+    // Cap the gather list below the usual IOV_MAX
+    const std::size_t maxgather = 64;
+
+    std::vector<asio::const_buffer> buffers;
+    std::size_t total = 0;
+    while (!writequeue_.empty() && writing_.size() < maxgather)
+    {
+        netbuffer_ptr & buffer = writequeue_.front();
+        buffers.push_back(asio::buffer(buffer->data(), buffer->size));
+        total += buffer->size;
+        writing_.push_back(std::move(buffer));
+        writequeue_.pop_front();
+    }
+
+    auto self(shared_from_this());
+    asio::async_write(socket_, buffers,
+        [this, self, total](asio::error_code ec, std::size_t written)
     {
         lastpacketsent = Utils::time();
+        writing_.clear();
         if (!ec)
         {
             // No socket errors on write
-            if (size != written)
+            if (total != written)
             {
                 //sent size not matching
                 spitfire::GetSingleton().stop(shared_from_this(), false);
                 std::cerr << "Data sent does not match size sent. Socket closed.\n";
+                return;
             }
+            if (!writequeue_.empty())
+                do_write();
         }
         else if (ec != asio::error::operation_aborted)
         {
+            writequeue_.clear();
             spitfire::GetSingleton().stop(shared_from_this(), false);
             std::cerr << "asio::async_write() failure\n";
         }
         else
         {
+            writequeue_.clear();
             std::cerr << "asio::async_write() failure - operation_aborted\n";
         }
     });
@@ -135,61 +197,88 @@ void connection::handle_read_policy(const asio::error_code& e,
 
 }
 
-void connection::handle_read_header(const asio::error_code& e,
+void connection::do_read()
+{
+    uint32_t maxframe = spitfire::GetSingleton().maxpacketsize;
+
+    if (readstart_ == readend_)
+    {
+        readstart_ = readend_ = 0;
+    }
+
+    // Make room for at least the rest of the pending frame, or a fresh chunk
+    std::size_t needed = READCHUNKSIZE;
+    if (readend_ - readstart_ >= 4)
+    {
+        int32_t framesize = *(int32_t*)(buffer_.data() + readstart_);
+        Utils::ByteSwap5((unsigned char*)&framesize, sizeof(framesize));
+        needed = std::max<std::size_t>(needed, framesize + 4);
+    }
+    if (buffer_.size() - readstart_ < needed)
+    {
+        memmove(buffer_.data(), buffer_.data() + readstart_, readend_ - readstart_);
+        readend_ -= readstart_;
+        readstart_ = 0;
+    }
+    if (buffer_.size() < needed)
+    {
+        buffer_.resize(std::min<std::size_t>(std::max(needed, buffer_.size() * 2), maxframe + 4 + READCHUNKSIZE));
+    }
+
+    socket_.async_read_some(asio::buffer(buffer_.data() + readend_, buffer_.size() - readend_),
+        std::bind(&connection::handle_read, shared_from_this(),
+            std::placeholders::_1,
+            std::placeholders::_2));
+}
+
+void connection::handle_read(const asio::error_code& e,
     std::size_t bytes_transferred)
 {
     if (!e)
     {
-        if (bytes_transferred == 4)
-        {
-            size = *(int32_t*)buffer_.data();
-            Utils::ByteSwap5((unsigned char*)&size, sizeof(size));
+        readend_ += bytes_transferred;
+        lastpacketreceive = Utils::time();
 
-            if ((size < 4) || (size >= MAXPACKETSIZE))
-            {
-                spitfire::GetSingleton().log->error("Did not receive proper amount of bytes : sent: {} - ip:{}", size, address);
-                spitfire::GetSingleton().stop(shared_from_this());
-                return;
-            }
+        if (!process_frames() || !socket_.is_open())
+            return;
 
-            asio::async_read(socket_, asio::buffer(buffer_.data(), size), std::bind(&connection::handle_read, shared_from_this(),
-                std::placeholders::_1,
-                std::placeholders::_2));
-        }
+        do_read();
     }
     else if (e != asio::error::operation_aborted)
     {
         spitfire::GetSingleton().stop(shared_from_this());
         return;
     }
-
 }
 
-void connection::handle_read(const asio::error_code& e,
-    std::size_t bytes_transferred)
+bool connection::process_frames()
 {
-    if (!e)
+    uint32_t maxframe = spitfire::GetSingleton().maxpacketsize;
+    std::vector<request> requests;
+
+    while (readend_ - readstart_ >= 4)
     {
-        if (bytes_transferred != size)
+        int32_t size = *(int32_t*)(buffer_.data() + readstart_);
+        Utils::ByteSwap5((unsigned char*)&size, sizeof(size));
+
+        if ((size < 4) || (uint32_t(size) > maxframe))
         {
-            spitfire::GetSingleton().log->error("Did not receive proper amount of bytes : rcv: {} needed: {}", bytes_transferred, size);
+            spitfire::GetSingleton().log->error("Invalid frame size : sent: {} max: {} - ip:{}", size, maxframe, address);
             spitfire::GetSingleton().stop(shared_from_this());
-            return;
+            return false;
         }
-        char * t = buffer_.data();
+
+        if (readend_ - readstart_ < std::size_t(size) + 4)
+            break;
+
+        char * t = buffer_.data() + readstart_ + 4;
+        readstart_ += size + 4;
+
         if ((*(int8_t*)t != 0x0a) && (*(int8_t*)(t + 1) != 0x0b) && (*(int8_t*)(t + 2) != 0x01))
         {
             spitfire::GetSingleton().log->error("Not an AMF3 object - ip:{}", address);
             spitfire::GetSingleton().stop(shared_from_this());
-            return;
-        }
-        //printf("uid("XI64")\n", uid);
-        // read object size
-        if ((size > MAXPACKETSIZE) || (size <= 0))
-        {
-            //ERROR - object too large - close connection
-            spitfire::GetSingleton().stop(shared_from_this());
-            return;
+            return false;
         }
 
         //TODO: Decision: have socket read thread handle packets, or push into a queue
@@ -207,48 +296,41 @@ void connection::handle_read(const asio::error_code& e,
         // PRO: lag from one client only affects a set amount of players and not the entire server
         // CON: quite complex. is ultimately the process thread option only for x amount of sockets
 
-        lastpacketreceive = Utils::time();
-
         // parse packet
-        request_.size = size;
+        request req;
+        req.size = size;
         try
         {
-            amf3parser cparser(buffer_.data());
-            request_.object = cparser.ReadNextObject();
+            amf3parser cparser(t);
+            req.object = cparser.ReadNextObject();
         }
         catch (...)
         {
             std::cerr << "uncaught handle_request()::amf3parser exception\n";
         }
-        request_.conn = this;
-        {
-//             std::lock_guard<std::mutex> l(spitfire::GetSingleton().m);
-//             spitfire::GetSingleton().packetqueue.push_back(request_);
-            request_handler_.handle_request(spitfire::GetSingleton(), request_);
-        }
-
-        //         if (reply_.objects.size() > 0)
-        //         {
-        //             // send reply packets
-        //             try {
-        //                 socket_.write_some(reply_.to_buffers());
-        //             }
-        //             catch (std::exception& e)
-        //             {
-        //                 std::cerr << "asio::write_some() exception: " << e.what() << "\n";
-        //             }
-        //             reply_.objects.clear();
-        //         }
-
-        asio::async_read(socket_, asio::buffer(buffer_.data(), 4), std::bind(&connection::handle_read_header, shared_from_this(),
-            std::placeholders::_1,
-            std::placeholders::_2));
+        req.conn = this;
+        requests.push_back(req);
     }
-    else if (e != asio::error::operation_aborted)
+
+    if (!requests.empty())
     {
-        spitfire::GetSingleton().stop(shared_from_this());
-        return;
+//         std::lock_guard<std::mutex> l(spitfire::GetSingleton().m);
+//         spitfire::GetSingleton().packetqueue.push_back(request_);
+        // Reading and parsing run in parallel across shards, game logic does not
+        std::lock_guard<std::mutex> l(spitfire::GetSingleton().worldmtx);
+        bool open = true;
+        for (request & req : requests)
+        {
+            // A request can close this connection, drop whatever follows it
+            if (!(open = socket_.is_open()))
+                break;
+            request_handler_.handle_request(spitfire::GetSingleton(), req);
+        }
+        spitfire::GetSingleton().JournalCommit();
+        if (!open)
+            return false;
     }
+    return true;
 }
 
 void connection::handle_write(const asio::error_code& e)
@@ -6,13 +6,19 @@
 
 #pragma once
 
-#define MAXPACKETSIZE 32768/10
+// Default max frame size, overridden by maxpacketsize in config.json
+#define MAXPACKETSIZE (32768/10)
+
+// Bytes requested from the socket per read
+#define READCHUNKSIZE 8192
 
 #include <asio.hpp>
 #include <memory>
-#include <array>
+#include <vector>
 #include <mutex>
+#include <deque>
 #include "request_handler.h"
+#include "bufferpool.h"
 
 class spitfire;
 class Client;
@@ -35,38 +41,63 @@ public:
     void startpolicy();
 
     /// Stop all asynchronous operations associated with the connection.
+    /// Safe to call from any thread, with or without worldmtx held: the
+    /// socket is closed on its shard and the client let go of later on the
+    /// main io_service under worldmtx.
     void stop();
 
+    /// Copy data into a pooled buffer and queue it for sending.
     void write(const char * data, const int32_t size);
 
+    /// Queue a buffer for sending. Safe to call from any thread.
+    void write(netbuffer_ptr buffer);
+
 private:
+    /// Let go of the client. Runs under worldmtx.
+    void detach();
+
     /// Handle completion of a read operation.
     void handle_read_policy(const asio::error_code& e,
         std::size_t bytes_transferred);
-    void handle_read_header(const asio::error_code& e,
-        std::size_t bytes_transferred);
     void handle_read(const asio::error_code& e,
         std::size_t bytes_transferred);
+
+    /// Read whatever the socket has into the free end of the read buffer.
+    void do_read();
+
+    /// Split every complete frame in the read buffer and dispatch them in order.
+    /// Returns false if the connection was dropped.
+    bool process_frames();
     /// Handle completion of a write operation.
     void handle_write(const asio::error_code& e);
 
+    /// Send everything queued so far in a single gathered write.
+    void do_write();
+
     /// Socket for the connection.
     asio::ip::tcp::socket socket_;
 
     /// The handler used to process the incoming request.
     request_handler& request_handler_;
 
-    /// Buffer for incoming data.
-    std::array<char, MAXPACKETSIZE> buffer_;
+    /// Buffer for incoming data. Unparsed bytes live in [readstart_, readend_),
+    /// consumed space is reclaimed by moving the tail back to the front.
+    std::vector<char> buffer_;
+    std::size_t readstart_ = 0;
+    std::size_t readend_ = 0;
 
-    /// The incoming request.
-    request request_;
+    /// Buffers waiting to be sent. Only touched on this connection's shard.
+    std::deque<netbuffer_ptr> writequeue_;
 
-    int32_t size;
+    /// Buffers owned by the write currently in flight.
+    std::vector<netbuffer_ptr> writing_;
 
 public:
     uint64_t uid = 0;
 
+    /// Network shard this connection was accepted on and is served by.
+    uint32_t shard = 0;
+
     Client * client_ = nullptr;
 
     std::string address;
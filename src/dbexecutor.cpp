@@ -0,0 +1,132 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#include "dbexecutor.h"
+#include "spitfire.h"
+#include "storage.h"
+
+#include <algorithm>
+
+dbexecutor::dbexecutor(std::string name, storage & store)
+    : name(std::move(name))
+    , store(store)
+{
+}
+
+dbexecutor::~dbexecutor()
+{
+    Stop();
+}
+
+void dbexecutor::Start(uint32_t threads)
+{
+    threads = std::max(threads, 1u);
+    for (uint32_t i = 0; i < threads; ++i)
+        lanes.push_back(std::make_unique<lane>());
+    for (auto & l : lanes)
+        l->thread = std::thread(&dbexecutor::Worker, this, std::ref(*l));
+}
+
+void dbexecutor::Stop()
+{
+    if (stopped.exchange(true))
+        return;
+    for (auto & l : lanes)
+    {
+        // taken so a worker between its check and its wait sees the flag
+        std::lock_guard<std::mutex> lock(l->mtx);
+        l->cv.notify_one();
+    }
+    for (auto & l : lanes)
+    {
+        if (l->thread.joinable())
+            l->thread.join();
+    }
+}
+
+void dbexecutor::Post(uint64_t key, dbquery query, dbcompletion done, asio::io_service * context)
+{
+    if (lanes.empty() || stopped)
+    {
+        spitfire::GetSingleton().log->error("{} db query posted while not running, dropped.", name);
+        // same as a completion of a query that ran, never on the caller
+        if (done && context)
+            context->post([done]() { done(false); });
+        else if (done)
+            done(false);
+        return;
+    }
+    lane & l = *lanes[key % lanes.size()];
+    {
+        std::lock_guard<std::mutex> lock(l.mtx);
+        l.queue.push_back({ std::move(query), std::move(done), context });
+    }
+    l.cv.notify_one();
+}
+
+std::size_t dbexecutor::Pending()
+{
+    std::size_t count = 0;
+    for (auto & l : lanes)
+    {
+        std::lock_guard<std::mutex> lock(l->mtx);
+        count += l->queue.size();
+    }
+    return count;
+}
+
+void dbexecutor::Worker(lane & l)
+{
+    spitfire & server = spitfire::GetSingleton();
+
+    // Taken on first use and dropped after a failure, so a dead connection
+    // is replaced by the next query instead of failing every one after it
+    std::unique_ptr<storageconn> db;
+
+    for (;;)
+    {
+        dbtask task;
+        {
+            std::unique_lock<std::mutex> lock(l.mtx);
+            l.cv.wait(lock, [&] { return stopped || !l.queue.empty(); });
+            if (l.queue.empty())
+                return;
+            task = std::move(l.queue.front());
+            l.queue.pop_front();
+        }
+
+        bool ok = false;
+        try
+        {
+            if (!db)
+                db = store.Connect();
+            task.query(*db);
+            ok = true;
+        }
+        catch (Poco::Exception & e)
+        {
+            server.log->error("{} db query failed: {}", name, e.displayText());
+            db.reset();
+        }
+        catch (std::exception & e)
+        {
+            server.log->error("{} db query failed: {}", name, e.what());
+            db.reset();
+        }
+
+        if (!task.done)
+            continue;
+        if (task.context)
+        {
+            dbcompletion done = std::move(task.done);
+            task.context->post([done, ok]() { done(ok); });
+        }
+        else
+        {
+            task.done(ok);
+        }
+    }
+}
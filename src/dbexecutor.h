@@ -0,0 +1,79 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#pragma once
+
+#include <asio.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class storage;
+class storageconn;
+
+/// A statement to run off the calling thread. It owns copies of everything it
+/// binds; results go into state shared with its completion.
+typedef std::function<void(storageconn &)> dbquery;
+/// Runs once the query finished; ok is false if it threw
+typedef std::function<void(bool ok)> dbcompletion;
+
+/// Runs queries for the network shards and the timer thread so a slow MySQL
+/// response only stalls a worker. Each worker holds one connection to the
+/// store for its lifetime and drains its own queue. Queries posted with the same key
+/// land on the same worker and so run in the order they were posted.
+class dbexecutor
+{
+public:
+    dbexecutor(std::string name, storage & store);
+    ~dbexecutor();
+
+    dbexecutor(const dbexecutor &) = delete;
+    dbexecutor & operator=(const dbexecutor &) = delete;
+
+    void Start(uint32_t threads);
+    /// Runs every query already posted, then joins the workers
+    void Stop();
+
+    /// Queues query on the worker for key. done, if given, is posted to
+    /// context, or run on the worker itself when context is null. Before
+    /// Start or after Stop the query is dropped and done gets false.
+    void Post(uint64_t key, dbquery query, dbcompletion done = nullptr, asio::io_service * context = nullptr);
+
+    /// Number of queries not yet started
+    std::size_t Pending();
+
+private:
+    struct dbtask
+    {
+        dbquery query;
+        dbcompletion done;
+        asio::io_service * context;
+    };
+    struct lane
+    {
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::deque<dbtask> queue;
+        std::thread thread;
+    };
+
+    void Worker(lane & l);
+
+    std::string name;
+    storage & store;
+    std::vector<std::unique_ptr<lane>> lanes;
+    /// Set once by Stop; workers read it under their lane's mutex, after
+    /// Stop took that mutex to notify them
+    std::atomic<bool> stopped{ false };
+};
@@ -0,0 +1,290 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#include "journal.h"
+#include "spitfire.h"
+#include "Utils.h"
+
+#include <Poco/Checksum.h>
+#include <Poco/DirectoryIterator.h>
+#include <Poco/File.h>
+#include <Poco/Path.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const std::size_t recordheader = 9;
+
+    uint32_t Crc(uint8_t type, const char * data, std::size_t size)
+    {
+        Poco::Checksum crc(Poco::Checksum::TYPE_CRC32);
+        crc.update(reinterpret_cast<const char *>(&type), 1);
+        crc.update(data, static_cast<unsigned int>(size));
+        return crc.checksum();
+    }
+}
+
+journal::~journal()
+{
+    Close();
+}
+
+bool journal::Open(const std::string & dir, uint32_t syncms, uint64_t stamp, std::string & error)
+{
+    this->dir = dir;
+    this->syncms = syncms;
+    try
+    {
+        Poco::File(dir).createDirectories();
+    }
+    catch (Poco::Exception & e)
+    {
+        error = e.displayText();
+        return false;
+    }
+    if (!StartSegment(stamp))
+    {
+        error = "unable to create a segment in " + dir;
+        return false;
+    }
+    stopped = false;
+    running = true;
+    thread = std::thread(&journal::Writer, this);
+    return true;
+}
+
+void journal::Close()
+{
+    if (!running)
+        return;
+    Commit();
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopped = true;
+    }
+    cv.notify_one();
+    thread.join();
+    running = false;
+}
+
+void journal::Append(uint8_t type, const std::string & payload)
+{
+    if (!running)
+        return;
+    uint32_t size = uint32_t(payload.size());
+    uint32_t crc = Crc(type, payload.data(), payload.size());
+    batch.append(reinterpret_cast<const char *>(&size), 4);
+    batch.append(reinterpret_cast<const char *>(&crc), 4);
+    batch.append(reinterpret_cast<const char *>(&type), 1);
+    batch += payload;
+}
+
+void journal::Commit()
+{
+    if (batch.empty())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        queue.push_back({ std::move(batch), 0 });
+    }
+    batch.clear();
+    cv.notify_one();
+}
+
+void journal::Rotate(uint64_t stamp)
+{
+    if (!running)
+        return;
+    Commit();
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        queue.push_back({ std::string(), stamp });
+    }
+    cv.notify_one();
+}
+
+void journal::Retire(uint64_t stamp)
+{
+    if (dir.empty())
+        return;
+    std::string open;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        open = current;
+    }
+    for (const segment & s : Segments(dir))
+    {
+        // the writer may not have taken up a rotation queued before the
+        // marker yet; its segment goes with the next retirement
+        if (s.stamp >= stamp || s.path == open)
+            continue;
+        try
+        {
+            Poco::File(s.path).remove();
+        }
+        catch (Poco::Exception & e)
+        {
+            spitfire::GetSingleton().log->error("Unable to retire journal segment {}: {}", s.path, e.displayText());
+        }
+    }
+}
+
+std::vector<journal::segment> journal::Segments(const std::string & dir)
+{
+    std::vector<segment> segments;
+    try
+    {
+        Poco::DirectoryIterator end;
+        for (Poco::DirectoryIterator it(dir); it != end; ++it)
+        {
+            const std::string & name = it.name();
+            std::size_t dash = name.find('-');
+            std::size_t dot = name.find('.');
+            if (dash == std::string::npos || dot == std::string::npos || dash > dot || name.substr(dot) != ".journal")
+                continue;
+            try
+            {
+                segments.push_back({ std::stoull(name.substr(0, dash)), std::stoull(name.substr(dash + 1, dot - dash - 1)), it.path().toString() });
+            }
+            catch (std::exception &)
+            {
+            }
+        }
+    }
+    catch (Poco::Exception &)
+    {
+        // no directory yet, no segments
+    }
+    std::sort(segments.begin(), segments.end(), [](const segment & a, const segment & b) { return a.serial < b.serial; });
+    return segments;
+}
+
+bool journal::Read(const std::string & path, const std::function<void(uint8_t type, const char * data, std::size_t size)> & f,
+    uint64_t & records)
+{
+    records = 0;
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    const char * pos = data.data();
+    const char * end = data.data() + data.size();
+    while (pos != end)
+    {
+        if (std::size_t(end - pos) < recordheader)
+            return false;
+        uint32_t size, crc;
+        uint8_t type;
+        std::memcpy(&size, pos, 4);
+        std::memcpy(&crc, pos + 4, 4);
+        std::memcpy(&type, pos + 8, 1);
+        pos += recordheader;
+        if (std::size_t(end - pos) < size || Crc(type, pos, size) != crc)
+            return false;
+        f(type, pos, size);
+        pos += size;
+        ++records;
+    }
+    return true;
+}
+
+bool journal::StartSegment(uint64_t stamp)
+{
+    // strictly increasing even across restarts within the same millisecond
+    serial = std::max<uint64_t>(Utils::time(), serial + 1);
+    std::string path = Poco::Path(dir).append(std::to_string(serial) + "-" + std::to_string(stamp) + ".journal").toString();
+    file = std::fopen(path.c_str(), "ab");
+    std::lock_guard<std::mutex> lock(mtx);
+    current = (file != nullptr) ? path : std::string();
+    return file != nullptr;
+}
+
+void journal::Sync()
+{
+    if (file == nullptr)
+        return;
+    std::fflush(file);
+#ifdef WIN32
+    _commit(_fileno(file));
+#else
+    fsync(fileno(file));
+#endif
+}
+
+void journal::Writer()
+{
+    spitfire & server = spitfire::GetSingleton();
+    std::vector<item> items;
+    auto lastsync = std::chrono::steady_clock::now();
+    bool unsynced = false;
+
+    for (;;)
+    {
+        bool stop;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            // written but unsynced data only waits for the rest of the interval
+            if (unsynced)
+                cv.wait_until(lock, lastsync + std::chrono::milliseconds(syncms), [this] { return stopped || !queue.empty(); });
+            else
+                cv.wait(lock, [this] { return stopped || !queue.empty(); });
+            items.swap(queue);
+            stop = stopped;
+        }
+
+        for (item & i : items)
+        {
+            if (!i.data.empty() && file != nullptr)
+            {
+                if (std::fwrite(i.data.data(), 1, i.data.size(), file) != i.data.size())
+                    server.log->error("Journal write failed, {} bytes lost.", i.data.size());
+                unsynced = true;
+            }
+            if (i.rotate != 0)
+            {
+                Sync();
+                if (file != nullptr)
+                    std::fclose(file);
+                unsynced = false;
+                if (!StartSegment(i.rotate))
+                    server.log->error("Unable to start a journal segment in {}, journaling stops until the next save.", dir);
+            }
+        }
+        items.clear();
+
+        auto now = std::chrono::steady_clock::now();
+        if (unsynced && (stop || now - lastsync >= std::chrono::milliseconds(syncms)))
+        {
+            Sync();
+            unsynced = false;
+            lastsync = now;
+        }
+        else if (file != nullptr)
+        {
+            // out of our buffer at least, so only a machine crash can lose it
+            std::fflush(file);
+        }
+
+        if (stop)
+            break;
+    }
+
+    if (file != nullptr)
+        std::fclose(file);
+    file = nullptr;
+}
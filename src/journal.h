@@ -0,0 +1,95 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Append-only redo log of what changed since the last save, so a crash
+/// between saves loses no more than the last sync interval.
+///
+/// The log is a directory of segments named "<serial>-<stamp>.journal".
+/// serial orders them, stamp is the flush the segment was started at: every
+/// record in a segment was written after that flush, so once the DB's save
+/// marker reaches a stamp every segment started before it is redundant.
+///
+/// A record is a 32 bit payload size, the crc32 of type and payload, a one
+/// byte type and the payload. The game thread appends records to a batch and
+/// commits it; a writer thread writes committed batches as they come and
+/// syncs them to disk at most syncms later, so no packet waits on the disk.
+class journal
+{
+public:
+    ~journal();
+
+    /// Creates dir if needed, starts a segment for stamp and the writer.
+    /// syncms 0 syncs after every batch.
+    bool Open(const std::string & dir, uint32_t syncms, uint64_t stamp, std::string & error);
+    /// Writes and syncs everything committed, then stops the writer
+    void Close();
+    bool IsOpen() const { return running; }
+
+    /// Adds a record to the batch being built; game thread only
+    void Append(uint8_t type, const std::string & payload);
+    /// Hands the batch to the writer
+    void Commit();
+    /// Records committed after this go to a new segment for stamp
+    void Rotate(uint64_t stamp);
+    /// Deletes the segments started before stamp
+    void Retire(uint64_t stamp);
+
+    struct segment
+    {
+        uint64_t serial;
+        uint64_t stamp;
+        std::string path;
+    };
+    /// Segments in dir, oldest first
+    static std::vector<segment> Segments(const std::string & dir);
+    /// Calls f for each record of the segment at path in order. Stops at the
+    /// end or at the first damaged record, which is expected at the tail of a
+    /// segment that was being written when the process died; false then.
+    static bool Read(const std::string & path, const std::function<void(uint8_t type, const char * data, std::size_t size)> & f,
+        uint64_t & records);
+
+private:
+    struct item
+    {
+        std::string data;
+        uint64_t rotate;
+    };
+
+    void Writer();
+    bool StartSegment(uint64_t stamp);
+    void Sync();
+
+    std::string dir;
+    uint32_t syncms = 0;
+    uint64_t serial = 0;
+
+    // game thread side
+    std::string batch;
+    bool running = false;
+
+    // shared with the writer
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::vector<item> queue;
+    std::string current;
+    bool stopped = false;
+
+    // writer side
+    std::FILE * file = nullptr;
+    std::thread thread;
+};
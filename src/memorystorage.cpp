@@ -0,0 +1,375 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#include "memorystorage.h"
+
+#include <algorithm>
+
+typedef std::lock_guard<std::recursive_mutex> storelock;
+
+std::unique_ptr<storageconn> memorystorage::Connect()
+{
+    return std::make_unique<memoryconn>(*this);
+}
+
+void memorystorage::LoadWorld(worldrows & world, uint32_t chunk, bool tiles, uint64_t idlebefore)
+{
+    // nothing writes tiles, so there are never tile rows to hand back
+    storelock lock(mtx);
+
+    // next mail pid of each idle account, whose histories stay here
+    std::map<int64_t, int64_t> idle;
+    for (auto & it : accounts)
+    {
+        if (it.second.get<18>() < double(idlebefore))
+            idle[it.second.get<0>()] = 1;
+    }
+    for (const MailRow & row : mail)
+    {
+        auto found = idle.find(row.get<0>());
+        if (found != idle.end())
+            found->second = std::max(found->second, int64_t(row.get<5>()) + 1);
+    }
+    for (auto & it : idle)
+        world.evicted.emplace_back(it.first, it.second);
+
+    world.accounts.reserve(accounts.size());
+    for (auto & it : accounts)
+    {
+        const AccountSave & a = it.second;
+        std::string password, email;
+        for (const master & m : masters)
+        {
+            if (m.id == a.get<1>())
+            {
+                password = m.password;
+                email = m.email;
+                break;
+            }
+        }
+        world.accounts.emplace_back(a.get<0>(), a.get<1>(), a.get<2>(), password, email, a.get<13>(), a.get<14>(), a.get<18>(), a.get<3>(),
+            a.get<8>(), a.get<10>(), a.get<11>(), a.get<12>(), int32_t(a.get<15>()), a.get<16>(), a.get<17>(), a.get<4>(), a.get<5>(), a.get<6>(), a.get<7>());
+    }
+
+    for (const MailRow & row : mail)
+    {
+        if (idle.count(row.get<0>()) == 0)
+            world.mail.push_back(row);
+    }
+    std::sort(world.mail.begin(), world.mail.end(), [](const MailRow & a, const MailRow & b)
+    {
+        return a.get<0>() != b.get<0>() ? a.get<0>() < b.get<0>() : a.get<5>() < b.get<5>();
+    });
+
+    world.cities.reserve(cities.size());
+    for (auto & it : cities)
+    {
+        const CitySave & c = it.second;
+        world.cities.emplace_back(c.get<1>(), int64_t(c.get<0>()), c.get<7>(), c.get<18>(), c.get<19>(), c.get<20>(), c.get<21>(), c.get<17>(),
+            c.get<11>(), c.get<6>(), c.get<2>(), c.get<9>(), c.get<12>(), c.get<10>(), c.get<13>(), c.get<3>());
+    }
+
+    world.heroes.reserve(heroes.size());
+    for (auto & it : heroes)
+    {
+        const HeroSave & h = it.second;
+        world.heroes.emplace_back(h.get<0>(), int64_t(h.get<22>()), h.get<24>(), h.get<16>(), h.get<15>(),
+            h.get<3>(), h.get<7>(), h.get<8>(), h.get<9>(), h.get<2>(), h.get<4>(), h.get<5>(), h.get<6>(),
+            h.get<1>(), h.get<10>(), h.get<11>(), h.get<12>(), h.get<18>(), h.get<21>(), h.get<25>(), h.get<17>(),
+            h.get<14>(), h.get<13>(), h.get<19>());
+    }
+    // the loader expects heroes grouped by city
+    std::stable_sort(world.heroes.begin(), world.heroes.end(), [](const HeroRow & a, const HeroRow & b) { return a.get<1>() < b.get<1>(); });
+
+    world.alliances.reserve(alliances.size());
+    for (auto & it : alliances)
+    {
+        const AllianceSave & a = it.second;
+        world.alliances.emplace_back(a.get<0>(), a.get<1>(), a.get<2>(), a.get<10>(), a.get<9>(), a.get<7>(), a.get<8>(), a.get<4>());
+    }
+
+    world.armies.reserve(armies.size());
+    for (const ArmySave & a : armies)
+    {
+        world.armies.emplace_back(int64_t(a.get<11>()), a.get<10>(), a.get<0>(), a.get<9>(), int16_t(a.get<1>()), a.get<2>(), a.get<3>(),
+            a.get<4>(), a.get<5>(), a.get<6>(), int32_t(a.get<7>()), a.get<8>());
+    }
+
+    for (auto & it : reports)
+    {
+        if (idle.count(it.first) == 0)
+            world.reports.insert(world.reports.end(), it.second.begin(), it.second.end());
+    }
+}
+
+memoryconn::memoryconn(memorystorage & store)
+    : store(store)
+{
+}
+
+memoryconn::~memoryconn()
+{
+    // a batch that threw never reached Commit
+    if (transaction)
+        store.mtx.unlock();
+}
+
+void memoryconn::Begin()
+{
+    store.mtx.lock();
+    transaction = true;
+}
+
+void memoryconn::Commit()
+{
+    if (!transaction)
+        return;
+    transaction = false;
+    store.mtx.unlock();
+}
+
+void memoryconn::SaveAccounts(std::vector<AccountSave> & rows, uint32_t rowsper)
+{
+    storelock lock(store.mtx);
+    for (AccountSave & row : rows)
+        store.accounts[row.get<0>()] = row;
+}
+
+void memoryconn::SaveCities(std::vector<CitySave> & rows, uint32_t rowsper)
+{
+    storelock lock(store.mtx);
+    for (CitySave & row : rows)
+        store.cities[row.get<0>()] = row;
+}
+
+void memoryconn::SaveHeroes(std::vector<HeroSave> & rows, uint32_t rowsper)
+{
+    storelock lock(store.mtx);
+    for (HeroSave & row : rows)
+        store.heroes[row.get<0>()] = row;
+}
+
+void memoryconn::SaveAlliances(std::vector<AllianceSave> & rows, uint32_t rowsper)
+{
+    storelock lock(store.mtx);
+    for (AllianceSave & row : rows)
+        store.alliances[row.get<0>()] = row;
+}
+
+void memoryconn::SaveArmies(std::vector<ArmySave> & rows, uint32_t rowsper)
+{
+    storelock lock(store.mtx);
+    store.armies = rows;
+}
+
+void memoryconn::SaveReports(int64_t accountid, std::vector<ReportRow> & rows, uint32_t rowsper)
+{
+    storelock lock(store.mtx);
+    if (rows.empty())
+        store.reports.erase(accountid);
+    else
+        store.reports[accountid] = rows;
+}
+
+void memoryconn::DeleteHero(uint64_t id)
+{
+    storelock lock(store.mtx);
+    store.heroes.erase(id);
+}
+
+void memoryconn::DeleteAlliance(int64_t id)
+{
+    storelock lock(store.mtx);
+    store.alliances.erase(id);
+}
+
+uint64_t memoryconn::ReadSaveMarker()
+{
+    storelock lock(store.mtx);
+    return store.marker;
+}
+
+void memoryconn::SaveMarker(uint64_t stamp)
+{
+    storelock lock(store.mtx);
+    store.marker = stamp;
+}
+
+bool memoryconn::AccountExists(const std::string & username)
+{
+    storelock lock(store.mtx);
+    for (auto & it : store.accounts)
+    {
+        if (it.second.get<2>() == username)
+            return true;
+    }
+    return false;
+}
+
+int64_t memoryconn::CreateAccount(int64_t parentid, const std::string & username, uint64_t time, const std::string & ipaddress,
+    int32_t sex, const std::string & flag, const std::string & faceurl)
+{
+    storelock lock(store.mtx);
+    int64_t id = ++store.lastaccount;
+    AccountSave row;
+    row.set<0>(id);
+    row.set<1>(parentid);
+    row.set<2>(username);
+    row.set<3>(double(time));
+    row.set<8>(0);
+    row.set<9>(ipaddress);
+    row.set<10>(sex);
+    row.set<11>(flag);
+    row.set<12>(faceurl);
+    row.set<18>(double(time));
+    store.accounts[id] = row;
+    return id;
+}
+
+int64_t memoryconn::CreateCity(int64_t accountid, const std::string & misc, int32_t fieldid, const std::string & name,
+    const std::string & buildings, uint64_t time)
+{
+    storelock lock(store.mtx);
+    int64_t id = ++store.lastcity;
+    CitySave row;
+    row.set<0>(uint64_t(id));
+    row.set<1>(accountid);
+    row.set<2>(double(time));
+    row.set<3>(misc);
+    row.set<7>(fieldid);
+    row.set<11>(name);
+    row.set<12>(buildings);
+    row.set<17>(100000);
+    row.set<18>(100000);
+    row.set<19>(100000);
+    row.set<20>(100000);
+    row.set<21>(100000);
+    store.cities[uint64_t(id)] = row;
+    return id;
+}
+
+int64_t memoryconn::CreateAlliance(const std::string & name, const std::string & founder, const std::string & leader, int64_t time)
+{
+    storelock lock(store.mtx);
+    int64_t id = ++store.lastalliance;
+    AllianceSave row;
+    row.set<0>(id);
+    row.set<1>(name);
+    row.set<2>(founder);
+    row.set<3>(leader);
+    store.alliances[id] = row;
+    return id;
+}
+
+void memoryconn::InsertMail(MailRow & row)
+{
+    storelock lock(store.mtx);
+    store.mail.push_back(row);
+}
+
+void memoryconn::ReadMail(int64_t receiverid, int32_t pid, uint64_t readtime)
+{
+    storelock lock(store.mtx);
+    for (MailRow & row : store.mail)
+    {
+        if (row.get<0>() == receiverid && row.get<5>() == pid)
+        {
+            row.set<4>(readtime);
+            return;
+        }
+    }
+}
+
+void memoryconn::ReplaceMail(MailRow & row)
+{
+    storelock lock(store.mtx);
+    store.mail.erase(std::remove_if(store.mail.begin(), store.mail.end(), [&](const MailRow & m)
+    {
+        return m.get<0>() == row.get<0>() && m.get<5>() == row.get<5>() && m.get<3>() == row.get<3>();
+    }), store.mail.end());
+    store.mail.push_back(row);
+}
+
+void memoryconn::ReplaceReport(ReportRow & row)
+{
+    storelock lock(store.mtx);
+    std::vector<ReportRow> & rows = store.reports[row.get<0>()];
+    rows.erase(std::remove_if(rows.begin(), rows.end(), [&](const ReportRow & r) { return r.get<8>() == row.get<8>(); }), rows.end());
+    rows.insert(rows.begin(), row);
+}
+
+void memoryconn::LoadMail(int64_t accountid, std::vector<MailRow> & rows)
+{
+    storelock lock(store.mtx);
+    rows.clear();
+    for (const MailRow & row : store.mail)
+    {
+        if (row.get<0>() == accountid)
+            rows.push_back(row);
+    }
+    std::sort(rows.begin(), rows.end(), [](const MailRow & a, const MailRow & b) { return a.get<5>() < b.get<5>(); });
+}
+
+void memoryconn::LoadReports(int64_t accountid, std::vector<ReportRow> & rows)
+{
+    storelock lock(store.mtx);
+    auto found = store.reports.find(accountid);
+    if (found != store.reports.end())
+        rows = found->second;
+    else
+        rows.clear();
+}
+
+void memoryconn::Login(const std::string & email, const std::string & password, loginrecord & result)
+{
+    storelock lock(store.mtx);
+
+    auto master = std::find_if(store.masters.begin(), store.masters.end(), [&](const memorystorage::master & m) { return m.email == email; });
+    if (master == store.masters.end())
+    {
+        //account does not exist - insert new row
+        int32_t id = int32_t(store.masters.size()) + 1;
+        store.masters.push_back({ id, email, password, 0, "" });
+        master = store.masters.end() - 1;
+    }
+    if (master->password != password)
+        return;
+
+    result.found = true;
+    result.masteraccountid = master->id;
+
+    std::string reason = master->reason;
+    if (master->status == -99)
+        result.banned = true;
+
+    for (auto & it : store.accounts)
+    {
+        if (it.second.get<1>() == master->id)
+        {
+            if (it.second.get<8>() == -99)
+                result.banned = true;
+            result.accountid = it.first;
+            break;
+        }
+    }
+    if (result.banned)
+    {
+        result.banreason = reason;
+        return;
+    }
+
+    if (result.accountid >= 0)
+    {
+        for (auto & it : store.cities)
+        {
+            if (it.second.get<1>() == result.accountid)
+            {
+                result.hascities = true;
+                break;
+            }
+        }
+    }
+}
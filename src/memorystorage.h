@@ -0,0 +1,96 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#pragma once
+
+#include "storage.h"
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// Keeps the rows in process memory. Nothing survives a restart, and the
+/// config tables still come from MySQL, so this replaces the world and
+/// account tables only.
+class memorystorage : public storage
+{
+public:
+    std::unique_ptr<storageconn> Connect() override;
+    void LoadWorld(worldrows & world, uint32_t chunk, bool tiles, uint64_t idlebefore) override;
+
+private:
+    friend class memoryconn;
+
+    // the master account table of dbmaintable
+    struct master
+    {
+        int32_t id;
+        std::string email;
+        std::string password;
+        int32_t status;
+        std::string reason;
+    };
+
+    // recursive so a connection inside Begin can still take it per call
+    std::recursive_mutex mtx;
+    std::vector<master> masters;
+    std::map<int64_t, AccountSave> accounts;
+    std::map<uint64_t, CitySave> cities;
+    std::map<uint64_t, HeroSave> heroes;
+    std::map<int64_t, AllianceSave> alliances;
+    std::vector<ArmySave> armies;
+    std::map<int64_t, std::vector<ReportRow>> reports;
+    std::vector<MailRow> mail;
+    uint64_t marker = 0;
+    int64_t lastaccount = 0;
+    int64_t lastcity = 0;
+    int64_t lastalliance = 0;
+};
+
+/// Begin holds the store's lock until Commit so a batch lands at once.
+/// There is no rollback: rows written before a failure stay written.
+class memoryconn : public storageconn
+{
+public:
+    explicit memoryconn(memorystorage & store);
+    ~memoryconn();
+
+    void Begin() override;
+    void Commit() override;
+
+    void SaveAccounts(std::vector<AccountSave> & rows, uint32_t rowsper) override;
+    void SaveCities(std::vector<CitySave> & rows, uint32_t rowsper) override;
+    void SaveHeroes(std::vector<HeroSave> & rows, uint32_t rowsper) override;
+    void SaveAlliances(std::vector<AllianceSave> & rows, uint32_t rowsper) override;
+    void SaveArmies(std::vector<ArmySave> & rows, uint32_t rowsper) override;
+    void SaveReports(int64_t accountid, std::vector<ReportRow> & rows, uint32_t rowsper) override;
+    void DeleteHero(uint64_t id) override;
+    void DeleteAlliance(int64_t id) override;
+
+    uint64_t ReadSaveMarker() override;
+    void SaveMarker(uint64_t stamp) override;
+
+    bool AccountExists(const std::string & username) override;
+    int64_t CreateAccount(int64_t parentid, const std::string & username, uint64_t time, const std::string & ipaddress,
+        int32_t sex, const std::string & flag, const std::string & faceurl) override;
+    int64_t CreateCity(int64_t accountid, const std::string & misc, int32_t fieldid, const std::string & name,
+        const std::string & buildings, uint64_t time) override;
+    int64_t CreateAlliance(const std::string & name, const std::string & founder, const std::string & leader, int64_t time) override;
+
+    void InsertMail(MailRow & row) override;
+    void ReadMail(int64_t receiverid, int32_t pid, uint64_t readtime) override;
+    void ReplaceMail(MailRow & row) override;
+    void ReplaceReport(ReportRow & row) override;
+    void LoadMail(int64_t accountid, std::vector<MailRow> & rows) override;
+    void LoadReports(int64_t accountid, std::vector<ReportRow> & rows) override;
+
+    void Login(const std::string & email, const std::string & password, loginrecord & result) override;
+
+private:
+    memorystorage & store;
+    bool transaction = false;
+};
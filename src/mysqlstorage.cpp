@@ -0,0 +1,613 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#include "mysqlstorage.h"
+#include "batchwriter.h"
+#include "defines.h"
+#include "spitfire.h"
+#include "Utils.h"
+
+#include <Poco/Data/Session.h>
+#include <Poco/Data/SessionPool.h>
+#include <Poco/Data/Statement.h>
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+
+using namespace Poco::Data;
+using namespace Poco::Data::Keywords;
+
+namespace
+{
+    const char * statementnames[SQL_COUNT] =
+    {
+        "saveaccounts", "savecities", "saveheroes", "savealliances", "deletearmies", "savearmies", "deletereports", "savereports",
+        "deletehero", "deletealliance", "readmarker", "createmarker", "savemarker", "accountexists", "createaccount", "createcity",
+        "createalliance", "lastinsertid", "insertmail", "readmail", "deletemail", "masterexists", "createmaster", "masterlogin",
+        "serveraccount", "citycount", "loadmail", "loadreports", "deletereport", "insertreport"
+    };
+
+    // How long a link may sit unused before it is closed rather than
+    // reused, well inside MySQL's default wait_timeout
+    const uint64_t linkidle = 5 * 60 * 1000;
+
+    // Statements kept on a link, each owning what its placeholders and
+    // results are bound to so it can be executed again as is
+    template<typename Row>
+    struct preparedexec : mysqlprepared
+    {
+        preparedexec(Session & ses, const std::string & sql, std::size_t count)
+            : rows(count)
+            , stmt(ses)
+        {
+            stmt << sql;
+            for (Row & row : rows)
+                stmt.addBind(use(row));
+        }
+        std::vector<Row> rows;
+        Statement stmt;
+    };
+
+    struct preparedplain : mysqlprepared
+    {
+        preparedplain(Session & ses, const std::string & sql)
+            : stmt(ses)
+        {
+            stmt << sql;
+        }
+        Statement stmt;
+    };
+
+    template<typename Params, typename Result>
+    struct preparedquery : mysqlprepared
+    {
+        preparedquery(Session & ses, const std::string & sql)
+            : stmt(ses)
+        {
+            stmt << sql, use(params), into(result);
+        }
+        Params params;
+        std::vector<Result> result;
+        Statement stmt;
+    };
+
+    template<typename Result>
+    struct preparedselect : mysqlprepared
+    {
+        preparedselect(Session & ses, const std::string & sql)
+            : stmt(ses)
+        {
+            stmt << sql, into(result);
+        }
+        std::vector<Result> result;
+        Statement stmt;
+    };
+
+    // Fetches a whole table on its own pooled session, chunk rows per round
+    // trip, converting straight into Row (a Poco::Tuple matching the columns)
+    template<typename Row>
+    std::future<std::vector<Row>> FetchRows(SessionPool & pool, std::string table, std::string query, uint32_t chunk)
+    {
+        return std::async(std::launch::async, [&pool, table, query, chunk]()
+        {
+            uint64_t t1 = Utils::time();
+            std::vector<Row> rows;
+            Session ses(pool.get());
+            Statement select(ses);
+            select << query, into(rows), limit(chunk);
+            while (!select.done())
+                select.execute();
+            spitfire::GetSingleton().log->info("Fetched {} {} in {}ms.", rows.size(), table, Utils::time() - t1);
+            return rows;
+        });
+    }
+}
+
+mysqlstorage::mysqlstorage(SessionPool & accountpool, SessionPool & serverpool, std::string dbmaintable, std::string servername)
+    : accountpool(accountpool)
+    , serverpool(serverpool)
+    , dbmaintable(std::move(dbmaintable))
+    , server(servername.substr(0, 10))
+{
+}
+
+mysqlstorage::~mysqlstorage()
+{
+}
+
+std::unique_ptr<storageconn> mysqlstorage::Connect()
+{
+    return std::make_unique<mysqlconn>(*this);
+}
+
+void mysqlstorage::LogStats()
+{
+    std::lock_guard<std::mutex> lock(statsmtx);
+    spitfire & server = spitfire::GetSingleton();
+    for (uint32_t id = 0; id < SQL_COUNT; ++id)
+    {
+        const statementstats & st = stats[id];
+        if (st.executions == 0)
+            continue;
+        server.log->info("sql {}: {} runs, {:.1f}% reused, avg {}us, max {}us, {} failed.", statementnames[id], st.executions,
+            100.0 * double(st.executions - st.prepares) / double(st.executions), st.totalus / st.executions, st.maxus, st.failures);
+    }
+}
+
+std::unique_ptr<mysqllink> mysqlstorage::Checkout()
+{
+    std::vector<std::unique_ptr<mysqllink>> stale;
+    std::unique_ptr<mysqllink> link;
+    {
+        std::lock_guard<std::mutex> lock(linkmtx);
+        uint64_t now = Utils::time();
+        while (!idle.empty())
+        {
+            std::unique_ptr<mysqllink> l = std::move(idle.back());
+            idle.pop_back();
+            if (now - l->lastused < linkidle)
+            {
+                link = std::move(l);
+                break;
+            }
+            stale.push_back(std::move(l));
+        }
+    }
+    // closed outside the lock
+    stale.clear();
+    if (!link)
+        link = std::make_unique<mysqllink>();
+    return link;
+}
+
+void mysqlstorage::Checkin(std::unique_ptr<mysqllink> link)
+{
+    if (link->broken)
+        return;
+    link->lastused = Utils::time();
+    std::lock_guard<std::mutex> lock(linkmtx);
+    idle.push_back(std::move(link));
+}
+
+void mysqlstorage::Record(uint32_t id, bool prepared, bool failed, uint64_t us)
+{
+    std::lock_guard<std::mutex> lock(statsmtx);
+    statementstats & st = stats[id];
+    ++st.executions;
+    if (prepared)
+        ++st.prepares;
+    if (failed)
+        ++st.failures;
+    st.totalus += us;
+    st.maxus = std::max(st.maxus, us);
+}
+
+void mysqlstorage::LoadWorld(worldrows & world, uint32_t chunk, bool tiles, uint64_t idlebefore)
+{
+    // Every table is fetched and row-converted on its own session at the
+    // same time; the caller links them into the world in dependency order
+    std::future<std::vector<TileRow>> tilefetch;
+    if (tiles)
+        tilefetch = FetchRows<TileRow>(serverpool, "tiles", "SELECT `id`,`ownerid`,`type`,`level` FROM `tiles` ORDER BY `id` ASC;", chunk);
+    //SQLITE//Statement stmt = (ses2 << "SELECT accounts.*,account.email,account.password FROM accounts LEFT JOIN account ON (account.id=accounts.parentid) ORDER BY accounts.accountid ASC;");
+    std::string account = dbmaintable + ".account";
+    auto accountfetch = FetchRows<AccountRow>(serverpool, "accounts", "SELECT accounts.accountid,accounts.parentid,accounts.username," + account + ".password," + account + ".email,"
+        "accounts.allianceid,accounts.alliancerank,accounts.lastlogin,accounts.creation,accounts.status,accounts.sex,accounts.flag,accounts.faceurl,"
+        "accounts.cents,accounts.prestige,accounts.honor,accounts.buffs,accounts.research,accounts.items,accounts.misc "
+        "FROM accounts LEFT JOIN " + account + " ON (" + account + ".id=accounts.parentid) ORDER BY accounts.accountid ASC;", chunk);
+    // histories of idle accounts stay in the store, only their next mail pid is read
+    std::string idle = std::to_string(idlebefore);
+    auto evictedfetch = FetchRows<EvictedRow>(serverpool, "evicted accounts", "SELECT accounts.accountid,IFNULL(MAX(mail.pid),0)+1 FROM accounts "
+        "LEFT JOIN mail ON (mail.receiverid=accounts.accountid) WHERE accounts.lastlogin<" + idle + " GROUP BY accounts.accountid;", chunk);
+    auto mailfetch = FetchRows<MailRow>(serverpool, "mail", "SELECT mail.receiverid,mail.title,mail.content,mail.senttime,mail.readtime,mail.pid,mail.senderid,mail.type "
+        "FROM mail JOIN accounts ON (accounts.accountid=mail.receiverid) WHERE accounts.lastlogin>=" + idle + " ORDER BY mail.receiverid,mail.pid;", chunk);
+    auto cityfetch = FetchRows<CityRow>(serverpool, "cities", "SELECT `accountid`,`id`,`fieldid`,`food`,`wood`,`iron`,`stone`,`gold`,`name`,`logurl`,`creation`,"
+        "`troop`,`buildings`,`troopqueues`,`fortification`,`misc` FROM `cities`;", chunk);
+    auto herofetch = FetchRows<HeroRow>(serverpool, "heroes", "SELECT `id`,`castleid`,`status`,`itemid`,`itemamount`,"
+        "`basestratagem`,`stratagem`,`stratagemadded`,`stratagembuffadded`,`basepower`,`power`,`poweradded`,`powerbuffadded`,"
+        "`basemanagement`,`management`,`managementadded`,`managementbuffadded`,`logurl`,`name`,`remainpoint`,`level`,"
+        "`upgradeexp`,`experience`,`loyalty` FROM `heroes` ORDER BY `castleid`,`id`;", chunk);
+    auto alliancefetch = FetchRows<AllianceRow>(serverpool, "alliances", "SELECT `id`,`name`,`founder`,`members`,`enemies`,`allies`,`neutrals`,`note` FROM `alliances`;", chunk);
+    auto armyfetch = FetchRows<ArmyRow>(serverpool, "armies", "SELECT `clientid`,`cityid`,`heroid`,`targetfieldid`,`direction`,`resource`,`troops`,"
+        "`starttime`,`reachtime`,`resttime`,`missiontype`,`startfieldid` FROM `armies`;", chunk);
+    auto reportfetch = FetchRows<ReportRow>(serverpool, "reports", "SELECT reports.accountid,reports.armytype,reports.back,reports.attack,reports.typeid,"
+        "reports.startpos,reports.targetpos,reports.title,reports.guid,reports.eventtime,reports.isread FROM reports "
+        "JOIN accounts ON (accounts.accountid=reports.accountid) WHERE accounts.lastlogin>=" + idle + ";", chunk);
+
+    if (tiles)
+        world.tiles = tilefetch.get();
+    world.accounts = accountfetch.get();
+    world.mail = mailfetch.get();
+    world.cities = cityfetch.get();
+    world.heroes = herofetch.get();
+    world.alliances = alliancefetch.get();
+    world.armies = armyfetch.get();
+    world.reports = reportfetch.get();
+    world.evicted = evictedfetch.get();
+}
+
+mysqllink::~mysqllink()
+{
+    // statements before the sessions they were prepared on
+    statements.clear();
+}
+
+mysqlconn::mysqlconn(mysqlstorage & store)
+    : store(store)
+    , link(store.Checkout())
+{
+}
+
+mysqlconn::~mysqlconn()
+{
+    store.Checkin(std::move(link));
+}
+
+Session & mysqlconn::Account()
+{
+    if (!link->account)
+        link->account = std::make_unique<Session>(store.accountpool.get());
+    return *link->account;
+}
+
+Session & mysqlconn::Server()
+{
+    if (!link->server)
+        link->server = std::make_unique<Session>(store.serverpool.get());
+    return *link->server;
+}
+
+template<typename T, typename F>
+T & mysqlconn::Prepared(uint32_t id, std::size_t rows, bool & prepared, F create)
+{
+    uint64_t key = (uint64_t(id) << 32) | rows;
+    auto it = link->statements.find(key);
+    prepared = (it == link->statements.end());
+    if (prepared)
+        it = link->statements.emplace(key, create()).first;
+    return static_cast<T &>(*it->second);
+}
+
+std::size_t mysqlconn::Run(uint32_t id, Statement & stmt, bool prepared)
+{
+    auto t1 = std::chrono::steady_clock::now();
+    auto elapsed = [&]() { return uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t1).count()); };
+    try
+    {
+        std::size_t rows = stmt.execute();
+        store.Record(id, prepared, false, elapsed());
+        return rows;
+    }
+    catch (...)
+    {
+        // the connection may have been reset under its prepared statements
+        link->broken = true;
+        store.Record(id, prepared, true, elapsed());
+        throw;
+    }
+}
+
+template<typename Row>
+void mysqlconn::Exec(uint32_t id, bool account, const std::string & sql, const Row & row)
+{
+    Session & ses = account ? Account() : Server();
+    bool prepared;
+    auto & p = Prepared<preparedexec<Row>>(id, 1, prepared, [&]() { return std::make_unique<preparedexec<Row>>(ses, sql, 1); });
+    p.rows[0] = row;
+    Run(id, p.stmt, prepared);
+}
+
+void mysqlconn::Exec(uint32_t id, bool account, const std::string & sql)
+{
+    Session & ses = account ? Account() : Server();
+    bool prepared;
+    auto & p = Prepared<preparedplain>(id, 0, prepared, [&]() { return std::make_unique<preparedplain>(ses, sql); });
+    Run(id, p.stmt, prepared);
+}
+
+template<typename Result, typename Params>
+std::vector<Result> & mysqlconn::Query(uint32_t id, bool account, const std::string & sql, const Params & params)
+{
+    Session & ses = account ? Account() : Server();
+    bool prepared;
+    auto & p = Prepared<preparedquery<Params, Result>>(id, 1, prepared, [&]() { return std::make_unique<preparedquery<Params, Result>>(ses, sql); });
+    p.params = params;
+    // extraction appends
+    p.result.clear();
+    Run(id, p.stmt, prepared);
+    return p.result;
+}
+
+template<typename Result>
+std::vector<Result> & mysqlconn::Query(uint32_t id, bool account, const std::string & sql)
+{
+    Session & ses = account ? Account() : Server();
+    bool prepared;
+    auto & p = Prepared<preparedselect<Result>>(id, 0, prepared, [&]() { return std::make_unique<preparedselect<Result>>(ses, sql); });
+    p.result.clear();
+    Run(id, p.stmt, prepared);
+    return p.result;
+}
+
+template<typename Row>
+void mysqlconn::Batch(uint32_t id, const batchwriter & writer, std::vector<Row> & rows, uint32_t rowsper)
+{
+    std::size_t per = std::max<std::size_t>(rowsper, 1);
+    for (std::size_t first = 0; first < rows.size(); first += per)
+    {
+        std::size_t count = std::min(rows.size() - first, per);
+        // Full chunks and single rows come back every save; the odd tail
+        // sizes would mostly fill the cache, so they run once and go
+        if (count == per || count == 1)
+        {
+            bool prepared;
+            auto & p = Prepared<preparedexec<Row>>(id, count, prepared, [&]() { return std::make_unique<preparedexec<Row>>(Server(), writer.Sql(count), count); });
+            std::copy(rows.begin() + first, rows.begin() + first + count, p.rows.begin());
+            Run(id, p.stmt, prepared);
+        }
+        else
+        {
+            preparedexec<Row> once(Server(), writer.Sql(count), count);
+            std::copy(rows.begin() + first, rows.begin() + first + count, once.rows.begin());
+            Run(id, once.stmt, true);
+        }
+    }
+}
+
+int64_t mysqlconn::LastInsertId()
+{
+    std::vector<int64_t> & id = Query<int64_t>(SQL_LASTINSERTID, false, "SELECT " + LAST_INSERT_ID + ";");
+    return id.empty() ? 0 : id.front();
+}
+
+void mysqlconn::Begin()
+{
+    try
+    {
+        Server().begin();
+    }
+    catch (...)
+    {
+        link->broken = true;
+        throw;
+    }
+}
+
+void mysqlconn::Commit()
+{
+    try
+    {
+        Server().commit();
+    }
+    catch (...)
+    {
+        link->broken = true;
+        throw;
+    }
+}
+
+void mysqlconn::SaveAccounts(std::vector<AccountSave> & rows, uint32_t rowsper)
+{
+    static const batchwriter writer("INSERT INTO `accounts` (accountid,parentid,username,creation,reason,buffs,`research`,items,misc,`status`,ipaddress,sex,flag,faceurl,"
+        "allianceid,alliancerank,cents,prestige,honor,lastlogin,changedface,icon,allianceapply,allianceapplytime,castlesign) VALUES",
+        "(?,?,?,?,'',?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?)",
+        " ON DUPLICATE KEY UPDATE buffs=VALUES(buffs),`research`=VALUES(`research`),items=VALUES(items),misc=VALUES(misc),`status`=VALUES(`status`),"
+        "ipaddress=VALUES(ipaddress),sex=VALUES(sex),flag=VALUES(flag),faceurl=VALUES(faceurl),allianceid=VALUES(allianceid),alliancerank=VALUES(alliancerank),"
+        "cents=VALUES(cents),prestige=VALUES(prestige),honor=VALUES(honor),lastlogin=VALUES(lastlogin),changedface=VALUES(changedface),icon=VALUES(icon),"
+        "allianceapply=VALUES(allianceapply),allianceapplytime=VALUES(allianceapplytime),castlesign=VALUES(castlesign)");
+    Batch(SQL_SAVEACCOUNTS, writer, rows, rowsper);
+}
+
+void mysqlconn::SaveCities(std::vector<CitySave> & rows, uint32_t rowsper)
+{
+    static const batchwriter writer("INSERT INTO `cities` (id,accountid,creation,misc,status,allowalliance,logurl,fieldid,transingtrades,troop,troopqueues,name,buildings,"
+        "fortification,trades,gooutforbattle,hasenemy,gold,food,wood,iron,stone) VALUES",
+        "(?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?)",
+        " ON DUPLICATE KEY UPDATE misc=VALUES(misc),status=VALUES(status),allowalliance=VALUES(allowalliance),logurl=VALUES(logurl),fieldid=VALUES(fieldid),"
+        "transingtrades=VALUES(transingtrades),troop=VALUES(troop),troopqueues=VALUES(troopqueues),name=VALUES(name),buildings=VALUES(buildings),"
+        "fortification=VALUES(fortification),trades=VALUES(trades),gooutforbattle=VALUES(gooutforbattle),hasenemy=VALUES(hasenemy),"
+        "gold=VALUES(gold),food=VALUES(food),wood=VALUES(wood),iron=VALUES(iron),stone=VALUES(stone)");
+    Batch(SQL_SAVECITIES, writer, rows, rowsper);
+}
+
+void mysqlconn::SaveHeroes(std::vector<HeroSave> & rows, uint32_t rowsper)
+{
+    static const batchwriter writer("INSERT INTO `heroes` (id,basemanagement,basepower,basestratagem,power,poweradded,powerbuffadded,"
+        "stratagem,stratagemadded,stratagembuffadded,management,managementadded,managementbuffadded,"
+        "experience,upgradeexp,itemamount,itemid,level,logurl,loyalty,troop,name,castleid,ownerid,status,remainpoint) VALUES",
+        "(?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?)",
+        " ON DUPLICATE KEY UPDATE basemanagement=VALUES(basemanagement),basepower=VALUES(basepower),basestratagem=VALUES(basestratagem),"
+        "power=VALUES(power),poweradded=VALUES(poweradded),powerbuffadded=VALUES(powerbuffadded),stratagem=VALUES(stratagem),"
+        "stratagemadded=VALUES(stratagemadded),stratagembuffadded=VALUES(stratagembuffadded),management=VALUES(management),"
+        "managementadded=VALUES(managementadded),managementbuffadded=VALUES(managementbuffadded),experience=VALUES(experience),"
+        "upgradeexp=VALUES(upgradeexp),itemamount=VALUES(itemamount),itemid=VALUES(itemid),level=VALUES(level),logurl=VALUES(logurl),"
+        "loyalty=VALUES(loyalty),troop=VALUES(troop),name=VALUES(name),castleid=VALUES(castleid),ownerid=VALUES(ownerid),"
+        "status=VALUES(status),remainpoint=VALUES(remainpoint)");
+    Batch(SQL_SAVEHEROES, writer, rows, rowsper);
+}
+
+void mysqlconn::SaveAlliances(std::vector<AllianceSave> & rows, uint32_t rowsper)
+{
+    static const batchwriter writer("INSERT INTO `alliances` (id,name,founder,leader,created,note,intro,motd,allies,neutrals,enemies,members) VALUES",
+        "(?,?,?,?,0,?,?,?,?,?,?,?)",
+        " ON DUPLICATE KEY UPDATE name=VALUES(name),founder=VALUES(founder),leader=VALUES(leader),note=VALUES(note),intro=VALUES(intro),"
+        "motd=VALUES(motd),allies=VALUES(allies),neutrals=VALUES(neutrals),enemies=VALUES(enemies),members=VALUES(members)");
+    Batch(SQL_SAVEALLIANCES, writer, rows, rowsper);
+}
+
+void mysqlconn::SaveArmies(std::vector<ArmySave> & rows, uint32_t rowsper)
+{
+    static const batchwriter writer("INSERT INTO `armies` (`heroid`, `direction`, `resource`, `troops`, `starttime`, `reachtime`, `resttime`, `missiontype`, `startfieldid`, `targetfieldid`, `cityid`, `clientid`) VALUES",
+        "(?,?,?,?,?,?,?,?,?,?,?,?)");
+    // DELETE rather than TRUNCATE so the rewrite stays inside the batch transaction
+    Exec(SQL_DELETEARMIES, false, "DELETE FROM `armies`;");
+    Batch(SQL_SAVEARMIES, writer, rows, rowsper);
+}
+
+void mysqlconn::SaveReports(int64_t accountid, std::vector<ReportRow> & rows, uint32_t rowsper)
+{
+    static const batchwriter writer("INSERT INTO `reports` (`accountid`, `armytype`, `back`, `attack`, `typeid`, `startpos`, `targetpos`, `title`, `guid`, `eventtime`, `isread`) VALUES",
+        "(?,?,?,?,?,?,?,?,?,?,?)");
+    Exec(SQL_DELETEREPORTS, false, "DELETE FROM `reports` WHERE `accountid`=?;", Poco::Tuple<int64_t>(accountid));
+    Batch(SQL_SAVEREPORTS, writer, rows, rowsper);
+}
+
+void mysqlconn::DeleteHero(uint64_t id)
+{
+    Exec(SQL_DELETEHERO, false, "DELETE FROM `heroes` WHERE id=?;", Poco::Tuple<uint64_t>(id));
+}
+
+void mysqlconn::DeleteAlliance(int64_t id)
+{
+    Exec(SQL_DELETEALLIANCE, false, "DELETE FROM `alliances` WHERE id=?;", Poco::Tuple<int64_t>(id));
+}
+
+uint64_t mysqlconn::ReadSaveMarker()
+{
+    Poco::Tuple<std::string> server(store.server);
+    std::vector<std::string> & values = Query<std::string>(SQL_READMARKER, true, "SELECT `options` FROM `settings` WHERE `server`=? AND `setting`='savemarker';", server);
+    if (values.empty())
+    {
+        Exec(SQL_CREATEMARKER, true, "INSERT INTO `settings` (`server`, `setting`, `options`, `desription`) VALUES (?, 'savemarker', '0', 'Last committed world save');", server);
+        return 0;
+    }
+    return std::stoull(values.front());
+}
+
+void mysqlconn::SaveMarker(uint64_t stamp)
+{
+    Exec(SQL_SAVEMARKER, false, "UPDATE " + store.dbmaintable + ".settings SET `options`=? WHERE `server`=? AND `setting`='savemarker';",
+        Poco::Tuple<std::string, std::string>(std::to_string(stamp), store.server));
+}
+
+bool mysqlconn::AccountExists(const std::string & username)
+{
+    std::vector<int64_t> & count = Query<int64_t>(SQL_ACCOUNTEXISTS, false, "SELECT COUNT(*) FROM `accounts` WHERE `username`=?;", Poco::Tuple<std::string>(username));
+    return !count.empty() && count.front() > 0;
+}
+
+int64_t mysqlconn::CreateAccount(int64_t parentid, const std::string & username, uint64_t time, const std::string & ipaddress,
+    int32_t sex, const std::string & flag, const std::string & faceurl)
+{
+    //parentid, username, lastlogin, creation, ipaddress, status, reason, sex, flag, faceurl
+    using AccountInsert = Poco::Tuple<int64_t, std::string, uint64_t, uint64_t, std::string, int32_t, std::string, int32_t, std::string, std::string>;
+    Exec(SQL_CREATEACCOUNT, false, "INSERT INTO `accounts` (`parentid`, `username`, `lastlogin`, `creation`, `ipaddress`, `status`, `reason`, `sex`, `flag`, `faceurl`, `buffs`, `research`, `items`, `misc`) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, '', '', '', '');",
+        AccountInsert(parentid, username, time, time, ipaddress, 0, "", sex, flag, faceurl));
+    return LastInsertId();
+}
+
+int64_t mysqlconn::CreateCity(int64_t accountid, const std::string & misc, int32_t fieldid, const std::string & name,
+    const std::string & buildings, uint64_t time)
+{
+    //accountid, misc, fieldid, name, buildings, creation
+    using CityInsert = Poco::Tuple<int64_t, std::string, int32_t, std::string, std::string, uint64_t>;
+    Exec(SQL_CREATECITY, false, "INSERT INTO `cities` (`accountid`,`misc`,`fieldid`,`name`,`buildings`,`gold`,`food`,`wood`,`iron`,`stone`,`creation`,`transingtrades`,`troop`,`fortification`,`trades`,`troopqueues`) VALUES (?, ?, ?, ?, ?,100000,100000,100000,100000,100000,?,'','','','','');",
+        CityInsert(accountid, misc, fieldid, name, buildings, time));
+    return LastInsertId();
+}
+
+int64_t mysqlconn::CreateAlliance(const std::string & name, const std::string & founder, const std::string & leader, int64_t time)
+{
+    //name, founder, leader, created
+    using AllianceInsert = Poco::Tuple<std::string, std::string, std::string, int64_t>;
+    Exec(SQL_CREATEALLIANCE, false, "INSERT INTO `alliances` (name,founder,leader,created,note,intro,motd,allies,neutrals,enemies,members) VALUES (?,?,?,?,'','','','','','','');",
+        AllianceInsert(name, founder, leader, time));
+    return LastInsertId();
+}
+
+void mysqlconn::InsertMail(MailRow & row)
+{
+    Exec(SQL_INSERTMAIL, false, "INSERT INTO `mail` (`receiverid`,`title`,`content`,`senttime`,`readtime`,`pid`,`senderid`,`type`) VALUES (?,?,?,?,?,?,?,?);", row);
+}
+
+void mysqlconn::ReadMail(int64_t receiverid, int32_t pid, uint64_t readtime)
+{
+    Exec(SQL_READMAIL, false, "UPDATE `mail` SET `readtime`=? WHERE `pid`=? AND `receiverid`=? LIMIT 1;",
+        Poco::Tuple<uint64_t, int32_t, int64_t>(readtime, pid, receiverid));
+}
+
+void mysqlconn::ReplaceMail(MailRow & row)
+{
+    Exec(SQL_DELETEMAIL, false, "DELETE FROM `mail` WHERE `receiverid`=? AND `pid`=? AND `senttime`=?;",
+        Poco::Tuple<int64_t, int32_t, uint64_t>(row.get<0>(), row.get<5>(), row.get<3>()));
+    InsertMail(row);
+}
+
+void mysqlconn::ReplaceReport(ReportRow & row)
+{
+    Exec(SQL_DELETEREPORT, false, "DELETE FROM `reports` WHERE `accountid`=? AND `guid`=?;",
+        Poco::Tuple<int64_t, std::string>(row.get<0>(), row.get<8>()));
+    Exec(SQL_INSERTREPORT, false, "INSERT INTO `reports` (`accountid`, `armytype`, `back`, `attack`, `typeid`, `startpos`, `targetpos`, `title`, `guid`, `eventtime`, `isread`) VALUES (?,?,?,?,?,?,?,?,?,?,?);", row);
+}
+
+void mysqlconn::LoadMail(int64_t accountid, std::vector<MailRow> & rows)
+{
+    rows = Query<MailRow>(SQL_LOADMAIL, false, "SELECT `receiverid`,`title`,`content`,`senttime`,`readtime`,`pid`,`senderid`,`type` FROM `mail` WHERE `receiverid`=? ORDER BY `pid`;",
+        Poco::Tuple<int64_t>(accountid));
+}
+
+void mysqlconn::LoadReports(int64_t accountid, std::vector<ReportRow> & rows)
+{
+    rows = Query<ReportRow>(SQL_LOADREPORTS, false, "SELECT `accountid`,`armytype`,`back`,`attack`,`typeid`,`startpos`,`targetpos`,"
+        "`title`,`guid`,`eventtime`,`isread` FROM `reports` WHERE `accountid`=? ORDER BY `eventtime` DESC;", Poco::Tuple<int64_t>(accountid));
+}
+
+void mysqlconn::Login(const std::string & email, const std::string & password, loginrecord & result)
+{
+    //id, status, reason
+    using MasterAccount = Poco::Tuple<int32_t, int32_t, std::string>;
+    //accountid, status, reason
+    using ServerAccount = Poco::Tuple<int64_t, int32_t, std::string>;
+
+    Poco::Tuple<std::string> user(email);
+    std::vector<int64_t> & exists = Query<int64_t>(SQL_MASTEREXISTS, true, "SELECT COUNT(*) FROM `account` WHERE `email`=?;", user);
+    if (exists.empty() || exists.front() == 0)
+    {
+        //account does not exist - insert new row
+        uint64_t ttime = Utils::time();
+        Exec(SQL_CREATEMASTER, true, "INSERT INTO `account` (`name`, `email`, `ip`, `lastlogin`, `creation`, `password`, `status`, `reason`) VALUES ('null', ?, '', ?, ?, ?, 0, '');",
+            Poco::Tuple<std::string, uint64_t, uint64_t, std::string>(email, ttime, ttime, password));
+    }
+
+    std::vector<MasterAccount> & masters = Query<MasterAccount>(SQL_MASTERLOGIN, true, "SELECT `id`,`status`,`reason` FROM `account` WHERE `email`=? AND `password`=?;",
+        Poco::Tuple<std::string, std::string>(email, password));
+    if (masters.empty())
+        return;
+
+    const MasterAccount & master = masters.front();
+    result.found = true;
+    result.masteraccountid = master.get<0>();
+
+    //are they banned? if so, globally or for this server?
+    std::string reason = master.get<2>();
+    if (master.get<1>() == -99)
+        result.banned = true;
+
+    std::vector<ServerAccount> & accounts = Query<ServerAccount>(SQL_SERVERACCOUNT, false, "SELECT `accountid`,`status`,`reason` FROM `accounts` WHERE `parentid`=?;",
+        Poco::Tuple<int64_t>(result.masteraccountid));
+    if (!accounts.empty())
+    {
+        const ServerAccount & account = accounts.front();
+        if (account.get<1>() == -99)
+            result.banned = true;
+        if (reason.length() == 0)
+            reason = account.get<2>();
+        result.accountid = account.get<0>();
+    }
+    if (result.banned)
+    {
+        result.banreason = reason;
+        return;
+    }
+
+    if (result.accountid >= 0)
+    {
+        //has an account, what about cities?
+        std::vector<int64_t> & cities = Query<int64_t>(SQL_CITYCOUNT, false, "SELECT COUNT(*) FROM `cities` WHERE `accountid`=?;", Poco::Tuple<int64_t>(result.accountid));
+        result.hascities = !cities.empty() && cities.front() > 0;
+    }
+}
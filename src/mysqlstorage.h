@@ -0,0 +1,189 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#pragma once
+
+#include "storage.h"
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Poco { namespace Data { class Session; class SessionPool; class Statement; } }
+
+class batchwriter;
+
+// Statements the MySQL backend prepares once per link and runs again with
+// new values. Names for the stats are in mysqlstorage.cpp.
+enum mysqlstatement : uint32_t
+{
+    SQL_SAVEACCOUNTS,
+    SQL_SAVECITIES,
+    SQL_SAVEHEROES,
+    SQL_SAVEALLIANCES,
+    SQL_DELETEARMIES,
+    SQL_SAVEARMIES,
+    SQL_DELETEREPORTS,
+    SQL_SAVEREPORTS,
+    SQL_DELETEHERO,
+    SQL_DELETEALLIANCE,
+    SQL_READMARKER,
+    SQL_CREATEMARKER,
+    SQL_SAVEMARKER,
+    SQL_ACCOUNTEXISTS,
+    SQL_CREATEACCOUNT,
+    SQL_CREATECITY,
+    SQL_CREATEALLIANCE,
+    SQL_LASTINSERTID,
+    SQL_INSERTMAIL,
+    SQL_READMAIL,
+    SQL_DELETEMAIL,
+    SQL_MASTEREXISTS,
+    SQL_CREATEMASTER,
+    SQL_MASTERLOGIN,
+    SQL_SERVERACCOUNT,
+    SQL_CITYCOUNT,
+    SQL_LOADMAIL,
+    SQL_LOADREPORTS,
+    SQL_DELETEREPORT,
+    SQL_INSERTREPORT,
+    SQL_COUNT
+};
+
+/// A statement with the values its placeholders are bound to
+struct mysqlprepared
+{
+    virtual ~mysqlprepared() {}
+};
+
+/// A session from each pool and the statements prepared on them. Poco
+/// prepares a statement on its first execution and only binds and executes
+/// it after that, so a statement kept here is parsed by the server once.
+/// Prepared statements die with the connection they were prepared on: a
+/// link that saw an error may have reconnected, so it is dropped whole.
+struct mysqllink
+{
+    ~mysqllink();
+
+    std::unique_ptr<Poco::Data::Session> account;
+    std::unique_ptr<Poco::Data::Session> server;
+    // keyed by statement id and row count
+    std::unordered_map<uint64_t, std::unique_ptr<mysqlprepared>> statements;
+    uint64_t lastused = 0;
+    bool broken = false;
+};
+
+/// The MySQL schema: master accounts and settings in dbmaintable, the
+/// world in dbservertable, each behind its own pool
+class mysqlstorage : public storage
+{
+public:
+    mysqlstorage(Poco::Data::SessionPool & accountpool, Poco::Data::SessionPool & serverpool, std::string dbmaintable, std::string servername);
+    ~mysqlstorage();
+
+    std::unique_ptr<storageconn> Connect() override;
+    void LoadWorld(worldrows & world, uint32_t chunk, bool tiles, uint64_t idlebefore) override;
+    void LogStats() override;
+
+private:
+    friend class mysqlconn;
+
+    struct statementstats
+    {
+        uint64_t executions = 0;
+        // executions that had to prepare first
+        uint64_t prepares = 0;
+        uint64_t failures = 0;
+        uint64_t totalus = 0;
+        uint64_t maxus = 0;
+    };
+
+    std::unique_ptr<mysqllink> Checkout();
+    void Checkin(std::unique_ptr<mysqllink> link);
+    void Record(uint32_t id, bool prepared, bool failed, uint64_t us);
+
+    Poco::Data::SessionPool & accountpool;
+    Poco::Data::SessionPool & serverpool;
+    std::string dbmaintable;
+    // servername as it fits the settings table
+    std::string server;
+
+    std::mutex linkmtx;
+    std::vector<std::unique_ptr<mysqllink>> idle;
+
+    std::mutex statsmtx;
+    std::array<statementstats, SQL_COUNT> stats;
+};
+
+/// Borrows a link from the storage and returns it when destroyed.
+/// Transactions are on the server session.
+class mysqlconn : public storageconn
+{
+public:
+    explicit mysqlconn(mysqlstorage & store);
+    ~mysqlconn();
+
+    void Begin() override;
+    void Commit() override;
+
+    void SaveAccounts(std::vector<AccountSave> & rows, uint32_t rowsper) override;
+    void SaveCities(std::vector<CitySave> & rows, uint32_t rowsper) override;
+    void SaveHeroes(std::vector<HeroSave> & rows, uint32_t rowsper) override;
+    void SaveAlliances(std::vector<AllianceSave> & rows, uint32_t rowsper) override;
+    void SaveArmies(std::vector<ArmySave> & rows, uint32_t rowsper) override;
+    void SaveReports(int64_t accountid, std::vector<ReportRow> & rows, uint32_t rowsper) override;
+    void DeleteHero(uint64_t id) override;
+    void DeleteAlliance(int64_t id) override;
+
+    uint64_t ReadSaveMarker() override;
+    void SaveMarker(uint64_t stamp) override;
+
+    bool AccountExists(const std::string & username) override;
+    int64_t CreateAccount(int64_t parentid, const std::string & username, uint64_t time, const std::string & ipaddress,
+        int32_t sex, const std::string & flag, const std::string & faceurl) override;
+    int64_t CreateCity(int64_t accountid, const std::string & misc, int32_t fieldid, const std::string & name,
+        const std::string & buildings, uint64_t time) override;
+    int64_t CreateAlliance(const std::string & name, const std::string & founder, const std::string & leader, int64_t time) override;
+
+    void InsertMail(MailRow & row) override;
+    void ReadMail(int64_t receiverid, int32_t pid, uint64_t readtime) override;
+    void ReplaceMail(MailRow & row) override;
+    void ReplaceReport(ReportRow & row) override;
+    void LoadMail(int64_t accountid, std::vector<MailRow> & rows) override;
+    void LoadReports(int64_t accountid, std::vector<ReportRow> & rows) override;
+
+    void Login(const std::string & email, const std::string & password, loginrecord & result) override;
+
+private:
+    Poco::Data::Session & Account();
+    Poco::Data::Session & Server();
+
+    // The cached statement for id and rows, made by create on a miss
+    template<typename T, typename F>
+    T & Prepared(uint32_t id, std::size_t rows, bool & prepared, F create);
+    // Executes a statement of id, timing it into the stats
+    std::size_t Run(uint32_t id, Poco::Data::Statement & stmt, bool prepared);
+    // Runs a statement binding row, or nothing
+    template<typename Row>
+    void Exec(uint32_t id, bool account, const std::string & sql, const Row & row);
+    void Exec(uint32_t id, bool account, const std::string & sql);
+    // Runs a query binding params, or nothing, and returns its rows
+    template<typename Result, typename Params>
+    std::vector<Result> & Query(uint32_t id, bool account, const std::string & sql, const Params & params);
+    template<typename Result>
+    std::vector<Result> & Query(uint32_t id, bool account, const std::string & sql);
+    // Writes rows rowsper per statement
+    template<typename Row>
+    void Batch(uint32_t id, const batchwriter & writer, std::vector<Row> & rows, uint32_t rowsper);
+    int64_t LastInsertId();
+
+    mysqlstorage & store;
+    std::unique_ptr<mysqllink> link;
+};
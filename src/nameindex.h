@@ -0,0 +1,187 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+/// Case-insensitive substring index over item names. Every lowercased name
+/// is broken into trigrams, and a search only verifies the items on the
+/// shortest posting list of the key's trigrams. Keys under three characters
+/// fall back to checking every name. The index does not own its items.
+template<typename T>
+class nameindex
+{
+public:
+    /// Indexes item under name, replacing its previous name; no-op if the
+    /// name is unchanged
+    void Set(T item, const std::string & name)
+    {
+        std::string lower = Lower(name);
+        auto it = names.find(item);
+        if (it != names.end())
+        {
+            if (it->second == lower)
+                return;
+            Unlink(item, it->second);
+            it->second = std::move(lower);
+            Link(item, it->second);
+            return;
+        }
+        Link(item, names.emplace(item, std::move(lower)).first->second);
+    }
+
+    void Remove(T item)
+    {
+        auto it = names.find(item);
+        if (it == names.end())
+            return;
+        Unlink(item, it->second);
+        names.erase(it);
+    }
+
+    size_t Size() const { return names.size(); }
+
+    /// Calls f(item) for every item whose name contains key
+    template<typename F>
+    void Find(const std::string & key, F f) const
+    {
+        std::string lower = Lower(key);
+        if (lower.size() < 3)
+        {
+            for (auto & entry : names)
+            {
+                if (entry.second.find(lower) != std::string::npos)
+                    f(entry.first);
+            }
+            return;
+        }
+
+        const std::unordered_set<T> * shortest = nullptr;
+        for (size_t i = 0; i + 3 <= lower.size(); ++i)
+        {
+            auto it = grams.find(Gram(lower, i));
+            if (it == grams.end())
+                return;
+            if (!shortest || it->second.size() < shortest->size())
+                shortest = &it->second;
+        }
+        for (T item : *shortest)
+        {
+            if (names.at(item).find(lower) != std::string::npos)
+                f(item);
+        }
+    }
+
+    /// Collects the page [first, first + count) of the items matching key,
+    /// ordered by their position in ranking, as (item, rank) pairs. Returns
+    /// the total number of ranked matches, which are only counted. Where
+    /// matches are dense the ranking is walked in order until the page is
+    /// full; where they are sparse only the first + count best ranked
+    /// matches are kept.
+    template<typename Ranking>
+    size_t Page(const Ranking & ranking, const std::string & key, size_t first, size_t count, std::vector<std::pair<T, int32_t>> & page) const
+    {
+        page.clear();
+        size_t total = 0;
+        Find(key, [&](T item)
+        {
+            if (ranking.Contains(item))
+                ++total;
+        });
+        if (first >= total || count == 0)
+            return total;
+        size_t need = std::min(total, first + count);
+
+        // the walk passes about need * Size() / total items to fill the page
+        if (uint64_t(need) * ranking.Size() <= uint64_t(total) * total)
+        {
+            std::string lower = Lower(key);
+            size_t seen = 0;
+            const size_t chunk = 256;
+            for (size_t pos = 0; seen < need && pos < ranking.Size(); pos += chunk)
+            {
+                ranking.ForRange(pos, chunk, [&](T item, int32_t rank)
+                {
+                    if (seen >= need)
+                        return;
+                    auto it = names.find(item);
+                    if (it == names.end() || it->second.find(lower) == std::string::npos)
+                        return;
+                    if (seen++ >= first)
+                        page.emplace_back(item, rank);
+                });
+            }
+            return total;
+        }
+
+        // max-heap on rank, so the worst of the best is on top
+        std::vector<std::pair<int32_t, T>> best;
+        best.reserve(need);
+        auto byrank = [](const std::pair<int32_t, T> & a, const std::pair<int32_t, T> & b) { return a.first < b.first; };
+        Find(key, [&](T item)
+        {
+            int32_t rank = ranking.Rank(item);
+            if (rank <= 0)
+                return;
+            if (best.size() < need)
+            {
+                best.emplace_back(rank, item);
+                std::push_heap(best.begin(), best.end(), byrank);
+            }
+            else if (rank < best.front().first)
+            {
+                std::pop_heap(best.begin(), best.end(), byrank);
+                best.back() = std::make_pair(rank, item);
+                std::push_heap(best.begin(), best.end(), byrank);
+            }
+        });
+        std::sort_heap(best.begin(), best.end(), byrank);
+        for (size_t i = first; i < best.size(); ++i)
+            page.emplace_back(best[i].second, best[i].first);
+        return total;
+    }
+
+private:
+    static std::string Lower(const std::string & str)
+    {
+        std::string lower = str;
+        std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+        return lower;
+    }
+    static uint32_t Gram(const std::string & str, size_t i)
+    {
+        return (uint32_t(uint8_t(str[i])) << 16) | (uint32_t(uint8_t(str[i + 1])) << 8) | uint8_t(str[i + 2]);
+    }
+
+    void Link(T item, const std::string & lower)
+    {
+        for (size_t i = 0; i + 3 <= lower.size(); ++i)
+            grams[Gram(lower, i)].insert(item);
+    }
+    void Unlink(T item, const std::string & lower)
+    {
+        for (size_t i = 0; i + 3 <= lower.size(); ++i)
+        {
+            auto it = grams.find(Gram(lower, i));
+            if (it == grams.end())
+                continue;
+            it->second.erase(item);
+            if (it->second.empty())
+                grams.erase(it);
+        }
+    }
+
+    std::unordered_map<T, std::string> names;
+    std::unordered_map<uint32_t, std::unordered_set<T>> grams;
+};
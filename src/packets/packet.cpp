@@ -15,31 +15,29 @@ packet::packet(spitfire & server, request & req, amf3object & obj)
     gserver(server),
     obj(obj),
     client(req.conn!=0?req.conn->client_:0),
-    data(obj["data"]),
+    data(obj[atoms::data]),
     obj2(amf3object())
 {
-    std::string cmd = obj["cmd"];
-    std::vector<std::string> tokens;
-    my_split(tokens, cmd, ".");
-    //boost::split(tokens, cmd, boost::is_any_of("."));
-
-    if (tokens.size() == 2)
-    {
-        cmdtype = tokens[0];
-        command = tokens[1];
-    }
-    else if (tokens.size() == 1)
-    {
-        cmdtype = tokens[0];
-    }
+    // split once by request_handler
+    cmdtype = req.cmdtype;
+    command = req.command;
+    commandid = req.commandid;
 
     timestamp = Utils::time();
 
-    obj2["cmd"] = "";
+    obj2[atoms::cmd] = "";
 
     city = 0;
     if (client && client->currentcityindex != -1)
         city = client->citylist[client->currentcityindex];
+
+    // handlers check and spend m_resources directly, so bring them up to now
+    if (client)
+    {
+        for (PlayerCity * c : client->citylist)
+            if (c)
+                c->SettleResources(timestamp);
+    }
 }
 
 packet::~packet()
@@ -50,16 +48,16 @@ packet::~packet()
 
 void packet::CHECKCASTLEID() const
 {
-    if (IsObject(data) && KeyExists(data, "castleId") && (int)data["castleId"] != client->currentcityid)
+    if (IsObject(data) && KeyExists(data, atoms::castleId) && (int)data[atoms::castleId] != client->currentcityid)
     {
-        gserver.log->error("castleId does not match castle focus! gave: {} is:{} - cmd: {}.{} - accountid:{} - playername: {}", (int)data["castleId"], client->currentcityid, cmdtype, command, client->accountid, (char*)client->playername.c_str());
+        gserver.log->error("castleId does not match castle focus! gave: {} is:{} - cmd: {}.{} - accountid:{} - playername: {}", (int)data[atoms::castleId], client->currentcityid, cmdtype, command, client->accountid, (char*)client->playername.c_str());
         throw(0);
     }
 }
 
 void packet::VERIFYCASTLEID() const
 {
-    if (!IsObject(data) || !KeyExists(data, "castleId"))
+    if (!IsObject(data) || !KeyExists(data, atoms::castleId))
     {
         gserver.log->error("castleId not received! - cmd: {}.{} - accountid:{} - playername: {}", cmdtype, command, client->accountid, (char*)client->playername.c_str());
         throw(1);
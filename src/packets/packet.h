@@ -9,6 +9,7 @@
 #include "../structs.h"
 #include "../amf3.h"
 #include "../PlayerCity.h"
+#include "../command_registry.h"
 
 class spitfire;
 class Client;
@@ -25,6 +26,8 @@ public:
     request & req;
     std::string cmdtype;
     std::string command;
+    // module command id from the command_registry, -1 when unregistered
+    int32_t commandid;
     amf3object & data;
     amf3object obj2;
     uint64_t timestamp;
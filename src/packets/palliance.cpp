@@ -22,12 +22,45 @@ palliance::~palliance()
 
 }
 
+void palliance::Register(command_registry & registry)
+{
+    registry.Add<palliance>("alliance", "sayByetoAlliance", CMD_sayByetoAlliance);
+    registry.Add<palliance>("alliance", "isHasAlliance", CMD_isHasAlliance);
+    registry.Add<palliance>("alliance", "leaderWantUserInAllianceList", CMD_leaderWantUserInAllianceList);
+    registry.Add<palliance>("alliance", "rejectComeinAlliance", CMD_rejectComeinAlliance);
+    registry.Add<palliance>("alliance", "agreeComeinAllianceList", CMD_agreeComeinAllianceList);
+    registry.Add<palliance>("alliance", "resignForAlliance", CMD_resignForAlliance);
+    registry.Add<palliance>("alliance", "getAllianceMembers", CMD_getAllianceMembers);
+    registry.Add<palliance>("alliance", "getAllianceWanted", CMD_getAllianceWanted);
+    registry.Add<palliance>("alliance", "getAllianceInfo", CMD_getAllianceInfo);
+    registry.Add<palliance>("alliance", "userWantInAlliance", CMD_userWantInAlliance);
+    registry.Add<palliance>("alliance", "cancelUserWantInAlliance", CMD_cancelUserWantInAlliance);
+    registry.Add<palliance>("alliance", "getMilitarySituationList", CMD_getMilitarySituationList);
+    registry.Add<palliance>("alliance", "addUsertoAllianceList", CMD_addUsertoAllianceList);
+    registry.Add<palliance>("alliance", "addUsertoAlliance", CMD_addUsertoAlliance);
+    registry.Add<palliance>("alliance", "canceladdUsertoAlliance", CMD_canceladdUsertoAlliance);
+    registry.Add<palliance>("alliance", "cancelagreeComeinAlliance", CMD_cancelagreeComeinAlliance);
+    registry.Add<palliance>("alliance", "setAllianceFriendship", CMD_setAllianceFriendship);
+    registry.Add<palliance>("alliance", "getAllianceFriendshipList", CMD_getAllianceFriendshipList);
+    registry.Add<palliance>("alliance", "createAlliance", CMD_createAlliance);
+    registry.Add<palliance>("alliance", "setAllInfoForAlliance", CMD_setAllInfoForAlliance);
+    registry.Add<palliance>("alliance", "getPowerFromAlliance", CMD_getPowerFromAlliance);
+    registry.Add<palliance>("alliance", "resetTopPowerForAlliance", CMD_resetTopPowerForAlliance);
+    registry.Add<palliance>("alliance", "agreeComeinAllianceByUser", CMD_agreeComeinAllianceByUser);
+    registry.Add<palliance>("alliance", "agreeComeinAllianceByLeader", CMD_agreeComeinAllianceByLeader);
+    registry.Add<palliance>("alliance", "setPowerForUserByAlliance", CMD_setPowerForUserByAlliance);
+    registry.Add<palliance>("alliance", "kickOutMemberfromAlliance", CMD_kickOutMemberfromAlliance);
+    registry.AddModule<palliance>("alliance");
+}
+
 void palliance::process()
 {
     obj2["data"] = amf3object();
     amf3object & data2 = obj2["data"];
 
-    if ((command == "sayByetoAlliance"))
+    switch (commandid)
+    {
+    case CMD_sayByetoAlliance:
     {
         if (client->HasAlliance())
         {
@@ -48,7 +81,7 @@ void palliance::process()
         }
         return;
     }
-    if ((command == "isHasAlliance"))
+    case CMD_isHasAlliance:
     {
         obj2["cmd"] = "alliance.isHasAlliance";
 
@@ -137,7 +170,7 @@ void palliance::process()
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "leaderWantUserInAllianceList"))
+    case CMD_leaderWantUserInAllianceList:
     {
         obj2["cmd"] = "alliance.leaderWantUserInAllianceList";
         data2["ok"] = 1;
@@ -175,7 +208,7 @@ void palliance::process()
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "rejectComeinAlliance"))
+    case CMD_rejectComeinAlliance:
     {
         obj2["cmd"] = "alliance.rejectComeinAlliance";
         data2["packageId"] = 0.0;
@@ -211,7 +244,7 @@ void palliance::process()
         gserver.SendObject(client, gserver.CreateError("alliance.rejectComeinAlliance", -99, "An unknown error occurred."));
         return;
     }
-    if ((command == "agreeComeinAllianceList"))
+    case CMD_agreeComeinAllianceList:
     {
         obj2["cmd"] = "alliance.agreeComeinAllianceList";
         data2["packageId"] = 0.0;
@@ -253,7 +286,7 @@ void palliance::process()
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "resignForAlliance"))
+    case CMD_resignForAlliance:
     {
         obj2["cmd"] = "alliance.resignForAlliance";
         data2["packageId"] = 0.0;
@@ -289,12 +322,12 @@ void palliance::process()
 
         data2["ok"] = 1;
 
-        client->SaveToDB();
+        client->MarkDirty();
 
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "getAllianceMembers"))
+    case CMD_getAllianceMembers:
     {
         obj2["cmd"] = "alliance.getAllianceMembers";
         data2["packageId"] = 0.0;
@@ -351,7 +384,7 @@ void palliance::process()
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "getAllianceWanted"))
+    case CMD_getAllianceWanted:
     {
         obj2["cmd"] = "alliance.getAllianceWanted";
         data2["ok"] = 1;
@@ -363,7 +396,7 @@ void palliance::process()
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "getAllianceInfo"))
+    case CMD_getAllianceInfo:
     {
         obj2["cmd"] = "alliance.getAllianceInfo";
         data2["ok"] = 1;
@@ -393,7 +426,7 @@ void palliance::process()
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "userWantInAlliance"))
+    case CMD_userWantInAlliance:
     {
         obj2["cmd"] = "alliance.userWantInAlliance";
         data2["ok"] = 1;
@@ -431,12 +464,12 @@ void palliance::process()
         data2["ok"] = 1;
         data2["packageId"] = 0.0;
 
-        client->SaveToDB();
+        client->MarkDirty();
 
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "cancelUserWantInAlliance"))
+    case CMD_cancelUserWantInAlliance:
     {
         obj2["cmd"] = "alliance.cancelUserWantInAlliance";
         data2["ok"] = 1;
@@ -464,7 +497,7 @@ void palliance::process()
         client->allianceapply = "";
         client->allianceapplytime = 0;
 
-        client->SaveToDB();
+        client->MarkDirty();
 
         data2["ok"] = 1;
         data2["packageId"] = 0.0;
@@ -472,7 +505,7 @@ void palliance::process()
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "getMilitarySituationList"))
+    case CMD_getMilitarySituationList:
     {
         int pagesize = data["pageSize"];
         int pageno = data["pageNo"];
@@ -484,7 +517,7 @@ void palliance::process()
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "addUsertoAllianceList"))
+    case CMD_addUsertoAllianceList:
     {
         obj2["cmd"] = "alliance.addUsertoAllianceList";
         data2["packageId"] = 0.0;
@@ -521,7 +554,7 @@ void palliance::process()
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "addUsertoAlliance"))
+    case CMD_addUsertoAlliance:
     {
         //invite player
         obj2["cmd"] = "alliance.addUsertoAlliance";
@@ -581,11 +614,11 @@ void palliance::process()
 
         gserver.SendObject(client, obj2);
 
-        alliance->SaveToDB();
+        alliance->MarkDirty();
 
         return;
     }
-    if ((command == "canceladdUsertoAlliance"))
+    case CMD_canceladdUsertoAlliance:
     {
         //TODO: permission check
         obj2["cmd"] = "alliance.canceladdUsertoAlliance";
@@ -607,11 +640,11 @@ void palliance::process()
 
         gserver.SendObject(client, obj2);
 
-        alliance->SaveToDB();
+        alliance->MarkDirty();
 
         return;
     }
-    if ((command == "cancelagreeComeinAlliance"))
+    case CMD_cancelagreeComeinAlliance:
     {
         obj2["cmd"] = "alliance.cancelagreeComeinAlliance";
         data2["packageId"] = 0.0;
@@ -632,11 +665,11 @@ void palliance::process()
 
         gserver.SendObject(client, obj2);
 
-        alliance->SaveToDB();
+        alliance->MarkDirty();
 
         return;
     }
-    if ((command == "setAllianceFriendship"))
+    case CMD_setAllianceFriendship:
     {
         //TODO: permission check
         obj2["cmd"] = "alliance.setAllianceFriendship";
@@ -706,10 +739,10 @@ void palliance::process()
         data2["ok"] = 1;
         gserver.SendObject(client, obj2);
 
-        alliance->SaveToDB();
+        alliance->MarkDirty();
         return;
     }
-    if ((command == "getAllianceFriendshipList"))
+    case CMD_getAllianceFriendshipList:
     {
         // TODO War reports -- alliance.getMilitarySituationList
         obj2["cmd"] = "alliance.getAllianceFriendshipList";
@@ -789,7 +822,7 @@ void palliance::process()
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "createAlliance"))
+    case CMD_createAlliance:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -856,8 +889,9 @@ void palliance::process()
             city->ResourceUpdate();
 
             gserver.SendObject(client, obj2);
-            client->SaveToDB();
-            alliance->SaveToDB();
+            client->MarkDirty();
+            city->MarkDirty();
+            alliance->MarkDirty();
 
             gserver.m_alliances->SortAlliances();
 
@@ -868,8 +902,9 @@ void palliance::process()
             gserver.SendObject(client, gserver.CreateError("alliance.createAlliance", -99, "Cannot create alliance. Please contact support."));
             return;
         }
+        break;
     }
-    if ((command == "setAllInfoForAlliance"))
+    case CMD_setAllInfoForAlliance:
     {
         //TODO: permission check
         std::string notetext = data["noteText"];
@@ -899,11 +934,11 @@ void palliance::process()
 
         gserver.SendObject(client, obj2);
 
-        alliance->SaveToDB();
+        alliance->MarkDirty();
 
         return;
     }
-    if (command == "getPowerFromAlliance")
+    case CMD_getPowerFromAlliance:
     {
         obj2["cmd"] = "alliance.getPowerFromAlliance";
         data2["packageId"] = 0.0;
@@ -919,7 +954,7 @@ void palliance::process()
         gserver.SendObject(client, obj2);
         return;
     }
-    if (command == "resetTopPowerForAlliance")
+    case CMD_resetTopPowerForAlliance:
     {
         obj2["cmd"] = "alliance.resetTopPowerForAlliance";
         data2["packageId"] = 0.0;
@@ -961,9 +996,9 @@ void palliance::process()
 
             gserver.SendObject(client, obj2);
 
-            alliance->SaveToDB();
-            client->SaveToDB();
-            tclient->SaveToDB();
+            alliance->MarkDirty();
+            client->MarkDirty();
+            tclient->MarkDirty();
 
             return;
         }
@@ -972,8 +1007,9 @@ void palliance::process()
             gserver.SendObject(client, gserver.CreateError("alliance.resetTopPowerForAlliance", -41, "Player " + passtoname + " doesn't exist."));
             return;
         }
+        break;
     }
-    if ((command == "agreeComeinAllianceByUser"))//TODO: alliance invites player, player accepts via embassy
+    case CMD_agreeComeinAllianceByUser: //TODO: alliance invites player, player accepts via embassy
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -1018,12 +1054,12 @@ void palliance::process()
 
         client->PlayerInfoUpdate();
 
-        alliance->SaveToDB();
-        client->SaveToDB();
+        alliance->MarkDirty();
+        client->MarkDirty();
 
         return;
     }
-    if ((command == "agreeComeinAllianceByLeader"))//player applies to alliance, leader accepts
+    case CMD_agreeComeinAllianceByLeader: //player applies to alliance, leader accepts
     {
         obj2["cmd"] = "alliance.agreeComeinAllianceByLeader";
         data2["packageId"] = 0.0;
@@ -1062,12 +1098,12 @@ void palliance::process()
 
         gserver.SendObject(client, obj2);
 
-        alliance->SaveToDB();
-        invitee->SaveToDB();
+        alliance->MarkDirty();
+        invitee->MarkDirty();
 
         return;
     }
-    if ((command == "setPowerForUserByAlliance"))
+    case CMD_setPowerForUserByAlliance:
     {
         obj2["cmd"] = "alliance.setPowerForUserByAlliance";
         data2["packageId"] = 0.0;
@@ -1100,12 +1136,12 @@ void palliance::process()
         std::string msg = client->playername + " promotes " + tar->playername + " to " + AllianceMgr::GetAllianceRank(type) + ".";
         alliance->SendAllianceMessage(msg, false, false);
 
-        alliance->SaveToDB();
-        client->SaveToDB();
+        alliance->MarkDirty();
+        client->MarkDirty();
 
         return;
     }
-    if ((command == "kickOutMemberfromAlliance"))
+    case CMD_kickOutMemberfromAlliance:
     {
         //TODO: permission check
         obj2["cmd"] = "alliance.kickOutMemberfromAlliance";
@@ -1149,10 +1185,13 @@ void palliance::process()
 
         gserver.SendObject(client, obj2);
 
-        alliance->SaveToDB();
-        tar->SaveToDB();
+        alliance->MarkDirty();
+        tar->MarkDirty();
 
         return;
     }
+    default:
+        break;
+    }
 }
 
@@ -11,8 +11,40 @@
 class palliance : public packet
 {
 public:
+    enum command_id
+    {
+        CMD_sayByetoAlliance,
+        CMD_isHasAlliance,
+        CMD_leaderWantUserInAllianceList,
+        CMD_rejectComeinAlliance,
+        CMD_agreeComeinAllianceList,
+        CMD_resignForAlliance,
+        CMD_getAllianceMembers,
+        CMD_getAllianceWanted,
+        CMD_getAllianceInfo,
+        CMD_userWantInAlliance,
+        CMD_cancelUserWantInAlliance,
+        CMD_getMilitarySituationList,
+        CMD_addUsertoAllianceList,
+        CMD_addUsertoAlliance,
+        CMD_canceladdUsertoAlliance,
+        CMD_cancelagreeComeinAlliance,
+        CMD_setAllianceFriendship,
+        CMD_getAllianceFriendshipList,
+        CMD_createAlliance,
+        CMD_setAllInfoForAlliance,
+        CMD_getPowerFromAlliance,
+        CMD_resetTopPowerForAlliance,
+        CMD_agreeComeinAllianceByUser,
+        CMD_agreeComeinAllianceByLeader,
+        CMD_setPowerForUserByAlliance,
+        CMD_kickOutMemberfromAlliance,
+    };
+
     palliance(spitfire & server, request & req, amf3object & o);
     ~palliance();
     void process();
+
+    static void Register(command_registry & registry);
 };
 
@@ -24,12 +24,26 @@ parmy::~parmy()
 
 }
 
+void parmy::Register(command_registry & registry)
+{
+    registry.Add<parmy>("army", "setArmyGoOut", CMD_setArmyGoOut);
+    registry.Add<parmy>("army", "IsDropItemInCastle", CMD_IsDropItemInCastle);
+    registry.Add<parmy>("army", "callBackArmy", CMD_callBackArmy);
+    registry.Add<parmy>("army", "getInjuredTroop", CMD_getInjuredTroop);
+    registry.Add<parmy>("army", "getTroopParam", CMD_getTroopParam);
+    registry.Add<parmy>("army", "newArmy", CMD_newArmy);
+    registry.Add<parmy>("army", "getStayAllianceArmys", CMD_getStayAllianceArmys);
+    registry.AddModule<parmy>("army");
+}
+
 void parmy::process()
 {
     obj2["data"] = amf3object();
     amf3object & data2 = obj2["data"];
  
-    if (command == "setArmyGoOut")
+    switch (commandid)
+    {
+    case CMD_setArmyGoOut:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -41,7 +55,7 @@ void parmy::process()
         gserver.SendObject(client, obj2);
         return;
     }
-    if (command == "IsDropItemInCastle")
+    case CMD_IsDropItemInCastle:
     {
         data2["ok"]=1;
         data2["packageId"]=0.0;
@@ -49,7 +63,7 @@ void parmy::process()
         gserver.SendObject(client,obj2);
         return;
     }
-    if ((command == "callBackArmy"))
+    case CMD_callBackArmy:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -58,7 +72,7 @@ void parmy::process()
  
         return;
     }
-    if ((command == "getInjuredTroop"))
+    case CMD_getInjuredTroop:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -81,7 +95,7 @@ void parmy::process()
         gserver.SendObject(client,obj4);
         return;
     }
-    if (command == "getTroopParam")
+    case CMD_getTroopParam:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -101,7 +115,7 @@ void parmy::process()
         gserver.SendObject(client, obj3);
         return;
     }
-    if (command == "newArmy")
+    case CMD_newArmy:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -215,14 +229,13 @@ void parmy::process()
                         return;
                     }
                 }
-                stArmyMovement * am = new stArmyMovement;
+                stArmyMovement * am = gserver.armies.Create();
                 am->hero = hero;
                 if (hero!=nullptr) {
                     am->heroname=hero->m_name;
                     am->herolevel = hero->m_level;
                 }
  
-                stTimedEvent te;
                 am->city = city;
                 am->client = client;
  
@@ -240,12 +253,7 @@ void parmy::process()
                 am->targetfieldid = targettile;
                 am->targetposname = gserver.map->GetTileFromID(targettile)->GetName();
  
-                te.data = am;
-                te.type = DEF_TIMEDARMY;
- 
-                gserver.AddTimedEvent(te);
- 
-                client->armymovement.push_back(am);
+                gserver.armies.Add(am);
  
                 //timer made, remove troops from city
                 city->m_troops -= troops;
@@ -273,8 +281,8 @@ void parmy::process()
                 //armies in embassy from other players go here
                 gserver.SendObject(client, obj3);
  
-                city->SaveToDB();
-                if (hero!=nullptr) hero->SaveToDB();
+                city->MarkDirty();
+                if (hero!=nullptr) hero->MarkDirty();
             }
             else
             {
@@ -316,14 +324,13 @@ void parmy::process()
                         return;
                     }
                 }
-                stArmyMovement * am = new stArmyMovement;
+                stArmyMovement * am = gserver.armies.Create();
                 am->hero = hero;
                 if (hero!=nullptr) {
                     am->heroname=hero->m_name;
                     am->herolevel = hero->m_level;
                 }
  
-                stTimedEvent te;
                 am->city = city;
                 am->client = client;
  
@@ -341,12 +348,7 @@ void parmy::process()
                 am->targetfieldid = targettile;
                 am->targetposname = gserver.map->GetTileFromID(targettile)->GetName();
  
-                te.data = am;
-                te.type = DEF_TIMEDARMY;
- 
-                gserver.AddTimedEvent(te);
- 
-                client->armymovement.push_back(am);
+                gserver.armies.Add(am);
  
                 //timer made, remove troops from city
                 city->m_troops -= troops;
@@ -373,8 +375,8 @@ void parmy::process()
                 //armies in embassy from other players go here
                 gserver.SendObject(client, obj3);
  
-                city->SaveToDB();
-                if (hero!=nullptr) hero->SaveToDB();
+                city->MarkDirty();
+                if (hero!=nullptr) hero->MarkDirty();
             }
         }
         else if (missiontype == MISSION_REINF)
@@ -420,7 +422,7 @@ void parmy::process()
 //         //                 ["backAfterConstruct"] Type: Boolean - Value: False
 // 
     }
-    if (command == "getStayAllianceArmys")
+    case CMD_getStayAllianceArmys:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -437,4 +439,7 @@ void parmy::process()
         gserver.SendObject(client, obj3);
         return;
     }
+    default:
+        break;
+    }
 }
@@ -11,8 +11,21 @@
 class parmy : public packet
 {
 public:
+    enum command_id
+    {
+        CMD_setArmyGoOut,
+        CMD_IsDropItemInCastle,
+        CMD_callBackArmy,
+        CMD_getInjuredTroop,
+        CMD_getTroopParam,
+        CMD_newArmy,
+        CMD_getStayAllianceArmys,
+    };
+
     parmy(spitfire & server, request & req, amf3object & o);
     ~parmy();
     void process();
+
+    static void Register(command_registry & registry);
 };
 
@@ -24,12 +24,31 @@ pcastle::~pcastle()
 
 }
 
+void pcastle::Register(command_registry & registry)
+{
+    registry.Add<pcastle>("castle", "getAvailableBuildingBean", CMD_getAvailableBuildingBean);
+    registry.Add<pcastle>("castle", "getAvailableBuildingListInside", CMD_getAvailableBuildingListInside);
+    registry.Add<pcastle>("castle", "getAvailableBuildingListOutside", CMD_getAvailableBuildingListOutside);
+    registry.Add<pcastle>("castle", "newBuilding", CMD_newBuilding);
+    registry.Add<pcastle>("castle", "destructBuilding", CMD_destructBuilding);
+    registry.Add<pcastle>("castle", "upgradeBuilding", CMD_upgradeBuilding);
+    registry.Add<pcastle>("castle", "checkOutUpgrade", CMD_checkOutUpgrade);
+    registry.Add<pcastle>("castle", "speedUpBuildCommand", CMD_speedUpBuildCommand);
+    registry.Add<pcastle>("castle", "getCoinsNeed", CMD_getCoinsNeed);
+    registry.Add<pcastle>("castle", "cancleBuildCommand", CMD_cancleBuildCommand);
+    registry.Add<pcastle>("castle", "saveCastleSignList", CMD_saveCastleSignList);
+    registry.Add<pcastle>("castle", "deleteCastleSignList", CMD_deleteCastleSignList);
+    registry.AddModule<pcastle>("castle");
+}
+
 void pcastle::process()
 {
     obj2["data"] = amf3object();
     amf3object & data2 = obj2["data"];
 
-    if ((command == "getAvailableBuildingBean"))
+    switch (commandid)
+    {
+    case CMD_getAvailableBuildingBean:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -126,7 +145,7 @@ void pcastle::process()
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "getAvailableBuildingListInside"))
+    case CMD_getAvailableBuildingListInside:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -236,7 +255,7 @@ void pcastle::process()
 
         return;
     }
-    if ((command == "getAvailableBuildingListOutside"))
+    case CMD_getAvailableBuildingListOutside:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -344,7 +363,7 @@ void pcastle::process()
 
         return;
     }
-    if ((command == "newBuilding")) //TODO implement hammer queue system
+    case CMD_newBuilding: //TODO implement hammer queue system
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -444,8 +463,8 @@ void pcastle::process()
 
         city->ResourceUpdate();
 
-        client->SaveToDB();
-        city->SaveToDB();
+        client->MarkDirty();
+        city->MarkDirty();
 
         stTimedEvent te;
         ba->city = city;
@@ -459,7 +478,7 @@ void pcastle::process()
         gserver.AddTimedEvent(te);
         return;
     }
-    if ((command == "destructBuilding")) //TODO implement hammer queue system
+    case CMD_destructBuilding: //TODO implement hammer queue system
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -531,11 +550,11 @@ void pcastle::process()
 
         city->ResourceUpdate();
 
-        client->SaveToDB();
-        city->SaveToDB();
+        client->MarkDirty();
+        city->MarkDirty();
         return;
     }
-    if ((command == "upgradeBuilding")) //TODO implement hammer queue system
+    case CMD_upgradeBuilding: //TODO implement hammer queue system
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -635,11 +654,11 @@ void pcastle::process()
 
         gserver.SendObject(client, obj2);
 
-        client->SaveToDB();
-        city->SaveToDB();
+        client->MarkDirty();
+        city->MarkDirty();
         return;
     }
-    if ((command == "checkOutUpgrade"))
+    case CMD_checkOutUpgrade:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -759,7 +778,7 @@ void pcastle::process()
 
         return;
     }
-    if ((command == "speedUpBuildCommand"))
+    case CMD_speedUpBuildCommand:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -786,9 +805,10 @@ void pcastle::process()
                 gserver.SendObject(client, obj2);
 
                 building->endtime -= 5 * 60 * 1000;
+                gserver.ScheduleBuilding(city, positionid);
 
-                client->SaveToDB();
-                city->SaveToDB();
+                client->MarkDirty();
+                city->MarkDirty();
             }
             else
             {
@@ -872,6 +892,7 @@ void pcastle::process()
                 reducetime = (building->endtime - building->starttime);
                 building->endtime -= reducetime;
                 city->SetBuilding(building->type, 1, building->id, building->status, building->starttime, building->endtime);
+                gserver.ScheduleBuilding(city, positionid);
 
                 obj2["cmd"] = "server.BuildComplate";
 
@@ -880,8 +901,8 @@ void pcastle::process()
 
                 gserver.SendObject(client, obj2);
 
-                client->SaveToDB();
-                city->SaveToDB();
+                client->MarkDirty();
+                city->MarkDirty();
                 return;
             }
             else if (speeditemid == "coins.speed")
@@ -910,6 +931,7 @@ void pcastle::process()
             building->endtime -= reducetime;
 
             city->SetBuilding(building->type, building->level, building->id, building->status, building->starttime, building->endtime);
+            gserver.ScheduleBuilding(city, positionid);
 
             obj2["cmd"] = "server.BuildComplate";
 
@@ -918,14 +940,14 @@ void pcastle::process()
 
             gserver.SendObject(client, obj2);
 
-            client->SaveToDB();
-            city->SaveToDB();
+            client->MarkDirty();
+            city->MarkDirty();
 
             return;
         }
         return;
     }
-    if ((command == "getCoinsNeed"))
+    case CMD_getCoinsNeed:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -949,7 +971,7 @@ void pcastle::process()
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "cancleBuildCommand"))
+    case CMD_cancleBuildCommand:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -987,7 +1009,7 @@ void pcastle::process()
                             city->m_resources += res;
                         }
 
-                        gserver.buildinglist.erase(iter++);
+                        iter = gserver.RemoveTimedEvent(gserver.buildinglist, iter);
 
                         if (bldg->level == 0)
                             ba->city->SetBuilding(0, 0, ba->positionid, 0, 0.0, 0.0);
@@ -1006,8 +1028,8 @@ void pcastle::process()
 
                         gserver.SendObject(client, obj2);
 
-                        client->SaveToDB();
-                        city->SaveToDB();
+                        client->MarkDirty();
+                        city->MarkDirty();
 
                         delete ba;
 
@@ -1024,7 +1046,7 @@ void pcastle::process()
         }
         return;
     }
-    if (command == "saveCastleSignList")
+    case CMD_saveCastleSignList:
     {
         int32_t tx = data["x"];
         int32_t ty = data["y"];
@@ -1050,7 +1072,7 @@ void pcastle::process()
         client->CastleSignUpdate();
         return;
     }
-    if (command == "deleteCastleSignList")
+    case CMD_deleteCastleSignList:
     {
         uint64_t tid = data["id"];//tile id
 
@@ -1067,4 +1089,7 @@ void pcastle::process()
         gserver.CreateError("castle.saveCastleSignList", -99, "Invalid castle");
         return;
     }
+    default:
+        break;
+    }
 }
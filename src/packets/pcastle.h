@@ -11,7 +11,25 @@
 class pcastle : public packet
 {
 public:
+    enum command_id
+    {
+        CMD_getAvailableBuildingBean,
+        CMD_getAvailableBuildingListInside,
+        CMD_getAvailableBuildingListOutside,
+        CMD_newBuilding,
+        CMD_destructBuilding,
+        CMD_upgradeBuilding,
+        CMD_checkOutUpgrade,
+        CMD_speedUpBuildCommand,
+        CMD_getCoinsNeed,
+        CMD_cancleBuildCommand,
+        CMD_saveCastleSignList,
+        CMD_deleteCastleSignList,
+    };
+
     pcastle(spitfire & server, request & req, amf3object & o);
     ~pcastle();
     void process();
+
+    static void Register(command_registry & registry);
 };
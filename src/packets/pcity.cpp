@@ -23,12 +23,25 @@ pcity::~pcity()
 
 }
 
+void pcity::Register(command_registry & registry)
+{
+    registry.Add<pcity>("city", "advMoveCastle", CMD_advMoveCastle);
+    registry.Add<pcity>("city", "moveCastle", CMD_moveCastle);
+    registry.Add<pcity>("city", "modifyCastleName", CMD_modifyCastleName);
+    registry.Add<pcity>("city", "modifyFlag", CMD_modifyFlag);
+    registry.Add<pcity>("city", "setStopWarState", CMD_setStopWarState);
+    registry.Add<pcity>("city", "modifyUserName", CMD_modifyUserName);
+    registry.AddModule<pcity>("city");
+}
+
 void pcity::process()
 {
     obj2["data"] = amf3object();
     amf3object & data2 = obj2["data"];
 
-    if (command == "advMoveCastle")
+    switch (commandid)
+    {
+    case CMD_advMoveCastle:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -66,7 +79,7 @@ void pcity::process()
         gserver.SendObject(client, obj3);
         return;
     }
-    if (command == "moveCastle")
+    case CMD_moveCastle:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -123,11 +136,13 @@ void pcity::process()
                 gserver.SendObject(client, gserver.CreateError("city.moveCastle",-77,"You must recall all of your troops before you teleport your city."));
                 return;
             }
-            for (stArmyMovement* pl : client->friendarmymovement) {
-                if (pl->targetfieldid==city->m_tileid && pl->direction == DIRECTION_STAY) {
-                    gserver.SendObject(client, gserver.CreateError("city.moveCastle",-77,"You must recall all of your troops before you teleport your city."));
-                    return;
-                } 
+            if (const tilearmylist * here = gserver.armies.AtTile(city->m_tileid)) {
+                for (stArmyMovement* pl : *here) {
+                    if (pl->direction == DIRECTION_STAY) {
+                        gserver.SendObject(client, gserver.CreateError("city.moveCastle",-77,"You must recall all of your troops before you teleport your city."));
+                        return;
+                    }
+                }
             }
             gserver.map->m_tile[city->m_tileid].m_type = FLAT;
             city->m_tileid = randomid;
@@ -160,7 +175,7 @@ void pcity::process()
         gserver.SendObject(client, gserver.CreateError("city.moveCastle", -25, "No open flats exist."));
         return;
     }
-    if ((command == "modifyCastleName"))
+    case CMD_modifyCastleName:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -171,6 +186,7 @@ void pcity::process()
 
         city->m_cityname = name;
         city->m_logurl = logurl;
+        gserver.RankCastle(city);
         // TODO check valid name and error reporting - city.modifyCastleName
 
         obj2["cmd"] = "city.modifyCastleName";
@@ -179,11 +195,11 @@ void pcity::process()
 
         gserver.SendObject(client, obj2);
 
-        city->SaveToDB();
+        city->MarkDirty();
 
         return;
     }
-    if ((command == "modifyFlag"))
+    case CMD_modifyFlag:
     {
         std::string flag = data["newFlag"];
 
@@ -206,11 +222,11 @@ void pcity::process()
 
         gserver.SendObject(client, obj2);
 
-        client->SaveToDB();
+        client->MarkDirty();
 
         return;
     }
-    if ((command == "setStopWarState"))
+    case CMD_setStopWarState:
     {
         std::string pass = data["passWord"];
         std::string itemid = data["ItemId"];
@@ -252,11 +268,11 @@ void pcity::process()
 
         gserver.SendObject(client, obj2);
 
-        client->SaveToDB();
+        client->MarkDirty();
 
         return;
     }
-    if (command == "modifyUserName")
+    case CMD_modifyUserName:
     {
         std::string newname = data["userName"];
         std::string itemid = data["itemId"];
@@ -276,7 +292,7 @@ void pcity::process()
         // TODO check valid name and error reporting - city.modifyUserName
         client->AddItem("player.name.1.a", -1);
 
-        client->playername = newname;
+        gserver.SetClientName(client, newname);
         client->PlayerInfoUpdate();
 
 
@@ -286,8 +302,11 @@ void pcity::process()
 
         gserver.SendObject(client, obj2);
 
-        client->SaveToDB();
+        client->MarkDirty();
         return;
     }
+    default:
+        break;
+    }
 }
 
@@ -12,8 +12,20 @@
 class pcity : public packet
 {
 public:
+    enum command_id
+    {
+        CMD_advMoveCastle,
+        CMD_moveCastle,
+        CMD_modifyCastleName,
+        CMD_modifyFlag,
+        CMD_setStopWarState,
+        CMD_modifyUserName,
+    };
+
     pcity(spitfire & server, request & req, amf3object & o);
     ~pcity();
     void process();
+
+    static void Register(command_registry & registry);
 };
 
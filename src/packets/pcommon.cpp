@@ -29,12 +29,34 @@ pcommon::~pcommon()
 
 }
 
+void pcommon::Register(command_registry & registry)
+{
+    registry.Add<pcommon>("common", "worldChat", CMD_worldChat);
+    registry.Add<pcommon>("common", "privateChat", CMD_privateChat);
+    registry.Add<pcommon>("common", "channelChat", CMD_channelChat);
+    registry.Add<pcommon>("common", "allianceChat", CMD_allianceChat);
+    registry.Add<pcommon>("common", "mapInfoSimple", CMD_mapInfoSimple);
+    registry.Add<pcommon>("common", "zoneInfo", CMD_zoneInfo);
+    registry.Add<pcommon>("common", "getPackage", CMD_getPackage);
+    registry.Add<pcommon>("common", "getPackageList", CMD_getPackageList);
+    registry.Add<pcommon>("common", "getPackageNumber", CMD_getPackageNumber);
+    registry.Add<pcommon>("common", "changeUserFace", CMD_changeUserFace);
+    registry.Add<pcommon>("common", "delUniteServerPeaceStatus", CMD_delUniteServerPeaceStatus);
+    registry.Add<pcommon>("common", "getItemDefXml", CMD_getItemDefXml);
+    registry.Add<pcommon>("common", "createNewPlayer", CMD_createNewPlayer);
+    registry.Add<pcommon>("common", "setSecurityCode", CMD_setSecurityCode);
+    registry.Add<pcommon>("common", "deleteUserAndRestart", CMD_deleteUserAndRestart);
+    registry.AddModule<pcommon>("common");
+}
+
 void pcommon::process()
 {
     obj2["data"] = amf3object();
     amf3object & data2 = obj2["data"];
 
-    if (command == "worldChat")
+    switch (commandid)
+    {
+    case CMD_worldChat:
     {
         obj2["cmd"] = "common.worldChat";
         data2["packageId"] = 0.0;
@@ -60,20 +82,13 @@ void pcommon::process()
         data3["fromUser"] = client->playername;
         data3["channel"] = "world";
 
-        std::list<Client*>::iterator playeriter;
-
         if (gserver.ParseChat(client, data["msg"]))
         {
-            for (playeriter = gserver.players.begin(); playeriter != gserver.players.end(); ++playeriter)
-            {
-                Client * client = *playeriter;
-                if (client)
-                    gserver.SendObject(client, obj3);
-            }
+            gserver.Broadcast(stBroadcastTarget::World(), obj3);
         }
         return;
     }
-    if (command == "privateChat")
+    case CMD_privateChat:
     {
         Client * clnt = gserver.GetClientByName(data["targetName"]);
         if (!clnt)
@@ -98,7 +113,7 @@ void pcommon::process()
         gserver.SendObject(clnt, obj3);
         return;
     }
-    if ((command == "channelChat"))
+    case CMD_channelChat:
     {
         obj2["cmd"] = "common.channelChat";
         data2["msg"] = data["msg"];
@@ -126,20 +141,13 @@ void pcommon::process()
         data3["channel"] = "beginner";
 
 
-        std::list<Client*>::iterator playeriter;
-
         if (gserver.ParseChat(client, data["sendMsg"]))
         {
-            for (playeriter = gserver.players.begin(); playeriter != gserver.players.end(); ++playeriter)
-            {
-                Client * client = *playeriter;
-                if (client)
-                    gserver.SendObject(client, obj3);
-            }
+            gserver.Broadcast(stBroadcastTarget::Channel("beginner"), obj3);
         }
         return;
     }
-    if ((command == "allianceChat"))
+    case CMD_allianceChat:
     {
 
         if (client->allianceid <= 0)
@@ -165,18 +173,13 @@ void pcommon::process()
         data3["fromUser"] = client->playername;
         data3["channel"] = "alliance";
 
-        Alliance * alliance = client->GetAlliance();
-
         if (gserver.ParseChat(client, data["msg"]))
         {
-            for (Alliance::stMember & member : alliance->m_members)
-            {
-                gserver.SendObject(gserver.GetClient(member.clientid), obj3);
-            }
+            gserver.Broadcast(stBroadcastTarget::ToAlliance(client->allianceid), obj3);
         }
         return;
     }
-    if ((command == "mapInfoSimple"))
+    case CMD_mapInfoSimple:
     {
 
         int x1 = data["x1"];
@@ -199,7 +202,7 @@ void pcommon::process()
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "zoneInfo"))
+    case CMD_zoneInfo:
     {
         obj2["cmd"] = "common.zoneInfo";
         data2["packageId"] = 0.0;
@@ -221,7 +224,7 @@ void pcommon::process()
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "getPackage")) //TODO
+    case CMD_getPackage: //TODO
     {
         obj["ruleId"];//package id to claim
         obj["serial"];//unsure of what this does - is sent as a null string (0 length)
@@ -234,7 +237,7 @@ void pcommon::process()
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "getPackageList")) //TODO
+    case CMD_getPackageList: //TODO
     {
         obj2["cmd"] = "common.getPackageList";
         data2["packages"] = client->Packages();
@@ -244,7 +247,7 @@ void pcommon::process()
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "getPackageNumber")) //TODO
+    case CMD_getPackageNumber: //TODO
     {
         obj2["cmd"] = "common.getPackageNumber";
         data2["packageId"] = 0.0;
@@ -254,7 +257,7 @@ void pcommon::process()
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "changeUserFace")) //TODO check for valid faceurl (currently can send any link, even offsite)
+    case CMD_changeUserFace: //TODO check for valid faceurl (currently can send any link, even offsite)
     {
         obj2["cmd"] = "common.changeUserFace";
         data2["packageId"] = 0.0;
@@ -276,12 +279,12 @@ void pcommon::process()
 
         client->haschangedface = true;
 
-        client->SaveToDB();
+        client->MarkDirty();
 
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "delUniteServerPeaceStatus")) //TODO is this correct?
+    case CMD_delUniteServerPeaceStatus: //TODO is this correct?
     {
         obj2["cmd"] = "common.delUniteServerPeaceStatus";
         data2["packageId"] = 0.0;
@@ -290,12 +293,12 @@ void pcommon::process()
 
         client->status = DEF_NORMAL;
 
-        client->SaveToDB();
+        client->MarkDirty();
 
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "getItemDefXml")) //TODO lots of things to fix here.
+    case CMD_getItemDefXml: //TODO lots of things to fix here.
     {
         //send online user count for fun
         uint32_t tc = 0;
@@ -361,7 +364,7 @@ void pcommon::process()
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "createNewPlayer"))
+    case CMD_createNewPlayer:
     {
         std::string captcha = data["captcha"];
         std::string faceUrl = data["faceUrl"];
@@ -390,13 +393,7 @@ void pcommon::process()
         if (client->accountid == 0)
         {
             gserver.log->info("Account [{}] doesn't exist", userName);
-            Session ses(gserver.serverpool->get());
-            Statement select(ses);
-            select << "SELECT * FROM `accounts` WHERE `username`=?;", use(userName);
-            select.execute();
-            RecordSet rs(select);
-
-            if (rs.rowCount() > 0)
+            if (gserver.store->Connect()->AccountExists(userName))
             {
                 //player name exists
                 gserver.SendObject(client, gserver.CreateError("common.createNewPlayer", -88, "Player name taken"));
@@ -432,38 +429,18 @@ void pcommon::process()
                 castlename2 = Utils::makesafe(castleName);
                 faceUrl2 = Utils::makesafe(faceUrl);
                 flag2 = Utils::makesafe(flag);
+                std::unique_ptr<storageconn> db = gserver.store->Connect();
                 if (client->accountid == 0)
                 {
-
-                    Session ses(gserver.serverpool->get());
-                    Statement select(ses);
-                    select << "SELECT * FROM `accounts` WHERE `username`=?;", use(userName);
-                    select.execute();
-                    RecordSet rs(select);
-                    uint64_t nixtime = Utils::time();
-                    int32_t zero = 0;
-                    std::string empty = "";
-                    Statement stmt = (ses << "INSERT INTO `accounts` (`parentid`, `username`, `lastlogin`, `creation`, `ipaddress`, `status`, `reason`, `sex`, `flag`, `faceurl`, `buffs`, `research`, `items`, `misc`) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, '', '', '', '');", use(client->masteraccountid), use(user), use(nixtime), use(nixtime), use(client->ipaddress), use(zero), use(empty), use(sex), use(flag2), use(faceUrl2));
-                    stmt.execute();
-                    if (!stmt.done())
-                    {
-                        gserver.log->error("Unable to create account.");
-                        gserver.SendObject(client, gserver.CreateError("common.createNewPlayer", -26, "Error with account creation. #-26"));
-                        return;
-                    }
-                    Statement lastinsert = (ses << "SELECT " + LAST_INSERT_ID);
-                    lastinsert.execute();
-                    RecordSet lsi(lastinsert);
-                    lsi.moveFirst();
-                    int32_t lsiv = lsi.value(LAST_INSERT_ID).convert<int32_t>();
+                    int64_t lsiv = db->CreateAccount(client->masteraccountid, user, Utils::time(), client->ipaddress, sex, flag2, faceUrl2);
                     if (lsiv > 0)
                     {
-                        client->accountid = lsiv;
+                        gserver.SetClientAccountId(client, lsiv);
                     }
                     else
                     {
                         gserver.log->error("Unable to create account.");
-                        gserver.SendObject(client, gserver.CreateError("common.createNewPlayer", -27, "Error with account creation. #-27"));
+                        gserver.SendObject(client, gserver.CreateError("common.createNewPlayer", -26, "Error with account creation. #-26"));
                         return;
                     }
 
@@ -482,15 +459,9 @@ void pcommon::process()
                 //                     if (!gserver.sql2->Query("INSERT INTO `cities` (`accountid`,`misc`,`fieldid`,`name`,`buildings`,`gold`,`food`,`wood`,`iron`,`stone`,`creation`,`transingtrades`,`troop`,`fortification`,`trades`) \
                                                         //                                  VALUES ("XI64", '%s',%d, '%s', '%s',100000,100000,100000,100000,100000,"DBL",'','','','');",
                 //                                  client->m_accountid, (char*)temp.c_str(), randomid, castleName, "31,1,-1,0,0.000000,0.000000", (double)unixtime()))
-                Session ses(gserver.serverpool->get());
-                uint64_t nixtime = Utils::time();
-                int32_t zero = 0;
-                std::string empty = "";
                 std::string defaultbuildings = "31,1,-1,0,0.000000,0.000000";
-                Statement stmt = (ses << "INSERT INTO `cities` (`accountid`,`misc`,`fieldid`,`name`,`buildings`,`gold`,`food`,`wood`,`iron`,`stone`,`creation`,`transingtrades`,`troop`,`fortification`,`trades`,`troopqueues`) VALUES (?, ?, ?, ?, ?,100000,100000,100000,100000,100000,?,'','','','','');",
-                                    use(client->accountid), use(temp), use(randomid), use(castleName), use(defaultbuildings), use(nixtime));
-                stmt.execute();
-                if (!stmt.done())
+                int64_t cityid = db->CreateCity(client->accountid, temp, randomid, castleName, defaultbuildings, Utils::time());
+                if (cityid <= 0)
                 {
                     //gserver.FileLog()->Log("Unable to create city.");
                     //error making city
@@ -499,21 +470,17 @@ void pcommon::process()
                     return;
                 }
 
-                client->playername = user;
+                gserver.SetClientName(client, user);
                 client->flag = flag2;
                 client->faceurl = faceUrl2;
                 client->sex = sex;
 
                 PlayerCity * city;
 
-                Statement lastinsert = (ses << "SELECT " + LAST_INSERT_ID);
-                lastinsert.execute();
-                RecordSet lsi(lastinsert);
-                lsi.moveFirst();
-                uint32_t lsiv = lsi.value(LAST_INSERT_ID).convert<uint32_t>();
+                uint32_t lsiv = uint32_t(cityid);
                 if (lsiv > 0)
                 {
-                    client->accountid = lsiv;
+                    gserver.SetClientAccountId(client, lsiv);
                     city = (PlayerCity*)gserver.AddPlayerCity(client, randomid, lsiv);
                 }
                 else
@@ -530,6 +497,7 @@ void pcommon::process()
                 city->m_logurl = "images/icon/cityLogo/citylogo_01.png";
                 //city->m_accountid = client->m_accountid;
                 city->m_cityname = castlename2;
+                gserver.RankCastle(city);
                 //city->m_tileid = randomid;
                 client->currentcityid = city->m_castleid;
                 city->m_creation = Utils::time();
@@ -547,7 +515,6 @@ void pcommon::process()
 
                 gserver.SortPlayers();
                 gserver.SortHeroes();
-                gserver.SortCastles();
 
 
                 amf3object obj3;
@@ -569,8 +536,8 @@ void pcommon::process()
 
                 gserver.map->CalculateOpenTiles();
 
-                client->SaveToDB();
-                city->SaveToDB();
+                client->MarkDirty();
+                city->MarkDirty();
 
 
                 return;
@@ -585,12 +552,12 @@ void pcommon::process()
         }
         return;
     }
-    if (command == "setSecurityCode")
+    case CMD_setSecurityCode:
     {
         std::string code = data["code"];
         return;
     }
-    if (command == "deleteUserAndRestart")
+    case CMD_deleteUserAndRestart:
     {
         std::string pwd = data["pwd"];
         data2["packageId"] = 0.0;
@@ -609,4 +576,7 @@ void pcommon::process()
         gserver.SendObject(client, obj2);//return command success ( sends back to login screen )
         return;
     }
+    default:
+        break;
+    }
 }
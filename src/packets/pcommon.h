@@ -12,7 +12,28 @@
 class pcommon : public packet
 {
 public:
+    enum command_id
+    {
+        CMD_worldChat,
+        CMD_privateChat,
+        CMD_channelChat,
+        CMD_allianceChat,
+        CMD_mapInfoSimple,
+        CMD_zoneInfo,
+        CMD_getPackage,
+        CMD_getPackageList,
+        CMD_getPackageNumber,
+        CMD_changeUserFace,
+        CMD_delUniteServerPeaceStatus,
+        CMD_getItemDefXml,
+        CMD_createNewPlayer,
+        CMD_setSecurityCode,
+        CMD_deleteUserAndRestart,
+    };
+
     pcommon(spitfire & server, request & req, amf3object & o);
     ~pcommon();
     void process();
+
+    static void Register(command_registry & registry);
 };
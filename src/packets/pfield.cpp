@@ -21,12 +21,20 @@ pfield::~pfield()
 
 }
 
+void pfield::Register(command_registry & registry)
+{
+    registry.Add<pfield>("field", "getOtherFieldInfo", CMD_getOtherFieldInfo);
+    registry.AddModule<pfield>("field");
+}
+
 void pfield::process()
 {
     obj2["data"] = amf3object();
     amf3object & data2 = obj2["data"];
 
-    if (command == "getOtherFieldInfo")
+    switch (commandid)
+    {
+    case CMD_getOtherFieldInfo:
     {
         int fieldid = data["fieldId"];
 
@@ -43,5 +51,8 @@ void pfield::process()
         gserver.SendObject(client, obj2);
         return;
     }
+    default:
+        break;
+    }
 }
 
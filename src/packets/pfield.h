@@ -11,8 +11,15 @@
 class pfield : public packet
 {
 public:
+    enum command_id
+    {
+        CMD_getOtherFieldInfo,
+    };
+
     pfield(spitfire & server, request & req, amf3object & o);
     ~pfield();
     void process();
+
+    static void Register(command_registry & registry);
 };
 
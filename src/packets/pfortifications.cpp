@@ -21,6 +21,17 @@ pfortifications::~pfortifications()
 
 }
 
+void pfortifications::Register(command_registry & registry)
+{
+    registry.Add<pfortifications>("fortifications", "getProduceQueue", CMD_getProduceQueue);
+    registry.Add<pfortifications>("fortifications", "destructWallProtect", CMD_destructWallProtect);
+    registry.Add<pfortifications>("fortifications", "getFortificationsProduceList", CMD_getFortificationsProduceList);
+    registry.Add<pfortifications>("fortifications", "accTroopProduce", CMD_accTroopProduce);
+    registry.Add<pfortifications>("fortifications", "produceWallProtect", CMD_produceWallProtect);
+    registry.Add<pfortifications>("fortifications", "cancelFortificationProduce", CMD_cancelFortificationProduce);
+    registry.AddModule<pfortifications>("fortifications");
+}
+
 void pfortifications::process()
 {
     obj2["data"] = amf3object();
@@ -32,7 +43,9 @@ void pfortifications::process()
     VERIFYCASTLEID();
     CHECKCASTLEID();
 
-    if ((command == "getProduceQueue"))
+    switch (commandid)
+    {
+    case CMD_getProduceQueue:
     {
         uint32_t castleid = data["castleId"];
 
@@ -70,7 +83,7 @@ void pfortifications::process()
         gserver.SendObject(client, obj2);
         return;
     }
-    if (command == "destructWallProtect")
+    case CMD_destructWallProtect:
     {
         uint32_t num = data["num"];
         uint32_t type = data["typeId"];
@@ -136,13 +149,14 @@ void pfortifications::process()
 
         city->FortUpdate();
         city->ResourceUpdate();
+        city->MarkDirty();
 
         obj2["cmd"] = "fortifications.destructWallProtect";
 
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "getFortificationsProduceList"))
+    case CMD_getFortificationsProduceList:
     {
         uint32_t castleid = data["castleId"];
 
@@ -235,7 +249,7 @@ void pfortifications::process()
         gserver.SendObject(client, obj2);
         return;
     }
-    if (command == "accTroopProduce")
+    case CMD_accTroopProduce:
     {
         std::string speeditemid;
         uint32_t castleid = data["castleId"];
@@ -298,13 +312,14 @@ void pfortifications::process()
 
             }
         }
-        
-        client->SaveToDB();
-        city->SaveToDB();
+        gserver.ScheduleTroopQueue(city, queue);
+
+        client->MarkDirty();
+        city->MarkDirty();
 
         return;
     }
-    if ((command == "produceWallProtect"))
+    case CMD_produceWallProtect:
     {
         uint32_t castleid = data["castleId"];
 
@@ -344,12 +359,12 @@ void pfortifications::process()
 
         gserver.SendObject(client, obj2);
 
-        client->SaveToDB();
-        city->SaveToDB();
+        client->MarkDirty();
+        city->MarkDirty();
 
         return;
     }
-    if ((command == "cancelFortificationProduce"))
+    case CMD_cancelFortificationProduce:
     {
         uint32_t castleid = data["castleId"];
         int positionid = data["positionId"];
@@ -400,16 +415,21 @@ void pfortifications::process()
                     city->ResourceUpdate();
                 }
 
+                gserver.ScheduleTroopQueue(city, tq);
                 gserver.SendObject(client, obj2);
 //                 client->lists.unlock();
 
-                client->SaveToDB();
-                city->SaveToDB();
+                client->MarkDirty();
+                city->MarkDirty();
 
                 return;
             }
             ++iter;
         }
 //        client->lists.unlock();
+        break;
+    }
+    default:
+        break;
     }
 }
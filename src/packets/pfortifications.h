@@ -11,8 +11,20 @@
 class pfortifications : public packet
 {
 public:
+    enum command_id
+    {
+        CMD_getProduceQueue,
+        CMD_destructWallProtect,
+        CMD_getFortificationsProduceList,
+        CMD_accTroopProduce,
+        CMD_produceWallProtect,
+        CMD_cancelFortificationProduce,
+    };
+
     pfortifications(spitfire & server, request & req, amf3object & o);
     ~pfortifications();
     void process();
+
+    static void Register(command_registry & registry);
 };
 
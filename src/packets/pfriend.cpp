@@ -17,6 +17,11 @@ pfriend::~pfriend()
 
 }
 
+void pfriend::Register(command_registry & registry)
+{
+    registry.AddModule<pfriend>("friend");
+}
+
 void pfriend::process()
 {
     obj2["data"] = amf3object();
@@ -14,4 +14,6 @@ public:
     pfriend(spitfire & server, request & req, amf3object & o);
     ~pfriend();
     void process();
+
+    static void Register(command_registry & registry);
 };
@@ -19,12 +19,21 @@ pfurlough::~pfurlough()
 
 }
 
+void pfurlough::Register(command_registry & registry)
+{
+    registry.Add<pfurlough>("furlough", "isFurlought", CMD_isFurlought);
+    registry.Add<pfurlough>("furlough", "cancelFurlought", CMD_cancelFurlought);
+    registry.AddModule<pfurlough>("furlough");
+}
+
 void pfurlough::process()
 {
     obj2["data"] = amf3object();
     amf3object & data2 = obj2["data"];
 
-    if ((command == "isFurlought"))
+    switch (commandid)
+    {
+    case CMD_isFurlought:
     {
         int32_t playerid = data["playerId"];
         std::string password = data["password"];
@@ -54,7 +63,7 @@ void pfurlough::process()
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "cancelFurlought"))
+    case CMD_cancelFurlought:
     {
         client->SetBuff("FurloughBuff", "", 0);
 
@@ -64,9 +73,12 @@ void pfurlough::process()
 
         gserver.SendObject(client, obj2);
 
-        client->SaveToDB();
+        client->MarkDirty();
 
         return;
     }
+    default:
+        break;
+    }
 }
 
@@ -12,7 +12,15 @@
 class pfurlough : public packet
 {
 public:
+    enum command_id
+    {
+        CMD_isFurlought,
+        CMD_cancelFurlought,
+    };
+
     pfurlough(spitfire & server, request & req, amf3object & o);
     ~pfurlough();
     void process();
+
+    static void Register(command_registry & registry);
 };
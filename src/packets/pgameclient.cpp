@@ -18,12 +18,20 @@ pgameclient::~pgameclient()
 
 }
 
+void pgameclient::Register(command_registry & registry)
+{
+    registry.Add<pgameclient>("gameClient", "version", CMD_version, false);
+    registry.AddModule<pgameclient>("gameClient", false);
+}
+
 void pgameclient::process()
 {
     obj2["data"] = amf3object();
     amf3object & data2 = obj2["data"];
 
-    if (command == "version")
+    switch (commandid)
+    {
+    case CMD_version:
     {
         if (data == "091103_11")
         {
@@ -48,6 +56,10 @@ void pgameclient::process()
             //"other" version
             return;
         }
+        break;
+    }
+    default:
+        break;
     }
     return;
 }
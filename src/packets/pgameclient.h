@@ -11,8 +11,15 @@
 class pgameclient : public packet
 {
 public:
+    enum command_id
+    {
+        CMD_version,
+    };
+
     pgameclient(spitfire & server, request & req, amf3object & o);
     ~pgameclient();
     void process();
+
+    static void Register(command_registry & registry);
 };
 
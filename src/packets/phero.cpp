@@ -21,6 +21,23 @@ phero::~phero()
 
 }
 
+void phero::Register(command_registry & registry)
+{
+    registry.Add<phero>("hero", "awardGold", CMD_awardGold);
+    registry.Add<phero>("hero", "useItem", CMD_useItem);
+    registry.Add<phero>("hero", "changeName", CMD_changeName);
+    registry.Add<phero>("hero", "getHerosListFromTavern", CMD_getHerosListFromTavern);
+    registry.Add<phero>("hero", "hireHero", CMD_hireHero);
+    registry.Add<phero>("hero", "fireHero", CMD_fireHero);
+    registry.Add<phero>("hero", "promoteToChief", CMD_promoteToChief);
+    registry.Add<phero>("hero", "dischargeChief", CMD_dischargeChief);
+    registry.Add<phero>("hero", "resetPoint", CMD_resetPoint);
+    registry.Add<phero>("hero", "addPoint", CMD_addPoint);
+    registry.Add<phero>("hero", "levelUp", CMD_levelUp);
+    registry.Add<phero>("hero", "refreshHerosListFromTavern", CMD_refreshHerosListFromTavern);
+    registry.AddModule<phero>("hero");
+}
+
 void phero::process()
 {
     obj2["data"] = amf3object();
@@ -29,7 +46,9 @@ void phero::process()
     VERIFYCASTLEID();
     CHECKCASTLEID();
 
-    if (command == "awardGold")
+    switch (commandid)
+    {
+    case CMD_awardGold:
     {
         Hero * hero = city->GetHero((uint64_t)data["heroId"]);
         if (hero == nullptr)
@@ -72,14 +91,15 @@ void phero::process()
 
             gserver.SendObject(client, obj2);
 
-            client->SaveToDB();
-            city->SaveToDB();
-            hero->SaveToDB();
+            client->MarkDirty();
+            city->MarkDirty();
+            hero->MarkDirty();
 
             return;
         }
+        break;
     }
-    if (command == "useItem")
+    case CMD_useItem:
     {
         Hero * hero = city->GetHero((uint64_t)data["heroId"]);
         if (hero == nullptr)
@@ -157,9 +177,9 @@ void phero::process()
 
                 gserver.SendObject(client, obj2);
 
-                client->SaveToDB();
-                city->SaveToDB();
-                hero->SaveToDB();
+                client->MarkDirty();
+                city->MarkDirty();
+                hero->MarkDirty();
                 return;
             }
             else if (_substr == "hero.loyalty")
@@ -204,16 +224,17 @@ void phero::process()
 
                 gserver.SendObject(client, obj2);
 
-                client->SaveToDB();
-                city->SaveToDB();
-                hero->SaveToDB();
+                client->MarkDirty();
+                city->MarkDirty();
+                hero->MarkDirty();
                 return;
             }
             gserver.SendObject(client, gserver.CreateError("hero.useItem", -99, "Invalid Item."));
             return;
         }
+        break;
     }
-    if (command == "changeName")
+    case CMD_changeName:
     {
         int64_t heroid = data["heroId"];
         std::string newname = data["newName"];
@@ -235,11 +256,11 @@ void phero::process()
         data2["packageId"] = 0.0;
         gserver.SendObject(client, obj2);
 
-        hero->SaveToDB();
+        hero->MarkDirty();
 
         return;
     }
-    if ((command == "getHerosListFromTavern"))
+    case CMD_getHerosListFromTavern:
     {
         int innlevel = city->GetBuildingLevel(B_INN);
 
@@ -282,7 +303,7 @@ void phero::process()
 
         return;
     }
-    if ((command == "hireHero"))
+    case CMD_hireHero:
     {
         std::string heroname = data["heroName"];
         int blevel = city->GetBuildingLevel(B_FEASTINGHALL);
@@ -321,6 +342,8 @@ void phero::process()
                             city->m_heroes[x] = city->m_innheroes[i];
                             city->m_innheroes[i] = nullptr;
                         }
+                        // salary
+                        city->RateResources();
                         city->ResourceUpdate();
                         city->m_heroes[x]->m_client = client;
                         city->m_heroes[x]->m_ownerid = client->accountid;
@@ -336,8 +359,8 @@ void phero::process()
 
                 gserver.SendObject(client, obj2);
 
-                client->SaveToDB();
-                city->SaveToDB();
+                client->MarkDirty();
+                city->MarkDirty();
 
                 return;
             }
@@ -345,7 +368,7 @@ void phero::process()
         gserver.SendObject(client, gserver.CreateError("hero.hireHero", -99, "Hero does not exist!"));
         return;
     }
-    if ((command == "fireHero"))
+    case CMD_fireHero:
     {
         int heroid = data["heroId"];
 
@@ -368,8 +391,12 @@ void phero::process()
 
                 city->m_heroes[i]->DeleteFromDB();
 
+                gserver.UnrankHero(city->m_heroes[i]);
+                gserver.ForgetDirty(city->m_heroes[i]);
                 delete city->m_heroes[i];
                 city->m_heroes[i] = 0;
+                // salary
+                city->RateResources();
 
                 obj2["cmd"] = "hero.fireHero";
                 data2["ok"] = 1;
@@ -383,7 +410,7 @@ void phero::process()
         gserver.SendObject(client, gserver.CreateError("hero.fireHero", -99, "Hero does not exist!"));
         return;
     }
-    if (command == "promoteToChief")
+    case CMD_promoteToChief:
     {// BUG : Correct hero not being promoted
         int heroid = data["heroId"];
 
@@ -416,10 +443,10 @@ void phero::process()
                 gserver.SendObject(client, obj2);
 
                 if (oldhero)
-                    oldhero->SaveToDB();
-                city->m_mayor->SaveToDB();
+                    oldhero->MarkDirty();
+                city->m_mayor->MarkDirty();
 
-                city->SaveToDB();
+                city->MarkDirty();
 
                 return;
             }
@@ -428,7 +455,7 @@ void phero::process()
         return;
         // TODO needs an error message - hero.promoteToChief
     }
-    if ((command == "dischargeChief"))
+    case CMD_dischargeChief:
     {
         if (!city->m_mayor)
         {
@@ -454,12 +481,12 @@ void phero::process()
 
         gserver.SendObject(client, obj2);
 
-        oldhero->SaveToDB();
-        city->SaveToDB();
+        oldhero->MarkDirty();
+        city->MarkDirty();
 
         return;
     }
-    if ((command == "resetPoint"))
+    case CMD_resetPoint:
     {
         int heroid = data["heroId"];
 
@@ -495,7 +522,7 @@ void phero::process()
 
                 gserver.SendObject(client, obj2);
 
-                city->m_heroes[i]->SaveToDB();
+                city->m_heroes[i]->MarkDirty();
 
                 return;
             }
@@ -504,7 +531,7 @@ void phero::process()
         gserver.SendObject(client, gserver.CreateError("hero.resetPoint", -99, "Hero does not exist!"));
         return;
     }
-    if ((command == "addPoint"))
+    case CMD_addPoint:
     {
         int heroid = data["heroId"];
         int stratagem = data["stratagem"];
@@ -545,7 +572,7 @@ void phero::process()
 
                 gserver.SendObject(client, obj2);
 
-                city->m_heroes[i]->SaveToDB();
+                city->m_heroes[i]->MarkDirty();
 
                 return;
             }
@@ -554,7 +581,7 @@ void phero::process()
         gserver.SendObject(client, gserver.CreateError("hero.addPoint", -99, "Hero does not exist!"));
         return;
     }
-    if ((command == "levelUp"))
+    case CMD_levelUp:
     {
         int heroid = data["heroId"];
 
@@ -577,6 +604,8 @@ void phero::process()
 
                 hero->m_experience -= hero->m_upgradeexp;
                 hero->m_upgradeexp = hero->m_level * hero->m_level * 100;
+                // salary
+                city->RateResources();
 
                 city->HeroUpdate(hero, 2);
 
@@ -585,7 +614,7 @@ void phero::process()
 
                 gserver.SendObject(client, obj2);
 
-                city->m_heroes[i]->SaveToDB();
+                city->m_heroes[i]->MarkDirty();
 
                 return;
             }
@@ -594,7 +623,7 @@ void phero::process()
         gserver.SendObject(client, gserver.CreateError("hero.levelUp", -99, "Hero does not exist!"));
         return;
     }
-    if ((command == "refreshHerosListFromTavern"))
+    case CMD_refreshHerosListFromTavern:
     {
         int innlevel = city->GetBuildingLevel(B_INN);
 
@@ -645,5 +674,8 @@ void phero::process()
 
         return;
     }
+    default:
+        break;
+    }
 }
 
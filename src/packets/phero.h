@@ -12,8 +12,26 @@
 class phero : public packet
 {
 public:
+    enum command_id
+    {
+        CMD_awardGold,
+        CMD_useItem,
+        CMD_changeName,
+        CMD_getHerosListFromTavern,
+        CMD_hireHero,
+        CMD_fireHero,
+        CMD_promoteToChief,
+        CMD_dischargeChief,
+        CMD_resetPoint,
+        CMD_addPoint,
+        CMD_levelUp,
+        CMD_refreshHerosListFromTavern,
+    };
+
     phero(spitfire & server, request & req, amf3object & o);
     ~phero();
     void process();
+
+    static void Register(command_registry & registry);
 };
 
@@ -21,12 +21,24 @@ pinterior::~pinterior()
 
 }
 
+void pinterior::Register(command_registry & registry)
+{
+    registry.Add<pinterior>("interior", "modifyTaxRate", CMD_modifyTaxRate);
+    registry.Add<pinterior>("interior", "pacifyPeople", CMD_pacifyPeople);
+    registry.Add<pinterior>("interior", "taxation", CMD_taxation);
+    registry.Add<pinterior>("interior", "modifyCommenceRate", CMD_modifyCommenceRate);
+    registry.Add<pinterior>("interior", "getResourceProduceData", CMD_getResourceProduceData);
+    registry.AddModule<pinterior>("interior");
+}
+
 void pinterior::process()
 {
     obj2["data"] = amf3object();
     amf3object & data2 = obj2["data"];
 
-    if ((command == "modifyTaxRate"))
+    switch (commandid)
+    {
+    case CMD_modifyTaxRate:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -54,12 +66,12 @@ void pinterior::process()
         city->CalculateResources();
         city->ResourceUpdate();
 
-        client->SaveToDB();
-        city->SaveToDB();
+        client->MarkDirty();
+        city->MarkDirty();
 
         return;
     }
-    if ((command == "pacifyPeople"))
+    case CMD_pacifyPeople:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -138,8 +150,8 @@ void pinterior::process()
                     city->ResourceUpdate();
                     client->PlayerInfoUpdate();
 
-                    client->SaveToDB();
-                    city->SaveToDB();
+                    client->MarkDirty();
+                    city->MarkDirty();
 
                     return;
                 }
@@ -156,6 +168,7 @@ void pinterior::process()
                 city->m_population += double(city->m_maxpopulation) / 20;
                 if (city->m_population >= city->m_maxpopulation)
                     city->m_population = city->m_maxpopulation;
+                gserver.RankCastle(city);
                 city->ResourceUpdate();
                 client->PlayerInfoUpdate();
                 break;
@@ -168,12 +181,12 @@ void pinterior::process()
 
         gserver.SendObject(client, obj2);
 
-        client->SaveToDB();
-        city->SaveToDB();
+        client->MarkDirty();
+        city->MarkDirty();
 
         return;
     }
-    if ((command == "taxation"))
+    case CMD_taxation:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -237,12 +250,12 @@ void pinterior::process()
 
         gserver.SendObject(client, obj2);
 
-        client->SaveToDB();
-        city->SaveToDB();
+        client->MarkDirty();
+        city->MarkDirty();
 
         return;
     }
-    if ((command == "modifyCommenceRate"))
+    case CMD_modifyCommenceRate:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -303,12 +316,12 @@ void pinterior::process()
         city->CalculateStats();
         city->ResourceUpdate();
 
-        client->SaveToDB();
-        city->SaveToDB();
+        client->MarkDirty();
+        city->MarkDirty();
 
         return;
     }
-    if ((command == "getResourceProduceData"))
+    case CMD_getResourceProduceData:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -323,5 +336,8 @@ void pinterior::process()
         gserver.SendObject(client, obj2);
         return;
     }
+    default:
+        break;
+    }
 }
 
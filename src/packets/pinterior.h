@@ -11,8 +11,19 @@
 class pinterior : public packet
 {
 public:
+    enum command_id
+    {
+        CMD_modifyTaxRate,
+        CMD_pacifyPeople,
+        CMD_taxation,
+        CMD_modifyCommenceRate,
+        CMD_getResourceProduceData,
+    };
+
     pinterior(spitfire & server, request & req, amf3object & o);
     ~pinterior();
     void process();
+
+    static void Register(command_registry & registry);
 };
 
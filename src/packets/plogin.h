@@ -14,5 +14,7 @@ public:
     plogin(spitfire & server, request & req, amf3object & o);
     ~plogin();
     void process();
+
+    static void Register(command_registry & registry);
 };
 
@@ -23,12 +23,23 @@ pmail::~pmail()
 
 }
 
+void pmail::Register(command_registry & registry)
+{
+    registry.Add<pmail>("mail", "receiveMailList", CMD_receiveMailList);
+    registry.Add<pmail>("mail", "readMail", CMD_readMail);
+    registry.Add<pmail>("mail", "sendMail", CMD_sendMail);
+    registry.Add<pmail>("mail", "reportBug", CMD_reportBug);
+    registry.AddModule<pmail>("mail");
+}
+
 void pmail::process()
 {
     obj2["data"] = amf3object();
     amf3object & data2 = obj2["data"];
 
-    if (command == "receiveMailList")
+    switch (commandid)
+    {
+    case CMD_receiveMailList:
     {
         int pagesize = data["pageSize"];
         int type = data["type"];
@@ -154,7 +165,7 @@ void pmail::process()
         gserver.SendObject(client, obj3);
         return;
     }*/
-    if (command == "readMail")
+    case CMD_readMail:
     {
         uint32_t mailid = data["mailId"];
 
@@ -176,6 +187,7 @@ void pmail::process()
                     data2["targetId"] = client->accountid;
                 }
                 mail.readtime = Utils::time();
+                gserver.JournalMail(client->accountid, mail);
                 data2["content"] = mail.content;
                 data2["mailid"] = mailid;
                 data2["title"] = mail.title;
@@ -191,24 +203,24 @@ void pmail::process()
                 client->MailUpdate();
                 gserver.SendObject(client, obj2);
 
-                try
+                // same key as the insert in CreateMail, so this never overtakes it
+                int64_t readtime = mail.readtime;
+                int64_t receiverid = client->accountid;
+                Client * reader = client;
+                ++reader->pendingwrites;
+                gserver.serverdb->Post(receiverid, [readtime, mailid, receiverid](storageconn & db)
                 {
-                    Session ses(gserver.serverpool->get());
-                    Statement stmt = (ses << "UPDATE `mail` SET `readtime`=? WHERE `pid`=? AND `receiverid`=? LIMIT 1;",
-                                      use(mail.readtime), use(mailid), use(client->accountid));
-                    stmt.execute();
-                    if (!stmt.done())
-                    {
-                        gserver.log->error("Unable to update read mail.");
-                        return;
-                    }
-                }
-                SQLCATCH3(return;, gserver);
+                    db.ReadMail(receiverid, int32_t(mailid), uint64_t(readtime));
+                }, [reader](bool)
+                {
+                    --reader->pendingwrites;
+                });
                 return;
             }
         }
+        break;
     }
-    if (command == "sendMail")
+    case CMD_sendMail:
     {
         std::string username = data["username"];
         std::string title = data["title"];
@@ -243,7 +255,7 @@ void pmail::process()
         tclient->MailUpdate();
         return;
     }
-    if (command == "reportBug")
+    case CMD_reportBug:
     {
         std::string subject = data["subject"];
         std::string content = data["content"];
@@ -255,5 +267,9 @@ void pmail::process()
         data2["packageId"] = 0.0;
         data2["ok"] = 1;
         gserver.SendObject(client, obj2);
+        break;
+    }
+    default:
+        break;
     }
 }
@@ -11,7 +11,17 @@
 class pmail : public packet
 {
 public:
+    enum command_id
+    {
+        CMD_receiveMailList,
+        CMD_readMail,
+        CMD_sendMail,
+        CMD_reportBug,
+    };
+
     pmail(spitfire & server, request & req, amf3object & o);
     ~pmail();
     void process();
+
+    static void Register(command_registry & registry);
 };
@@ -18,12 +18,21 @@ pquest::~pquest()
 
 }
 
+void pquest::Register(command_registry & registry)
+{
+    registry.Add<pquest>("quest", "getQuestType", CMD_getQuestType);
+    registry.Add<pquest>("quest", "getQuestList", CMD_getQuestList);
+    registry.AddModule<pquest>("quest");
+}
+
 void pquest::process()
 {
     obj2["data"] = amf3object();
     amf3object & data2 = obj2["data"];
 
-    if (command == "getQuestType") //quest info requested every 3 mins
+    switch (commandid)
+    {
+    case CMD_getQuestType: //quest info requested every 3 mins
     {
         VERIFYCASTLEID();
 
@@ -79,7 +88,7 @@ void pquest::process()
 
         return;
     }
-    if (command == "getQuestList")
+    case CMD_getQuestList:
     {
         VERIFYCASTLEID();
 
@@ -120,4 +129,7 @@ void pquest::process()
         gserver.SendObject(client, obj2);
         return;
     }
+    default:
+        break;
+    }
 }
@@ -11,7 +11,15 @@
 class pquest : public packet
 {
 public:
+    enum command_id
+    {
+        CMD_getQuestType,
+        CMD_getQuestList,
+    };
+
     pquest(spitfire & server, request & req, amf3object & o);
     ~pquest();
     void process();
+
+    static void Register(command_registry & registry);
 };
@@ -10,6 +10,8 @@
 #include "../City.h"
 #include "../Alliance.h"
 #include "../AllianceMgr.h"
+#include "../Hero.h"
+#include "../PlayerCity.h"
 
 prank::prank(spitfire & server, request & req, amf3object & obj)
     : packet(server, req, obj)
@@ -22,12 +24,39 @@ prank::~prank()
 
 }
 
+void prank::Register(command_registry & registry)
+{
+    registry.Add<prank>("rank", "getPlayerRank", CMD_getPlayerRank);
+    registry.Add<prank>("rank", "getAllianceRank", CMD_getAllianceRank);
+    registry.Add<prank>("rank", "getHeroRank", CMD_getHeroRank);
+    registry.Add<prank>("rank", "getCastleRank", CMD_getCastleRank);
+    registry.AddModule<prank>("rank");
+}
+
+// Walks one page of a ranking, or of the ranked matches of a name search
+// over it when matches is given, handing f each item and its rank
+template<typename Ranking, typename Item, typename F>
+static void ForPage(const Ranking & ranking, const std::vector<std::pair<Item, int32_t>> * matches, size_t first, size_t count, F f)
+{
+    if (matches)
+    {
+        for (const std::pair<Item, int32_t> & match : *matches)
+            f(match.first, match.second);
+    }
+    else
+    {
+        ranking.ForRange(first, count, f);
+    }
+}
+
 void prank::process()
 {
     obj2["data"] = amf3object();
     amf3object & data2 = obj2["data"];
 
-    if ((command == "getPlayerRank"))
+    switch (commandid)
+    {
+    case CMD_getPlayerRank:
     {
         int pagesize = data["pageSize"];
         std::string key = data["key"];
@@ -37,7 +66,8 @@ void prank::process()
         obj2["cmd"] = "rank.getPlayerRank";
         data2["packageId"] = 0.0;
         data2["ok"] = 1;
-        std::list<stClientRank> * ranklist;
+        const spitfire::clientranking * ranklist;
+        std::vector<std::pair<Client*, int32_t>> matches;
         amf3array beans = amf3array();
         switch (sorttype)
         {
@@ -60,70 +90,69 @@ void prank::process()
                 ranklist = &gserver.m_prestigerank;
                 break;
         }
-        std::list<stClientRank>::iterator iter;
         if (pagesize <= 0 || pagesize > 20 || pageno < 0 || pageno > 100000)
         {
             gserver.SendObject(client, gserver.CreateError("rank.getPlayerRank", -99, "Invalid data."));
             return;
         }
 
+        if (pageno < 1)
+        {
+            gserver.SendObject(client, gserver.CreateError("rank.getPlayerRank", -99, "Invalid page."));
+            return;
+        }
+
+        size_t first = size_t(pageno - 1)*pagesize;
+        size_t total = ranklist->Size();
         if (key.length() > 0)
         {
             //search term given
-            ranklist = (std::list<stClientRank>*)gserver.DoRankSearch(key, 1, ranklist, pageno, pagesize);//1 = client
+            total = gserver.m_playernames.Page(*ranklist, key, first, pagesize, matches);
         }
 
-        if ((pageno - 1)*pagesize > ranklist->size())
+        if (first > total)
         {
             gserver.SendObject(client, gserver.CreateError("rank.getPlayerRank", -99, "Invalid page."));
             return;
         }
-        iter = ranklist->begin();
-        for (int i = 0; i < (pageno - 1)*pagesize; ++i)
-            ++iter;
 
-        int rank = (pageno - 1)*pagesize + 1;
         data2["pageNo"] = pageno;
         data2["pageSize"] = pagesize;
-        if ((ranklist->size() % pagesize) == 0)
-            data2["totalPage"] = (ranklist->size() / pagesize);
-        else
-            data2["totalPage"] = (ranklist->size() / pagesize) + 1;
-        for (; iter != ranklist->end() && pagesize != 0; ++iter)
+        data2["totalPage"] = int32_t((total + pagesize - 1) / pagesize);
+        ForPage(*ranklist, key.length() > 0 ? &matches : nullptr, first, pagesize, [&](Client * player, int32_t rank)
         {
-            pagesize--;
             amf3object temp = amf3object();
             temp["createrTime"] = 0;
-            if (iter->client->allianceid > 0)
+            if (player->allianceid > 0)
             {
-                temp["alliance"] = iter->client->GetAlliance()->m_name;
-                temp["allianceLevel"] = AllianceMgr::GetAllianceRank(iter->client->alliancerank);
-                temp["levelId"] = iter->client->alliancerank;
+                temp["alliance"] = player->GetAlliance()->m_name;
+                temp["allianceLevel"] = AllianceMgr::GetAllianceRank(player->alliancerank);
+                temp["levelId"] = player->alliancerank;
             }
-            temp["office"] = iter->client->office;
-            temp["sex"] = iter->client->sex;
-            temp["honor"] = iter->client->honor;
-            temp["bdenyotherplayer"] = iter->client->m_bdenyotherplayer;
-            temp["id"] = iter->client->accountid;
+            temp["office"] = player->office;
+            temp["sex"] = player->sex;
+            temp["honor"] = player->honor;
+            temp["bdenyotherplayer"] = player->m_bdenyotherplayer;
+            temp["id"] = player->accountid;
             temp["accountName"] = "";
-            temp["prestige"] = iter->client->prestige;
-            temp["faceUrl"] = iter->client->faceurl;
-            temp["flag"] = iter->client->flag;
-            temp["userId"] = iter->client->masteraccountid;
-            temp["userName"] = iter->client->playername;
-            temp["castleCount"] = iter->client->citycount;
-            temp["titleId"] = iter->client->title;
+            temp["prestige"] = player->prestige;
+            temp["faceUrl"] = player->faceurl;
+            temp["flag"] = player->flag;
+            temp["userId"] = player->masteraccountid;
+            temp["userName"] = player->playername;
+            temp["castleCount"] = player->citycount;
+            temp["titleId"] = player->title;
             temp["medal"] = 0;
-            temp["ranking"] = iter->rank;
+            temp["ranking"] = rank;
             temp["lastLoginTime"] = 0;
-            temp["population"] = iter->client->population;
+            temp["population"] = player->population;
             beans.Add(temp);
-        }
+        });
         data2["beans"] = beans;
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "getAllianceRank"))
+    case CMD_getAllianceRank:
     {
         obj2["cmd"] = "rank.getAllianceRank";
         data2["packageId"] = 0.0;
@@ -140,7 +169,8 @@ void prank::process()
             obj2["cmd"] = "rank.getAllianceRank";
             data2["packageId"] = 0.0;
             data2["ok"] = 1;
-            std::list<stAlliance> * ranklist;
+            const allianceranking * ranklist;
+            std::vector<std::pair<Alliance*, int32_t>> matches;
             amf3array beans = amf3array();
             switch (sorttype)
             {
@@ -157,50 +187,49 @@ void prank::process()
                 ranklist = &gserver.m_alliances->m_membersrank;
                 break;
             }
-            std::list<stAlliance>::iterator iter;
             if (pagesize <= 0 || pagesize > 20 || pageno < 0 || pageno > 100000)
             {
                 gserver.SendObject(client, gserver.CreateError("rank.getAllianceRank", -99, "Invalid data."));
                 return;
             }
 
+            if (pageno < 1)
+            {
+                gserver.SendObject(client, gserver.CreateError("rank.getAllianceRank", -99, "Invalid page."));
+                return;
+            }
+
+            size_t first = size_t(pageno - 1)*pagesize;
+            size_t total = ranklist->Size();
             if (key.length() > 0)
             {
                 //search term given
-                ranklist = (std::list<stAlliance>*)gserver.DoRankSearch(key, 4, ranklist, pageno, pagesize);//1 = client
+                total = gserver.m_alliances->m_names.Page(*ranklist, key, first, pagesize, matches);
             }
 
-            if ((pageno - 1)*pagesize > ranklist->size())
+            if (first > total)
             {
                 gserver.SendObject(client, gserver.CreateError("rank.getAllianceRank", -99, "Invalid page."));
                 return;
             }
-            iter = ranklist->begin();
-            for (int i = 0; i < (pageno - 1)*pagesize; ++i)
-                iter++;
 
-            int rank = (pageno - 1)*pagesize + 1;
             data2["pageNo"] = pageno;
             data2["pageSize"] = pagesize;
-            if ((ranklist->size() % pagesize) == 0)
-                data2["totalPage"] = (ranklist->size() / pagesize);
-            else
-                data2["totalPage"] = (ranklist->size() / pagesize) + 1;
-            for (; iter != ranklist->end() && pagesize != 0; ++iter)
+            data2["totalPage"] = int32_t((total + pagesize - 1) / pagesize);
+            ForPage(*ranklist, key.length() > 0 ? &matches : nullptr, first, pagesize, [&](Alliance * alliance, int32_t rank)
             {
-                pagesize--;
                 amf3object temp = amf3object();
-                temp["member"] = iter->ref->m_currentmembers;
-                temp["prestige"] = iter->ref->m_prestige;
-                temp["rank"] = iter->rank;
-                temp["playerName"] = iter->ref->m_owner;
-                temp["honor"] = iter->ref->m_honor;
-                temp["description"] = iter->ref->m_intro;
-                temp["createrName"] = iter->ref->m_founder;
-                temp["name"] = iter->ref->m_name;
-                temp["city"] = iter->ref->m_allicitycount;
+                temp["member"] = alliance->m_currentmembers;
+                temp["prestige"] = alliance->m_prestige;
+                temp["rank"] = rank;
+                temp["playerName"] = alliance->m_owner;
+                temp["honor"] = alliance->m_honor;
+                temp["description"] = alliance->m_intro;
+                temp["createrName"] = alliance->m_founder;
+                temp["name"] = alliance->m_name;
+                temp["city"] = alliance->m_allicitycount;
                 beans.Add(temp);
-            }
+            });
             data2["beans"] = beans;
             gserver.SendObject(client, obj2);
         }
@@ -214,7 +243,7 @@ void prank::process()
         }
         return;
     }
-    if ((command == "getHeroRank"))
+    case CMD_getHeroRank:
     {
         int pagesize = data["pageSize"];
         std::string key = data["key"];
@@ -224,7 +253,8 @@ void prank::process()
         obj2["cmd"] = "rank.getHeroRank";
         data2["packageId"] = 0.0;
         data2["ok"] = 1;
-        std::list<stHeroRank> * ranklist;
+        const spitfire::heroranking * ranklist;
+        std::vector<std::pair<Hero*, int32_t>> matches;
         amf3array beans = amf3array();
         switch (sorttype)
         {
@@ -244,53 +274,52 @@ void prank::process()
                 ranklist = &gserver.m_herorankgrade;
                 break;
         }
-        std::list<stHeroRank>::iterator iter;
         if (pagesize <= 0 || pagesize > 20 || pageno < 0 || pageno > 100000)
         {
             gserver.SendObject(client, gserver.CreateError("rank.getHeroRank", -99, "Invalid data."));
             return;
         }
 
+        if (pageno < 1)
+        {
+            gserver.SendObject(client, gserver.CreateError("rank.getHeroRank", -99, "Invalid page."));
+            return;
+        }
+
+        size_t first = size_t(pageno - 1)*pagesize;
+        size_t total = ranklist->Size();
         if (key.length() > 0)
         {
             //search term given
-            ranklist = (std::list<stHeroRank>*)gserver.DoRankSearch(key, 2, ranklist, pageno, pagesize);//1 = client
+            total = gserver.m_heronames.Page(*ranklist, key, first, pagesize, matches);
         }
 
-        if ((pageno - 1)*pagesize > ranklist->size())
+        if (first > total)
         {
             gserver.SendObject(client, gserver.CreateError("rank.getHeroRank", -99, "Invalid page."));
             return;
         }
-        iter = ranklist->begin();
-        for (int i = 0; i < (pageno - 1)*pagesize; ++i)
-            iter++;
 
-        int rank = (pageno - 1)*pagesize + 1;
         data2["pageNo"] = pageno;
         data2["pageSize"] = pagesize;
-        if ((ranklist->size() % pagesize) == 0)
-            data2["totalPage"] = (ranklist->size() / pagesize);
-        else
-            data2["totalPage"] = (ranklist->size() / pagesize) + 1;
-        for (; iter != ranklist->end() && pagesize != 0; ++iter)
+        data2["totalPage"] = int32_t((total + pagesize - 1) / pagesize);
+        ForPage(*ranklist, key.length() > 0 ? &matches : nullptr, first, pagesize, [&](Hero * hero, int32_t rank)
         {
-            pagesize--;
             amf3object temp = amf3object();
-            temp["rank"] = iter->rank;
-            temp["stratagem"] = iter->stratagem;
-            temp["name"] = iter->name;
-            temp["power"] = iter->power;
-            temp["grade"] = iter->grade;
-            temp["management"] = iter->management;
-            temp["kind"] = iter->kind;
+            temp["rank"] = rank;
+            temp["stratagem"] = hero->m_stratagem;
+            temp["name"] = hero->m_name;
+            temp["power"] = hero->m_power;
+            temp["grade"] = hero->m_level;
+            temp["management"] = hero->m_management;
+            temp["kind"] = hero->m_client ? hero->m_client->playername : "";
             beans.Add(temp);
-        }
+        });
         data2["beans"] = beans;
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "getCastleRank"))
+    case CMD_getCastleRank:
     {
         int pagesize = data["pageSize"];
         std::string key = data["key"];
@@ -300,7 +329,8 @@ void prank::process()
         obj2["cmd"] = "rank.getCastleRank";
         data2["packageId"] = 0.0;
         data2["ok"] = 1;
-        std::list<stCastleRank> * ranklist;
+        const spitfire::castleranking * ranklist;
+        std::vector<std::pair<PlayerCity*, int32_t>> matches;
         amf3array beans = amf3array();
         switch (sorttype)
         {
@@ -314,50 +344,54 @@ void prank::process()
                 ranklist = &gserver.m_castlerankpopulation;
                 break;
         }
-        std::list<stCastleRank>::iterator iter;
         if (pagesize <= 0 || pagesize > 20 || pageno < 0 || pageno > 100000)
         {
             gserver.SendObject(client, gserver.CreateError("rank.getCastleRank", -99, "Invalid data."));
             return;
         }
 
+        if (pageno < 1)
+        {
+            gserver.SendObject(client, gserver.CreateError("rank.getCastleRank", -99, "Invalid page."));
+            return;
+        }
+
+        size_t first = size_t(pageno - 1)*pagesize;
+        size_t total = ranklist->Size();
         if (key.length() > 0)
         {
             //search term given
-            ranklist = (std::list<stCastleRank>*)gserver.DoRankSearch(key, 3, ranklist, pageno, pagesize);//1 = client
+            total = gserver.m_castlenames.Page(*ranklist, key, first, pagesize, matches);
         }
 
-        if ((pageno - 1)*pagesize > ranklist->size())
+        if (first > total)
         {
             gserver.SendObject(client, gserver.CreateError("rank.getCastleRank", -99, "Invalid page."));
             return;
         }
-        iter = ranklist->begin();
-        for (int i = 0; i < (pageno - 1)*pagesize; ++i)
-            iter++;
 
-        int rank = (pageno - 1)*pagesize + 1;
         data2["pageNo"] = pageno;
         data2["pageSize"] = pagesize;
-        if ((ranklist->size() % pagesize) == 0)
-            data2["totalPage"] = (ranklist->size() / pagesize);
-        else
-            data2["totalPage"] = (ranklist->size() / pagesize) + 1;
-        for (; iter != ranklist->end() && pagesize != 0; ++iter)
+        data2["totalPage"] = int32_t((total + pagesize - 1) / pagesize);
+        ForPage(*ranklist, key.length() > 0 ? &matches : nullptr, first, pagesize, [&](PlayerCity * city, int32_t rank)
         {
-            pagesize--;
+            int16_t level = city->GetBuildingLevel(B_TOWNHALL);
+            Client * owner = city->m_client;
             amf3object temp = amf3object();
-            temp["alliance"] = iter->alliance;
-            temp["rank"] = iter->rank;
-            temp["level"] = iter->level;
-            temp["name"] = iter->name;
-            temp["grade"] = iter->grade;
-            temp["kind"] = iter->kind;
-            temp["population"] = iter->population;
+            temp["alliance"] = (owner && owner->HasAlliance()) ? owner->GetAlliance()->m_name : "";
+            temp["rank"] = rank;
+            temp["level"] = level;
+            temp["name"] = city->m_cityname;
+            temp["grade"] = "Level " + std::to_string(level);
+            temp["kind"] = owner ? owner->playername : "";
+            temp["population"] = city->m_population;
             beans.Add(temp);
-        }
+        });
         data2["beans"] = beans;
         gserver.SendObject(client, obj2);
         return;
     }
+    default:
+        break;
+    }
 }
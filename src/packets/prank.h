@@ -12,7 +12,17 @@
 class prank : public packet
 {
 public:
+    enum command_id
+    {
+        CMD_getPlayerRank,
+        CMD_getAllianceRank,
+        CMD_getHeroRank,
+        CMD_getCastleRank,
+    };
+
     prank(spitfire & server, request & req, amf3object & o);
     ~prank();
     void process();
+
+    static void Register(command_registry & registry);
 };
@@ -21,12 +21,23 @@ preport::~preport()
 
 }
 
+void preport::Register(command_registry & registry)
+{
+    registry.Add<preport>("report", "deleteReport", CMD_deleteReport);
+    registry.Add<preport>("report", "markAsRead", CMD_markAsRead);
+    registry.Add<preport>("report", "readOverReport", CMD_readOverReport);
+    registry.Add<preport>("report", "receiveReportList", CMD_receiveReportList);
+    registry.AddModule<preport>("report");
+}
+
 void preport::process()
 {
     obj2["data"] = amf3object();
     amf3object & data2 = obj2["data"];
 
-    if (command == "deleteReport")
+    switch (commandid)
+    {
+    case CMD_deleteReport:
     {
         std::string reportid = data["idStr"];
 
@@ -45,6 +56,7 @@ void preport::process()
                 for (iter = client->reportlist.begin(); iter != client->reportlist.end(); ++iter) {
                     if (iter->reportid == x) {
                         client->reportlist.erase(iter);
+                        client->MarkReportsDirty();
                         break;
                     }
                 }
@@ -60,7 +72,7 @@ void preport::process()
         client->ReportUpdate();
         return;
     }
-    if (command == "markAsRead")
+    case CMD_markAsRead:
     {
         int reportid = data["reportId"];
         std::list<stReport>::iterator iter;
@@ -96,10 +108,11 @@ void preport::process()
         gserver.SendObject(client, obj2);
 
         r->isread = true;
+        client->MarkReportsDirty();
         client->ReportUpdate();
         return;
     }
-    if (command == "readOverReport")
+    case CMD_readOverReport:
     {
         std::string reportid = data["reportIds"];
 
@@ -118,6 +131,7 @@ void preport::process()
                 for (iter = client->reportlist.begin(); iter != client->reportlist.end(); ++iter) {
                     if (iter->reportid == x) {
                         iter->isread = true;
+                        client->MarkReportsDirty();
                         break;
                     }
                 }
@@ -133,7 +147,7 @@ void preport::process()
         client->ReportUpdate();
         return;
     }
-    if (command == "receiveReportList")
+    case CMD_receiveReportList:
     {
         int pagesize = data["pageSize"];
         int type = data["reportType"];
@@ -215,4 +229,7 @@ void preport::process()
         gserver.SendObject(client, obj2);
         return;
     }
+    default:
+        break;
+    }
 }
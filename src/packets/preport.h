@@ -12,7 +12,17 @@
 class preport : public packet
 {
 public:
+    enum command_id
+    {
+        CMD_deleteReport,
+        CMD_markAsRead,
+        CMD_readOverReport,
+        CMD_receiveReportList,
+    };
+
     preport(spitfire & server, request & req, amf3object & o);
     ~preport();
     void process();
+
+    static void Register(command_registry & registry);
 };
@@ -17,6 +17,11 @@ pserver::~pserver()
 
 }
 
+void pserver::Register(command_registry & registry)
+{
+    registry.AddModule<pserver>("server");
+}
+
 void pserver::process()
 {
     obj2["data"] = amf3object();
@@ -14,4 +14,6 @@ public:
     pserver(spitfire & server, request & req, amf3object & o);
     ~pserver();
     void process();
+
+    static void Register(command_registry & registry);
 };
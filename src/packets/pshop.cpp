@@ -21,12 +21,24 @@ pshop::~pshop()
 
 }
 
+void pshop::Register(command_registry & registry)
+{
+    registry.Add<pshop>("shop", "buy", CMD_buy);
+    registry.Add<pshop>("shop", "getBuyResourceInfo", CMD_getBuyResourceInfo);
+    registry.Add<pshop>("shop", "buyResource", CMD_buyResource);
+    registry.Add<pshop>("shop", "useGoods", CMD_useGoods);
+    registry.Add<pshop>("shop", "useCastleGoods", CMD_useCastleGoods);
+    registry.AddModule<pshop>("shop");
+}
+
 void pshop::process()
 {
     obj2["data"] = amf3object();
     amf3object & data2 = obj2["data"];
 
-    if ((command == "buy"))
+    switch (commandid)
+    {
+    case CMD_buy:
     {
         int64_t amount = data["amount"];
         std::string itemid = static_cast<std::string>(data["itemId"]);
@@ -59,7 +71,7 @@ void pshop::process()
 
                 gserver.SendObject(client, obj2);
 
-                client->SaveToDB();
+                client->MarkDirty();
 
                 return;
             }
@@ -67,7 +79,7 @@ void pshop::process()
         gserver.SendObject(client, gserver.CreateError("shop.buy", -99, "Item does not exist."));
         return;
     }
-    if ((command == "getBuyResourceInfo"))
+    case CMD_getBuyResourceInfo:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -95,7 +107,7 @@ void pshop::process()
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "buyResource"))
+    case CMD_buyResource:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -123,11 +135,13 @@ void pshop::process()
 
         client->PlayerInfoUpdate();
         city->ResourceUpdate();
+        client->MarkDirty();
+        city->MarkDirty();
 
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "useGoods"))
+    case CMD_useGoods:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -148,11 +162,11 @@ void pshop::process()
         //}
         ShopUseGoods(data, client);
 
-        client->SaveToDB();
+        client->MarkDirty();
 
         return;
     }
-    if ((command == "useCastleGoods"))
+    case CMD_useCastleGoods:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -173,10 +187,13 @@ void pshop::process()
         //}
         ShopUseCastleGoods(data, client);
 
-        client->SaveToDB();
+        client->MarkDirty();
 
         return;
     }
+    default:
+        break;
+    }
 }
 
 void pshop::ShopUseGoods(amf3object & data, Client * client)
@@ -214,6 +231,7 @@ void pshop::ShopUseGoods(amf3object & data, Client * client)
         }
         hero->m_level += 100;
         hero->m_remainpoint += 100;
+        city->RateResources();
 
 
         city->HeroUpdate(hero, 2);
@@ -222,9 +240,9 @@ void pshop::ShopUseGoods(amf3object & data, Client * client)
 
         gserver.SendObject(client, obj2);
     
-        client->SaveToDB();
-        city->SaveToDB();
-        hero->SaveToDB();
+        client->MarkDirty();
+        city->MarkDirty();
+        hero->MarkDirty();
         return;
     }
     if (itemid == "player.box.special.1")
@@ -263,7 +281,7 @@ void pshop::ShopUseGoods(amf3object & data, Client * client)
 
         gserver.SendObject(client, obj2);
 
-        client->SaveToDB();
+        client->MarkDirty();
         return;
     }
     if (itemid == "player.box.special.2")
@@ -302,7 +320,7 @@ void pshop::ShopUseGoods(amf3object & data, Client * client)
 
         gserver.SendObject(client, obj2);
 
-        client->SaveToDB();
+        client->MarkDirty();
         return;
     }
     if (itemid == "player.box.special.3")
@@ -341,7 +359,7 @@ void pshop::ShopUseGoods(amf3object & data, Client * client)
 
         gserver.SendObject(client, obj2);
 
-        client->SaveToDB();
+        client->MarkDirty();
         return;
     }
 
@@ -635,6 +653,7 @@ void pshop::ShopUseGoods(amf3object & data, Client * client)
         }
         else
             client->AddItem(it->name, itemobj["count"]);
+        client->GetFocusCity()->MarkDirty();
 
         std::stringstream ss;
         if (client->sex == 1)
@@ -694,11 +713,12 @@ void pshop::ShopUseCastleGoods(amf3object & data, Client * client)
                     city->m_population += int32_t(city->m_maxpopulation * 0.20);
                 if (city->m_population > city->m_maxpopulation)
                     city->m_population = city->m_maxpopulation;
+                gserver.RankCastle(city);
                 city->CalculateStats();
                 city->CastleUpdate();
                 city->ResourceUpdate();
-                client->SaveToDB();
-                city->SaveToDB();
+                client->MarkDirty();
+                city->MarkDirty();
                 gserver.SendObject(client, obj2);
                 return;
             }
@@ -720,8 +740,8 @@ void pshop::ShopUseCastleGoods(amf3object & data, Client * client)
                 city->CalculateStats();
                 city->CastleUpdate();
                 city->ResourceUpdate();
-                client->SaveToDB();
-                city->SaveToDB();
+                client->MarkDirty();
+                city->MarkDirty();
                 gserver.SendObject(client, obj2);
                 return;
             }
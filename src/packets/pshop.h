@@ -11,10 +11,21 @@
 class pshop : public packet
 {
 public:
+    enum command_id
+    {
+        CMD_buy,
+        CMD_getBuyResourceInfo,
+        CMD_buyResource,
+        CMD_useGoods,
+        CMD_useCastleGoods,
+    };
+
     pshop(spitfire & server, request & req, amf3object & o);
     ~pshop();
     void process();
 
+    static void Register(command_registry & registry);
+
     void ShopUseGoods(amf3object & data, Client * client);
     void ShopUseCastleGoods(amf3object & data, Client * client);
     int32_t GetGambleCount(std::string item);
@@ -22,12 +22,24 @@ ptech::~ptech()
 
 }
 
+void ptech::Register(command_registry & registry)
+{
+    registry.Add<ptech>("tech", "getResearchList", CMD_getResearchList);
+    registry.Add<ptech>("tech", "research", CMD_research);
+    registry.Add<ptech>("tech", "cancelResearch", CMD_cancelResearch);
+    registry.Add<ptech>("tech", "speedUpResearch", CMD_speedUpResearch);
+    registry.Add<ptech>("tech", "getCoinsNeed", CMD_getCoinsNeed);
+    registry.AddModule<ptech>("tech");
+}
+
 void ptech::process()
 {
     obj2["data"] = amf3object();
     amf3object & data2 = obj2["data"];
 
-    if ((command == "getResearchList"))
+    switch (commandid)
+    {
+    case CMD_getResearchList:
     {
         VERIFYCASTLEID();
 
@@ -152,7 +164,7 @@ void ptech::process()
         gserver.SendObject(client, obj2);
         return;
     }
-    if ((command == "research"))
+    case CMD_research:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -296,7 +308,8 @@ void ptech::process()
 
             city->ResourceUpdate();
 
-            client->SaveToDB();
+            client->MarkDirty();
+            city->MarkDirty();
 
             return;
         }
@@ -305,8 +318,9 @@ void ptech::process()
             gserver.SendObject(client, gserver.CreateError("tech.research", -99, "Research already in progress."));
             return;
         }
+        break;
     }
-    if ((command == "cancelResearch"))
+    case CMD_cancelResearch:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -359,6 +373,7 @@ void ptech::process()
                 if (city->m_castleid == castleid)
                 {
                     ra->researchid = 0;
+                    gserver.ScheduleTimedEvent(*iter);
                     break;
                 }
                 ++iter;
@@ -373,12 +388,14 @@ void ptech::process()
 
             city->ResourceUpdate();
 
-            client->SaveToDB();
+            client->MarkDirty();
+            city->MarkDirty();
 
             return;
         }
+        break;
     }
-    if ((command == "speedUpResearch"))
+    case CMD_speedUpResearch:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -418,8 +435,9 @@ void ptech::process()
                 gserver.SendObject(client, obj2);
 
                 research->endtime -= 5 * 60 * 1000;
+                gserver.ScheduleResearch(city);
 
-                client->SaveToDB();
+                client->MarkDirty();
             }
             else
             {
@@ -503,14 +521,15 @@ void ptech::process()
             }
 
             research->endtime -= reducetime;
+            gserver.ScheduleResearch(city);
 
-            client->SaveToDB();
+            client->MarkDirty();
 
             return;
         }
         return;
     }
-    if ((command == "getCoinsNeed"))
+    case CMD_getCoinsNeed:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -544,4 +563,7 @@ void ptech::process()
         gserver.SendObject(client, obj2);
         return;
     }
+    default:
+        break;
+    }
 }
@@ -12,7 +12,18 @@
 class ptech : public packet
 {
 public:
+    enum command_id
+    {
+        CMD_getResearchList,
+        CMD_research,
+        CMD_cancelResearch,
+        CMD_speedUpResearch,
+        CMD_getCoinsNeed,
+    };
+
     ptech(spitfire & server, request & req, amf3object & o);
     ~ptech();
     void process();
+
+    static void Register(command_registry & registry);
 };
@@ -21,12 +21,21 @@ ptrade::~ptrade()
 
 }
 
+void ptrade::Register(command_registry & registry)
+{
+    registry.Add<ptrade>("trade", "searchTrades", CMD_searchTrades);
+    registry.Add<ptrade>("trade", "newTrade", CMD_newTrade);
+    registry.AddModule<ptrade>("trade");
+}
+
 void ptrade::process()
 {
     obj2["data"] = amf3object();
     amf3object & data2 = obj2["data"];
 
-    if ((command == "searchTrades"))
+    switch (commandid)
+    {
+    case CMD_searchTrades:
     {
         int restype = data["resType"];
 
@@ -149,7 +158,7 @@ void ptrade::process()
         gserver.SendObject(client, obj2);
         return;
     }
-    else if (command == "newTrade")
+    case CMD_newTrade:
     {
         int restype = data["resType"];
 
@@ -232,5 +241,9 @@ void ptrade::process()
             obj["data"] = data;
             gserver.SendObject(client, obj);
         }*/
+        break;
+    }
+    default:
+        break;
     }
 }
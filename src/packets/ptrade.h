@@ -11,7 +11,15 @@
 class ptrade : public packet
 {
 public:
+    enum command_id
+    {
+        CMD_searchTrades,
+        CMD_newTrade,
+    };
+
     ptrade(spitfire & server, request & req, amf3object & o);
     ~ptrade();
     void process();
+
+    static void Register(command_registry & registry);
 };
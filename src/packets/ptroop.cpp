@@ -22,12 +22,25 @@ ptroop::~ptroop()
 
 }
 
+void ptroop::Register(command_registry & registry)
+{
+    registry.Add<ptroop>("troop", "getProduceQueue", CMD_getProduceQueue);
+    registry.Add<ptroop>("troop", "accTroopProduce", CMD_accTroopProduce);
+    registry.Add<ptroop>("troop", "getTroopProduceList", CMD_getTroopProduceList);
+    registry.Add<ptroop>("troop", "disbandTroop", CMD_disbandTroop);
+    registry.Add<ptroop>("troop", "produceTroop", CMD_produceTroop);
+    registry.Add<ptroop>("troop", "cancelTroopProduce", CMD_cancelTroopProduce);
+    registry.AddModule<ptroop>("troop");
+}
+
 void ptroop::process()
 {
     obj2["data"] = amf3object();
     amf3object & data2 = obj2["data"];
 
-    if ((command == "getProduceQueue"))
+    switch (commandid)
+    {
+    case CMD_getProduceQueue:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -85,7 +98,7 @@ void ptroop::process()
         gserver.SendObject(client, obj2);
         return;
     }
-    if (command == "accTroopProduce")
+    case CMD_accTroopProduce:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -152,13 +165,14 @@ void ptroop::process()
 
             }
         }
+        gserver.ScheduleTroopQueue(city, queue);
 
-        client->SaveToDB();
-        city->SaveToDB();
+        client->MarkDirty();
+        city->MarkDirty();
 
         return;
     }
-    if ((command == "getTroopProduceList"))
+    case CMD_getTroopProduceList:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -268,7 +282,7 @@ void ptroop::process()
         gserver.SendObject(client, obj2);
         return;
     }
-    if (command == "disbandTroop")
+    case CMD_disbandTroop:
     {
         uint32_t num = data["num"];
         uint32_t type = data["typeId"];
@@ -416,13 +430,14 @@ void ptroop::process()
 
         city->TroopUpdate();
         city->ResourceUpdate();
+        city->MarkDirty();
 
         obj2["cmd"] = "troop.disbandTroop";
 
         gserver.SendObject(client, obj2);
         return;
     }
-    if (command == "produceTroop")
+    case CMD_produceTroop:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -472,6 +487,7 @@ void ptroop::process()
 
         city->m_resources -= res;
         city->m_population -= num;
+        gserver.RankCastle(city);
         city->ResourceUpdate();
         city->CastleUpdate();
 
@@ -483,12 +499,12 @@ void ptroop::process()
 
         gserver.SendObject(client, obj2);
 
-        client->SaveToDB();
-        city->SaveToDB();
+        client->MarkDirty();
+        city->MarkDirty();
 
         return;
     }
-    if ((command == "cancelTroopProduce"))
+    case CMD_cancelTroopProduce:
     {
         VERIFYCASTLEID();
         CHECKCASTLEID();
@@ -545,17 +561,22 @@ void ptroop::process()
                     city->ResourceUpdate();
                 }
 
+                gserver.ScheduleTroopQueue(city, tq);
                 gserver.SendObject(client, obj2);
 
 //                client->lists.unlock();
 
-                client->SaveToDB();
-                city->SaveToDB();
+                client->MarkDirty();
+                city->MarkDirty();
 
                 return;
             }
             ++iter;
         }
 //        client->lists.unlock();
+        break;
+    }
+    default:
+        break;
     }
 }
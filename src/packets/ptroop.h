@@ -12,7 +12,19 @@
 class ptroop : public packet
 {
 public:
+    enum command_id
+    {
+        CMD_getProduceQueue,
+        CMD_accTroopProduce,
+        CMD_getTroopProduceList,
+        CMD_disbandTroop,
+        CMD_produceTroop,
+        CMD_cancelTroopProduce,
+    };
+
     ptroop(spitfire & server, request & req, amf3object & o);
     ~ptroop();
     void process();
+
+    static void Register(command_registry & registry);
 };
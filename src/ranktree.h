@@ -0,0 +1,311 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/// One ranking kept as an order-statistic treap. Items are ordered by score,
+/// highest first, ties going to the lower tiebreak id. Every node carries its
+/// subtree size, so a score change repositions only that item in O(log n) and
+/// a page of the ranking is reached in O(log n + pagesize).
+/// The tree does not own its items; Score only needs operator<.
+template<typename T, typename Score = int64_t>
+class ranktree
+{
+public:
+    ranktree() = default;
+    ranktree(const ranktree &) = delete;
+    ranktree & operator=(const ranktree &) = delete;
+
+    /// Inserts the item, or moves it if its score changed. Marks it as seen
+    /// for the current sweep either way.
+    void Update(T item, const Score & score, uint64_t tiebreak)
+    {
+        auto it = lookup.find(item);
+        if (it == lookup.end())
+        {
+            int32_t idx = Alloc(item, score, tiebreak);
+            lookup.emplace(item, idx);
+            root = Insert(root, idx);
+            return;
+        }
+        int32_t idx = it->second;
+        node & n = nodes[idx];
+        n.epoch = epoch;
+        if (!(n.score < score) && !(score < n.score) && n.tiebreak == tiebreak)
+            return;
+        root = Erase(root, idx);
+        n.score = score;
+        n.tiebreak = tiebreak;
+        n.left = n.right = -1;
+        n.size = 1;
+        root = Insert(root, idx);
+    }
+
+    void Remove(T item)
+    {
+        auto it = lookup.find(item);
+        if (it == lookup.end())
+            return;
+        root = Erase(root, it->second);
+        freenodes.push_back(it->second);
+        lookup.erase(it);
+    }
+
+    /// A pinned item is kept by EndSweep without being passed to Update,
+    /// for items whose score cannot change while they sit out the sweeps
+    void Pin(T item, bool pinned)
+    {
+        auto it = lookup.find(item);
+        if (it != lookup.end())
+            nodes[it->second].pinned = pinned;
+    }
+
+    bool Contains(T item) const { return lookup.count(item) != 0; }
+    size_t Size() const { return lookup.size(); }
+
+    /// 1-based rank of the item, 0 if it is not ranked
+    int32_t Rank(T item) const
+    {
+        auto it = lookup.find(item);
+        if (it == lookup.end())
+            return 0;
+        int32_t idx = it->second;
+        int32_t rank = 0;
+        int32_t t = root;
+        while (t != idx)
+        {
+            if (Before(idx, t))
+            {
+                t = nodes[t].left;
+            }
+            else
+            {
+                rank += SizeOf(nodes[t].left) + 1;
+                t = nodes[t].right;
+            }
+        }
+        return rank + SizeOf(nodes[idx].left) + 1;
+    }
+
+    /// Item at a zero-based position; index must be less than Size()
+    T At(size_t index) const
+    {
+        int32_t t = root;
+        for (;;)
+        {
+            size_t leftsize = SizeOf(nodes[t].left);
+            if (index < leftsize)
+            {
+                t = nodes[t].left;
+            }
+            else if (index == leftsize)
+            {
+                return nodes[t].item;
+            }
+            else
+            {
+                index -= leftsize + 1;
+                t = nodes[t].right;
+            }
+        }
+    }
+
+    /// Calls f(item, rank) for up to count items starting at the zero-based
+    /// position first, in rank order
+    template<typename F>
+    void ForRange(size_t first, size_t count, F f) const
+    {
+        if (first >= Size() || count == 0)
+            return;
+
+        // Descend to the first item keeping the ancestors still to be visited
+        std::vector<int32_t> pending;
+        size_t index = first;
+        int32_t t = root;
+        while (t >= 0)
+        {
+            size_t leftsize = SizeOf(nodes[t].left);
+            if (index < leftsize)
+            {
+                pending.push_back(t);
+                t = nodes[t].left;
+            }
+            else if (index == leftsize)
+            {
+                pending.push_back(t);
+                break;
+            }
+            else
+            {
+                index -= leftsize + 1;
+                t = nodes[t].right;
+            }
+        }
+
+        int32_t rank = int32_t(first) + 1;
+        while (count > 0 && !pending.empty())
+        {
+            t = pending.back();
+            pending.pop_back();
+            f(nodes[t].item, rank++);
+            --count;
+            for (int32_t c = nodes[t].right; c >= 0; c = nodes[c].left)
+                pending.push_back(c);
+        }
+    }
+
+    template<typename F>
+    void ForEach(F f) const { ForRange(0, Size(), f); }
+
+    /// Items not passed to Update between BeginSweep and EndSweep are removed
+    /// by EndSweep, so a periodic refresh drops whatever left the ranking
+    void BeginSweep() { ++epoch; }
+    void EndSweep()
+    {
+        std::vector<T> stale;
+        for (auto & entry : lookup)
+        {
+            if (nodes[entry.second].epoch != epoch && !nodes[entry.second].pinned)
+                stale.push_back(entry.first);
+        }
+        for (T item : stale)
+            Remove(item);
+    }
+
+    void Clear()
+    {
+        nodes.clear();
+        freenodes.clear();
+        lookup.clear();
+        root = -1;
+    }
+
+private:
+    struct node
+    {
+        T item;
+        Score score;
+        uint64_t tiebreak;
+        uint32_t priority;
+        uint32_t epoch;
+        int32_t left;
+        int32_t right;
+        uint32_t size;
+        bool pinned;
+    };
+
+    int32_t Alloc(T item, const Score & score, uint64_t tiebreak)
+    {
+        // xorshift32, only needs to be cheap and well spread
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        node n{ item, score, tiebreak, seed, epoch, -1, -1, 1, false };
+        if (!freenodes.empty())
+        {
+            int32_t idx = freenodes.back();
+            freenodes.pop_back();
+            nodes[idx] = n;
+            return idx;
+        }
+        nodes.push_back(n);
+        return int32_t(nodes.size() - 1);
+    }
+
+    uint32_t SizeOf(int32_t t) const { return (t >= 0) ? nodes[t].size : 0; }
+    void Pull(int32_t t) { nodes[t].size = 1 + SizeOf(nodes[t].left) + SizeOf(nodes[t].right); }
+
+    // Whether node a ranks ahead of node b
+    bool Before(int32_t a, int32_t b) const
+    {
+        if (nodes[b].score < nodes[a].score)
+            return true;
+        if (nodes[a].score < nodes[b].score)
+            return false;
+        return nodes[a].tiebreak < nodes[b].tiebreak;
+    }
+
+    // Splits t into the nodes ranking ahead of idx and the rest
+    void Split(int32_t t, int32_t idx, int32_t & l, int32_t & r)
+    {
+        if (t < 0)
+        {
+            l = r = -1;
+            return;
+        }
+        if (Before(t, idx))
+        {
+            Split(nodes[t].right, idx, nodes[t].right, r);
+            l = t;
+        }
+        else
+        {
+            Split(nodes[t].left, idx, l, nodes[t].left);
+            r = t;
+        }
+        Pull(t);
+    }
+
+    // Joins two subtrees where every node of a ranks ahead of every node of b
+    int32_t Merge(int32_t a, int32_t b)
+    {
+        if (a < 0)
+            return b;
+        if (b < 0)
+            return a;
+        if (nodes[a].priority > nodes[b].priority)
+        {
+            nodes[a].right = Merge(nodes[a].right, b);
+            Pull(a);
+            return a;
+        }
+        nodes[b].left = Merge(a, nodes[b].left);
+        Pull(b);
+        return b;
+    }
+
+    int32_t Insert(int32_t t, int32_t idx)
+    {
+        if (t < 0)
+            return idx;
+        if (nodes[idx].priority > nodes[t].priority)
+        {
+            Split(t, idx, nodes[idx].left, nodes[idx].right);
+            Pull(idx);
+            return idx;
+        }
+        if (Before(idx, t))
+            nodes[t].left = Insert(nodes[t].left, idx);
+        else
+            nodes[t].right = Insert(nodes[t].right, idx);
+        Pull(t);
+        return t;
+    }
+
+    int32_t Erase(int32_t t, int32_t idx)
+    {
+        if (t == idx)
+            return Merge(nodes[t].left, nodes[t].right);
+        if (Before(idx, t))
+            nodes[t].left = Erase(nodes[t].left, idx);
+        else
+            nodes[t].right = Erase(nodes[t].right, idx);
+        Pull(t);
+        return t;
+    }
+
+    std::vector<node> nodes;
+    std::vector<int32_t> freenodes;
+    std::unordered_map<T, int32_t> lookup;
+    int32_t root = -1;
+    uint32_t epoch = 0;
+    uint32_t seed = 2463534242u;
+};
@@ -51,29 +51,49 @@
 
 request_handler::request_handler()
 {
+    pcommon::Register(commands);
+    preport::Register(commands);
+    pserver::Register(commands);
+    pcastle::Register(commands);
+    pfield::Register(commands);
+    pquest::Register(commands);
+    palliance::Register(commands);
+    ptech::Register(commands);
+    plogin::Register(commands);
+    prank::Register(commands);
+    ptrade::Register(commands);
+    pshop::Register(commands);
+    pmail::Register(commands);
+    pfortifications::Register(commands);
+    ptroop::Register(commands);
+    pinterior::Register(commands);
+    phero::Register(commands);
+    pfriend::Register(commands);
+    pcity::Register(commands);
+    pfurlough::Register(commands);
+    parmy::Register(commands);
+    pgameclient::Register(commands);
+    commands.Build();
 }
 
 void request_handler::handle_request(spitfire & server, request& req) const
 {
     amf3object & obj = req.object;
-    std::string cmd = obj["cmd"];
+    std::string cmd = obj[atoms::cmd];
 
     amf3object obj2 = amf3object();
-    obj2["cmd"] = "";
-    amf3object & data2 = obj2["data"];
+    obj2[atoms::cmd] = "";
+    amf3object & data2 = obj2[atoms::data];
     data2 = amf3object();
 
     server.log->trace("packet: size: {0:5d} - Command: {1}", req.size, cmd);
 
-    std::vector<std::string> tokens;
-    my_split(tokens, cmd, ".");
-    //boost::split(tokens, cmd, boost::is_any_of("."));
-
     std::string cmdtype, command;
 
-    cmdtype = tokens[0];
-    if (tokens.size() > 1)
-        command = tokens[1];
+    size_t dot = cmd.find('.');
+    cmdtype = cmd.substr(0, dot);
+    if (dot != std::string::npos)
+        command = cmd.substr(dot + 1);
 
     connection & c = *req.conn;
     Client * client = c.client_;
@@ -95,137 +115,22 @@ void request_handler::handle_request(spitfire & server, request& req) const
         server.SendMessage(client, cmd);
     }
 
+    const stCommandHandler * handler = commands.Find(cmd);
+    if (handler == nullptr)
+        handler = commands.FindModule(cmdtype);
+
+    req.cmdtype = cmdtype;
+    req.command = command;
+    req.commandid = (handler != nullptr) ? handler->id : -1;
+
     try
     {
-        if (cmdtype == "common")
-        {
-            pcommon pkt(server, req, obj);
-            pkt.check();
-            pkt.process();
-        }
-        else if (cmdtype == "report")
-        {
-            preport pkt(server, req, obj);
-            pkt.check();
-            pkt.process();
-        }
-        else if (cmdtype == "server")
-        {
-            pserver pkt(server, req, obj);
-            pkt.check();
-            pkt.process();
-        }
-        else if (cmdtype == "castle")
-        {
-            pcastle pkt(server, req, obj);
-            pkt.check();
-            pkt.process();
-        }
-        else if (cmdtype == "field")
-        {
-            pfield pkt(server, req, obj);
-            pkt.check();
-            pkt.process();
-        }
-        else if (cmdtype == "quest")
+        if (handler != nullptr)
         {
-            pquest pkt(server, req, obj);
-            pkt.check();
-            pkt.process();
-        }
-        else if (cmdtype == "alliance")
-        {
-            palliance pkt(server, req, obj);
-            pkt.check();
-            pkt.process();
-        }
-        else if (cmdtype == "tech")
-        {
-            ptech pkt(server, req, obj);
-            pkt.check();
-            pkt.process();
-        }
-        else if (cmdtype == "login")
-        {
-            plogin pkt(server, req, obj);
-            pkt.process();
-        }
-        else if (cmdtype == "rank")
-        {
-            prank pkt(server, req, obj);
-            pkt.check();
-            pkt.process();
-        }
-        else if (cmdtype == "trade")
-        {
-            ptrade pkt(server, req, obj);
-            pkt.check();
-            pkt.process();
-        }
-        else if (cmdtype == "shop")
-        {
-            pshop pkt(server, req, obj);
-            pkt.check();
-            pkt.process();
-        }
-        else if (cmdtype == "mail")
-        {
-            pmail pkt(server, req, obj);
-            pkt.check();
-            pkt.process();
-        }
-        else if (cmdtype == "fortifications")
-        {
-            pfortifications pkt(server, req, obj);
-            pkt.check();
-            pkt.process();
-        }
-        else if (cmdtype == "troop")
-        {
-            ptroop pkt(server, req, obj);
-            pkt.check();
-            pkt.process();
-        }
-        else if (cmdtype == "interior")
-        {
-            pinterior pkt(server, req, obj);
-            pkt.check();
-            pkt.process();
-        }
-        else if (cmdtype == "hero")
-        {
-            phero pkt(server, req, obj);
-            pkt.check();
-            pkt.process();
-        }
-        else if (cmdtype == "friend")
-        {
-            pfriend pkt(server, req, obj);
-            pkt.check();
-            pkt.process();
-        }
-        else if (cmdtype == "city")
-        {
-            pcity pkt(server, req, obj);
-            pkt.check();
-            pkt.process();
-        }
-        else if (cmdtype == "furlough")
-        {
-            pfurlough pkt(server, req, obj);
-            pkt.check();
-            pkt.process();
-        }
-        else if (cmdtype == "army")
-        {
-            parmy pkt(server, req, obj);
-            pkt.check();
-            pkt.process();
-        }
-        else if (cmdtype == "gameClient")
-        {
-            pgameclient pkt(server, req, obj);
-            pkt.process();
+            std::unique_ptr<packet> pkt(handler->create(server, req, obj));
+            if (handler->checkclient)
+                pkt->check();
+            pkt->process();
         }
         else
         {
@@ -11,6 +11,7 @@
 #include <asio.hpp>
 #include "amf3.h"
 #include "Utils.h"
+#include "command_registry.h"
 
 class connection;
 class spitfire;
@@ -54,6 +55,7 @@ struct request
         uri = "";
         object = amf3object();
         conn = nullptr;
+        commandid = -1;
     }
     request(const request & req)
     {
@@ -62,12 +64,20 @@ struct request
         uri = req.uri;
         object = req.object;
         conn = req.conn;
+        cmdtype = req.cmdtype;
+        command = req.command;
+        commandid = req.commandid;
     }
     int32_t size;
     std::string cmd;
     std::string uri;
     amf3object object;
     connection * conn;
+
+    // filled in by request_handler before dispatch
+    std::string cmdtype;
+    std::string command;
+    int32_t commandid;
 };
 
 /// The common handler for all incoming requests.
@@ -81,4 +91,8 @@ public:
 
     /// Handle a request and produce a reply.
     void handle_request(spitfire & server, request& req) const;
+
+private:
+    /// Every packet module's commands, keyed by the full command string.
+    command_registry commands;
 };
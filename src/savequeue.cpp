@@ -0,0 +1,47 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#include "savequeue.h"
+
+void savequeue::Push(std::vector<savejob> && jobs)
+{
+    if (jobs.empty())
+        return;
+    {
+        std::lock_guard<std::mutex> l(mtx);
+        queue.push_back(std::move(jobs));
+    }
+    cv.notify_one();
+}
+
+bool savequeue::Wait(std::vector<std::vector<savejob>> & groups)
+{
+    std::unique_lock<std::mutex> l(mtx);
+    cv.wait(l, [this] { return stopped || !queue.empty(); });
+    if (queue.empty())
+        return false;
+    groups.swap(queue);
+    queue.clear();
+    return true;
+}
+
+void savequeue::Stop()
+{
+    {
+        std::lock_guard<std::mutex> l(mtx);
+        stopped = true;
+    }
+    cv.notify_one();
+}
+
+std::size_t savequeue::Pending()
+{
+    std::lock_guard<std::mutex> l(mtx);
+    std::size_t count = 0;
+    for (auto & group : queue)
+        count += group.size();
+    return count;
+}
@@ -0,0 +1,60 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+class storageconn;
+
+/// One write captured on the game thread. It owns copies of every value it
+/// binds, so the saver can run it without touching live game state.
+struct savejob
+{
+    savejob() {}
+    explicit savejob(std::function<void(storageconn &)> write, std::function<void()> failed = nullptr)
+        : write(std::move(write))
+        , failed(std::move(failed))
+    {
+    }
+
+    void operator()(storageconn & db) { write(db); }
+
+    std::function<void(storageconn &)> write;
+    /// Runs on the game thread under worldmtx if the write could not be
+    /// committed, to queue what it covered for the next flush. Without one
+    /// the write itself goes into the next flush.
+    std::function<void()> failed;
+};
+
+/// Hand-off between the game thread, which pushes batches of snapshots, and
+/// the save thread, which drains them onto its own storage connections.
+/// Each push stays a group: jobs within a group may run in any order, groups
+/// run in the order they were pushed.
+class savequeue
+{
+public:
+    void Push(std::vector<savejob> && jobs);
+
+    /// Blocks until there are jobs or Stop() was called. Moves every pending
+    /// group into groups; returns false once stopped and fully drained.
+    bool Wait(std::vector<std::vector<savejob>> & groups);
+
+    void Stop();
+    /// Number of jobs not yet taken by Wait
+    std::size_t Pending();
+
+private:
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::vector<std::vector<savejob>> queue;
+    bool stopped = false;
+};
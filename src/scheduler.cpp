@@ -0,0 +1,124 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#include "scheduler.h"
+
+#include <limits>
+
+std::size_t scheduler::keyhash::operator()(const stScheduleKey & key) const
+{
+    uint64_t h = uint64_t(key.id) * 0x9E3779B97F4A7C15ull;
+    h ^= (uint64_t(uint32_t(key.param)) << 8) ^ uint8_t(key.type);
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 32;
+    return std::size_t(h);
+}
+
+bool scheduler::Schedule(const stScheduleKey & key, uint64_t due)
+{
+    auto iter = positions.find(key);
+    if (iter == positions.end())
+    {
+        heap.push_back(entry{ due, key });
+        positions.emplace(key, heap.size() - 1);
+        SiftUp(heap.size() - 1);
+    }
+    else
+    {
+        std::size_t pos = iter->second;
+        uint64_t old = heap[pos].due;
+        heap[pos].due = due;
+        if (due < old)
+            SiftUp(pos);
+        else
+            SiftDown(pos);
+    }
+    return heap.front().key == key;
+}
+
+bool scheduler::Cancel(const stScheduleKey & key)
+{
+    auto iter = positions.find(key);
+    if (iter == positions.end())
+        return false;
+    Erase(iter->second);
+    return true;
+}
+
+bool scheduler::PopDue(uint64_t now, stScheduleKey & key)
+{
+    if (heap.empty() || heap.front().due > now)
+        return false;
+    key = heap.front().key;
+    Erase(0);
+    return true;
+}
+
+uint64_t scheduler::NextDue() const
+{
+    if (heap.empty())
+        return std::numeric_limits<uint64_t>::max();
+    return heap.front().due;
+}
+
+void scheduler::Place(std::size_t pos, const entry & e)
+{
+    heap[pos] = e;
+    positions[e.key] = pos;
+}
+
+void scheduler::SiftUp(std::size_t pos)
+{
+    entry e = heap[pos];
+    while (pos > 0)
+    {
+        std::size_t parent = (pos - 1) / 2;
+        if (heap[parent].due <= e.due)
+            break;
+        Place(pos, heap[parent]);
+        pos = parent;
+    }
+    Place(pos, e);
+}
+
+void scheduler::SiftDown(std::size_t pos)
+{
+    entry e = heap[pos];
+    std::size_t count = heap.size();
+    for (;;)
+    {
+        std::size_t child = pos * 2 + 1;
+        if (child >= count)
+            break;
+        if (child + 1 < count && heap[child + 1].due < heap[child].due)
+            ++child;
+        if (e.due <= heap[child].due)
+            break;
+        Place(pos, heap[child]);
+        pos = child;
+    }
+    Place(pos, e);
+}
+
+void scheduler::Erase(std::size_t pos)
+{
+    positions.erase(heap[pos].key);
+    std::size_t last = heap.size() - 1;
+    if (pos != last)
+    {
+        Place(pos, heap[last]);
+        heap.pop_back();
+        if (pos > 0 && heap[pos].due < heap[(pos - 1) / 2].due)
+            SiftUp(pos);
+        else
+            SiftDown(pos);
+    }
+    else
+    {
+        heap.pop_back();
+    }
+}
@@ -0,0 +1,64 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+/// Identifies what a deadline belongs to. The meaning of id and param
+/// depends on type (see the DEF_TIMED* defines).
+struct stScheduleKey
+{
+    int8_t type = 0;
+    int64_t id = 0;
+    int32_t param = 0;
+
+    bool operator==(const stScheduleKey & b) const
+    {
+        return type == b.type && id == b.id && param == b.param;
+    }
+};
+
+/// Indexed binary min-heap of deadlines in ms. Each key has at most one
+/// pending deadline, scheduling a key that is already pending moves it.
+/// Not thread safe, owners serialize access.
+class scheduler
+{
+public:
+    /// Add or move a deadline. Returns true if it is now the earliest one.
+    bool Schedule(const stScheduleKey & key, uint64_t due);
+    bool Cancel(const stScheduleKey & key);
+
+    /// Remove the earliest deadline if it is at or before now
+    bool PopDue(uint64_t now, stScheduleKey & key);
+
+    /// Earliest pending deadline, UINT64_MAX when there is none
+    uint64_t NextDue() const;
+
+    std::size_t Size() const { return heap.size(); }
+
+private:
+    struct entry
+    {
+        uint64_t due;
+        stScheduleKey key;
+    };
+    struct keyhash
+    {
+        std::size_t operator()(const stScheduleKey & key) const;
+    };
+
+    void Place(std::size_t pos, const entry & e);
+    void SiftUp(std::size_t pos);
+    void SiftDown(std::size_t pos);
+    void Erase(std::size_t pos);
+
+    std::vector<entry> heap;
+    std::unordered_map<stScheduleKey, std::size_t, keyhash> positions;
+};
@@ -0,0 +1,187 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#include "snapshot.h"
+#include "Utils.h"
+
+#include <Poco/Checksum.h>
+
+#include <cstdio>
+#include <fstream>
+
+namespace
+{
+    const std::size_t headersize = 32;
+    const std::size_t entrysize = 32;
+
+    uint32_t Crc(const char * data, std::size_t size)
+    {
+        Poco::Checksum crc(Poco::Checksum::TYPE_CRC32);
+        crc.update(data, static_cast<unsigned int>(size));
+        return crc.checksum();
+    }
+
+    std::size_t Align(std::size_t offset)
+    {
+        return (offset + 7) & ~std::size_t(7);
+    }
+}
+
+snapshotwriter::snapshotwriter(uint64_t flushstamp)
+    : flushstamp(flushstamp)
+{
+}
+
+bool snapshotwriter::Save(const std::string & path, std::string & error) const
+{
+    using snapshotcodec::Put;
+
+    // header and table first, with the offsets the sections will land at
+    std::string head;
+    head.append(snapshotcodec::magic, 4);
+    Put(head, snapshotcodec::version);
+    Put(head, uint64_t(Utils::time()));
+    Put(head, flushstamp);
+    Put(head, uint32_t(sections.size()));
+    Put(head, uint32_t(0));
+
+    std::size_t offset = Align(headersize + entrysize * sections.size());
+    for (const section & s : sections)
+    {
+        Put(head, s.id);
+        Put(head, Crc(s.data.data(), s.data.size()));
+        Put(head, s.rows);
+        Put(head, uint64_t(offset));
+        Put(head, uint64_t(s.data.size()));
+        offset = Align(offset + s.data.size());
+    }
+    uint32_t headcrc = Crc(head.data(), head.size());
+    std::memcpy(&head[headersize - 4], &headcrc, 4);
+
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out)
+        {
+            error = "unable to open " + tmp;
+            return false;
+        }
+        const char zeros[8] = {};
+        out.write(head.data(), head.size());
+        out.write(zeros, Align(head.size()) - head.size());
+        for (const section & s : sections)
+        {
+            out.write(s.data.data(), s.data.size());
+            out.write(zeros, Align(s.data.size()) - s.data.size());
+        }
+        out.flush();
+        if (!out)
+        {
+            error = "unable to write " + tmp;
+            return false;
+        }
+    }
+
+    // rename does not replace an existing file on every platform
+    std::remove(path.c_str());
+    if (std::rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        error = "unable to rename " + tmp + " to " + path;
+        return false;
+    }
+    return true;
+}
+
+bool snapshotreader::Open(const std::string & path, std::string & error)
+{
+    using snapshotcodec::Get;
+
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in)
+    {
+        error = "no snapshot at " + path;
+        return false;
+    }
+    std::streamoff size = in.tellg();
+    if (size < std::streamoff(headersize))
+    {
+        error = "snapshot is truncated";
+        return false;
+    }
+    file.resize(std::size_t(size));
+    in.seekg(0);
+    if (!in.read(file.data(), size))
+    {
+        error = "unable to read " + path;
+        return false;
+    }
+
+    const char * pos = file.data();
+    const char * end = file.data() + file.size();
+    uint32_t version = 0, count = 0, crc = 0;
+    if (std::memcmp(pos, snapshotcodec::magic, 4) != 0)
+    {
+        error = "not a snapshot file";
+        return false;
+    }
+    pos += 4;
+    Get(pos, end, version);
+    Get(pos, end, created);
+    Get(pos, end, flushstamp);
+    Get(pos, end, count);
+    Get(pos, end, crc);
+    if (version != snapshotcodec::version)
+    {
+        error = "unsupported snapshot version " + std::to_string(version);
+        return false;
+    }
+    if (std::size_t(end - pos) / entrysize < count)
+    {
+        error = "snapshot is truncated";
+        return false;
+    }
+
+    // the checksum covers the header with its own field zeroed, and the table
+    std::string head(file.data(), headersize + entrysize * count);
+    std::memset(&head[headersize - 4], 0, 4);
+    if (Crc(head.data(), head.size()) != crc)
+    {
+        error = "snapshot header checksum mismatch";
+        return false;
+    }
+
+    entries.resize(count);
+    for (entry & e : entries)
+    {
+        Get(pos, end, e.id);
+        Get(pos, end, e.crc);
+        Get(pos, end, e.rows);
+        Get(pos, end, e.offset);
+        Get(pos, end, e.bytes);
+        if (e.offset > file.size() || e.bytes > file.size() - e.offset)
+        {
+            error = "snapshot is truncated";
+            return false;
+        }
+    }
+    return true;
+}
+
+const snapshotreader::entry * snapshotreader::Find(uint32_t id) const
+{
+    for (const entry & e : entries)
+    {
+        if (e.id != id)
+            continue;
+        // every row takes at least one byte, so a larger count is damage
+        if (e.rows > e.bytes)
+            return nullptr;
+        if (Crc(file.data() + e.offset, std::size_t(e.bytes)) != e.crc)
+            return nullptr;
+        return &e;
+    }
+    return nullptr;
+}
@@ -0,0 +1,166 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/// Binary image of the world for a warm restart. Numbers are stored at their
+/// native width in host byte order (little-endian everywhere we ship; a file
+/// from another byte order fails the version check).
+///  - header: "SFWS", format version, creation time, flush stamp, section
+///    count and a crc32 over the header and section table
+///  - section table: id, crc32, row count, offset and size of each section
+///  - sections, each on an 8 byte boundary: rows back to back, strings as a
+///    32 bit length followed by the bytes
+/// Sections are found through the table alone, so the file can be read in
+/// one sequential pass or mapped, and each section checked on its own.
+namespace snapshotcodec
+{
+    const char magic[4] = { 'S', 'F', 'W', 'S' };
+    // 2 added SECTION_EVICTED, which the loader needs to trust the mail
+    // and reports sections; 3 added each evicted account's next mail pid
+    const uint32_t version = 3;
+
+    template<typename T>
+    inline void Put(std::string & out, const T & value)
+    {
+        static_assert(std::is_arithmetic<T>::value, "snapshot fields are numbers or strings");
+        out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+    inline void Put(std::string & out, const std::string & value)
+    {
+        Put(out, uint32_t(value.size()));
+        out += value;
+    }
+
+    template<typename T>
+    inline bool Get(const char *& pos, const char * end, T & value)
+    {
+        static_assert(std::is_arithmetic<T>::value, "snapshot fields are numbers or strings");
+        if (std::size_t(end - pos) < sizeof(T))
+            return false;
+        std::memcpy(&value, pos, sizeof(T));
+        pos += sizeof(T);
+        return true;
+    }
+    inline bool Get(const char *& pos, const char * end, std::string & value)
+    {
+        uint32_t length;
+        if (!Get(pos, end, length) || std::size_t(end - pos) < length)
+            return false;
+        value.assign(pos, length);
+        pos += length;
+        return true;
+    }
+
+    // Rows are Poco::Tuples, written field by field in column order
+    template<int N = 0, typename Row>
+    inline void PutRow(std::string & out, const Row & row)
+    {
+        if constexpr (N < int(Row::length))
+        {
+            Put(out, row.template get<N>());
+            PutRow<N + 1>(out, row);
+        }
+    }
+    template<int N = 0, typename Row>
+    inline bool GetRow(const char *& pos, const char * end, Row & row)
+    {
+        if constexpr (N < int(Row::length))
+            return Get(pos, end, row.template get<N>()) && GetRow<N + 1>(pos, end, row);
+        else
+            return true;
+    }
+}
+
+/// Collects sections in memory and writes them out in one go
+class snapshotwriter
+{
+public:
+    explicit snapshotwriter(uint64_t flushstamp);
+
+    template<typename Row>
+    void Section(uint32_t id, const std::vector<Row> & rows)
+    {
+        sections.push_back({ id, rows.size(), std::string() });
+        std::string & data = sections.back().data;
+        for (const Row & row : rows)
+            snapshotcodec::PutRow(data, row);
+    }
+
+    /// Writes to path + ".tmp" and renames that over path, so a failed
+    /// write leaves the previous snapshot in place
+    bool Save(const std::string & path, std::string & error) const;
+
+private:
+    struct section
+    {
+        uint32_t id;
+        uint64_t rows;
+        std::string data;
+    };
+
+    uint64_t flushstamp;
+    std::vector<section> sections;
+};
+
+/// Loads a snapshot file and decodes its sections on request
+class snapshotreader
+{
+public:
+    /// Reads the file and verifies its header; false with error set if it
+    /// is missing, truncated, damaged or of another format version
+    bool Open(const std::string & path, std::string & error);
+
+    /// Time the snapshot was written
+    uint64_t Created() const { return created; }
+    /// Save marker of the flush the snapshot was taken right after
+    uint64_t FlushStamp() const { return flushstamp; }
+
+    /// Decodes section id into rows; false if it is missing, fails its
+    /// checksum or does not hold exactly its row count
+    template<typename Row>
+    bool Section(uint32_t id, std::vector<Row> & rows) const
+    {
+        const entry * e = Find(id);
+        if (e == nullptr)
+            return false;
+        const char * pos = file.data() + e->offset;
+        const char * end = pos + e->bytes;
+        rows.clear();
+        rows.resize(std::size_t(e->rows));
+        for (Row & row : rows)
+        {
+            if (!snapshotcodec::GetRow(pos, end, row))
+                return false;
+        }
+        return pos == end;
+    }
+
+private:
+    struct entry
+    {
+        uint32_t id;
+        uint32_t crc;
+        uint64_t rows;
+        uint64_t offset;
+        uint64_t bytes;
+    };
+
+    /// Entry for id with a verified checksum, nullptr otherwise
+    const entry * Find(uint32_t id) const;
+
+    std::vector<char> file;
+    std::vector<entry> entries;
+    uint64_t created = 0;
+    uint64_t flushstamp = 0;
+};
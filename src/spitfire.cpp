@@ -9,6 +9,23 @@
 
 #include <fstream>
 #include <thread>
+#include <future>
+#include <atomic>
+#include <algorithm>
+#include <iterator>
+#include <cerrno>
+#include <cstring>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#ifndef WIN32
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 // #include <boost/smart_ptr/shared_ptr.hpp>
 // #include <boost/smart_ptr/make_shared_object.hpp>
@@ -57,6 +74,12 @@
 #include "combatsimulator.h"
 #include "Valley.h"
 #include "xml_writer.hpp"
+#include "snapshot.h"
+#include "mysqlstorage.h"
+#include "memorystorage.h"
+
+#include <map>
+#include <tuple>
 
 #define DEF_NOMAPDATA
 
@@ -72,7 +95,6 @@ using Poco::Data::Statement;
 
 spitfire::spitfire()
     : signals_(io_service_)
-    , acceptor_(io_service_)
     , socket_(io_service_)
     , request_handler_()
     , acceptorpolicy_(io_service_)
@@ -88,6 +110,9 @@ spitfire::spitfire()
 
     accountpool = nullptr;
     serverpool = nullptr;
+    accountdb = nullptr;
+    serverdb = nullptr;
+    store = nullptr;
 
     SaveThreadRunning = false;
     serverstatus = SERVERSTATUS_STOPPED;//offline
@@ -129,6 +154,9 @@ spitfire::~spitfire()
 {
     if (map)
         delete map;
+    delete accountdb;
+    delete serverdb;
+    delete store;
     delete accountpool;
     delete serverpool;
     MySQL::Connector::unregisterConnector();
@@ -142,6 +170,59 @@ void spitfire::io_thread()
     io_service_.run();
 }
 
+void spitfire::shard_thread(netshard & shard)
+{
+    srand(static_cast<int32_t>(Utils::time()) ^ shard.id);
+
+    if (shard.cpu >= 0)
+    {
+#ifdef __linux__
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(shard.cpu, &cpuset);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0)
+            log->error("Unable to pin network shard {} to cpu {}", shard.id, shard.cpu);
+#elif defined(WIN32)
+        if (!SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << shard.cpu))
+            log->error("Unable to pin network shard {} to cpu {}", shard.id, shard.cpu);
+#endif
+    }
+
+    asio::io_service::work work(shard.io_service);
+    shard.io_service.run();
+}
+
+// Mail and reports as the loader and Fault rebuild them from rows
+static stMail MailOf(const MailRow & row)
+{
+    stMail mail;
+    mail.title = row.get<1>();
+    mail.content = row.get<2>();
+    mail.senttime = row.get<3>();
+    mail.readtime = row.get<4>();
+    mail.mailid = row.get<5>();
+    mail.playerid = row.get<6>();
+    mail.type_id = row.get<7>();
+    return mail;
+}
+
+static stReport ReportOf(const ReportRow & row, uint32_t reportid)
+{
+    stReport r;
+    r.armytype = row.get<1>();
+    r.back = row.get<2>();
+    r.attack = row.get<3>();
+    r.type_id = row.get<4>();
+    r.startpos = row.get<5>();
+    r.targetpos = row.get<6>();
+    r.title = row.get<7>();
+    r.guid = row.get<8>();
+    r.eventtime = row.get<9>();
+    r.isread = row.get<10>();
+    r.reportid = reportid;
+    return r;
+}
+
 void spitfire::run()
 {
     printf("Start up procedure\n");
@@ -177,9 +258,6 @@ void spitfire::run()
     //    Statement stmt = ( ses << "SELECT * FROM account WHERE `name`=? AND `password`=?", use(username), use(password), into(account), now );
     //    account.get<0>()
 
-    int count = 0;
-
-
     //     if (rs.rowCount() == 0)
     //     {
     //         //no settings exist
@@ -507,46 +585,101 @@ void spitfire::run()
         log->error("std::exception: {} {} {}", file, __LINE__, e.what());
     }
 
-    log->info("Loading map data.");
+    uint64_t loadstart = Utils::time();
 
+    // A snapshot is used instead of the DB when it was taken no earlier than
+    // the last flush the DB committed. If its own flush never committed, what
+    // was loaded from it is saved again so the DB catches up.
+    uint64_t savemarker = 0;
+    if (!ReadSaveMarker(savemarker))
+        return;
+    flushstamp = savemarker;
+    savedstamp = savemarker;
 
-#ifndef DEF_NOMAPDATA
+    worldrows world;
+    uint64_t snapshotstamp = 0;
+    bool fromsnapshot = !snapshotfile.empty() && ReadSnapshot(world, savemarker, snapshotstamp);
+    bool snapshotahead = fromsnapshot && snapshotstamp > savemarker;
+
+    if (!fromsnapshot)
     {
-        Poco::Data::Session ses2(serverpool->get());
-        Statement select(ses2);
-        select << "SELECT `id`,`ownerid`,`type`,`level` FROM `tiles` ORDER BY `id` ASC;";
-        select.execute();
-        RecordSet rs(select);
+        log->info("Fetching world data.");
+
+        // The store fetches its tables side by side where it can. Linking
+        // the rows into the world below stays on this thread and runs in
+        // dependency order.
+        try
+        {
+            // accounts that would have been evicted by now start out evicted
+            uint64_t idlebefore = (evictafter > 0 && loadstart > evictafter) ? loadstart - evictafter : 0;
+#ifndef DEF_NOMAPDATA
+            store->LoadWorld(world, loadchunk, true, idlebefore);
+#else
+            store->LoadWorld(world, loadchunk, false, idlebefore);
+#endif
+        }
+        SQLCATCH(return;);
 
-        rs.moveFirst();
+        log->info("Fetched world data in {}ms.", Utils::time() - loadstart);
+    }
 
-        do
+    // What changed after the flush the rows are as of, if the last run did
+    // not get to save it
+    uint64_t loadedstamp = fromsnapshot ? snapshotstamp : savemarker;
+    bool replayed = false;
+    if (!journaldir.empty())
+    {
+        // may read evicted histories back from the store
+        try
         {
-            int64_t id = rs.value("id").convert<int64_t>();
-            int64_t ownerid = rs.value("ownerid").convert<int64_t>();
-            int64_t type = rs.value("type").convert<int64_t>();
-            int64_t level = rs.value("level").convert<int64_t>();
+            replayed = ReplayJournal(world, loadedstamp);
+        }
+        SQLCATCH(return;);
+    }
 
-            map->m_tile[id].m_id = id;
-            map->m_tile[id].m_ownerid = ownerid;
-            map->m_tile[id].m_type = type;
-            map->m_tile[id].m_level = level;
+#ifndef DEF_NOMAPDATA
+    std::vector<TileRow> & tilerows = world.tiles;
+#endif
+    std::vector<AccountRow> & accountrows = world.accounts;
+    std::vector<MailRow> & mailrows = world.mail;
+    std::vector<CityRow> & cityrows = world.cities;
+    std::vector<HeroRow> & herorows = world.heroes;
+    std::vector<AllianceRow> & alliancerows = world.alliances;
+    std::vector<ArmyRow> & armyrows = world.armies;
+    std::vector<ReportRow> & reportrows = world.reports;
+
+    uint64_t phasestart = Utils::time();
+    auto phasedone = [&](const char * phase, size_t rows)
+    {
+        uint64_t t = Utils::time();
+        log->info("Linked {} {} in {}ms.", rows, phase, t - phasestart);
+        phasestart = t;
+    };
 
-            if (type == NPC)
-            {
-                NpcCity * city = (NpcCity *)AddNpcCity(id);
-                city->Initialize(true, true);
-                city->m_level = level;
-                city->m_ownerid = ownerid;
-                map->m_tile[id].m_zoneid = map->GetStateFromID(id);
-            }
+#ifndef DEF_NOMAPDATA
+    for (const TileRow & row : tilerows)
+    {
+        int64_t id = row.get<0>();
+        int64_t ownerid = row.get<1>();
+        int64_t type = row.get<2>();
+        int64_t level = row.get<3>();
 
-            if ((id + 1) % ((mapsize*mapsize) / 100) == 0)
-            {
-                log->info(fmt::format("{}%", int((double(double(id + 1) / (mapsize*mapsize)))*double(100))));
-            }
-        } while (rs.moveNext());
+        map->m_tile[id].m_id = id;
+        map->m_tile[id].m_ownerid = ownerid;
+        map->m_tile[id].m_type = type;
+        map->m_tile[id].m_level = level;
+
+        if (type == NPC)
+        {
+            NpcCity * city = (NpcCity *)AddNpcCity(id);
+            city->Initialize(true, true);
+            city->m_level = level;
+            city->m_ownerid = ownerid;
+            map->m_tile[id].m_zoneid = map->GetStateFromID(id);
+        }
     }
+    phasedone("tiles", tilerows.size());
+    std::vector<TileRow>().swap(tilerows);
 #else
     //this fakes map data
     int32_t maparea=mapsize*mapsize;
@@ -577,256 +710,191 @@ void spitfire::run()
             log->info("{}%", int((double(double(x + 1) / maparea))*double(100)));
         }
     }
+    phasedone("generated tiles", maparea);
 #endif
 
     map->CalculateOpenTiles();
 
-    log->info("Loading account data.");
-
-    uint64_t accountcount = 0;
+    for (const AccountRow & row : accountrows)
     {
-        Poco::Data::Session ses2(serverpool->get());
-        Statement select(ses2);
-        select << "SELECT COUNT(*) AS a FROM `accounts`;";
-        select.execute();
-        RecordSet rs(select);
-
-        rs.moveFirst();
-        accountcount = rs.value("a").convert<uint64_t>();
+        Client * client = NewClient();
+        client->accountexists = true;
+        SetClientAccountId(client, row.get<0>());
+        SetClientParentId(client, row.get<1>());
+        SetClientName(client, row.get<2>());
+        client->password = row.get<3>();
+        client->email = row.get<4>();
+
+        client->allianceid = row.get<5>();
+        client->alliancerank = row.get<6>();
+        client->lastlogin = row.get<7>();
+        client->creation = row.get<8>();
+        client->status = row.get<9>();
+        client->sex = row.get<10>();
+        client->flag = row.get<11>();
+        client->faceurl = row.get<12>();
+        client->cents = row.get<13>();
+        client->Prestige(row.get<14>());
+        client->honor = row.get<15>();
+        RankClient(client);
+
+        client->ParseBuffs(row.get<16>());
+        client->ParseResearch(row.get<17>());
+        client->ParseItems(row.get<18>());
+        client->ParseMisc(row.get<19>());
+        client->lastseen = uint64_t(client->lastlogin);
+
+        client->CheckBeginner(false);
+        ScheduleBeginner(client);
     }
+    phasedone("accounts", accountrows.size());
+    std::vector<AccountRow>().swap(accountrows);
 
+    // their mail and reports stay in the store until faulted in
+    for (const EvictedRow & row : world.evicted)
     {
-        Poco::Data::Session ses2(serverpool->get());
-        //SQLITE//Statement stmt = (ses2 << "SELECT accounts.*,account.email,account.password FROM accounts LEFT JOIN account ON (account.id=accounts.parentid) ORDER BY accounts.accountid ASC;");
-        Statement stmt = (ses2 << "SELECT accounts.*," + dbmaintable + ".account.email," + dbmaintable + ".account.password FROM accounts LEFT JOIN " + dbmaintable + ".account ON (" + dbmaintable + ".account.id=accounts.parentid) ORDER BY accounts.accountid ASC;");
-        stmt.execute();
-        bool test = stmt.done();
-        RecordSet rs(stmt);
-
-        rs.moveFirst();
-
-        for (int i = 0; i < rs.rowCount(); ++i, rs.moveNext())
+        Client * client = GetClient(row.get<0>());
+        if (client != nullptr)
         {
-            count++;
-
-            Client * client = NewClient();
-            client->accountexists = true;
-            client->accountid = rs.value("accountid").convert<int64_t>();
-            client->masteraccountid = rs.value("parentid").convert<int64_t>();
-            client->playername = rs.value("username").convert<std::string>();
-            client->password = rs.value("password").convert<std::string>();
-            client->email = rs.value("email").convert<std::string>();
-
-            client->allianceid = rs.value("allianceid").convert<int32_t>();
-            client->alliancerank = rs.value("alliancerank").convert<int16_t>();
-            client->lastlogin = rs.value("lastlogin").convert<double>();
-            client->creation = rs.value("creation").convert<double>();
-            client->status = rs.value("status").convert<int32_t>();
-            client->sex = rs.value("sex").convert<int32_t>();
-            client->flag = rs.value("flag").convert<std::string>();
-            client->faceurl = rs.value("faceurl").convert<std::string>();
-            client->cents = rs.value("cents").convert<int32_t>();
-            client->Prestige(rs.value("prestige").convert<double>());
-            client->honor = rs.value("honor").convert<double>();
-
-            client->ParseBuffs(rs.value("buffs").convert<std::string>());
-            client->ParseResearch(rs.value("research").convert<std::string>());
-            client->ParseItems(rs.value("items").convert<std::string>());
-            client->ParseMisc(rs.value("misc").convert<std::string>());
-
-            client->CheckBeginner(false);
-
-            try
-            {
-                Poco::Data::Session ses(serverpool->get());
-                Statement select(ses);
-                select << "SELECT * FROM `mail` WHERE `receiverid`=" << client->accountid;
-                select.execute();
-                RecordSet rs(select);
-
-                rs.moveFirst();
-
-                stMail mail;
-
-                for (int i = 0; i < rs.rowCount(); ++i, rs.moveNext())
-                {
-                    mail.title = rs.value("title").convert<std::string>();
-                    mail.content = rs.value("content").convert<std::string>();
-                    mail.senttime = rs.value("senttime").convert<uint64_t>();
-                    mail.readtime = rs.value("readtime").convert<uint64_t>();
-                    mail.mailid = rs.value("pid").convert<int32_t>();
-                    mail.playerid = rs.value("senderid").convert<int64_t>();
-                    mail.type_id = rs.value("type").convert<int8_t>();
-
-                    client->maillist.push_back(mail);
-                    if (client->mailpid <= mail.mailid)
-                        client->mailpid = mail.mailid + 1;
-                }
-            }
-            SQLCATCH(return;);
-
-
-
-
-            if (accountcount > 101)
-            {
-                if ((count) % ((accountcount) / 100) == 0)
-                {
-                    log->info("{}%", int((double(double(count) / accountcount + 1))*double(100)));
-                }
-            }
+            client->evicted = true;
+            client->mailpid = uint32_t(row.get<1>());
         }
     }
 
-
-    log->info("Loading city data.");
-
-
-
-    uint64_t citycount = 0;
-    {
-        Poco::Data::Session ses2(serverpool->get());
-        Statement select(ses2);
-        select << "SELECT COUNT(*) AS a FROM `cities`;";
-        select.execute();
-        RecordSet rs(select);
-
-        rs.moveFirst();
-        citycount = rs.value("a").convert<uint64_t>();
-    }
-
-    count = 0;
-
-
     {
-        Poco::Data::Session ses2(serverpool->get());
-        Statement select(ses2);
-        select << "SELECT * FROM `cities`";
-        select.execute();
-        RecordSet rs(select);
-
-        rs.moveFirst();
-
-        for (auto i = 0; i < rs.rowCount(); ++i, rs.moveNext())
+        // ordered by receiver so consecutive rows mostly reuse the last lookup
+        Client * client = nullptr;
+        for (const MailRow & row : mailrows)
         {
-            count++;
-
-            auto accountid = rs.value("accountid").convert<int64_t>();
-            auto cityid = rs.value("id").convert<int64_t>();
-            auto fieldid = rs.value("fieldid").convert<int32_t>();
-            auto * client = GetClient(accountid);
-            GETXYFROMID(fieldid);
+            if (client == nullptr || client->accountid != row.get<0>())
+                client = GetClient(row.get<0>());
             if (client == nullptr)
-            {
-                log->error("City exists with no account attached. - accountid:{} cityid:{} coord:({},{})", accountid, cityid, xfromid, yfromid);
                 continue;
-            }
-            auto * city = (PlayerCity *)AddPlayerCity(client, fieldid, cityid);
-            city->m_client = client;
-            city->m_resources.food = rs.value("food").convert<double>();
-            city->m_resources.wood = rs.value("wood").convert<double>();
-            city->m_resources.iron = rs.value("iron").convert<double>();
-            city->m_resources.stone = rs.value("stone").convert<double>();
-            city->m_resources.gold = rs.value("gold").convert<double>();
-            city->m_cityname = rs.value("name").convert<std::string>();
-            city->m_logurl = rs.value("logurl").convert<std::string>();
-            city->m_tileid = fieldid;
-            //        city->m_accountid = accountid;
-            //        city->m_client = client;
-            city->m_creation = rs.value("creation").convert<double>();
-
-            //        client->m_citycount++;
-
-            //         server->m_map->m_tile[fieldid].m_city = city;
-            //         server->m_map->m_tile[fieldid].m_npc = false;
-            //         server->m_map->m_tile[fieldid].m_ownerid = accountid;
-            //         server->m_map->m_tile[fieldid].m_type = CASTLE;
-            // 
-            //         //server->m_map->m_tile[fieldid].m_zoneid = server->m_map->GetStateFromID(fieldid);
-            // 
-            //         server->m_map->m_tile[fieldid].m_castleid = cityid;
-
-
-            city->ParseTroops(rs.value("troop").convert<std::string>());
-            city->ParseBuildings(rs.value("buildings").convert<std::string>());
-            city->ParseTroopQueues(rs.value("troopqueues").convert<std::string>());
-            city->ParseFortifications(rs.value("fortification").convert<std::string>());
-            city->ParseMisc(rs.value("misc").convert<std::string>());
-
-            //city->ParseHeroes(msql->GetString(i, "heroes"));
-            //city->ParseTrades(msql->GetString(i, "trades"));
-            //city->ParseArmyMovement(msql->GetString(i, "buffs"));
-
-            {
-                Poco::Data::Session ses2(serverpool->get());
-                Statement select2(ses2);
-                select2 << "SELECT * FROM `heroes` WHERE `castleid`=?", use(city->m_castleid);
-                select2.execute();
-                RecordSet rs2(select2);
 
-                rs2.moveFirst();
+            stMail mail = MailOf(row);
+            client->maillist.push_back(mail);
+            if (client->mailpid <= mail.mailid)
+                client->mailpid = mail.mailid + 1;
+        }
+    }
+    phasedone("mail", mailrows.size());
+    std::vector<MailRow>().swap(mailrows);
 
-                for (int a = 0; a < rs2.rowCount(); ++a, rs2.moveNext())
-                {
-                    Hero * temphero;
-                    temphero = new Hero();
-                    temphero->m_id = rs2.value("id").convert<uint64_t>();
-                    temphero->m_status = rs2.value("status").convert<int8_t>();
-                    temphero->m_itemid = rs2.value("itemid").convert<int32_t>();
-                    temphero->m_itemamount = rs2.value("itemamount").convert<int32_t>();
-                    temphero->m_castleid = cityid;
-                    temphero->m_ownerid = accountid;
-
-                    temphero->m_basestratagem = rs2.value("basestratagem").convert<uint32_t>();
-                    temphero->m_stratagem = rs2.value("stratagem").convert<uint32_t>();
-                    temphero->m_stratagemadded = rs2.value("stratagemadded").convert<uint32_t>();
-                    temphero->m_stratagembuffadded = rs2.value("stratagembuffadded").convert<uint32_t>();
-                    temphero->m_basepower = rs2.value("basepower").convert<uint32_t>();
-                    temphero->m_power = rs2.value("power").convert<uint32_t>();
-                    temphero->m_poweradded = rs2.value("poweradded").convert<uint32_t>();
-                    temphero->m_powerbuffadded = rs2.value("powerbuffadded").convert<uint32_t>();
-                    temphero->m_basemanagement = rs2.value("basemanagement").convert<uint32_t>();
-                    temphero->m_management = rs2.value("management").convert<uint32_t>();
-                    temphero->m_managementadded = rs2.value("managementadded").convert<uint32_t>();
-                    temphero->m_managementbuffadded = rs2.value("managementbuffadded").convert<uint32_t>();
-                    temphero->m_logourl = rs2.value("logurl").convert<std::string>();
-                    temphero->m_name = rs2.value("name").convert<std::string>();
-                    temphero->m_remainpoint = rs2.value("remainpoint").convert<uint32_t>();
-                    temphero->m_level = rs2.value("level").convert<uint32_t>();
-                    temphero->m_upgradeexp = rs2.value("upgradeexp").convert<double>();
-                    temphero->m_experience = rs2.value("experience").convert<double>();
-                    temphero->m_loyalty = rs2.value("loyalty").convert<int8_t>();
-                    if (temphero->m_loyalty>100) temphero->m_loyalty=100;
-                    city->m_heroes[a] = temphero;
-                    city->m_heroes[a]->m_client = client;
-                    if (temphero->m_status == DEF_HEROMAYOR && city->m_mayor)
-                    {
-                        temphero->m_status = DEF_HEROIDLE;
-                    }
-                    if (!city->m_mayor && temphero->m_status == DEF_HEROMAYOR)
-                    {
-                        city->m_mayor = temphero;
-                    }
-                    if (temphero->m_id >= m_heroid)
-                        m_heroid = temphero->m_id + 1;
-                }
-            }
+    // heroes are matched to their cities by id once both tables are in
+    std::unordered_map<int64_t, PlayerCity*> citiesbyid;
+    citiesbyid.reserve(cityrows.size());
 
-            if (cityid >= m_cityid)
-                m_cityid = cityid + 1;
+    for (const CityRow & row : cityrows)
+    {
+        auto accountid = row.get<0>();
+        auto cityid = row.get<1>();
+        auto fieldid = row.get<2>();
+        auto * client = GetClient(accountid);
+        GETXYFROMID(fieldid);
+        if (client == nullptr)
+        {
+            log->error("City exists with no account attached. - accountid:{} cityid:{} coord:({},{})", accountid, cityid, xfromid, yfromid);
+            continue;
+        }
+        auto * city = (PlayerCity *)AddPlayerCity(client, fieldid, cityid);
+        city->m_client = client;
+        city->m_resources.food = row.get<3>();
+        city->m_resources.wood = row.get<4>();
+        city->m_resources.iron = row.get<5>();
+        city->m_resources.stone = row.get<6>();
+        city->m_resources.gold = row.get<7>();
+        city->m_cityname = row.get<8>();
+        city->m_logurl = row.get<9>();
+        city->m_tileid = fieldid;
+        city->m_creation = row.get<10>();
+
+        city->ParseTroops(row.get<11>());
+        city->ParseBuildings(row.get<12>());
+        city->ParseTroopQueues(row.get<13>());
+        city->ParseFortifications(row.get<14>());
+        city->ParseMisc(row.get<15>());
+        RankCastle(city);
+
+        //city->ParseHeroes(msql->GetString(i, "heroes"));
+        //city->ParseTrades(msql->GetString(i, "trades"));
+        //city->ParseArmyMovement(msql->GetString(i, "buffs"));
+
+        citiesbyid[cityid] = city;
+
+        if (cityid >= m_cityid)
+            m_cityid = cityid + 1;
+    }
+    phasedone("cities", cityrows.size());
+    std::vector<CityRow>().swap(cityrows);
 
+    for (const HeroRow & row : herorows)
+    {
+        auto found = citiesbyid.find(row.get<1>());
+        if (found == citiesbyid.end())
+            continue;
+        PlayerCity * city = found->second;
 
-            client->CalculateResources();
+        int slot = 0;
+        while (slot < 10 && city->m_heroes[slot])
+            ++slot;
+        if (slot == 10)
+        {
+            log->error("Hero does not fit in its city. - heroid:{} castleid:{}", row.get<0>(), city->m_castleid);
+            continue;
+        }
 
-            if (citycount > 101)
-            {
-                if ((count) % ((citycount) / 100) == 0)
-                {
-                    log->info("{}%", int((double(double(count) / citycount + 1))*double(100)));
-                }
-            }
+        Hero * temphero;
+        temphero = new Hero();
+        temphero->m_id = row.get<0>();
+        temphero->m_status = row.get<2>();
+        temphero->m_itemid = row.get<3>();
+        temphero->m_itemamount = row.get<4>();
+        temphero->m_castleid = city->m_castleid;
+        temphero->m_ownerid = city->m_client->accountid;
+
+        temphero->m_basestratagem = row.get<5>();
+        temphero->m_stratagem = row.get<6>();
+        temphero->m_stratagemadded = row.get<7>();
+        temphero->m_stratagembuffadded = row.get<8>();
+        temphero->m_basepower = row.get<9>();
+        temphero->m_power = row.get<10>();
+        temphero->m_poweradded = row.get<11>();
+        temphero->m_powerbuffadded = row.get<12>();
+        temphero->m_basemanagement = row.get<13>();
+        temphero->m_management = row.get<14>();
+        temphero->m_managementadded = row.get<15>();
+        temphero->m_managementbuffadded = row.get<16>();
+        temphero->m_logourl = row.get<17>();
+        temphero->m_name = row.get<18>();
+        temphero->m_remainpoint = row.get<19>();
+        temphero->m_level = row.get<20>();
+        temphero->m_upgradeexp = row.get<21>();
+        temphero->m_experience = row.get<22>();
+        temphero->m_loyalty = row.get<23>();
+        if (temphero->m_loyalty>100) temphero->m_loyalty=100;
+        city->m_heroes[slot] = temphero;
+        city->m_heroes[slot]->m_client = city->m_client;
+        if (temphero->m_status == DEF_HEROMAYOR && city->m_mayor)
+        {
+            temphero->m_status = DEF_HEROIDLE;
+        }
+        if (!city->m_mayor && temphero->m_status == DEF_HEROMAYOR)
+        {
+            city->m_mayor = temphero;
         }
+        if (temphero->m_id >= m_heroid)
+            m_heroid = temphero->m_id + 1;
     }
+    phasedone("heroes", herorows.size());
+    std::vector<HeroRow>().swap(herorows);
+
+    for (Client * client : players)
+        client->CalculateResources();
+
+    // recalculating what was just loaded is not a change worth saving
+    for (PlayerCity * city : dirtycities)
+        city->m_dirty = false;
+    dirtycities.clear();
 
 
 
@@ -869,116 +937,64 @@ void spitfire::run()
             }
         }
     }
+    phasedone("client resources and research", players.size());
 
-
-
-    log->info("Loading alliance data.");
-
-
-
-
-    uint64_t alliancecount = 0;
-    {
-        Poco::Data::Session ses2(serverpool->get());
-        Statement select(ses2);
-        select << "SELECT COUNT(*) AS a FROM `alliances`";
-        select.execute();
-        RecordSet rs(select);
-
-        rs.moveFirst();
-        alliancecount = rs.value("a").convert<uint64_t>();
-    }
-
-    count = 0;
-
-
+    for (const AllianceRow & row : alliancerows)
     {
-        Poco::Data::Session ses2(serverpool->get());
-        Statement select(ses2);
-        select << "SELECT * FROM `alliances`";
-        select.execute();
-        RecordSet rs(select);
-
-        rs.moveFirst();
-
-
-
-        Alliance * alliance;
-
-        for (int i = 0; i < rs.rowCount(); ++i, rs.moveNext())
+        Alliance * alliance = m_alliances->CreateAlliance(row.get<1>(), row.get<2>(), row.get<0>(), false);
+        if (alliance == nullptr)
+            throw("Unable to create alliance : " + row.get<1>() + " ID : " + std::to_string(row.get<0>()));
+        //alliance->m_allianceid = msql->GetInt(i, "id");
+        alliance->ParseMembers(row.get<3>());
+        for (Alliance::stMember & member : alliance->m_members)
         {
-            count++;
-            alliance = m_alliances->CreateAlliance(rs.value("name").convert<std::string>(), rs.value("founder").convert<std::string>(), rs.value("id").convert<int64_t>(), false);
-            if (alliance == nullptr)
-                throw("Unable to create alliance : " + rs.value("name").convert<std::string>() + " ID : " + rs.value("id").convert<std::string>());
-            //alliance->m_allianceid = msql->GetInt(i, "id");
-            alliance->ParseMembers(rs.value("members").convert<std::string>());
-            for (Alliance::stMember & member : alliance->m_members)
+            if (member.rank == DEF_ALLIANCEHOST)
             {
-                if (member.rank == DEF_ALLIANCEHOST)
-                {
-                    alliance->m_ownerid = member.clientid;
-                    alliance->m_owner = GetClient(member.clientid)->playername;
-                    break;
-                }
+                alliance->m_ownerid = member.clientid;
+                alliance->m_owner = GetClient(member.clientid)->playername;
+                break;
             }
-            alliance->ParseRelation(&alliance->m_enemies, rs.value("enemies").convert<std::string>());
-            alliance->ParseRelation(&alliance->m_allies, rs.value("allies").convert<std::string>());
-            alliance->ParseRelation(&alliance->m_neutral, rs.value("neutrals").convert<std::string>());
-            alliance->m_name = rs.value("name").convert<std::string>();
-            alliance->m_founder = rs.value("founder").convert<std::string>();
-            alliance->m_note = rs.value("note").convert<std::string>();
-
-            if (alliance->m_allianceid >= m_allianceid)
-                m_allianceid = alliance->m_allianceid + 1;
-
-
-            if (alliancecount > 101)
-                if ((count) % ((alliancecount) / 100) == 0)
-                {
-                    log->info("%d%", int((double(double(count) / alliancecount + 1))*double(100)));
-                }
         }
+        alliance->ParseRelation(&alliance->m_enemies, row.get<4>());
+        alliance->ParseRelation(&alliance->m_allies, row.get<5>());
+        alliance->ParseRelation(&alliance->m_neutral, row.get<6>());
+        alliance->m_name = row.get<1>();
+        alliance->m_founder = row.get<2>();
+        alliance->m_note = row.get<7>();
+
+        if (alliance->m_allianceid >= m_allianceid)
+            m_allianceid = alliance->m_allianceid + 1;
     }
+    phasedone("alliances", alliancerows.size());
+    std::vector<AllianceRow>().swap(alliancerows);
 
-    log->info("Loading army data.");
     {
-        Poco::Data::Session ses2(serverpool->get());
-        Statement select(ses2);
-        select << "SELECT * FROM `armies`";
-        select.execute();
-        RecordSet rs(select);
-
-        rs.moveFirst();
         std::vector<std::string> vec;
-        for (int i = 0; i < rs.rowCount(); ++i, rs.moveNext())
+        for (const ArmyRow & row : armyrows)
         {
-            stArmyMovement* x=new stArmyMovement;
-            Client* l=GetClient(rs.value("clientid").convert<std::int32_t>());
+            Client* l=GetClient(row.get<0>());
             if (l==0) {
-                delete x;
                 continue;
             }
-            x->client=l;
-            PlayerCity* city=l->GetCity(rs.value("cityid").convert<int64_t>());
+            PlayerCity* city=l->GetCity(row.get<1>());
             if (city==0) {
-                delete x;
                 continue;
             }
-            int64_t heroid=rs.value("heroid").convert<int64_t>();
+            int64_t heroid=row.get<2>();
             Hero* hero = nullptr;
             if (heroid>0) {
                 hero=city->GetHero(heroid);
                 if (hero==0) {
-                    delete x;
                     continue;
                 }
             }
+            stArmyMovement* x=armies.Create();
+            x->client=l;
             x->hero=hero;
             x->city=city;
-            x->targetfieldid=rs.value("targetfieldid").convert<int32_t>();
-            x->direction=rs.value("direction").convert<int16_t>();
-            std::string resourcestring = rs.value("resource").convert<std::string>();
+            x->targetfieldid=row.get<3>();
+            x->direction=row.get<4>();
+            const std::string & resourcestring = row.get<5>();
             if (resourcestring.length() > 0) {
                 my_split(vec, resourcestring, ",");
                 x->resources.food = atol(vec[0].c_str());
@@ -987,7 +1003,7 @@ void spitfire::run()
                 x->resources.iron = atol(vec[3].c_str());
                 x->resources.gold = atol(vec[4].c_str());
             }
-            std::string troopstring = rs.value("troops").convert<std::string>();
+            const std::string & troopstring = row.get<6>();
             if (troopstring.length() > 0) {
                 my_split(vec, troopstring, ",");
                 x->troops.worker = atol(vec[0].c_str());
@@ -1003,11 +1019,11 @@ void spitfire::run()
                 x->troops.ram = atol(vec[10].c_str());
                 x->troops.catapult = atol(vec[11].c_str());
             }
-            x->starttime = rs.value("starttime").convert<int64_t>();
-            x->reachtime = rs.value("reachtime").convert<int64_t>();
-            x->resttime = rs.value("resttime").convert<int64_t>();
-            x->missiontype = rs.value("missiontype").convert<int32_t>();
-            x->startfieldid = rs.value("startfieldid").convert<int32_t>();
+            x->starttime = row.get<7>();
+            x->reachtime = row.get<8>();
+            x->resttime = row.get<9>();
+            x->missiontype = row.get<10>();
+            x->startfieldid = row.get<11>();
             if (x->hero != 0) {
                 x->herolevel = x->hero->m_level;
                 x->heroname = x->hero->m_name;
@@ -1015,11 +1031,7 @@ void spitfire::run()
             x->startposname = city->m_cityname;
             x->targetposname= map->GetTileFromID(x->targetfieldid)->GetName();
             x->armyid = armycounter++;
-            stTimedEvent tl;
-            tl.type = DEF_TIMEDARMY;
-            tl.data = x;
-            armylist.push_back(tl);
-            x->client->armymovement.push_back(x);
+            armies.Add(x);
             Tile* til = map->GetTileFromID(x->targetfieldid);
             if (til->m_ownerid > 0) {
                 Client* ml = GetClient(til->m_ownerid);
@@ -1031,38 +1043,42 @@ void spitfire::run()
                 }
             }
         }
-        armylist.sort(comparearmies);
+        // what was just loaded matches the table already
+        armies.dirty = false;
     }
+    phasedone("armies", armyrows.size());
+    std::vector<ArmyRow>().swap(armyrows);
 
-    log->info("Loading Report data.");
+    for (const ReportRow & row : reportrows)
+    {
+        Client * client = GetClient(row.get<0>());
+        if (client == 0) continue;
+        client->reportlist.push_back(ReportOf(row, client->currentreportid++));
+    }
+    phasedone("reports", reportrows.size());
+    std::vector<ReportRow>().swap(reportrows);
 
+    if (snapshotahead)
+    {
+        MarkAllDirty();
+        log->info("Snapshot is ahead of the database, everything will be saved again.");
+    }
+    else if (replayed)
     {
-        Poco::Data::Session ses(serverpool->get());
-        Statement select(ses);
-        select << "SELECT * FROM `reports`;";
-        select.execute();
-        RecordSet rs(select);
+        MarkAllDirty();
+        log->info("Journal replayed, everything will be saved again.");
+    }
 
-        rs.moveFirst();
-        for (int i = 0; i < rs.rowCount(); ++i, rs.moveNext()) {
-            int64_t clientid = rs.value("accountid").convert<int64_t>();
-            Client * client = GetClient(clientid);
-            if (client == 0) continue;
-            stReport r;
-            r.armytype = rs.value("armytype").convert<int8_t>();
-            r.back = rs.value("back").convert<bool>();
-            r.attack = rs.value("attack").convert<bool>();
-            r.type_id = rs.value("typeid").convert<int8_t>();
-            r.startpos = rs.value("startpos").convert<std::string>();
-            r.targetpos = rs.value("targetpos").convert<std::string>();
-            r.title = rs.value("title").convert<std::string>();
-            r.guid = rs.value("guid").convert<std::string>();
-            r.eventtime = rs.value("eventtime").convert<uint64_t>();
-            r.isread = rs.value("isread").convert<bool>();
-            r.reportid = client->currentreportid++;
-            client->reportlist.push_back(r);
-        }
+    if (!journaldir.empty())
+    {
+        std::string error;
+        if (redolog.Open(journaldir, journalsync, loadedstamp, error))
+            log->info("Journaling to {}.", journaldir);
+        else
+            log->error("Unable to open journal in {}, running without it: {}", journaldir, error);
     }
+
+    log->info("World loaded in {}ms.", Utils::time() - loadstart);
     /*uint64_t alliancecount = 0;
     {
     Session ses2(serverpool->get());
@@ -1175,23 +1191,25 @@ void spitfire::run()
 
     SortPlayers();
     SortHeroes();
-    SortCastles();
     //m_alliances->SortAlliances();
 
     TimerThreadRunning = true;
     std::thread timerthread(std::bind(std::mem_fun(&spitfire::TimerThread), this));
+    std::thread savethread(std::bind(&spitfire::SaveThread, this));
 
 
     //SOCKET THREADS
 
-    // Create a pool of threads to run all of the io_services.
+    // One thread per network shard plus one for the main io_service (signals, policy)
     std::vector<std::shared_ptr<std::thread> > threads;
-    for (std::size_t i = 0; i < /*thread_pool_size_*/1; ++i)
+    threads.push_back(std::make_shared<std::thread>(std::bind(&spitfire::io_thread, this)));
+    for (auto & shard : shards_)
     {
         std::shared_ptr<std::thread> thread(new std::thread(
-            std::bind(&spitfire::io_thread, this)));
+            std::bind(&spitfire::shard_thread, this, std::ref(*shard))));
         threads.push_back(thread);
     }
+    log->info("Running {} network shard(s).", shards_.size());
 
     // Wait for all threads in the pool to exit.
     for (std::size_t i = 0; i < threads.size(); ++i)
@@ -1200,204 +1218,1207 @@ void spitfire::run()
 
     timerthread.join();
 
-    // update DB on exit
-    log->info("Updating database before exiting.");
-
-    log->info("Updating players database.");
-    for (Client* xl:players) {
-        if (xl) xl->SaveToDB();
-    }
+    // flush whatever changed since the last save and let the save thread drain
+    log->info("Saving dirty entities before exiting.");
+    FlushDirty();
+    WriteSnapshot(true);
+    saves.Stop();
+    savethread.join();
+    redolog.Close();
+
+    // finish mail and other queries still queued by the last players
+    accountdb->Stop();
+    serverdb->Stop();
+    store->LogStats();
+}
 
-    log->info("Updating cities database.");
-    for (Client* xl : players) {
-        if (xl) {
-            for (PlayerCity* pl : xl->citylist) {
-                if (pl) pl->SaveToDB();
-            }
-        }
-    }
+void spitfire::Query(dbexecutor & db, uint64_t key, connection * c, dbquery query, std::function<void(bool)> done)
+{
+    connection_ptr conn = c->shared_from_this();
+    db.Post(key, std::move(query), [this, conn, done](bool ok)
+    {
+        if (!conn->socket().is_open())
+            return;
+        std::lock_guard<std::mutex> l(worldmtx);
+        done(ok);
+        JournalCommit();
+    }, &conn->socket().get_io_service());
+}
 
-    log->info("Updating heroes database.");
-    for (Client* xl : players) {
-        if (xl) {
-            for (PlayerCity* pl : xl->citylist) {
-                if (pl) {
-                    for (Hero* hl : pl->m_heroes) {
-                        if (hl) hl->SaveToDB();
-                    }
-                }
-            }
-        }
-    }
+// The resource and troop columns of an army row
+static void ArmyStrings(const stArmyMovement * x, std::string & resourcestring, std::string & troopstring)
+{
+    std::vector<Poco::Any> vec;
+    vec.emplace_back((int64_t)x->resources.food);
+    vec.emplace_back((int64_t)x->resources.wood);
+    vec.emplace_back((int64_t)x->resources.stone);
+    vec.emplace_back((int64_t)x->resources.iron);
+    vec.emplace_back((int64_t)x->resources.gold);
+    resourcestring.clear();
+    Poco::format(resourcestring,"%?d,%?d,%?d,%?d,%?d", vec);
+    vec.clear();
+    vec.emplace_back(x->troops.worker);
+    vec.emplace_back(x->troops.warrior);
+    vec.emplace_back(x->troops.scout);
+    vec.emplace_back(x->troops.pike);
+    vec.emplace_back(x->troops.sword);
+    vec.emplace_back(x->troops.archer);
+    vec.emplace_back(x->troops.transporter);
+    vec.emplace_back(x->troops.cavalry);
+    vec.emplace_back(x->troops.cataphract);
+    vec.emplace_back(x->troops.ballista);
+    vec.emplace_back(x->troops.ram);
+    vec.emplace_back(x->troops.catapult);
+    troopstring.clear();
+    Poco::format(troopstring,"%?d,%?d,%?d,%?d,%?d,%?d,%?d,%?d,%?d,%?d,%?d,%?d", vec);
+}
 
-    log->info("Updating armies database.");
+savejob spitfire::ArmiesSaveJob()
+{
+    std::vector<ArmySave> rows;
+    rows.reserve(armies.Count());
+    std::string resourcestring, troopstring;
+    armies.ForEach([&](stArmyMovement * x)
     {
-        Poco::Data::Session ses2(serverpool->get());
-        ses2 << "TRUNCATE TABLE `armies`", now;        
-        
-        using ArmyData = Poco::Tuple<int64_t, int8_t, std::string, std::string, int64_t, int64_t, int64_t, int8_t, int32_t, int32_t, int64_t, int32_t>;
-        std::vector<Poco::Any> vec;
-        for (stTimedEvent& evt : armylist)
-        {
-            stArmyMovement* x=(stArmyMovement*)evt.data;
-            vec.clear();
-            vec.emplace_back((int64_t)x->resources.food);
-            vec.emplace_back((int64_t)x->resources.wood);
-            vec.emplace_back((int64_t)x->resources.stone);
-            vec.emplace_back((int64_t)x->resources.iron);
-            vec.emplace_back((int64_t)x->resources.gold);
-            std::string resourcestring;
-            Poco::format(resourcestring,"%?d,%?d,%?d,%?d,%?d", vec);
-            vec.clear();
-            vec.emplace_back(x->troops.worker);
-            vec.emplace_back(x->troops.warrior);
-            vec.emplace_back(x->troops.scout);
-            vec.emplace_back(x->troops.pike);
-            vec.emplace_back(x->troops.sword);
-            vec.emplace_back(x->troops.archer);
-            vec.emplace_back(x->troops.transporter);
-            vec.emplace_back(x->troops.cavalry);
-            vec.emplace_back(x->troops.cataphract);
-            vec.emplace_back(x->troops.ballista);
-            vec.emplace_back(x->troops.ram);
-            vec.emplace_back(x->troops.catapult);
-            std::string troopstring;
-            Poco::format(troopstring,"%?d,%?d,%?d,%?d,%?d,%?d,%?d,%?d,%?d,%?d,%?d,%?d", vec);
-            int64_t heroid = -1;
-            if (x->hero != 0) heroid = x->hero->m_id;
-            ArmyData save(heroid, x->direction, resourcestring, troopstring, x->starttime, x->reachtime, x->resttime, x->missiontype, x->startfieldid, x->targetfieldid, ((PlayerCity*)x->city)->m_castleid, x->client->accountid);
-            ses2 << "INSERT INTO `armies` (`heroid`, `direction`, `resource`, `troops`, `starttime`, `reachtime`, `resttime`, `missiontype`, `startfieldid`, `targetfieldid`, `cityid`, `clientid`) VALUES( ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);", use(save), now;
-        }
-    }
+        ArmyStrings(x, resourcestring, troopstring);
+        int64_t heroid = -1;
+        if (x->hero != 0) heroid = x->hero->m_id;
+        rows.emplace_back(heroid, x->direction, resourcestring, troopstring, x->starttime, x->reachtime, x->resttime, x->missiontype, x->startfieldid, x->targetfieldid, ((PlayerCity*)x->city)->m_castleid, x->client->accountid);
+    });
+    uint32_t rowsper = saverows;
 
-    log->info("Updating reports database.");
+    return savejob([rows, rowsper](storageconn & db) mutable
     {
-        Poco::Data::Session ses(serverpool->get());
-        ses << "TRUNCATE TABLE `reports`;", now;
-        using ReportData = Poco::Tuple<int64_t, int8_t, bool, bool, int8_t, std::string, std::string, std::string, std::string, uint64_t, bool>;
-        for (Client* client : players) {
-            if (client == 0) continue;
-            for (stReport& r : client->reportlist) {
-                ReportData report(client->accountid, r.armytype, r.back, r.attack, r.type_id, r.startpos, r.targetpos, r.title, r.guid, r.eventtime, r.isread);
-                ses << "INSERT INTO `reports` (`accountid`, `armytype`, `back`, `attack`, `typeid`, `startpos`, `targetpos`, `title`, `guid`, `eventtime`, `isread`) VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);", use(report), now;
-            }
-        }
-    }
+        db.SaveArmies(rows, rowsper);
+    }, [this]()
+    {
+        armies.dirty = true;
+    });
 }
 
-void spitfire::stop()
+// Splits the dirty entities of one kind into jobs of saverows rows each
+template<typename T>
+static void QueueSaves(std::vector<savejob> & jobs, const std::vector<T*> & dirty, uint32_t rows)
 {
-    io_service_.post([this]()
+    for (size_t first = 0; first < dirty.size(); first += rows)
     {
-        Shutdown();
-    });
+        std::vector<T*> chunk(dirty.begin() + first, dirty.begin() + std::min<size_t>(dirty.size(), first + rows));
+        jobs.push_back(T::SaveJob(chunk));
+    }
 }
 
-void spitfire::start(connection_ptr c)
+void spitfire::FlushDirty()
 {
-    try
-    {
-        asio::ip::tcp::endpoint endp = c->socket().remote_endpoint();
-        asio::ip::address address = endp.address();
-        c->address = address.to_string();
-        log->info("Client connected {}", c->address);
+    std::vector<savejob> jobs;
 
-        connections_.insert(c);
-        c->start();
+    // What did not commit last time is marked again, or goes as it was
+    std::vector<savejob> failed;
+    {
+        std::lock_guard<std::mutex> l(savefailmtx);
+        failed.swap(savefailed);
     }
-    catch (std::exception & e)
+    saveretried += failed.size();
+    for (savejob & job : failed)
     {
-        //Remote connection closed before connection is finished
-        //std::cerr << "Server::start(connection_ptr c) exception: " << e.what() << std::endl;
+        if (job.failed)
+            job.failed();
+        else
+            jobs.push_back(std::move(job));
     }
-}
 
-void spitfire::startpolicy(connection_ptr c)
-{
-    try
-    {
-        asio::ip::tcp::endpoint endp = c->socket().remote_endpoint();
-        asio::ip::address address = endp.address();
-        c->address = address.to_string();
-        log->info("Policy Client connected {}", c->address);
+    std::vector<Client*> clients;
+    clients.reserve(dirtyclients.size());
+    size_t entities = dirtyclients.size() + dirtycities.size() + dirtyheroes.size() + dirtyalliances.size();
+    // the marker these saves commit with
+    uint64_t stamp = std::max<uint64_t>(Utils::time(), flushstamp + 1);
 
-        c->startpolicy();
+    for (Client * client : dirtyclients)
+    {
+        // rows are upserted, so an account not created yet must not be written
+        if (client->dirty && client->accountexists)
+            clients.push_back(client);
+        if (client->reportsdirty)
+        {
+            jobs.push_back(client->ReportsSaveJob());
+            client->reportstamp = stamp;
+        }
+        client->dirty = client->reportsdirty = false;
     }
-    catch (std::exception & e)
+    for (PlayerCity * city : dirtycities)
+        city->m_dirty = false;
+    for (Hero * hero : dirtyheroes)
+        hero->m_dirty = false;
+    for (Alliance * alliance : dirtyalliances)
+        alliance->m_dirty = false;
+
+    QueueSaves(jobs, clients, saverows);
+    QueueSaves(jobs, dirtycities, saverows);
+    QueueSaves(jobs, dirtyheroes, saverows);
+    QueueSaves(jobs, dirtyalliances, saverows);
+    if (armies.dirty)
     {
-        //Remote connection closed before connection is finished
-        //std::cerr << "Server::startpolicy(connection_ptr c) exception: " << e.what() << std::endl;
+        jobs.push_back(ArmiesSaveJob());
+        armies.dirty = false;
+    }
+
+    dirtyclients.clear();
+    dirtycities.clear();
+    dirtyheroes.clear();
+    dirtyalliances.clear();
+
+    if (!jobs.empty())
+    {
+        log->info("Queued {} entities for saving in {} jobs.", entities, jobs.size());
+        saves.Push(std::move(jobs));
+
+        // a group of its own, so the marker only moves once the saves
+        // before it have committed
+        flushstamp = stamp;
+        saves.Push({ SaveMarkerJob(flushstamp, saveretried) });
+        redolog.Rotate(flushstamp);
+        journalarmyimage = true;
     }
 }
 
-void spitfire::stop(connection_ptr c, bool checklock)
+void spitfire::ForgetDirty(Hero * hero)
 {
-    try
+    if (redolog.IsOpen())
     {
-        //        if (checklock)
-        //            c->mtx.lock();
-        connections_.erase(c);
-        asio::error_code ignored_ec;
-        c->socket().shutdown(asio::ip::tcp::socket::shutdown_both, ignored_ec);
-        c->stop();
-        //        if (checklock)
-        //            c->mtx.unlock();
+        journalheroes.erase(std::remove(journalheroes.begin(), journalheroes.end(), hero), journalheroes.end());
+        std::string payload;
+        snapshotcodec::Put(payload, hero->m_id);
+        redolog.Append(JOURNAL_HERODELETED, payload);
     }
-    catch (std::exception& e)
+    if (hero->m_dirty)
     {
-        std::cerr << "exception: " << e.what() << "\n";
-        //        if (checklock)
-        //            c->mtx.unlock();
+        dirtyheroes.erase(std::remove(dirtyheroes.begin(), dirtyheroes.end(), hero), dirtyheroes.end());
+        hero->m_dirty = false;
     }
 }
 
-void spitfire::stop_all()
+void spitfire::ForgetDirty(Alliance * alliance)
 {
-//    std::for_each(connections_.begin(), connections_.end(),
-//                  std::bind(&connection::stop, _1));
-    for (auto & conn : connections_)
-        conn->stop();
-    connections_.clear();
+    if (redolog.IsOpen())
+    {
+        journalalliances.erase(std::remove(journalalliances.begin(), journalalliances.end(), alliance), journalalliances.end());
+        std::string payload;
+        snapshotcodec::Put(payload, alliance->m_allianceid);
+        redolog.Append(JOURNAL_ALLIANCEDELETED, payload);
+    }
+    if (alliance->m_dirty)
+    {
+        dirtyalliances.erase(std::remove(dirtyalliances.begin(), dirtyalliances.end(), alliance), dirtyalliances.end());
+        alliance->m_dirty = false;
+    }
 }
 
-void spitfire::do_accept()
+savejob spitfire::SaveMarkerJob(uint64_t stamp, uint64_t retried)
 {
-    acceptor_.async_accept(socket_,
-                           [this](asio::error_code ec)
+    return savejob([this, stamp, retried](storageconn & db)
     {
-        try
+        // A job that failed since, or whose entities were not queued again
+        // before this flush, has changes only the journal still holds
         {
-            // Check whether the server was stopped by a signal before this
-            // completion handler had a chance to run.
-            if (!acceptor_.is_open())
+            std::lock_guard<std::mutex> l(savefailmtx);
+            if (savefailures != retried)
             {
+                log->warn("Save marker {} not written, {} save jobs failed.", stamp, savefailures - retried);
                 return;
             }
-
-            if (!ec)
-            {
-                start(std::make_shared<connection>(
-                    std::move(socket_), request_handler_));
-            }
         }
-        catch (std::exception & e)
-        {
-            //std::cerr << "uncaught do_accept() exception: " << e.what() << std::endl;
-        }
-        do_accept();
+        db.SaveMarker(stamp);
+        // every save queued before the marker has committed by now
+        redolog.Retire(stamp);
+        savedstamp = stamp;
+    }, []()
+    {
+        // the next flush's marker covers this one
     });
 }
 
-void spitfire::do_acceptpolicy()
+bool spitfire::ReadSaveMarker(uint64_t & marker)
 {
-    acceptorpolicy_.async_accept(socketpolicy_,
-                                 [this](asio::error_code ec)
+    try
+    {
+        marker = store->Connect()->ReadSaveMarker();
+        return true;
+    }
+    SQLCATCH(return false;);
+    return false;
+}
+
+// Row images of live entities, as the loader reads them back
+static AccountRow AccountRowOf(Client * c)
+{
+    return AccountRow(c->accountid, c->masteraccountid, c->playername, c->password, c->email, c->allianceid, c->alliancerank,
+        c->lastlogin, c->creation, c->status, c->sex, c->flag, c->faceurl, c->cents, c->prestige, c->honor,
+        c->DBBuffs(), c->DBResearch(), c->DBItems(), c->DBMisc());
+}
+
+static MailRow MailRowOf(int64_t accountid, const stMail & mail)
+{
+    return MailRow(accountid, mail.title, mail.content, mail.senttime, mail.readtime, mail.mailid, mail.playerid, mail.type_id);
+}
+
+static CityRow CityRowOf(int64_t accountid, const PlayerCity * city)
+{
+    return CityRow(accountid, city->m_castleid, city->m_tileid, city->m_resources.food, city->m_resources.wood,
+        city->m_resources.iron, city->m_resources.stone, city->m_resources.gold, city->m_cityname, city->m_logurl, city->m_creation,
+        city->DBTroops(), city->DBBuildings(), city->DBTroopQueues(), city->DBFortifications(), city->DBMisc());
+}
+
+static HeroRow HeroRowOf(int64_t castleid, const Hero * h)
+{
+    return HeroRow(h->m_id, castleid, h->m_status, h->m_itemid, h->m_itemamount,
+        h->m_basestratagem, h->m_stratagem, h->m_stratagemadded, h->m_stratagembuffadded,
+        h->m_basepower, h->m_power, h->m_poweradded, h->m_powerbuffadded,
+        h->m_basemanagement, h->m_management, h->m_managementadded, h->m_managementbuffadded,
+        h->m_logourl, h->m_name, h->m_remainpoint, h->m_level, h->m_upgradeexp, h->m_experience, h->m_loyalty);
+}
+
+static AllianceRow AllianceRowOf(const Alliance * alliance)
+{
+    return AllianceRow(alliance->m_allianceid, alliance->m_name, alliance->m_founder, alliance->DBMembers(),
+        Alliance::DBRelation(alliance->m_enemies), Alliance::DBRelation(alliance->m_allies), Alliance::DBRelation(alliance->m_neutral), alliance->m_note);
+}
+
+static ReportRow ReportRowOf(int64_t accountid, const stReport & r)
+{
+    return ReportRow(accountid, r.armytype, r.back, r.attack, r.type_id, r.startpos, r.targetpos, r.title, r.guid, r.eventtime, r.isread);
+}
+
+// The strings are scratch space, reused across armies
+static ArmyRow ArmyRowOf(const stArmyMovement * x, std::string & resourcestring, std::string & troopstring)
+{
+    ArmyStrings(x, resourcestring, troopstring);
+    int64_t heroid = (x->hero != nullptr) ? int64_t(x->hero->m_id) : -1;
+    return ArmyRow(x->client->accountid, ((PlayerCity*)x->city)->m_castleid, heroid, x->targetfieldid, x->direction,
+        resourcestring, troopstring, x->starttime, x->reachtime, x->resttime, x->missiontype, x->startfieldid);
+}
+
+static void ArmyRows(ArmyMgr & armies, std::vector<ArmyRow> & rows)
+{
+    std::string resourcestring, troopstring;
+    armies.ForEach([&](stArmyMovement * x)
+    {
+        rows.push_back(ArmyRowOf(x, resourcestring, troopstring));
+    });
+}
+
+void spitfire::CollectWorld(worldrows & world)
+{
+#ifndef DEF_NOMAPDATA
+    int32_t maparea = mapsize * mapsize;
+    world.tiles.reserve(maparea);
+    for (int32_t i = 0; i < maparea; ++i)
+    {
+        Tile & tile = map->m_tile[i];
+        world.tiles.emplace_back(tile.m_id, tile.m_ownerid, tile.m_type, tile.m_level);
+    }
+#endif
+
+    for (Client * c : players)
+    {
+        // only what the loader would have found in the DB
+        if (!c->accountexists)
+            continue;
+
+        world.accounts.push_back(AccountRowOf(c));
+        // the store has the histories of these, the lists are empty
+        if (c->evicted)
+            world.evicted.emplace_back(c->accountid, int64_t(c->mailpid));
+
+        for (const stMail & mail : c->maillist)
+            world.mail.push_back(MailRowOf(c->accountid, mail));
+
+        for (PlayerCity * city : c->citylist)
+        {
+            world.cities.push_back(CityRowOf(c->accountid, city));
+
+            for (Hero * h : city->m_heroes)
+            {
+                if (h != nullptr)
+                    world.heroes.push_back(HeroRowOf(city->m_castleid, h));
+            }
+        }
+
+        for (const stReport & r : c->reportlist)
+            world.reports.push_back(ReportRowOf(c->accountid, r));
+    }
+
+    for (Alliance * alliance : m_alliances->m_alliances)
+    {
+        if (alliance != nullptr)
+            world.alliances.push_back(AllianceRowOf(alliance));
+    }
+
+    ArmyRows(armies, world.armies);
+}
+
+// The sections of a snapshot file, in file order
+static void SnapshotSections(snapshotwriter & writer, const worldrows & world)
+{
+    writer.Section(SECTION_TILES, world.tiles);
+    writer.Section(SECTION_ACCOUNTS, world.accounts);
+    writer.Section(SECTION_MAIL, world.mail);
+    writer.Section(SECTION_CITIES, world.cities);
+    writer.Section(SECTION_HEROES, world.heroes);
+    writer.Section(SECTION_ALLIANCES, world.alliances);
+    writer.Section(SECTION_ARMIES, world.armies);
+    writer.Section(SECTION_REPORTS, world.reports);
+    writer.Section(SECTION_EVICTED, world.evicted);
+}
+
+bool spitfire::SnapshotBusy(bool wait)
+{
+    if (snapshotjob.valid())
+    {
+        if (!wait && snapshotjob.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return true;
+        snapshotjob.get();
+    }
+    ReapSnapshot(wait);
+    return snapshotpid != 0;
+}
+
+bool spitfire::WriteSnapshot(bool wait)
+{
+    if (snapshotfile.empty())
+        return false;
+
+    if (SnapshotBusy(wait))
+    {
+        log->info("A snapshot is already being written.");
+        return false;
+    }
+
+    // Everything in the snapshot is queued for saving first, so its stamp is
+    // the marker the DB holds once that flush has committed
+    FlushDirty();
+
+#ifndef WIN32
+    if (snapshotfork && !wait)
+        return ForkSnapshot();
+#endif
+
+    uint64_t t1 = Utils::time();
+    auto world = std::make_shared<worldrows>();
+    CollectWorld(*world);
+    log->info("Collected world for snapshot in {}ms.", Utils::time() - t1);
+
+    // encoding and writing run off the game thread
+    uint64_t stamp = flushstamp;
+    std::string path = snapshotfile;
+    snapshotjob = std::async(std::launch::async, [this, world, stamp, path]()
+    {
+        uint64_t t2 = Utils::time();
+        snapshotwriter writer(stamp);
+        SnapshotSections(writer, *world);
+
+        std::string error;
+        if (!writer.Save(path, error))
+        {
+            log->error("Unable to write snapshot: {}", error);
+            return false;
+        }
+        log->info("Wrote snapshot {} in {}ms.", path, Utils::time() - t2);
+        return true;
+    });
+
+    if (wait)
+        return snapshotjob.get();
+    return true;
+}
+
+bool spitfire::ForkSnapshot()
+{
+#ifndef WIN32
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    uint64_t t1 = Utils::time();
+    uint64_t stamp = flushstamp;
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        log->error("Unable to fork a snapshot process: {}", std::strerror(errno));
+        return false;
+    }
+    if (pid == 0)
+    {
+        // Only this thread was copied, and whatever lock another thread held
+        // at the fork stays held for good: no logging and no DB in here.
+        // The world is as this thread left it under worldmtx.
+        worldrows world;
+        CollectWorld(world);
+        snapshotwriter writer(stamp);
+        SnapshotSections(writer, world);
+        std::string error;
+        bool ok = writer.Save(snapshotfile, error);
+        if (!ok)
+            std::fprintf(stderr, "snapshot process: %s\n", error.c_str());
+        _exit(ok ? 0 : 1);
+    }
+
+    snapshotpid = pid;
+    snapshotstarted = t1;
+    snapshotfaults = usage.ru_minflt;
+    log->info("Forked snapshot process {} in {}ms.", pid, Utils::time() - t1);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void spitfire::ReapSnapshot(bool wait)
+{
+#ifndef WIN32
+    if (snapshotpid == 0)
+        return;
+
+    int status = 0;
+    struct rusage child;
+    pid_t pid = wait4(snapshotpid, &status, wait ? 0 : WNOHANG, &child);
+    if (pid == 0)
+        return;
+
+    // Every page the parent wrote while the child ran was copied once, so
+    // its minor faults over that time are the price of the image
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    snapshotms = Utils::time() - snapshotstarted;
+    snapshotpages = uint64_t(usage.ru_minflt - snapshotfaults);
+    snapshotpid = 0;
+
+    if (pid < 0)
+    {
+        log->error("Lost the snapshot process: {}", std::strerror(errno));
+        return;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        log->error("Snapshot process failed with status {} after {}ms.", status, snapshotms);
+        return;
+    }
+    log->info("Snapshot process wrote {} in {}ms. Copy-on-write: {} pages ({} KB) in the server, child peak {} KB.",
+        snapshotfile, snapshotms, snapshotpages, snapshotpages * uint64_t(sysconf(_SC_PAGESIZE)) / 1024, child.ru_maxrss);
+#endif
+}
+
+bool spitfire::ReadSnapshot(worldrows & world, uint64_t savemarker, uint64_t & stamp)
+{
+    uint64_t t1 = Utils::time();
+    snapshotreader reader;
+    std::string error;
+    if (!reader.Open(snapshotfile, error))
+    {
+        log->info("Not loading from snapshot: {}", error);
+        return false;
+    }
+    if (reader.FlushStamp() < savemarker)
+    {
+        log->info("Snapshot {} is older than the last save, loading from the database.", snapshotfile);
+        return false;
+    }
+
+    if (!reader.Section(SECTION_TILES, world.tiles) || !reader.Section(SECTION_ACCOUNTS, world.accounts)
+        || !reader.Section(SECTION_MAIL, world.mail) || !reader.Section(SECTION_CITIES, world.cities)
+        || !reader.Section(SECTION_HEROES, world.heroes) || !reader.Section(SECTION_ALLIANCES, world.alliances)
+        || !reader.Section(SECTION_ARMIES, world.armies) || !reader.Section(SECTION_REPORTS, world.reports)
+        || !reader.Section(SECTION_EVICTED, world.evicted))
+    {
+        log->error("Snapshot {} is damaged, loading from the database.", snapshotfile);
+        world = worldrows();
+        return false;
+    }
+
+    stamp = reader.FlushStamp();
+    log->info("Read snapshot {} in {}ms.", snapshotfile, Utils::time() - t1);
+    return true;
+}
+
+void spitfire::MarkAllDirty()
+{
+    for (Client * client : players)
+    {
+        if (!client->accountexists)
+            continue;
+        client->MarkDirty();
+        // the store already holds evicted reports
+        if (!client->evicted)
+            client->MarkReportsDirty();
+        for (PlayerCity * city : client->citylist)
+        {
+            city->MarkDirty();
+            for (Hero * hero : city->m_heroes)
+            {
+                if (hero)
+                    hero->MarkDirty();
+            }
+        }
+    }
+    for (Alliance * alliance : m_alliances->m_alliances)
+    {
+        if (alliance)
+            alliance->MarkDirty();
+    }
+    armies.dirty = true;
+}
+
+void spitfire::JournalMail(int64_t receiverid, const stMail & mail)
+{
+    if (!redolog.IsOpen())
+        return;
+    std::string payload;
+    snapshotcodec::PutRow(payload, MailRowOf(receiverid, mail));
+    redolog.Append(JOURNAL_MAIL, payload);
+}
+
+void spitfire::JournalReport(int64_t accountid, const stReport & report)
+{
+    if (!redolog.IsOpen())
+        return;
+    std::string payload;
+    snapshotcodec::PutRow(payload, ReportRowOf(accountid, report));
+    redolog.Append(JOURNAL_REPORT, payload);
+}
+
+// An entity can be marked many times in one packet, it is journaled once
+template<typename T>
+static void Unique(std::vector<T*> & list)
+{
+    std::sort(list.begin(), list.end());
+    list.erase(std::unique(list.begin(), list.end()), list.end());
+}
+
+void spitfire::JournalCommit()
+{
+    if (!redolog.IsOpen())
+        return;
+
+    using snapshotcodec::Put;
+    using snapshotcodec::PutRow;
+    std::string payload;
+
+    Unique(journalclients);
+    for (Client * client : journalclients)
+    {
+        if (!client->accountexists)
+            continue;
+        payload.clear();
+        PutRow(payload, AccountRowOf(client));
+        redolog.Append(JOURNAL_ACCOUNT, payload);
+    }
+    Unique(journalreports);
+    for (Client * client : journalreports)
+    {
+        payload.clear();
+        Put(payload, client->accountid);
+        Put(payload, uint32_t(client->reportlist.size()));
+        for (const stReport & r : client->reportlist)
+            PutRow(payload, ReportRowOf(client->accountid, r));
+        redolog.Append(JOURNAL_REPORTS, payload);
+    }
+    Unique(journalcities);
+    for (PlayerCity * city : journalcities)
+    {
+        if (city->m_client == nullptr || !city->m_client->accountexists)
+            continue;
+        payload.clear();
+        PutRow(payload, CityRowOf(city->m_client->accountid, city));
+        redolog.Append(JOURNAL_CITY, payload);
+    }
+    Unique(journalheroes);
+    for (Hero * hero : journalheroes)
+    {
+        payload.clear();
+        PutRow(payload, HeroRowOf(hero->m_castleid, hero));
+        redolog.Append(JOURNAL_HERO, payload);
+    }
+    Unique(journalalliances);
+    for (Alliance * alliance : journalalliances)
+    {
+        payload.clear();
+        PutRow(payload, AllianceRowOf(alliance));
+        redolog.Append(JOURNAL_ALLIANCE, payload);
+    }
+    if (!journalarmies.empty() || !journalarmiesgone.empty())
+    {
+        std::string resourcestring, troopstring;
+        if (journalarmyimage)
+        {
+            // keys do not outlive the process, so the segment starts from
+            // every army and its key
+            payload.clear();
+            Put(payload, uint32_t(armies.Count()));
+            armies.ForEach([&](stArmyMovement * am)
+            {
+                Put(payload, ArmyMgr::Key(am));
+                PutRow(payload, ArmyRowOf(am, resourcestring, troopstring));
+            });
+            redolog.Append(JOURNAL_ARMYIMAGE, payload);
+            journalarmyimage = false;
+        }
+        else
+        {
+            for (uint64_t key : journalarmiesgone)
+            {
+                payload.clear();
+                Put(payload, key);
+                redolog.Append(JOURNAL_ARMYGONE, payload);
+            }
+            Unique(journalarmies);
+            for (stArmyMovement * am : journalarmies)
+            {
+                // removed since, its key is in journalarmiesgone
+                if (!am->active)
+                    continue;
+                payload.clear();
+                Put(payload, ArmyMgr::Key(am));
+                PutRow(payload, ArmyRowOf(am, resourcestring, troopstring));
+                redolog.Append(JOURNAL_ARMY, payload);
+            }
+        }
+        journalarmies.clear();
+        journalarmiesgone.clear();
+    }
+
+    journalclients.clear();
+    journalreports.clear();
+    journalcities.clear();
+    journalheroes.clear();
+    journalalliances.clear();
+    redolog.Commit();
+}
+
+// Loaded rows indexed by key, so journal images can replace them in place
+template<typename Row, typename Key>
+class rowpatch
+{
+public:
+    typedef std::function<Key(const Row &)> keyof;
+
+    rowpatch(std::vector<Row> & rows, keyof key)
+        : rows(rows)
+        , key(key)
+    {
+        for (size_t i = 0; i < rows.size(); ++i)
+            index[key(rows[i])] = i;
+    }
+
+    void Put(const Row & row)
+    {
+        auto it = index.find(key(row));
+        if (it != index.end())
+        {
+            rows[it->second] = row;
+            return;
+        }
+        index.emplace(key(row), rows.size());
+        rows.push_back(row);
+    }
+
+    void Erase(const Key & k)
+    {
+        auto it = index.find(k);
+        if (it == index.end())
+            return;
+        erased.push_back(it->second);
+        index.erase(it);
+    }
+
+    // Drops the erased rows; the patch is not usable afterwards
+    void Finish()
+    {
+        if (erased.empty())
+            return;
+        std::sort(erased.begin(), erased.end());
+        size_t out = 0;
+        auto next = erased.begin();
+        for (size_t i = 0; i < rows.size(); ++i)
+        {
+            if (next != erased.end() && *next == i)
+            {
+                ++next;
+                continue;
+            }
+            if (out != i)
+                rows[out] = std::move(rows[i]);
+            ++out;
+        }
+        rows.resize(out);
+    }
+
+private:
+    std::vector<Row> & rows;
+    keyof key;
+    std::map<Key, size_t> index;
+    std::vector<size_t> erased;
+};
+
+// Reads a count followed by that many rows
+template<typename Row>
+static bool GetRows(const char *& pos, const char * end, std::vector<Row> & rows)
+{
+    uint32_t count;
+    // every row takes at least one byte
+    if (!snapshotcodec::Get(pos, end, count) || count > std::size_t(end - pos))
+        return false;
+    rows.resize(count);
+    for (Row & row : rows)
+    {
+        if (!snapshotcodec::GetRow(pos, end, row))
+            return false;
+    }
+    return true;
+}
+
+bool spitfire::ReplayJournal(worldrows & world, uint64_t stamp)
+{
+    std::vector<journal::segment> segments = journal::Segments(journaldir);
+    segments.erase(std::remove_if(segments.begin(), segments.end(), [stamp](const journal::segment & s) { return s.stamp < stamp; }), segments.end());
+    if (segments.empty())
+        return false;
+
+    uint64_t t1 = Utils::time();
+    typedef std::tuple<int64_t, int32_t, uint64_t> mailkey;
+    rowpatch<AccountRow, int64_t> accounts(world.accounts, [](const AccountRow & row) { return row.get<0>(); });
+    rowpatch<CityRow, int64_t> cities(world.cities, [](const CityRow & row) { return row.get<1>(); });
+    rowpatch<HeroRow, uint64_t> heroes(world.heroes, [](const HeroRow & row) { return row.get<0>(); });
+    rowpatch<AllianceRow, int64_t> alliances(world.alliances, [](const AllianceRow & row) { return row.get<0>(); });
+    rowpatch<MailRow, mailkey> mail(world.mail, [](const MailRow & row) { return mailkey(row.get<0>(), row.get<5>(), row.get<3>()); });
+    // reports by account, newest first as they were saved, so appends can
+    // go in front of an account's others
+    std::map<int64_t, std::vector<ReportRow>> reports;
+    for (ReportRow & row : world.reports)
+        reports[row.get<0>()].push_back(std::move(row));
+    world.reports.clear();
+    // armies by ArmyMgr::Key, once a segment has given their image
+    std::map<uint64_t, ArmyRow> keyedarmies;
+    bool armyimage = false;
+    std::map<mailkey, MailRow> newmail;
+    std::vector<uint64_t> deletedheroes;
+    std::vector<int64_t> deletedalliances;
+    uint64_t total = 0, bad = 0;
+
+    // An account whose histories were evicted when the rows were taken, and
+    // that the journal has mail or reports of, was read back in since. Its
+    // rows start from the store, the journal brings them up to date.
+    std::map<int64_t, int64_t> evicted;
+    for (const EvictedRow & row : world.evicted)
+        evicted[row.get<0>()] = row.get<1>();
+    std::unique_ptr<storageconn> db;
+    auto faultin = [&](int64_t accountid)
+    {
+        if (evicted.erase(accountid) == 0)
+            return;
+        if (!db)
+            db = store->Connect();
+        std::vector<MailRow> rows;
+        db->LoadMail(accountid, rows);
+        for (const MailRow & row : rows)
+            mail.Put(row);
+        db->LoadReports(accountid, reports[accountid]);
+    };
+
+    for (const journal::segment & s : segments)
+    {
+        uint64_t records = 0;
+        bool intact = journal::Read(s.path, [&](uint8_t type, const char * pos, std::size_t size)
+        {
+            const char * end = pos + size;
+            bool ok = false;
+            switch (type)
+            {
+                case JOURNAL_ACCOUNT:
+                {
+                    AccountRow row;
+                    if ((ok = snapshotcodec::GetRow(pos, end, row)))
+                        accounts.Put(row);
+                    break;
+                }
+                case JOURNAL_CITY:
+                {
+                    CityRow row;
+                    if ((ok = snapshotcodec::GetRow(pos, end, row)))
+                        cities.Put(row);
+                    break;
+                }
+                case JOURNAL_HERO:
+                {
+                    HeroRow row;
+                    if ((ok = snapshotcodec::GetRow(pos, end, row)))
+                        heroes.Put(row);
+                    break;
+                }
+                case JOURNAL_HERODELETED:
+                {
+                    uint64_t id;
+                    if ((ok = snapshotcodec::Get(pos, end, id)))
+                    {
+                        heroes.Erase(id);
+                        deletedheroes.push_back(id);
+                    }
+                    break;
+                }
+                case JOURNAL_ALLIANCE:
+                {
+                    AllianceRow row;
+                    if ((ok = snapshotcodec::GetRow(pos, end, row)))
+                        alliances.Put(row);
+                    break;
+                }
+                case JOURNAL_ALLIANCEDELETED:
+                {
+                    int64_t id;
+                    if ((ok = snapshotcodec::Get(pos, end, id)))
+                    {
+                        alliances.Erase(id);
+                        deletedalliances.push_back(id);
+                    }
+                    break;
+                }
+                case JOURNAL_REPORTS:
+                {
+                    int64_t accountid;
+                    std::vector<ReportRow> rows;
+                    if ((ok = snapshotcodec::Get(pos, end, accountid) && GetRows(pos, end, rows)))
+                    {
+                        faultin(accountid);
+                        reports[accountid] = std::move(rows);
+                    }
+                    break;
+                }
+                case JOURNAL_ARMIES:
+                {
+                    std::vector<ArmyRow> rows;
+                    if ((ok = GetRows(pos, end, rows)))
+                    {
+                        world.armies = std::move(rows);
+                        keyedarmies.clear();
+                        armyimage = false;
+                    }
+                    break;
+                }
+                case JOURNAL_ARMYIMAGE:
+                {
+                    uint32_t count;
+                    std::map<uint64_t, ArmyRow> rows;
+                    ok = snapshotcodec::Get(pos, end, count);
+                    for (uint32_t i = 0; ok && i < count; ++i)
+                    {
+                        uint64_t key;
+                        ArmyRow row;
+                        if ((ok = snapshotcodec::Get(pos, end, key) && snapshotcodec::GetRow(pos, end, row)))
+                            rows[key] = std::move(row);
+                    }
+                    if (ok)
+                    {
+                        keyedarmies = std::move(rows);
+                        armyimage = true;
+                    }
+                    break;
+                }
+                case JOURNAL_ARMY:
+                {
+                    uint64_t key;
+                    ArmyRow row;
+                    if ((ok = snapshotcodec::Get(pos, end, key) && snapshotcodec::GetRow(pos, end, row)) && armyimage)
+                        keyedarmies[key] = std::move(row);
+                    break;
+                }
+                case JOURNAL_ARMYGONE:
+                {
+                    uint64_t key;
+                    if ((ok = snapshotcodec::Get(pos, end, key)))
+                        keyedarmies.erase(key);
+                    break;
+                }
+                case JOURNAL_REPORT:
+                {
+                    ReportRow row;
+                    if ((ok = snapshotcodec::GetRow(pos, end, row)))
+                    {
+                        faultin(row.get<0>());
+                        // rows faulted in from the store may hold it already
+                        std::vector<ReportRow> & rows = reports[row.get<0>()];
+                        const std::string & guid = row.get<8>();
+                        if (std::none_of(rows.begin(), rows.end(), [&](const ReportRow & r) { return r.get<8>() == guid; }))
+                            rows.insert(rows.begin(), row);
+                    }
+                    break;
+                }
+                case JOURNAL_MAIL:
+                {
+                    MailRow row;
+                    if ((ok = snapshotcodec::GetRow(pos, end, row)))
+                    {
+                        faultin(row.get<0>());
+                        mail.Put(row);
+                        newmail[mailkey(row.get<0>(), row.get<5>(), row.get<3>())] = row;
+                    }
+                    break;
+                }
+            }
+            if (!ok || pos != end)
+                ++bad;
+        }, records);
+
+        total += records;
+        if (!intact)
+            log->warn("Journal segment {} ends in a partial record after {} records.", s.path, records);
+    }
+    if (bad > 0)
+        log->error("{} journal records could not be decoded and were skipped.", bad);
+
+    heroes.Finish();
+    alliances.Finish();
+    world.evicted.clear();
+    for (auto & account : evicted)
+        world.evicted.emplace_back(account.first, account.second);
+    for (auto & account : reports)
+        world.reports.insert(world.reports.end(), std::make_move_iterator(account.second.begin()), std::make_move_iterator(account.second.end()));
+    if (armyimage)
+    {
+        world.armies.clear();
+        world.armies.reserve(keyedarmies.size());
+        for (auto & army : keyedarmies)
+            world.armies.push_back(std::move(army.second));
+    }
+
+    // Deletions and mail are not part of the saves everything else catches
+    // up through
+    std::vector<savejob> jobs;
+    for (uint64_t id : deletedheroes)
+    {
+        jobs.emplace_back([id](storageconn & db)
+        {
+            db.DeleteHero(id);
+        });
+    }
+    for (int64_t id : deletedalliances)
+    {
+        jobs.emplace_back([id](storageconn & db)
+        {
+            db.DeleteAlliance(id);
+        });
+    }
+    for (auto & m : newmail)
+    {
+        MailRow row = m.second;
+        jobs.emplace_back([row](storageconn & db) mutable
+        {
+            db.ReplaceMail(row);
+        });
+    }
+    if (!jobs.empty())
+        saves.Push(std::move(jobs));
+
+    log->info("Replayed {} journal records from {} segment(s) in {}ms.", total, segments.size(), Utils::time() - t1);
+    return total > 0;
+}
+
+void spitfire::SaveBatch(std::vector<savejob> & jobs, size_t first, size_t last)
+{
+    bool failed = true;
+    try
+    {
+        std::unique_ptr<storageconn> db = store->Connect();
+        db->Begin();
+        for (size_t i = first; i < last; ++i)
+            jobs[i](*db);
+        db->Commit();
+        failed = false;
+    }
+    SQLCATCH3(0, spitfire::GetSingleton());
+
+    if (failed)
+    {
+        // One bad row should not cost the whole batch, retry them one by
+        // one. Each still gets a transaction of its own, as a job may be
+        // several statements (SaveArmies deletes, then inserts).
+        for (size_t i = first; i < last; ++i)
+        {
+            bool saved = false;
+            try
+            {
+                std::unique_ptr<storageconn> db = store->Connect();
+                db->Begin();
+                jobs[i](*db);
+                db->Commit();
+                saved = true;
+            }
+            SQLCATCH3(0, spitfire::GetSingleton());
+
+            if (!saved)
+            {
+                std::lock_guard<std::mutex> l(savefailmtx);
+                savefailed.push_back(std::move(jobs[i]));
+                ++savefailures;
+            }
+        }
+    }
+}
+
+void spitfire::SaveThread()
+{
+    SaveThreadRunning = true;
+
+    std::vector<std::vector<savejob>> groups;
+    while (saves.Wait(groups))
+    {
+        for (std::vector<savejob> & jobs : groups)
+        {
+            uint64_t t1 = Utils::time();
+
+            // The transactions of one group touch disjoint rows, so they fan
+            // out over up to savethreads pooled sessions
+            std::atomic<size_t> next(0);
+            auto worker = [&]()
+            {
+                for (size_t first = next.fetch_add(savebatch); first < jobs.size(); first = next.fetch_add(savebatch))
+                    SaveBatch(jobs, first, std::min<size_t>(jobs.size(), first + savebatch));
+            };
+            size_t transactions = (jobs.size() + savebatch - 1) / savebatch;
+            std::vector<std::thread> workers;
+            for (size_t i = 1; i < std::min<size_t>(savethreads, transactions); ++i)
+                workers.emplace_back(worker);
+            worker();
+            for (std::thread & t : workers)
+                t.join();
+
+            log->info("Saved {} jobs in {}ms.", jobs.size(), Utils::time() - t1);
+        }
+        groups.clear();
+    }
+
+    SaveThreadRunning = false;
+}
+
+void spitfire::stop()
+{
+    io_service_.post([this]()
+    {
+        Shutdown();
+    });
+}
+
+void spitfire::start(connection_ptr c)
+{
+    try
+    {
+        asio::ip::tcp::endpoint endp = c->socket().remote_endpoint();
+        asio::ip::address address = endp.address();
+        c->address = address.to_string();
+        log->info("Client connected {} on shard {}", c->address, c->shard);
+
+        {
+            std::lock_guard<std::mutex> l(connectionsmtx);
+            connections_.insert(c);
+        }
+        c->start();
+    }
+    catch (std::exception & e)
+    {
+        //Remote connection closed before connection is finished
+        //std::cerr << "Server::start(connection_ptr c) exception: " << e.what() << std::endl;
+    }
+}
+
+void spitfire::startpolicy(connection_ptr c)
+{
+    try
+    {
+        asio::ip::tcp::endpoint endp = c->socket().remote_endpoint();
+        asio::ip::address address = endp.address();
+        c->address = address.to_string();
+        log->info("Policy Client connected {}", c->address);
+
+        c->startpolicy();
+    }
+    catch (std::exception & e)
+    {
+        //Remote connection closed before connection is finished
+        //std::cerr << "Server::startpolicy(connection_ptr c) exception: " << e.what() << std::endl;
+    }
+}
+
+void spitfire::stop(connection_ptr c, bool checklock)
+{
+    try
+    {
+        //        if (checklock)
+        //            c->mtx.lock();
+        {
+            std::lock_guard<std::mutex> l(connectionsmtx);
+            connections_.erase(c);
+        }
+        asio::error_code ignored_ec;
+        c->socket().shutdown(asio::ip::tcp::socket::shutdown_both, ignored_ec);
+        c->stop();
+        //        if (checklock)
+        //            c->mtx.unlock();
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "exception: " << e.what() << "\n";
+        //        if (checklock)
+        //            c->mtx.unlock();
+    }
+}
+
+void spitfire::stop_all()
+{
+//    std::for_each(connections_.begin(), connections_.end(),
+//                  std::bind(&connection::stop, _1));
+    std::set<connection_ptr> conns;
+    {
+        std::lock_guard<std::mutex> l(connectionsmtx);
+        conns.swap(connections_);
+    }
+    for (auto & conn : conns)
+        conn->stop();
+}
+
+void spitfire::do_accept(netshard & shard)
+{
+    shard.acceptor.async_accept(shard.socket,
+                                [this, &shard](asio::error_code ec)
+    {
+        try
+        {
+            // Check whether the server was stopped by a signal before this
+            // completion handler had a chance to run.
+            if (!shard.acceptor.is_open())
+            {
+                return;
+            }
+
+            if (!ec)
+            {
+                auto c = std::make_shared<connection>(std::move(shard.socket), request_handler_);
+                c->shard = shard.id;
+                start(c);
+            }
+        }
+        catch (std::exception & e)
+        {
+            //std::cerr << "uncaught do_accept() exception: " << e.what() << std::endl;
+        }
+        do_accept(shard);
+    });
+}
+
+void spitfire::do_acceptpolicy()
+{
+    acceptorpolicy_.async_accept(socketpolicy_,
+                                 [this](asio::error_code ec)
     {
         try
         {
             // Check whether the server was stopped by a signal before this
             // completion handler had a chance to run.
-            if (!acceptor_.is_open())
+            if (!acceptorpolicy_.is_open())
             {
                 return;
             }
@@ -1423,6 +2444,23 @@ bool spitfire::ConnectSQL()
     {
         accountpool = new SessionPool("MySQL", "host=" + sqlhost + ";port=3306;db=" + dbmaintable + ";user=" + sqluser + ";password=" + sqlpass + ";compress=true;auto-reconnect=true");
         serverpool = new SessionPool("MySQL", "host=" + sqlhost + ";port=3306;db=" + dbservertable + ";user=" + sqluser + ";password=" + sqlpass + ";compress=true;auto-reconnect=true");
+        if (storagetype == "memory")
+        {
+            store = new memorystorage();
+        }
+        else if (storagetype == "mysql")
+        {
+            store = new mysqlstorage(*accountpool, *serverpool, dbmaintable, servername);
+        }
+        else
+        {
+            std::cerr << "Unknown storage '" << storagetype << "'" << std::endl;
+            return false;
+        }
+        accountdb = new dbexecutor("account", *store);
+        accountdb->Start(dbthreads);
+        serverdb = new dbexecutor("server", *store);
+        serverdb->Start(dbthreads);
     }
     catch (Poco::Exception& exc)
     {
@@ -1461,29 +2499,48 @@ bool spitfire::InitSockets()
 //         }
 //     }
 //#endif
-
-    // Open the acceptor with the option to reuse the address (i.e. SO_REUSEADDR).
-    asio::ip::tcp::resolver resolver(io_service_);
-    asio::ip::tcp::endpoint endpoint = *resolver.resolve({ bindaddress, bindport });
-    acceptor_.open(endpoint.protocol());
-    acceptor_.set_option(asio::ip::tcp::acceptor::reuse_address(true));
-    bool test = true;
-    try
-    {
-        acceptor_.bind(endpoint);
-    }
-    catch (std::exception& e)
+
+    asio::ip::tcp::resolver resolver(io_service_);
+    asio::ip::tcp::endpoint endpoint = *resolver.resolve({ bindaddress, bindport });
+
+    uint32_t shardcount = networkthreads;
+    if (shardcount == 0)
+        shardcount = std::max(1u, std::thread::hardware_concurrency());
+#ifndef SO_REUSEPORT
+    if (shardcount > 1)
     {
-        throw std::runtime_error(e.what());
+        log->error("SO_REUSEPORT not supported on this platform. Using a single network shard.");
+        shardcount = 1;
     }
-    if (test == false)
+#endif
+
+    // Each shard opens its own acceptor on the same endpoint and lets the kernel
+    // balance incoming connections between them (SO_REUSEPORT).
+    for (uint32_t i = 0; i < shardcount; ++i)
     {
-        throw std::runtime_error("Invalid bind address or port 443 already in use! Exiting.");
-    }
+        auto shard = std::make_unique<netshard>(i);
+        if (i < networkaffinity.size())
+            shard->cpu = networkaffinity[i];
+
+        shard->acceptor.open(endpoint.protocol());
+        shard->acceptor.set_option(asio::ip::tcp::acceptor::reuse_address(true));
+#ifdef SO_REUSEPORT
+        shard->acceptor.set_option(asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+#endif
+        try
+        {
+            shard->acceptor.bind(endpoint);
+        }
+        catch (std::exception& e)
+        {
+            throw std::runtime_error(fmt::format("Invalid bind address or port {} already in use! Exiting. ({})", bindport, e.what()));
+        }
 
-    // Finally listen on the socket and start accepting connections
-    acceptor_.listen();
-    do_accept();
+        // Finally listen on the socket and start accepting connections
+        shard->acceptor.listen();
+        do_accept(*shard);
+        shards_.push_back(std::move(shard));
+    }
     return true;
 }
 
@@ -1495,6 +2552,8 @@ Client * spitfire::NewClient()
         Client * client = new Client();
         client->internalid = clientnum++;
         players.push_back(client);
+        awakeplayers.push_back(client);
+        RankClient(client);
         log->info("New client # {}", players.size());
         return client;
     }
@@ -1516,39 +2575,61 @@ int32_t  spitfire::GetClientIndex(int64_t accountid)
 }
 Client * spitfire::GetClientByCastle(int64_t castleid)
 {
-//     for (Client * client : players)
-//     {
-//         if (client->GetCity(castleid) != 0)
-//             return client;
-//     }
-    return 0;
+    auto it = clientsbycastle.find(castleid);
+    return (it != clientsbycastle.end()) ? it->second : 0;
 }
 Client * spitfire::GetClient(int64_t accountid)
 {
-    for (Client * client : players)
-    {
-        if (client->accountid == accountid)
-            return client;
-    }
-    return 0;
+    auto it = clientsbyaccount.find(accountid);
+    return (it != clientsbyaccount.end()) ? it->second : 0;
 }
 Client * spitfire::GetClientByParent(int64_t accountid)
 {
-    for (Client * client : players)
-    {
-        if (client->masteraccountid == accountid)
-            return client;
-    }
-    return 0;
+    auto it = clientsbyparent.find(accountid);
+    return (it != clientsbyparent.end()) ? it->second : 0;
 }
 Client * spitfire::GetClientByName(std::string name)
 {
-    for (Client * client : players)
-    {
-        if (client->playername == name)
-            return client;
-    }
-    return 0;
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    auto it = clientsbyname.find(name);
+    return (it != clientsbyname.end()) ? it->second : 0;
+}
+
+// Drops the old key only if it still points at this client, so a stale key
+// shared with another client never unindexes that client
+template<typename K>
+static void Reindex(std::unordered_map<K, Client*> & index, const K & oldkey, const K & newkey, Client * client, bool valid)
+{
+    auto it = index.find(oldkey);
+    if (it != index.end() && it->second == client)
+        index.erase(it);
+    if (valid)
+        index[newkey] = client;
+}
+
+void spitfire::SetClientAccountId(Client * client, int64_t accountid)
+{
+    Reindex<int64_t>(clientsbyaccount, client->accountid, accountid, client, accountid != 0);
+    client->accountid = accountid;
+}
+void spitfire::SetClientParentId(Client * client, int64_t masteraccountid)
+{
+    Reindex<int64_t>(clientsbyparent, client->masteraccountid, masteraccountid, client, masteraccountid != 0);
+    client->masteraccountid = masteraccountid;
+}
+void spitfire::SetClientName(Client * client, const std::string & name)
+{
+    std::string oldkey = client->playername;
+    std::string newkey = name;
+    std::transform(oldkey.begin(), oldkey.end(), oldkey.begin(), ::tolower);
+    std::transform(newkey.begin(), newkey.end(), newkey.begin(), ::tolower);
+    Reindex<std::string>(clientsbyname, oldkey, newkey, client, !newkey.empty());
+    client->playername = name;
+    m_playernames.Set(client, name);
+}
+void spitfire::IndexCastle(Client * client, int64_t castleid)
+{
+    clientsbycastle[castleid] = client;
 }
 
 void spitfire::CloseClient(Client* client, int typecode, std::string message) const
@@ -1597,6 +2678,7 @@ City* spitfire::AddPlayerCity(Client* client, int tileid, uint64_t castleid)
 
     client->citylist.push_back(city);
     client->citycount++;
+    RankClient(client);
 
     map->m_tile[tileid].m_city = city;
     m_city.push_back(city);
@@ -1608,6 +2690,9 @@ City* spitfire::AddPlayerCity(Client* client, int tileid, uint64_t castleid)
     map->m_tile[tileid].m_type = CASTLE;
     map->m_tile[tileid].m_castleid = castleid;
 
+    IndexCastle(client, castleid);
+    RankCastle(city);
+
     return city;
 }
 
@@ -1627,19 +2712,16 @@ City * spitfire::AddNpcCity(int tileid)
 
 void spitfire::MassMessage(std::string str, bool nosender /* = false*/, bool tv /* = false*/, bool all /* = false*/)
 {
-    for (Client * client : players)
-    {
-        amf3object obj;
-        obj["cmd"] = "server.SystemInfoMsg";
-        obj["data"] = amf3object();
-        amf3object & data = obj["data"];
-        data["alliance"] = all;
-        data["tV"] = tv;
-        data["noSenderSystemInfo"] = nosender;
-        data["msg"] = str;
-
-        SendObject(client, obj);
-    }
+    amf3object obj;
+    obj["cmd"] = "server.SystemInfoMsg";
+    obj["data"] = amf3object();
+    amf3object & data = obj["data"];
+    data["alliance"] = all;
+    data["tV"] = tv;
+    data["noSenderSystemInfo"] = nosender;
+    data["msg"] = str;
+
+    Broadcast(stBroadcastTarget::World(), obj);
 }
 
 void spitfire::SendMessage(Client * client, std::string str, bool nosender /* = false*/, bool tv /* = false*/, bool all /* = false*/) const
@@ -1666,14 +2748,22 @@ void spitfire::Shutdown()
     //stop timer thread so the save
     //thread gets an accurate snapshot
     serverstatus = SERVERSTATUS_SHUTDOWN;
-
-    try
     {
-        acceptor_.close();
+        std::lock_guard<std::mutex> l(timermtx);
+        timerkick = true;
+        timercv.notify_one();
     }
-    catch (std::exception & e)
+
+    for (auto & shard : shards_)
     {
-        log->error("exception: {}", e.what());
+        try
+        {
+            shard->acceptor.close();
+        }
+        catch (std::exception & e)
+        {
+            log->error("exception: {}", e.what());
+        }
     }
 
     //disconnect everyone
@@ -1683,6 +2773,8 @@ void spitfire::Shutdown()
 
     //shutdown complete
     //do anything else that might need to be done
+    for (auto & shard : shards_)
+        shard->io_service.stop();
     io_service_.stop();
 }
 
@@ -1739,6 +2831,98 @@ void spitfire::SendObject(Client* c, const amf3object& object) const
     SendObject(c->socket, object);
 }
 
+netbuffer_ptr spitfire::SerializeObject(const amf3object & object) const
+{
+    // Serialize straight into a pooled buffer, moving up a size class
+    // whenever the object does not fit
+    netbuffer_ptr buffer = bufferpool::GetSingleton().Get(2048);
+    while (true)
+    {
+        try
+        {
+            amf3writer writer(buffer->data() + 4, buffer->capacity - 4);
+            writer.Write(object);
+            buffer->size = writer.position + 4;
+            break;
+        }
+        catch (std::length_error &)
+        {
+            if (buffer->sizeclass < 0)
+                throw;
+            buffer = bufferpool::GetSingleton().Grow(buffer);
+        }
+    }
+
+    (*(int32_t*)buffer->data()) = int32_t(buffer->size - 4);
+    Utils::ByteSwap5((unsigned char *)buffer->data(), sizeof(int32_t));
+    return buffer;
+}
+
+void spitfire::SendObject(connection * s, const amf3object & object) const
+{
+    if (s == nullptr)
+        return;
+    try
+    {
+        if (serverstatus == 0)
+            return;
+
+        s->write(SerializeObject(object));
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << s->address << "exception: " << __FILE__ << " @ " << __LINE__ << "\n";
+        std::cerr << e.what() << "\n";
+    }
+}
+
+void spitfire::Broadcast(const stBroadcastTarget & target, const amf3object & object, Client * exclude)
+{
+    if (serverstatus == 0)
+        return;
+
+    netbuffer_ptr buffer;
+    try
+    {
+        buffer = SerializeObject(object);
+    }
+    catch (std::exception& e)
+    {
+        log->error("Broadcast() serialization exception: {}", e.what());
+        return;
+    }
+
+    auto send = [&](Client * client)
+    {
+        if ((client == nullptr) || (client == exclude) || (!client->connected) || (client->socket == nullptr))
+            return;
+        client->socket->write(buffer);
+    };
+
+    switch (target.type)
+    {
+    case stBroadcastTarget::WORLD:
+    case stBroadcastTarget::CHANNEL:
+        // No per channel membership is tracked yet, every channel reaches everyone online
+        for (Client * client : players)
+            send(client);
+        break;
+    case stBroadcastTarget::ALLIANCE:
+    {
+        Alliance * alliance = m_alliances->AllianceById(target.allianceid);
+        if (alliance == nullptr)
+            break;
+        for (Alliance::stMember & member : alliance->m_members)
+            send(GetClient(member.clientid));
+        break;
+    }
+    case stBroadcastTarget::LIST:
+        for (Client * client : target.clients)
+            send(client);
+        break;
+    }
+}
+
 bool spitfire::ParseChat(Client * client, std::string str)
 {
     if (str.size() > 0)
@@ -1803,6 +2987,38 @@ bool spitfire::ParseChat(Client * client, std::string str)
                 }
                 SendMessage(client, fmt::format("<font color='#00A2FF'>There are currently <u>{}</u> players online.</font>", tc));
             }
+            else if (!strcmp(command, "snapshot"))
+            {
+                if (client->playername == "Daisy")
+                {
+                    if (snapshotpid != 0)
+                    {
+                        SendMessage(client, fmt::format("Snapshot process has been running for {}ms.", Utils::time() - snapshotstarted));
+                    }
+                    else
+                    {
+                        // taken at the end of the next timer tick
+                        snapshotrequested = true;
+                        {
+                            std::lock_guard<std::mutex> l(timermtx);
+                            timerkick = true;
+                            timercv.notify_one();
+                        }
+                        if (snapshotms != 0)
+                            SendMessage(client, fmt::format("Snapshot requested. The last one took {}ms and copied {} pages.", snapshotms, snapshotpages));
+                        else
+                            SendMessage(client, "Snapshot requested.");
+                    }
+                }
+            }
+            else if (!strcmp(command, "dbstats"))
+            {
+                if (client->playername == "Daisy")
+                {
+                    store->LogStats();
+                    SendMessage(client, "Statement stats written to the log.");
+                }
+            }
             else if (!strcmp(command, "debug"))
             {
                 client->debugmode = !client->debugmode;
@@ -1946,741 +3162,60 @@ int16_t spitfire::GetRelation(int32_t client1, int32_t client2) const
 
 void spitfire::TimerThread()
 {
-    uint64_t t1htimer;
-    uint64_t t30mintimer;
-    uint64_t t6mintimer;
-    uint64_t t5mintimer;
-    uint64_t t3mintimer;
-    uint64_t t1mintimer;
-    uint64_t t5sectimer;
-    uint64_t t1sectimer;
-    uint64_t t100msectimer;
-    uint64_t ltime;
-
-   std::list<stTimedEvent>::iterator iter;
-   std::list<Client*>::iterator playeriter;
-
-    t1htimer = t30mintimer = t6mintimer = t5mintimer = t3mintimer = t1mintimer = t5sectimer = t1sectimer = t100msectimer = Utils::time();
-
-    while (serverstatus == SERVERSTATUS_ONLINE)
-    {
-        try
-        {
-            ltime = Utils::time();
-
-            if (t1sectimer < ltime)
-            {
-                t1sectimer += 1000;
-            }
-            if (t100msectimer < ltime)
-            {
-                for (playeriter = players.begin(); playeriter != players.end(); ++playeriter)
-                {
-                    Client * client = *playeriter;
-//                    client->lists.lock();
-                    for (int j = 0; j < client->citylist.size(); ++j)
-                    {
-                        PlayerCity * city = client->citylist[j];
-                        std::vector<stTroopQueue>::iterator tqiter;
-                        for (tqiter = city->m_troopqueue.begin(); tqiter != city->m_troopqueue.end();)
-                        {
-                            std::list<stTroopTrain>::iterator iter;
-                            iter = tqiter->queue.begin();
-                            if (iter != tqiter->queue.end() && iter->endtime <= ltime)
-                            {
-                                //troops done training
-                                double gain = iter->count * GetPrestigeOfAction(DEF_TRAIN, iter->troopid, 1, city->m_level);
-                                client->Prestige(gain);
-                                client->PlayerInfoUpdate();
-                                if (city->m_mayor)
-                                {
-                                    city->m_mayor->m_experience += gain;
-                                    city->HeroUpdate(city->m_mayor, 2);
-                                }
-
-                                if (tqiter->positionid == -2)
-                                {
-                                    city->SetForts(iter->troopid, iter->count);
-                                }
-                                else
-                                    city->SetTroops(iter->troopid, iter->count);
-                                tqiter->queue.erase(iter++);
-                                if (iter != tqiter->queue.end())
-                                    iter->endtime = ltime + iter->costtime;
-                            }
-                            ++tqiter;
-                        }
-                    }
-//                    client->lists.unlock();
-                }
-
-                if (armylist.size() > 0)
-                {
-                    std::list<stTimedEvent> tarmylist = armylist;
-                    Client* oclient=nullptr;
-                    uint32_t fieldid;
-                    std::vector<stArmyMovement*> campers;
-                    for (iter = tarmylist.begin(); iter != tarmylist.end(); iter++)
-                    {
-                        //armylist.erase(iter++);
-                        stArmyMovement * am = (stArmyMovement *)iter->data;
-                        //if the army is invalid, remove it
-                        if (am->client == 0) {
-                            delete am;
-                            armylist.erase(iter);
-                            continue;
-                        }
-                        if (am->direction == DIRECTION_STAY) continue;
-                        PlayerCity * fcity = (PlayerCity *)am->city;
-                        Client * fclient = am->client;
-                        Hero * fhero = am->hero;
-                        fieldid=am->targetfieldid;
-                        Tile * tile = map->GetTileFromID(fieldid);
-                        if (am->reachtime < ltime)
-                        {
-                            if (am->direction == DIRECTION_FORWARD)
-                            {
-                                //check if its still a valid target
-                                bool validTarget=true;
-                                if (fclient->Beginner() && tile->m_type > 10) validTarget=false;
-                                if (tile->m_ownerid > 0) {
-                                    oclient=GetClient(tile->m_ownerid);
-                                    if (oclient == 0) validTarget=false;
-                                    int16_t relation = m_alliances->GetRelation(fclient->accountid, oclient->accountid);
-                                    if (relation == DEF_SELFRELATION || relation == DEF_ALLIANCE || relation == DEF_ALLY) validTarget=false;
-                                    if (oclient->Beginner() && tile->m_type==CASTLE) validTarget=false;
-                                }
-                                if (validTarget) {
-                                    // scouting mission
-                                    if (am->missiontype==MISSION_SCOUT) {
-                                        // in case of scouting valleys no scouting battle
-                                        if (tile->m_type < CASTLE) {
-                                            // this is for saving memory only for now
-                                            if (tile->m_valley == nullptr) {
-                                                tile->m_valley = new ValleyData;
-                                            }
-                                            tile->m_valley->Reset(false);
-                                            stReport r;
-                                            r.guid = Utils::generaterandomstring(28);
-                                            r.attack = true;
-                                            r.back = false;
-                                            r.armytype = MISSION_SCOUT;
-                                            r.isread = false;
-                                            r.reportid = fclient->currentreportid++;
-                                            int xid, yid;
-                                            GETXYFROMID4(xid,yid,am->startfieldid,mapsize);
-                                            std::stringstream ss;
-                                            ss << am->startposname << " (" << xid << "," << yid << ")";
-                                            r.startpos = ss.str();
-                                            std::stringstream ss1;
-                                            GETXYFROMID4(xid,yid,am->targetfieldid,mapsize);
-                                            ss1 << am->targetposname << " (" << xid << "," << yid << ")";
-                                            r.targetpos = ss1.str();
-                                            r.title = "Scout Report";
-                                            r.type_id = 1;
-                                            r.eventtime = Utils::time();
-                                            std::string path = reportbasepath + r.guid+".xml";
-                                            std::ofstream file;
-                                            file.open(path, std::ios::out);
-                                            ValleyData* valley = ((ValleyData*)tile->m_valley);
-                                            Writer writer(file);
-
-                                            writer.openElt("reportData").attr("reportUrl", reportbaseurl + r.guid + ".xml");
-                                            writer.openElt("scoutReport").attr("isFound", "false").attr("isSuccess", "true").attr("isAttack", "true");
-                                            writer.openElt("scoutInfo").attr("heroLevel",std::to_string(valley->m_temphero->m_level)).attr("heroName",valley->m_temphero->m_name).attr("heroUrl","");
-                                            writer.openElt("troops");
-                                            stTroops st = valley->m_troops;
-                                            int64_t* trc = (int64_t*)&st;
-                                            for (int ij = 0; ij < 12; ij++) {
-                                                if ((*(trc + ij)) > 0) writer.openElt("troopStrType").attr("typeId", std::to_string(ij + 2)).attr("count", std::to_string(*(trc + ij))).closeElt();
-                                            }
-                                            writer.closeElt();
-                                            writer.closeElt();
-                                            writer.openElt("battleInfo").attr("isAttack", "true").closeElt();
-                                            writer.closeAll();
-                                            file.close();
-                                            fclient->reportlist.push_front(r);
-                                            am->direction=DIRECTION_BACKWARD;
-                                            am->reachtime=Utils::time()+am->reachtime-am->starttime-am->resttime;
-                                            am->resttime=0;
-                                            am->starttime=Utils::time();
-                                            if (am->hero!=nullptr) am->hero->m_status=DEF_HERORETURN;
-                                            fclient->SelfArmyUpdate();
-                                            fclient->ReportUpdate();
-                                            continue;
-                                        }
-                                        // otherwise there will be a scouting battle
-                                        else if (tile->m_ownerid > 0) {
-                                            oclient=GetClient(tile->m_ownerid);
-                                            if (oclient!=0) {
-                                                campers.clear();
-                                                for (stArmyMovement* pq : oclient->armymovement) {
-                                                    if (pq->direction==DIRECTION_STAY && pq->targetfieldid==fieldid) campers.push_back(pq);
-                                                }
-                                                for (stArmyMovement* pq : oclient->friendarmymovement) {
-                                                    if (pq->direction==DIRECTION_STAY && pq->targetfieldid==fieldid) campers.push_back(pq);
-                                                }
-                                                attacker atk;
-                                                defender def;
-                                                if (am->hero!=nullptr) {
-                                                    atk.hero.attack=am->hero->GetPower();
-                                                    atk.hero.intel=am->hero->GetStratagem();
-                                                }
-                                                Hero* besthero=nullptr;
-                                                int16_t bestPower=-1;
-                                                if (campers.size()>0) {
-                                                    for (stArmyMovement* pu : campers) {
-                                                        def.troops[2]+=pu->troops.scout;
-                                                        if (pu->hero!=nullptr && pu->hero->GetPower()>bestPower) {
-                                                            besthero=pu->hero;
-                                                            bestPower=pu->hero->GetPower();
-                                                        }
-                                                    }
-                                                }
-                                                atk.troops[2]=am->troops.scout;
-                                                atk.research.military_tradition=fclient->research[T_MILITARYTRADITION].level;
-                                                atk.research.iron_working=fclient->research[T_IRONWORKING].level;
-                                                atk.research.medicine=fclient->research[T_MEDICINE].level;
-                                                atk.research.compass=fclient->research[T_COMPASS].level;
-                                                atk.research.horseback_riding=fclient->research[T_HORSEBACKRIDING].level;
-                                                atk.research.archery=fclient->research[T_ARCHERY].level;
-                                                atk.research.machinery=fclient->research[T_MACHINERY].level;
-                                                def.research.military_tradition=oclient->research[T_MILITARYTRADITION].level;
-                                                def.research.iron_working=oclient->research[T_IRONWORKING].level;
-                                                def.research.medicine=oclient->research[T_MEDICINE].level;
-                                                def.research.compass=oclient->research[T_COMPASS].level;
-                                                def.research.horseback_riding=oclient->research[T_HORSEBACKRIDING].level;
-                                                def.research.archery=oclient->research[T_ARCHERY].level;
-                                                def.research.machinery=oclient->research[T_MACHINERY].level;
-                                                PlayerCity* defenderCity=(PlayerCity*)tile->m_city;
-                                                //also update the hero for a castle
-                                                for (Hero* hh : defenderCity->m_heroes) {
-                                                    if (hh==0) continue;
-                                                    if (hh->GetPower()>bestPower) {
-                                                        besthero=hh;
-                                                        bestPower=hh->GetPower();
-                                                    }
-                                                }
-                                                int64_t mainScouts=0;
-                                                if (defenderCity->m_gooutforbattle) {
-                                                    mainScouts=defenderCity->m_troops.scout;
-                                                    def.troops[2]+=mainScouts;
-                                                }
-                                                if (besthero!=nullptr) {
-                                                    def.hero.attack=besthero->GetPower();
-                                                    def.hero.intel=besthero->GetStratagem();
-                                                }
-                                                battleResult result;
-                                                CombatSimulator::fight(atk,def,&result);
-                                                // send info for scout report generation :: TODO
-
-                                                // distribute the damage between all campers
-                                                int64_t damage=def.troops[2]-result.defenderTroops[2];
-                                                if (campers.size() > 0 &&  damage > 0) {
-                                                    for (stArmyMovement* il : campers) {
-                                                        int64_t dmg=ceil(il->troops.scout*damage/def.troops[2]);
-                                                        if (il->troops.scout > dmg) il->troops.scout-=dmg;
-                                                        else il->troops.scout=0;
-                                                        // if all the troops are dead, send the hero back
-                                                        if (!memcmp(&testMemory,&(il->troops.worker),96)) {
-                                                            if (il->hero!=nullptr) {
-                                                                il->hero->m_status=DEF_HEROIDLE;
-                                                                if (il->city!=0) il->client->HeroUpdate(il->hero->m_id,((PlayerCity*)il->city)->m_castleid);
-                                                            }
-                                                            il->client->armymovement.remove(il);
-                                                            if (am->client!=il->client) {
-                                                                am->client->friendarmymovement.remove(il);
-                                                                am->client->FriendArmyUpdate();
-                                                            }
-                                                            else am->client->armymovement.remove(il);
-                                                            il->client = 0;
-                                                            il->client->SelfArmyUpdate();
-                                                        }
-                                                    }
-                                                }
-                                                if (damage > 0) {
-                                                    mainScouts=ceil(mainScouts*damage/def.troops[2]);
-                                                    int64_t scoutsleft=defenderCity->m_troops.scout-mainScouts;
-                                                    if (scoutsleft>0) defenderCity->m_troops.scout=scoutsleft;
-                                                    else defenderCity->m_troops.scout=0;
-                                                    defenderCity->TroopUpdate();
-                                                }
-                                                // if defender wins
-                                                if (result.result) {
-                                                    // means all attacking scouts are dead
-                                                    if (result.attackerTroops[2]==0) {
-                                                        if (am->hero!=nullptr) {
-                                                            if (am->hero->m_loyalty < 5) am->hero->m_loyalty=0;
-                                                            else am->hero->m_loyalty-=5;
-                                                            if (defenderCity!=0 && defenderCity->GetBuildingLevel(B_FEASTINGHALL)>defenderCity->HeroCount()) {
-                                                                int8_t chance=rand()%100;
-                                                                // in this case the hero will get captured
-                                                                if (chance > am->hero->m_loyalty) {
-                                                                    for (int x=0;x<10;++x) {
-                                                                        if (fcity->m_heroes[x]==fhero) {
-                                                                            fcity->m_heroes[x]=0;
-                                                                            break;
-                                                                        }
-                                                                    }
-                                                                    for (int x=0;x<10;++x) {
-                                                                        if (!defenderCity->m_heroes[x]) {
-                                                                            defenderCity->m_heroes[x]=fhero;
-                                                                        }
-                                                                    }
-                                                                    fhero->m_client=oclient;
-                                                                    fhero->m_ownerid=oclient->accountid;
-                                                                    fhero->m_loyalty=0;
-                                                                    fhero->m_powerbuffadded=0;
-                                                                    fhero->m_stratagembuffadded=0;
-                                                                    fhero->m_managementbuffadded=0;
-                                                                    fhero->m_status=DEF_HEROSEIZED;
-                                                                    defenderCity->HeroUpdate(fhero,0);
-                                                                    fcity->HeroUpdate(fhero,1);
-                                                                    am->client->armymovement.remove(am);
-                                                                    am->client->SelfArmyUpdate();
-                                                                    armylist.remove(*iter);
-                                                                    delete am;
-                                                                    continue;
-                                                                }
-                                                            }
-                                                            // otherwise return the hero to the city immediately
-                                                            fhero->m_status=DEF_HEROSEIZED;
-                                                            fcity->HeroUpdate(fhero,2);
-                                                            am->client->armymovement.remove(am);
-                                                            am->client->SelfArmyUpdate();
-                                                            armylist.remove(*iter);
-                                                            delete am;
-                                                            continue;
-                                                        }
-                                                        am->client->armymovement.remove(am);
-                                                        am->client->SelfArmyUpdate();
-                                                        armylist.remove(*iter);
-                                                        delete am;
-                                                        continue;
-                                                    }
-                                                }
-                                                // if all attacking scouts aren't dead(doesn't matter if they lost or won), send the army back
-                                                am->troops.scout=result.attackerTroops[2];
-                                                am->direction=DIRECTION_BACKWARD;
-                                                am->reachtime=Utils::time()+am->reachtime-am->starttime-am->resttime;
-                                                am->resttime=0;
-                                                am->starttime=Utils::time();
-                                                am->hero->m_status=DEF_HERORETURN;
-                                                am->client->SelfArmyUpdate();
-                                                continue;
-                                            }
-                                        }
-                                        // when scouting a NPC
-                                        else {
-                                            // generate scouting report here
-                                            stReport r;
-                                            r.guid = Utils::generaterandomstring(28);
-                                            r.attack = true;
-                                            r.back = false;
-                                            r.armytype = MISSION_SCOUT;
-                                            r.isread = false;
-                                            r.reportid = fclient->currentreportid++;
-                                            int xid, yid;
-                                            GETXYFROMID4(xid, yid, am->startfieldid, mapsize);
-                                            std::stringstream ss;
-                                            ss << am->startposname << " (" << xid << "," << yid << ")";
-                                            r.startpos = ss.str();
-                                            std::stringstream ss1;
-                                            GETXYFROMID4(xid, yid, am->targetfieldid, mapsize);
-                                            ss1 << am->targetposname << " (" << xid << "," << yid << ")";
-                                            r.targetpos = ss1.str();
-                                            r.title = "Scout Report";
-                                            r.type_id = 1;
-                                            r.eventtime = Utils::time();
-                                            std::string path = reportbasepath + r.guid + ".xml";
-                                            std::ofstream file;
-                                            file.open(path, std::ios::out);
-                                            NpcCity* npc = ((NpcCity*)tile->m_city);
-                                            npc->ResetHero();
-                                            Writer writer(file);
-
-                                            writer.openElt("reportData").attr("reportUrl", reportbaseurl + r.guid + ".xml");
-                                            writer.openElt("scoutReport").attr("isFound", "true").attr("isSuccess", "true").attr("isAttack", "true");
-                                            writer.openElt("scoutInfo").attr("support", std::to_string(npc->m_loyalty)).attr("population", std::to_string(npc->m_population)).attr("gold", std::to_string((int64_t)npc->m_resources.gold)).attr("heroLevel", std::to_string(npc->m_temphero->m_level)).attr("heroName", npc->m_temphero->m_name).attr("heroUrl", "");
-                                            writer.openElt("resource").openElt("food").content(std::to_string((int64_t)npc->m_resources.food)).closeElt().openElt("wood").content(std::to_string((int64_t)npc->m_resources.wood)).closeElt().openElt("iron").content(std::to_string((int64_t)npc->m_resources.iron)).closeElt().openElt("stone").content(std::to_string((int64_t)npc->m_resources.stone)).closeElt().closeElt();
-                                            if (memcmp(&testMemory, &npc->m_forts, sizeof(stForts))) {
-                                                writer.openElt("fortifications");
-                                                if (npc->m_forts.traps > 0) writer.openElt("fortificationsType").attr("typeId", std::to_string(TR_TRAP)).attr("count", std::to_string(npc->m_forts.traps)).closeElt();
-                                                if (npc->m_forts.abatis > 0) writer.openElt("fortificationsType").attr("typeId", std::to_string(TR_ABATIS)).attr("count", std::to_string(npc->m_forts.abatis)).closeElt();
-                                                if (npc->m_forts.logs > 0) writer.openElt("fortificationsType").attr("typeId", std::to_string(TR_ROLLINGLOG)).attr("count", std::to_string(npc->m_forts.logs)).closeElt();
-                                                if (npc->m_forts.towers > 0) writer.openElt("fortificationsType").attr("typeId", std::to_string(TR_ARCHERTOWER)).attr("count", std::to_string(npc->m_forts.towers)).closeElt();
-                                                if (npc->m_forts.trebs>0) writer.openElt("fortificationsType").attr("typeId", std::to_string(TR_TREBUCHET)).attr("count", std::to_string(npc->m_forts.trebs)).closeElt();
-                                                writer.closeElt();
-                                            }
-                                            if (memcmp(&testMemory, &npc->m_troops, sizeof(NpcCity::stTroops))) {
-                                                writer.openElt("troops");
-                                                if (npc->m_troops.warrior > 0) writer.openElt("troopStrType").attr("typeId", std::to_string(TR_WARRIOR)).attr("count", std::to_string(npc->m_troops.warrior)).closeElt();
-                                                if (npc->m_troops.pike > 0) writer.openElt("troopStrType").attr("typeId", std::to_string(TR_PIKE)).attr("count", std::to_string(npc->m_troops.pike)).closeElt();
-                                                if (npc->m_troops.sword > 0) writer.openElt("troopStrType").attr("typeId", std::to_string(TR_SWORDS)).attr("count", std::to_string(npc->m_troops.sword)).closeElt();
-                                                if (npc->m_troops.archer > 0) writer.openElt("troopStrType").attr("typeId", std::to_string(TR_ARCHER)).attr("count", std::to_string(npc->m_troops.archer)).closeElt();
-                                                if (npc->m_troops.cavalry > 0) writer.openElt("troopStrType").attr("typeId", std::to_string(TR_CAVALRY)).attr("count", std::to_string(npc->m_troops.cavalry)).closeElt();
-                                                writer.closeElt();
-                                            }
-                                            
-                                            writer.openElt("buildings");
-                                            std::stringstream vec[31];
-                                            for (stBuilding& b : npc->m_innerbuildings) {
-                                                if (b.type > 30 || b.type==0) continue;
-                                                if (vec[b.type].tellp() > 0) vec[b.type] << ",";
-                                                vec[b.type] << b.level;
-                                            }
-                                            for (stBuilding& b : npc->m_outerbuildings) {
-                                                if (b.type > 30 || b.type == 0) continue;
-                                                if (vec[b.type].tellp() > 0) vec[b.type] << ",";
-                                                vec[b.type] << b.level;
-                                            }
-                                            for (int btype = 0; btype < 31; ++btype) {
-                                                if (vec[btype].tellp() > 0) {
-                                                    writer.openElt("buildingType").attr("type", std::to_string(btype)).attr("levels", vec[btype].str()).closeElt();
-                                                }
-                                            }
-                                            writer.closeElt();
-                                            writer.closeElt();
-                                            writer.openElt("battleInfo").attr("isAttack", "true").attr("unNomal", "No defending troops found.");
-                                            writer.openElt("backTroop");
-                                            writer.openElt("troops");
-                                            if (am->hero != 0) {
-                                                writer.attr("heroLevel", std::to_string(am->hero->m_level)).attr("heroName", am->hero->m_name).attr("heroUrl", am->hero->m_logourl).attr("isHeroBeSeized", "false");
-                                            }
-                                            stTroops st = am->troops;
-                                            int64_t* trc = (int64_t*)&st;
-                                            for (int ij = 0; ij < 12; ij++) {
-                                                if ((*(trc + ij)) > 0) writer.openElt("troopInfo").attr("typeId", std::to_string(ij + 2)).attr("remain", std::to_string(*(trc + ij))).closeElt();
-                                            }
-                                            writer.closeAll();
-                                            file.close();
-                                            fclient->reportlist.push_front(r);
-                                            am->direction=DIRECTION_BACKWARD;
-                                            am->reachtime=Utils::time()+am->reachtime-am->starttime-am->resttime;
-                                            am->resttime=0;
-                                            am->starttime=Utils::time();
-                                            if (am->hero) am->hero->m_status=DEF_HERORETURN;
-                                            am->client->SelfArmyUpdate();
-                                            am->client->ReportUpdate();
-                                            continue;
-                                        }
-                                    }
-                                    else if (am->missiontype==MISSION_ATTACK) {
-                                        // TODO
-                                    }
-                                }
-                                // if not valid target, just send the army back
-                                else {
-                                    am->direction=DIRECTION_BACKWARD;
-                                    am->reachtime=Utils::time()+am->reachtime-am->starttime-am->resttime;
-                                    am->resttime=0;
-                                    am->starttime=Utils::time();
-                                    if (am->hero) am->hero->m_status=DEF_HERORETURN;
-                                    am->client->SelfArmyUpdate();
-                                    continue;
-                                }
-                            }
-                            else 
-                            {
-                                //returning to city from attack/reinforce/etc
-
-                                if (am->hero) am->hero->m_status = DEF_HEROIDLE;
-
-                                am->city->m_resources += am->resources;
-                                ((PlayerCity*)am->city)->m_troops += am->troops;
-                                am->client->armymovement.remove(am);
-
-                                if (am->hero) ((PlayerCity*)am->city)->HeroUpdate(am->hero, 2);
-
-                                am->client->SelfArmyUpdate();
-                                am->client->PlayerInfoUpdate();
-                                ((PlayerCity*)am->city)->TroopUpdate();
-                                ((PlayerCity*)am->city)->ResourceUpdate();
-
-                                stReport r;
-                                r.guid = Utils::generaterandomstring(28);
-                                r.attack = false;
-                                r.back = true;
-                                r.armytype = am->missiontype;
-                                r.isread = false;
-                                r.reportid = fclient->currentreportid++;
-                                int xid, yid;
-                                GETXYFROMID4(xid,yid,am->startfieldid,mapsize);
-                                std::stringstream ss;
-                                ss << am->startposname << " (" << xid << "," << yid << ")";
-                                r.startpos = ss.str();
-                                std::stringstream ss1;
-                                GETXYFROMID4(xid,yid,am->targetfieldid,mapsize);
-                                ss1 << am->targetposname << " (" << xid << "," << yid << ")";
-                                r.targetpos = ss1.str();
-                                if (am->missiontype == MISSION_SCOUT) r.title = "Scout Returned";
-                                else if (am->missiontype == MISSION_ATTACK) r.title = "Attack Returned";
-                                else r.title = "Returned";
-                                r.type_id = 1;
-                                r.eventtime = Utils::time();
-                                std::string path = reportbasepath + r.guid + ".xml";
-                                std::ofstream file;
-                                file.open(path, std::ios::out);
-                                Writer writer(file);
-                                writer.openElt("reportData").attr("reportUrl", reportbaseurl + r.guid + ".xml");
-                                writer.openElt("troopMovement").attr("isBack", "true").attr("type", std::to_string(am->missiontype));
-                                if (am->hero != 0) {
-                                    writer.attr("heroLevel", std::to_string(am->hero->m_level)).attr("heroName", am->hero->m_name).attr("heroUrl", am->hero->m_logourl);
-                                }
-                                stTroops st = am->troops;
-                                int64_t* trc = (int64_t*)&st;
-                                for (int ij = 0; ij < 12; ij++) {
-                                    if ((*(trc + ij)) > 0) writer.openElt("troops").attr("typeId", std::to_string(ij + 2)).attr("count", std::to_string(*(trc + ij))).closeElt();
-                                }
-                                writer.closeElt();
-                                writer.closeAll();
-                                file.close();
-                                fclient->reportlist.push_front(r);
-                                fclient->ReportUpdate();
-
-                                armylist.remove(*iter);
-                                delete am;
-                            }
-                        }
-                    }
-                }
-
-                //TODO: some buildings not being set to notupgrading properly. add a new check for all buildings under construction to see if they are due to finish? maybe?
-                if (buildinglist.size() > 0)
-                {
-                    for (iter = buildinglist.begin(); iter != buildinglist.end();)
-                    {
-                        stBuildingAction * ba = (stBuildingAction *)iter->data;
-                        Client * client = ba->client;
-                        PlayerCity * city = ba->city;
-                        stBuilding * bldg = ba->city->GetBuilding(ba->positionid);
-//                        client->lists.lock();
-                        if (bldg->endtime < ltime)
-                        {
-                            if (bldg->status == 1)
-                            {
-                                //build/upgrade
-                                bldg->status = 0;
-                                bldg->level++;
-                                ba->city->SetBuilding(bldg->type, bldg->level, ba->positionid, 0, 0.0, 0.0);
-
-                                if (bldg->type == B_INN)
-                                {
-                                    for (int i = 0; i < 10; ++i)
-                                    {
-                                        if (city->m_innheroes[i])
-                                        {
-                                            delete city->m_innheroes[i];
-                                            city->m_innheroes[i] = 0;
-                                        }
-                                    }
-                                }
-                                if (bldg->type == B_TOWNHALL)
-                                {
-                                    if (bldg->level == 5)
-                                    {
-                                        //beginner protection removed
-                                        client->Beginner(false);
-                                        CreateMail("System", client->playername, "Beginner's Protection Expired", "Dear player,\n\
-This letter is dedicated to inform you that the Beginner's Protection is expired (7 days protection period was due or Town Hall has been upgraded to level 5). Now you are formally joining the battlefields of Evony. This is a competitive world. You never know when your enemies will come to your city gate. Therefore countermeasures must be made to secure your realm. It's recommended that you upgrade the Walls and build more fortified units, making it a great cost to those who lay their eyes upon your territory.In initial phase, your troops are far from enough to edge out the rivals, therefore you are also advised to build more Warehouses to preserve the resources from plundering.\n\
-Hang in there and stay alert.Good luck!", MAIL_SYSTEM);
-                                        //title- Beginner's Protection Expired
-                                        //content- Dear player,
-                                        //This letter is dedicated to inform you that the Beginner's Protection is expired (7 days protection period was due or Town Hall has been upgraded to level 5). Now you are formally joining the battlefields of Evony. This is a competitive world. You never know when your enemies will come to your city gate. Therefore countermeasures must be made to secure your realm. It's recommended that you upgrade the Walls and build more fortified units, making it a great cost to those who lay their eyes upon your territory.In initial phase, your troops are far from enough to edge out the rivals, therefore you are also advised to build more Warehouses to preserve the resources from plundering.
-                                        //Hang in there and stay alert.Good luck!
-                                    }
-                                }
-
-                                amf3object obj = amf3object();
-                                obj["cmd"] = "server.BuildComplate";
-                                obj["data"] = amf3object();
-
-                                amf3object & data = obj["data"];
-
-                                data["buildingBean"] = bldg->ToObject();
-                                data["castleId"] = city->m_castleid;
-
-                                buildinglist.erase(iter++);
-
-                                double gain = GetPrestigeOfAction(DEF_BUILDING, bldg->type, bldg->level, city->m_level);
-                                client->Prestige(gain);
-
-                                delete ba;
-
-                                client->CalculateResources();
-                                city->CalculateStats();
-                                if (city->m_mayor)
-                                {
-                                    city->m_mayor->m_experience += gain;
-                                    city->HeroUpdate(city->m_mayor, 2);
-                                }
-                                //city->CastleUpdate();
-                                client->PlayerInfoUpdate();
-                                city->ResourceUpdate();
-
-                                SendObject(client, obj);
-
-//                                client->lists.unlock();
-                                continue;
-                            }
-                            else if (bldg->status == 2)
-                            {
-                                //destruct
-                                bldg->status = 0;
-                                bldg->level--;
-
-                                stResources res;
-                                res.food = m_buildingconfig[bldg->type][bldg->level].food / 3;
-                                res.wood = m_buildingconfig[bldg->type][bldg->level].wood / 3;
-                                res.stone = m_buildingconfig[bldg->type][bldg->level].stone / 3;
-                                res.iron = m_buildingconfig[bldg->type][bldg->level].iron / 3;
-                                res.gold = m_buildingconfig[bldg->type][bldg->level].gold / 3;
-                                ba->city->m_resources += res;
-
-                                if (bldg->level == 0)
-                                    ba->city->SetBuilding(0, 0, ba->positionid, 0, 0.0, 0.0);
-                                else
-                                    ba->city->SetBuilding(bldg->type, bldg->level, ba->positionid, 0, 0.0, 0.0);
-
-                                delete ba;
-
-                                client->CalculateResources();
-                                city->CalculateStats();
-
-
-                                amf3object obj = amf3object();
-                                obj["cmd"] = "server.BuildComplate";
-                                obj["data"] = amf3object();
-
-                                amf3object & data = obj["data"];
-
-                                data["buildingBean"] = bldg->ToObject();
-                                data["castleId"] = city->m_castleid;
-
-                                SendObject(client, obj);
-
-                                buildinglist.erase(iter++);
-
-                                client->CalculateResources();
-                                city->CalculateStats();
-                                city->ResourceUpdate();
-
-
-//                                client->lists.unlock();
-                                continue;
-                            }
-                        }
-//                        client->lists.unlock();
-                        ++iter;
-                    }
-                }
-
-                if (researchlist.size() > 0)
-                {
-                    for (iter = researchlist.begin(); iter != researchlist.end();)
-                    {
-                        stResearchAction * ra = (stResearchAction *)iter->data;
-                        Client * client = ra->client;
-                        PlayerCity * city = ra->city;
-//                        client->lists.lock();
-                        if (ra->researchid != 0)
-                        {
-                            if (client->research[ra->researchid].endtime < ltime)
-                            {
-                                city->m_researching = false;
-                                client->research[ra->researchid].level++;
-                                client->research[ra->researchid].endtime = 0;
-                                client->research[ra->researchid].starttime = 0;
-                                client->research[ra->researchid].castleid = 0;
-
-                                amf3object obj = amf3object();
-                                obj["cmd"] = "server.ResearchCompleteUpdate";
-                                obj["data"] = amf3object();
-
-                                amf3object & data = obj["data"];
-
-                                data["castleId"] = city->m_castleid;
-
-
-                                researchlist.erase(iter++);
-
-                                double gain = GetPrestigeOfAction(DEF_RESEARCH, ra->researchid, client->research[ra->researchid].level, city->m_level);
-                                client->Prestige(gain);
+    uint64_t t1htimer;
+    uint64_t t30mintimer;
+    uint64_t t6mintimer;
+    uint64_t t5mintimer;
+    uint64_t t3mintimer;
+    uint64_t t1mintimer;
+    uint64_t t5sectimer;
+    uint64_t t1sectimer;
+    uint64_t savetimer;
+    uint64_t snapshottimer;
+    uint64_t ltime;
 
+    t1htimer = t30mintimer = t6mintimer = t5mintimer = t3mintimer = t1mintimer = t5sectimer = t1sectimer = Utils::time();
+    savetimer = t1sectimer + saveinterval;
+    snapshottimer = (snapshotinterval != 0) ? t1sectimer + snapshotinterval : UINT64_MAX;
 
-                                client->CalculateResources();
-                                city->CalculateStats();
-                                if (city->m_mayor)
-                                {
-                                    city->m_mayor->m_experience += gain;
-                                    city->HeroUpdate(city->m_mayor, 2);
-                                }
-                                //city->CastleUpdate();
-                                client->PlayerInfoUpdate();
-                                city->ResourceUpdate();
+    while (serverstatus == SERVERSTATUS_ONLINE)
+    {
+        try
+        {
+            std::unique_lock<std::mutex> wl(worldmtx);
 
-                                SendObject(client, obj);
+            ltime = Utils::time();
 
-                                delete ra;
+            // armies, buildings, research, troop queues, buffs and beginner protection
+            RunTimedEvents(ltime);
 
-//                                client->lists.unlock();
-                                continue;
-                            }
-                        }
-                        else
-                        {
-                            researchlist.erase(iter++);
-//                            client->lists.unlock();
-                            continue;
-                        }
-//                        client->lists.unlock();
-                        ++iter;
-                    }
-                }
-                t100msectimer += 100;
+            if (t1sectimer < ltime)
+            {
+                t1sectimer += 1000;
             }
             if (t5sectimer < ltime)
             {
                 //market.Process();
                 SortPlayers();
                 SortHeroes();
-                SortCastles();
                 m_alliances->SortAlliances();
-                for (playeriter = players.begin(); playeriter != players.end(); ++playeriter)
-                {
-                    Client * client = *playeriter;
-                    for (int j = 0; j < client->bufflist.size(); ++j)
-                    {
-                        if (client->bufflist[j].id.length() != 0)
-                        {
-                            if (ltime > client->bufflist[j].endtime)
-                            {
-                                if (client->bufflist[j].id == "PlayerPeaceBuff")
-                                {
-                                    client->SetBuff("PlayerPeaceCoolDownBuff", "Truce Agreement in cooldown.", ltime + (12 * 60 * 60 * 1000));
-                                }
-                                client->RemoveBuff(client->bufflist[j].id);
-                            }
-                        }
-                    }
-                }
 
                 t5sectimer += 5000;
             }
             if (t1mintimer < ltime)
             {
-                for (playeriter = players.begin(); playeriter != players.end(); ++playeriter)
+                size_t awake = 0;
+                for (Client * client : awakeplayers)
                 {
-                    Client * client = *playeriter;
-                    client->CalculateResources();
-
-                    if (client->socknum > 0 && (client->currentcityindex != -1) && client->citylist[client->currentcityindex])
+                    if (hibernateafter != 0 && client->socket == nullptr && client->lastseen + hibernateafter < ltime)
                     {
-                        client->citylist[client->currentcityindex]->ResourceUpdate();
+                        Hibernate(client, ltime);
+                        continue;
                     }
+                    awakeplayers[awake++] = client;
                 }
-
-                CheckRankSearchTimeouts(ltime);
+                awakeplayers.resize(awake);
+                EvictIdle(ltime);
 
                 t1mintimer += 60000;
             }
@@ -2717,9 +3252,15 @@ Hang in there and stay alert.Good luck!", MAIL_SYSTEM);
                         }
                         else if (m_city.at(i)->m_type == CASTLE)
                         {
-                            ((PlayerCity*)m_city.at(i))->RecalculateCityStats();
+                            PlayerCity * city = (PlayerCity*)m_city.at(i);
+                            // caught up by Wake instead
+                            if (city->m_client == nullptr || !city->m_client->hibernating)
+                                city->RecalculateCityStats();
                         }
                     }
+                    // for the population ranking
+                    for (Client * client : awakeplayers)
+                        client->SumPopulation();
                 }
                 catch (...)
                 {
@@ -2743,6 +3284,11 @@ Hang in there and stay alert.Good luck!", MAIL_SYSTEM);
 
                 t1htimer += 3600000;
             }
+            if (savetimer < ltime)
+            {
+                FlushDirty();
+                savetimer = ltime + saveinterval;
+            }
 
             uint64_t t1 = Utils::time();
             //packet queue - always process per cycle
@@ -2769,7 +3315,33 @@ Hang in there and stay alert.Good luck!", MAIL_SYSTEM);
                 //consoleLogger->information("Slow packet queue: " + Poco::NumberFormatter::format(t2-t1) + "ms");
                 log->error("Slow packet queue: %Lums", t2 - t1);
             }
-            std::this_thread::sleep_for(1ms);
+
+            // The tick is done and the world consistent, the cheapest point
+            // to fork a snapshot from
+            ReapSnapshot(false);
+            if (snapshotrequested || snapshottimer < ltime)
+            {
+                snapshotrequested = false;
+                if (snapshotinterval != 0)
+                    snapshottimer = ltime + snapshotinterval;
+                WriteSnapshot(false);
+            }
+
+            // sleep until the next periodic tick or event deadline, whichever is first
+            uint64_t wake = std::min({ t1sectimer, t5sectimer, t1mintimer, t3mintimer, t6mintimer, t1htimer, savetimer, snapshottimer, timers.NextDue() });
+            {
+                std::lock_guard<std::mutex> tl(timermtx);
+                timerwake = wake;
+                timerkick = false;
+            }
+            JournalCommit();
+            wl.unlock();
+
+            std::unique_lock<std::mutex> tl(timermtx);
+            uint64_t now = Utils::time();
+            // periodic ticks fire once strictly past their mark
+            if (wake >= now)
+                timercv.wait_for(tl, std::chrono::milliseconds(wake - now + 1), [this] { return timerkick; });
         }
         catch (...)
         {
@@ -2979,30 +3551,877 @@ double spitfire::GetPrestigeOfAction(int8_t action, int8_t id, int8_t level, int
                     prestige = 5;//not final
                     break;
             }
-            break;
+            break;
+    }
+    for (int i = 0; i < level; ++i)
+        prestige *= 2;
+    for (int i = 0; i < thlevel - 1; ++i)
+        prestige /= 2;
+    return prestige;
+}
+
+void spitfire::AddTimedEvent(stTimedEvent & te)
+{
+    te.id = tecounter++;
+    switch (te.type)
+    {
+        case DEF_TIMEDBUILDING:
+        {
+            stBuildingAction * ba = (stBuildingAction *)te.data;
+            timedevents[te.id] = buildinglist.insert(buildinglist.end(), te);
+            buildingevents[std::make_pair(ba->city, ba->positionid)] = te.id;
+            ScheduleTimedEvent(te);
+            break;
+        }
+        case DEF_TIMEDRESEARCH:
+        {
+            stResearchAction * ra = (stResearchAction *)te.data;
+            timedevents[te.id] = researchlist.insert(researchlist.end(), te);
+            researchevents[ra->city] = te.id;
+            ScheduleTimedEvent(te);
+            break;
+        }
+    }
+}
+
+std::list<stTimedEvent>::iterator spitfire::RemoveTimedEvent(std::list<stTimedEvent> & list, std::list<stTimedEvent>::iterator iter)
+{
+    Unschedule(iter->type, iter->id, 0);
+    timedevents.erase(iter->id);
+    if (iter->type == DEF_TIMEDBUILDING)
+    {
+        stBuildingAction * ba = (stBuildingAction *)iter->data;
+        auto found = buildingevents.find(std::make_pair(ba->city, ba->positionid));
+        if (found != buildingevents.end() && found->second == iter->id)
+            buildingevents.erase(found);
+    }
+    else if (iter->type == DEF_TIMEDRESEARCH)
+    {
+        stResearchAction * ra = (stResearchAction *)iter->data;
+        auto found = researchevents.find(ra->city);
+        if (found != researchevents.end() && found->second == iter->id)
+            researchevents.erase(found);
+    }
+    return list.erase(iter);
+}
+
+void spitfire::Schedule(int8_t type, int64_t id, int32_t param, double due)
+{
+    stScheduleKey key;
+    key.type = type;
+    key.id = id;
+    key.param = param;
+    uint64_t when = (due > 0) ? uint64_t(due) : 0;
+    if (timers.Schedule(key, when))
+    {
+        // new earliest deadline, wake the timer thread if it sleeps past it
+        std::lock_guard<std::mutex> l(timermtx);
+        if (when < timerwake)
+        {
+            timerkick = true;
+            timercv.notify_one();
+        }
+    }
+}
+
+void spitfire::Unschedule(int8_t type, int64_t id, int32_t param)
+{
+    stScheduleKey key;
+    key.type = type;
+    key.id = id;
+    key.param = param;
+    timers.Cancel(key);
+}
+
+void spitfire::ScheduleTimedEvent(const stTimedEvent & te)
+{
+    if (te.type == DEF_TIMEDBUILDING)
+    {
+        stBuildingAction * ba = (stBuildingAction *)te.data;
+        stBuilding * bldg = ba->city->GetBuilding(ba->positionid);
+        Schedule(te.type, te.id, 0, bldg ? bldg->endtime : 0);
+    }
+    else if (te.type == DEF_TIMEDRESEARCH)
+    {
+        stResearchAction * ra = (stResearchAction *)te.data;
+        // cancelled research is cleaned up right away
+        Schedule(te.type, te.id, 0, (ra->researchid != 0) ? ra->client->research[ra->researchid].endtime : 0);
+    }
+}
+
+void spitfire::ScheduleBuilding(PlayerCity * city, int16_t positionid)
+{
+    auto found = buildingevents.find(std::make_pair(city, positionid));
+    if (found != buildingevents.end())
+        ScheduleTimedEvent(*timedevents[found->second]);
+}
+
+void spitfire::ScheduleResearch(PlayerCity * city)
+{
+    auto found = researchevents.find(city);
+    if (found != researchevents.end())
+        ScheduleTimedEvent(*timedevents[found->second]);
+}
+
+void spitfire::ScheduleTroopQueue(PlayerCity * city, stTroopQueue * queue)
+{
+    if (queue == nullptr)
+        return;
+    // only the head of a queue is ever training
+    if (queue->queue.empty() || queue->queue.front().endtime <= 0)
+        Unschedule(DEF_TIMEDTROOPS, city->m_castleid, queue->positionid);
+    else
+        Schedule(DEF_TIMEDTROOPS, city->m_castleid, queue->positionid, queue->queue.front().endtime);
+}
+
+void spitfire::ScheduleBuffs(Client * client)
+{
+    double due = -1;
+    for (stBuff & buff : client->bufflist)
+    {
+        if (buff.id.length() != 0 && (due < 0 || buff.endtime < due))
+            due = buff.endtime;
+    }
+    if (due < 0)
+        Unschedule(DEF_TIMEDBUFF, client->accountid, 0);
+    else
+        Schedule(DEF_TIMEDBUFF, client->accountid, 0, due);
+}
+
+void spitfire::ScheduleBeginner(Client * client)
+{
+    if (client->Beginner())
+        Schedule(DEF_TIMEDBEGINNER, client->accountid, 0, client->creation + 1000.0 * 60 * 60 * 24 * 7);
+    else
+        Unschedule(DEF_TIMEDBEGINNER, client->accountid, 0);
+}
+
+void spitfire::RunTimedEvents(uint64_t ltime)
+{
+    stScheduleKey key;
+    while (timers.PopDue(ltime, key))
+    {
+        try
+        {
+            switch (key.type)
+            {
+                case DEF_TIMEDARMY:
+                {
+                    stArmyMovement * am = armies.Get(uint32_t(key.id));
+                    if (am && am->direction != DIRECTION_STAY)
+                        ArmyArrived(am, ltime);
+                    break;
+                }
+                case DEF_TIMEDBUILDING:
+                case DEF_TIMEDRESEARCH:
+                {
+                    auto found = timedevents.find(key.id);
+                    if (found == timedevents.end())
+                        break;
+                    if (key.type == DEF_TIMEDBUILDING)
+                        BuildingComplete(found->second, ltime);
+                    else
+                        ResearchComplete(found->second, ltime);
+                    break;
+                }
+                case DEF_TIMEDTROOPS:
+                    TroopQueueComplete(key.id, key.param, ltime);
+                    break;
+                case DEF_TIMEDBUFF:
+                    BuffsExpired(key.id, ltime);
+                    break;
+                case DEF_TIMEDBEGINNER:
+                {
+                    Client * client = GetClient(key.id);
+                    if (client)
+                    {
+                        client->CheckBeginner();
+                        client->MarkDirty();
+                    }
+                    break;
+                }
+            }
+        }
+        SQLCATCH3(0, spitfire::GetSingleton());
+    }
+}
+
+void spitfire::BuildingComplete(std::list<stTimedEvent>::iterator iter, uint64_t ltime)
+{
+    stBuildingAction * ba = (stBuildingAction *)iter->data;
+    Client * client = ba->client;
+    PlayerCity * city = ba->city;
+    stBuilding * bldg = ba->city->GetBuilding(ba->positionid);
+
+    //TODO: some buildings not being set to notupgrading properly. add a new check for all buildings under construction to see if they are due to finish? maybe?
+    if (bldg->endtime > ltime)
+    {
+        // pushed back since it was scheduled
+        ScheduleTimedEvent(*iter);
+        return;
+    }
+    // production and storage change from here on
+    Wake(client, ltime);
+    city->MarkDirty();
+    client->MarkDirty();
+    if (bldg->status == 1)
+    {
+        //build/upgrade
+        bldg->status = 0;
+        bldg->level++;
+        ba->city->SetBuilding(bldg->type, bldg->level, ba->positionid, 0, 0.0, 0.0);
+
+        if (bldg->type == B_INN)
+        {
+            for (int i = 0; i < 10; ++i)
+            {
+                if (city->m_innheroes[i])
+                {
+                    delete city->m_innheroes[i];
+                    city->m_innheroes[i] = 0;
+                }
+            }
+        }
+        if (bldg->type == B_TOWNHALL)
+        {
+            if (bldg->level == 5)
+            {
+                //beginner protection removed
+                client->Beginner(false);
+                ScheduleBeginner(client);
+                CreateMail("System", client->playername, "Beginner's Protection Expired", "Dear player,\n\
+This letter is dedicated to inform you that the Beginner's Protection is expired (7 days protection period was due or Town Hall has been upgraded to level 5). Now you are formally joining the battlefields of Evony. This is a competitive world. You never know when your enemies will come to your city gate. Therefore countermeasures must be made to secure your realm. It's recommended that you upgrade the Walls and build more fortified units, making it a great cost to those who lay their eyes upon your territory.In initial phase, your troops are far from enough to edge out the rivals, therefore you are also advised to build more Warehouses to preserve the resources from plundering.\n\
+Hang in there and stay alert.Good luck!", MAIL_SYSTEM);
+            }
+        }
+
+        amf3object obj = amf3object();
+        obj["cmd"] = "server.BuildComplate";
+        obj["data"] = amf3object();
+
+        amf3object & data = obj["data"];
+
+        data["buildingBean"] = bldg->ToObject();
+        data["castleId"] = city->m_castleid;
+
+        RemoveTimedEvent(buildinglist, iter);
+
+        double gain = GetPrestigeOfAction(DEF_BUILDING, bldg->type, bldg->level, city->m_level);
+        client->Prestige(gain);
+
+        delete ba;
+
+        client->CalculateResources();
+        city->CalculateStats();
+        if (city->m_mayor)
+        {
+            city->m_mayor->m_experience += gain;
+            city->m_mayor->MarkDirty();
+            city->HeroUpdate(city->m_mayor, 2);
+        }
+        //city->CastleUpdate();
+        client->PlayerInfoUpdate();
+        city->ResourceUpdate();
+
+        SendObject(client, obj);
+    }
+    else if (bldg->status == 2)
+    {
+        //destruct
+        bldg->status = 0;
+        bldg->level--;
+
+        stResources res;
+        res.food = m_buildingconfig[bldg->type][bldg->level].food / 3;
+        res.wood = m_buildingconfig[bldg->type][bldg->level].wood / 3;
+        res.stone = m_buildingconfig[bldg->type][bldg->level].stone / 3;
+        res.iron = m_buildingconfig[bldg->type][bldg->level].iron / 3;
+        res.gold = m_buildingconfig[bldg->type][bldg->level].gold / 3;
+        city->SettleResources(ltime);
+        city->m_resources += res;
+
+        if (bldg->level == 0)
+            ba->city->SetBuilding(0, 0, ba->positionid, 0, 0.0, 0.0);
+        else
+            ba->city->SetBuilding(bldg->type, bldg->level, ba->positionid, 0, 0.0, 0.0);
+
+        delete ba;
+
+        client->CalculateResources();
+        city->CalculateStats();
+
+
+        amf3object obj = amf3object();
+        obj["cmd"] = "server.BuildComplate";
+        obj["data"] = amf3object();
+
+        amf3object & data = obj["data"];
+
+        data["buildingBean"] = bldg->ToObject();
+        data["castleId"] = city->m_castleid;
+
+        SendObject(client, obj);
+
+        RemoveTimedEvent(buildinglist, iter);
+
+        client->CalculateResources();
+        city->CalculateStats();
+        city->ResourceUpdate();
+    }
+}
+
+void spitfire::ResearchComplete(std::list<stTimedEvent>::iterator iter, uint64_t ltime)
+{
+    stResearchAction * ra = (stResearchAction *)iter->data;
+    Client * client = ra->client;
+    PlayerCity * city = ra->city;
+
+    if (ra->researchid == 0)
+    {
+        // cancelled
+        RemoveTimedEvent(researchlist, iter);
+        return;
+    }
+    if (client->research[ra->researchid].endtime > ltime)
+    {
+        ScheduleTimedEvent(*iter);
+        return;
+    }
+    Wake(client, ltime);
+
+    city->MarkDirty();
+    client->MarkDirty();
+    city->m_researching = false;
+    client->research[ra->researchid].level++;
+    client->research[ra->researchid].endtime = 0;
+    client->research[ra->researchid].starttime = 0;
+    client->research[ra->researchid].castleid = 0;
+
+    amf3object obj = amf3object();
+    obj["cmd"] = "server.ResearchCompleteUpdate";
+    obj["data"] = amf3object();
+
+    amf3object & data = obj["data"];
+
+    data["castleId"] = city->m_castleid;
+
+
+    RemoveTimedEvent(researchlist, iter);
+
+    double gain = GetPrestigeOfAction(DEF_RESEARCH, ra->researchid, client->research[ra->researchid].level, city->m_level);
+    client->Prestige(gain);
+
+
+    client->CalculateResources();
+    city->CalculateStats();
+    if (city->m_mayor)
+    {
+        city->m_mayor->m_experience += gain;
+        city->m_mayor->MarkDirty();
+        city->HeroUpdate(city->m_mayor, 2);
+    }
+    //city->CastleUpdate();
+    client->PlayerInfoUpdate();
+    city->ResourceUpdate();
+
+    SendObject(client, obj);
+
+    delete ra;
+}
+
+void spitfire::TroopQueueComplete(int64_t castleid, int32_t positionid, uint64_t ltime)
+{
+    Client * client = GetClientByCastle(castleid);
+    if (client == nullptr)
+        return;
+    PlayerCity * city = client->GetCity(castleid);
+    if (city == nullptr)
+        return;
+    stTroopQueue * tq = city->GetBarracksQueue(positionid);
+    if (tq == nullptr)
+        return;
+
+    std::list<stTroopTrain>::iterator iter = tq->queue.begin();
+    if (iter != tq->queue.end() && iter->endtime <= ltime)
+    {
+        //troops done training
+        city->MarkDirty();
+        client->MarkDirty();
+        double gain = iter->count * GetPrestigeOfAction(DEF_TRAIN, iter->troopid, 1, city->m_level);
+        client->Prestige(gain);
+        client->PlayerInfoUpdate();
+        if (city->m_mayor)
+        {
+            city->m_mayor->m_experience += gain;
+            city->m_mayor->MarkDirty();
+            city->HeroUpdate(city->m_mayor, 2);
+        }
+
+        if (tq->positionid == -2)
+        {
+            city->SetForts(iter->troopid, iter->count);
+        }
+        else
+            city->SetTroops(iter->troopid, iter->count);
+        tq->queue.erase(iter++);
+        if (iter != tq->queue.end())
+            iter->endtime = ltime + iter->costtime;
+    }
+    ScheduleTroopQueue(city, tq);
+}
+
+void spitfire::ArmyArrived(stArmyMovement * am, uint64_t ltime)
+{
+    Client* oclient=nullptr;
+    uint32_t fieldid;
+    std::vector<stArmyMovement*> campers;
+    PlayerCity * fcity = (PlayerCity *)am->city;
+    Client * fclient = am->client;
+    Hero * fhero = am->hero;
+    fieldid=am->targetfieldid;
+    Tile * tile = map->GetTileFromID(fieldid);
+    if (am->reachtime <= ltime)
+    {
+        // resources are dropped off; reports go through FileReport, which
+        // copes with evicted histories
+        Wake(fclient, ltime);
+        fclient->MarkDirty();
+        if (fcity) fcity->MarkDirty();
+        if (fhero) fhero->MarkDirty();
+        if (am->direction == DIRECTION_FORWARD)
+        {
+            //check if its still a valid target
+            bool validTarget=true;
+            if (fclient->Beginner() && tile->m_type > 10) validTarget=false;
+            if (tile->m_ownerid > 0) {
+                oclient=GetClient(tile->m_ownerid);
+                if (oclient == 0) validTarget=false;
+                else Wake(oclient, ltime);
+                int16_t relation = m_alliances->GetRelation(fclient->accountid, oclient->accountid);
+                if (relation == DEF_SELFRELATION || relation == DEF_ALLIANCE || relation == DEF_ALLY) validTarget=false;
+                if (oclient->Beginner() && tile->m_type==CASTLE) validTarget=false;
+            }
+            if (validTarget) {
+                // scouting mission
+                if (am->missiontype==MISSION_SCOUT) {
+                    // in case of scouting valleys no scouting battle
+                    if (tile->m_type < CASTLE) {
+                        // this is for saving memory only for now
+                        if (tile->m_valley == nullptr) {
+                            tile->m_valley = new ValleyData;
+                        }
+                        tile->m_valley->Reset(false);
+                        stReport r;
+                        r.guid = Utils::generaterandomstring(28);
+                        r.attack = true;
+                        r.back = false;
+                        r.armytype = MISSION_SCOUT;
+                        r.isread = false;
+                        r.reportid = fclient->currentreportid++;
+                        int xid, yid;
+                        GETXYFROMID4(xid,yid,am->startfieldid,mapsize);
+                        std::stringstream ss;
+                        ss << am->startposname << " (" << xid << "," << yid << ")";
+                        r.startpos = ss.str();
+                        std::stringstream ss1;
+                        GETXYFROMID4(xid,yid,am->targetfieldid,mapsize);
+                        ss1 << am->targetposname << " (" << xid << "," << yid << ")";
+                        r.targetpos = ss1.str();
+                        r.title = "Scout Report";
+                        r.type_id = 1;
+                        r.eventtime = Utils::time();
+                        std::string path = reportbasepath + r.guid+".xml";
+                        std::ofstream file;
+                        file.open(path, std::ios::out);
+                        ValleyData* valley = ((ValleyData*)tile->m_valley);
+                        Writer writer(file);
+
+                        writer.openElt("reportData").attr("reportUrl", reportbaseurl + r.guid + ".xml");
+                        writer.openElt("scoutReport").attr("isFound", "false").attr("isSuccess", "true").attr("isAttack", "true");
+                        writer.openElt("scoutInfo").attr("heroLevel",std::to_string(valley->m_temphero->m_level)).attr("heroName",valley->m_temphero->m_name).attr("heroUrl","");
+                        writer.openElt("troops");
+                        stTroops st = valley->m_troops;
+                        int64_t* trc = (int64_t*)&st;
+                        for (int ij = 0; ij < 12; ij++) {
+                            if ((*(trc + ij)) > 0) writer.openElt("troopStrType").attr("typeId", std::to_string(ij + 2)).attr("count", std::to_string(*(trc + ij))).closeElt();
+                        }
+                        writer.closeElt();
+                        writer.closeElt();
+                        writer.openElt("battleInfo").attr("isAttack", "true").closeElt();
+                        writer.closeAll();
+                        file.close();
+                        FileReport(fclient, r);
+                        am->direction=DIRECTION_BACKWARD;
+                        am->reachtime=Utils::time()+am->reachtime-am->starttime-am->resttime;
+                        am->resttime=0;
+                        am->starttime=Utils::time();
+                        armies.Update(am);
+                        if (am->hero!=nullptr) am->hero->m_status=DEF_HERORETURN;
+                        fclient->SelfArmyUpdate();
+                        fclient->ReportUpdate();
+                        return;
+                    }
+                    // otherwise there will be a scouting battle
+                    else if (tile->m_ownerid > 0) {
+                        oclient=GetClient(tile->m_ownerid);
+                        if (oclient!=0) {
+                            campers.clear();
+                            if (const tilearmylist * here = armies.AtTile(fieldid)) {
+                                for (stArmyMovement* pq : *here) {
+                                    if (pq->direction==DIRECTION_STAY) campers.push_back(pq);
+                                }
+                            }
+                            attacker atk;
+                            defender def;
+                            if (am->hero!=nullptr) {
+                                atk.hero.attack=am->hero->GetPower();
+                                atk.hero.intel=am->hero->GetStratagem();
+                            }
+                            Hero* besthero=nullptr;
+                            int16_t bestPower=-1;
+                            if (campers.size()>0) {
+                                for (stArmyMovement* pu : campers) {
+                                    def.troops[2]+=pu->troops.scout;
+                                    if (pu->hero!=nullptr && pu->hero->GetPower()>bestPower) {
+                                        besthero=pu->hero;
+                                        bestPower=pu->hero->GetPower();
+                                    }
+                                }
+                            }
+                            atk.troops[2]=am->troops.scout;
+                            atk.research.military_tradition=fclient->research[T_MILITARYTRADITION].level;
+                            atk.research.iron_working=fclient->research[T_IRONWORKING].level;
+                            atk.research.medicine=fclient->research[T_MEDICINE].level;
+                            atk.research.compass=fclient->research[T_COMPASS].level;
+                            atk.research.horseback_riding=fclient->research[T_HORSEBACKRIDING].level;
+                            atk.research.archery=fclient->research[T_ARCHERY].level;
+                            atk.research.machinery=fclient->research[T_MACHINERY].level;
+                            def.research.military_tradition=oclient->research[T_MILITARYTRADITION].level;
+                            def.research.iron_working=oclient->research[T_IRONWORKING].level;
+                            def.research.medicine=oclient->research[T_MEDICINE].level;
+                            def.research.compass=oclient->research[T_COMPASS].level;
+                            def.research.horseback_riding=oclient->research[T_HORSEBACKRIDING].level;
+                            def.research.archery=oclient->research[T_ARCHERY].level;
+                            def.research.machinery=oclient->research[T_MACHINERY].level;
+                            PlayerCity* defenderCity=(PlayerCity*)tile->m_city;
+                            oclient->MarkDirty();
+                            defenderCity->MarkDirty();
+                            //also update the hero for a castle
+                            for (Hero* hh : defenderCity->m_heroes) {
+                                if (hh==0) continue;
+                                if (hh->GetPower()>bestPower) {
+                                    besthero=hh;
+                                    bestPower=hh->GetPower();
+                                }
+                            }
+                            int64_t mainScouts=0;
+                            if (defenderCity->m_gooutforbattle) {
+                                mainScouts=defenderCity->m_troops.scout;
+                                def.troops[2]+=mainScouts;
+                            }
+                            if (besthero!=nullptr) {
+                                def.hero.attack=besthero->GetPower();
+                                def.hero.intel=besthero->GetStratagem();
+                            }
+                            battleResult result;
+                            CombatSimulator::fight(atk,def,&result);
+                            // send info for scout report generation :: TODO
+
+                            // distribute the damage between all campers
+                            int64_t damage=def.troops[2]-result.defenderTroops[2];
+                            if (campers.size() > 0 &&  damage > 0) {
+                                for (stArmyMovement* il : campers) {
+                                    int64_t dmg=ceil(il->troops.scout*damage/def.troops[2]);
+                                    if (il->troops.scout > dmg) il->troops.scout-=dmg;
+                                    else il->troops.scout=0;
+                                    // if all the troops are dead, send the hero back
+                                    if (!memcmp(&testMemory,&(il->troops.worker),96)) {
+                                        if (il->hero!=nullptr) {
+                                            il->hero->m_status=DEF_HEROIDLE;
+                                            if (il->city!=0) il->client->HeroUpdate(il->hero->m_id,((PlayerCity*)il->city)->m_castleid);
+                                        }
+                                        Client * iclient = il->client;
+                                        armies.Remove(il);
+                                        if (oclient!=iclient) oclient->FriendArmyUpdate();
+                                        iclient->SelfArmyUpdate();
+                                    }
+                                }
+                            }
+                            if (damage > 0) {
+                                mainScouts=ceil(mainScouts*damage/def.troops[2]);
+                                int64_t scoutsleft=defenderCity->m_troops.scout-mainScouts;
+                                if (scoutsleft>0) defenderCity->m_troops.scout=scoutsleft;
+                                else defenderCity->m_troops.scout=0;
+                                defenderCity->TroopUpdate();
+                            }
+                            // if defender wins
+                            if (result.result) {
+                                // means all attacking scouts are dead
+                                if (result.attackerTroops[2]==0) {
+                                    if (am->hero!=nullptr) {
+                                        if (am->hero->m_loyalty < 5) am->hero->m_loyalty=0;
+                                        else am->hero->m_loyalty-=5;
+                                        if (defenderCity!=0 && defenderCity->GetBuildingLevel(B_FEASTINGHALL)>defenderCity->HeroCount()) {
+                                            int8_t chance=rand()%100;
+                                            // in this case the hero will get captured
+                                            if (chance > am->hero->m_loyalty) {
+                                                for (int x=0;x<10;++x) {
+                                                    if (fcity->m_heroes[x]==fhero) {
+                                                        fcity->m_heroes[x]=0;
+                                                        break;
+                                                    }
+                                                }
+                                                for (int x=0;x<10;++x) {
+                                                    if (!defenderCity->m_heroes[x]) {
+                                                        defenderCity->m_heroes[x]=fhero;
+                                                    }
+                                                }
+                                                fhero->m_client=oclient;
+                                                fhero->m_ownerid=oclient->accountid;
+                                                fhero->m_loyalty=0;
+                                                fhero->m_powerbuffadded=0;
+                                                fhero->m_stratagembuffadded=0;
+                                                fhero->m_managementbuffadded=0;
+                                                fhero->m_status=DEF_HEROSEIZED;
+                                                defenderCity->HeroUpdate(fhero,0);
+                                                fcity->HeroUpdate(fhero,1);
+                                                am->client->armymovement.remove(am);
+                                                am->client->SelfArmyUpdate();
+                                                armies.Remove(am);
+                                                return;
+                                            }
+                                        }
+                                        // otherwise return the hero to the city immediately
+                                        fhero->m_status=DEF_HEROSEIZED;
+                                        fcity->HeroUpdate(fhero,2);
+                                        am->client->armymovement.remove(am);
+                                        am->client->SelfArmyUpdate();
+                                        armies.Remove(am);
+                                        return;
+                                    }
+                                    am->client->armymovement.remove(am);
+                                    am->client->SelfArmyUpdate();
+                                    armies.Remove(am);
+                                    return;
+                                }
+                            }
+                            // if all attacking scouts aren't dead(doesn't matter if they lost or won), send the army back
+                            am->troops.scout=result.attackerTroops[2];
+                            am->direction=DIRECTION_BACKWARD;
+                            am->reachtime=Utils::time()+am->reachtime-am->starttime-am->resttime;
+                            am->resttime=0;
+                            am->starttime=Utils::time();
+                            armies.Update(am);
+                            am->hero->m_status=DEF_HERORETURN;
+                            am->client->SelfArmyUpdate();
+                            return;
+                        }
+                    }
+                    // when scouting a NPC
+                    else {
+                        // generate scouting report here
+                        stReport r;
+                        r.guid = Utils::generaterandomstring(28);
+                        r.attack = true;
+                        r.back = false;
+                        r.armytype = MISSION_SCOUT;
+                        r.isread = false;
+                        r.reportid = fclient->currentreportid++;
+                        int xid, yid;
+                        GETXYFROMID4(xid, yid, am->startfieldid, mapsize);
+                        std::stringstream ss;
+                        ss << am->startposname << " (" << xid << "," << yid << ")";
+                        r.startpos = ss.str();
+                        std::stringstream ss1;
+                        GETXYFROMID4(xid, yid, am->targetfieldid, mapsize);
+                        ss1 << am->targetposname << " (" << xid << "," << yid << ")";
+                        r.targetpos = ss1.str();
+                        r.title = "Scout Report";
+                        r.type_id = 1;
+                        r.eventtime = Utils::time();
+                        std::string path = reportbasepath + r.guid + ".xml";
+                        std::ofstream file;
+                        file.open(path, std::ios::out);
+                        NpcCity* npc = ((NpcCity*)tile->m_city);
+                        npc->ResetHero();
+                        Writer writer(file);
+
+                        writer.openElt("reportData").attr("reportUrl", reportbaseurl + r.guid + ".xml");
+                        writer.openElt("scoutReport").attr("isFound", "true").attr("isSuccess", "true").attr("isAttack", "true");
+                        writer.openElt("scoutInfo").attr("support", std::to_string(npc->m_loyalty)).attr("population", std::to_string(npc->m_population)).attr("gold", std::to_string((int64_t)npc->m_resources.gold)).attr("heroLevel", std::to_string(npc->m_temphero->m_level)).attr("heroName", npc->m_temphero->m_name).attr("heroUrl", "");
+                        writer.openElt("resource").openElt("food").content(std::to_string((int64_t)npc->m_resources.food)).closeElt().openElt("wood").content(std::to_string((int64_t)npc->m_resources.wood)).closeElt().openElt("iron").content(std::to_string((int64_t)npc->m_resources.iron)).closeElt().openElt("stone").content(std::to_string((int64_t)npc->m_resources.stone)).closeElt().closeElt();
+                        if (memcmp(&testMemory, &npc->m_forts, sizeof(stForts))) {
+                            writer.openElt("fortifications");
+                            if (npc->m_forts.traps > 0) writer.openElt("fortificationsType").attr("typeId", std::to_string(TR_TRAP)).attr("count", std::to_string(npc->m_forts.traps)).closeElt();
+                            if (npc->m_forts.abatis > 0) writer.openElt("fortificationsType").attr("typeId", std::to_string(TR_ABATIS)).attr("count", std::to_string(npc->m_forts.abatis)).closeElt();
+                            if (npc->m_forts.logs > 0) writer.openElt("fortificationsType").attr("typeId", std::to_string(TR_ROLLINGLOG)).attr("count", std::to_string(npc->m_forts.logs)).closeElt();
+                            if (npc->m_forts.towers > 0) writer.openElt("fortificationsType").attr("typeId", std::to_string(TR_ARCHERTOWER)).attr("count", std::to_string(npc->m_forts.towers)).closeElt();
+                            if (npc->m_forts.trebs>0) writer.openElt("fortificationsType").attr("typeId", std::to_string(TR_TREBUCHET)).attr("count", std::to_string(npc->m_forts.trebs)).closeElt();
+                            writer.closeElt();
+                        }
+                        if (memcmp(&testMemory, &npc->m_troops, sizeof(NpcCity::stTroops))) {
+                            writer.openElt("troops");
+                            if (npc->m_troops.warrior > 0) writer.openElt("troopStrType").attr("typeId", std::to_string(TR_WARRIOR)).attr("count", std::to_string(npc->m_troops.warrior)).closeElt();
+                            if (npc->m_troops.pike > 0) writer.openElt("troopStrType").attr("typeId", std::to_string(TR_PIKE)).attr("count", std::to_string(npc->m_troops.pike)).closeElt();
+                            if (npc->m_troops.sword > 0) writer.openElt("troopStrType").attr("typeId", std::to_string(TR_SWORDS)).attr("count", std::to_string(npc->m_troops.sword)).closeElt();
+                            if (npc->m_troops.archer > 0) writer.openElt("troopStrType").attr("typeId", std::to_string(TR_ARCHER)).attr("count", std::to_string(npc->m_troops.archer)).closeElt();
+                            if (npc->m_troops.cavalry > 0) writer.openElt("troopStrType").attr("typeId", std::to_string(TR_CAVALRY)).attr("count", std::to_string(npc->m_troops.cavalry)).closeElt();
+                            writer.closeElt();
+                        }
+                        
+                        writer.openElt("buildings");
+                        std::stringstream vec[31];
+                        for (stBuilding& b : npc->m_innerbuildings) {
+                            if (b.type > 30 || b.type==0) continue;
+                            if (vec[b.type].tellp() > 0) vec[b.type] << ",";
+                            vec[b.type] << b.level;
+                        }
+                        for (stBuilding& b : npc->m_outerbuildings) {
+                            if (b.type > 30 || b.type == 0) continue;
+                            if (vec[b.type].tellp() > 0) vec[b.type] << ",";
+                            vec[b.type] << b.level;
+                        }
+                        for (int btype = 0; btype < 31; ++btype) {
+                            if (vec[btype].tellp() > 0) {
+                                writer.openElt("buildingType").attr("type", std::to_string(btype)).attr("levels", vec[btype].str()).closeElt();
+                            }
+                        }
+                        writer.closeElt();
+                        writer.closeElt();
+                        writer.openElt("battleInfo").attr("isAttack", "true").attr("unNomal", "No defending troops found.");
+                        writer.openElt("backTroop");
+                        writer.openElt("troops");
+                        if (am->hero != 0) {
+                            writer.attr("heroLevel", std::to_string(am->hero->m_level)).attr("heroName", am->hero->m_name).attr("heroUrl", am->hero->m_logourl).attr("isHeroBeSeized", "false");
+                        }
+                        stTroops st = am->troops;
+                        int64_t* trc = (int64_t*)&st;
+                        for (int ij = 0; ij < 12; ij++) {
+                            if ((*(trc + ij)) > 0) writer.openElt("troopInfo").attr("typeId", std::to_string(ij + 2)).attr("remain", std::to_string(*(trc + ij))).closeElt();
+                        }
+                        writer.closeAll();
+                        file.close();
+                        FileReport(fclient, r);
+                        am->direction=DIRECTION_BACKWARD;
+                        am->reachtime=Utils::time()+am->reachtime-am->starttime-am->resttime;
+                        am->resttime=0;
+                        am->starttime=Utils::time();
+                        armies.Update(am);
+                        if (am->hero) am->hero->m_status=DEF_HERORETURN;
+                        am->client->SelfArmyUpdate();
+                        am->client->ReportUpdate();
+                        return;
+                    }
+                }
+                else if (am->missiontype==MISSION_ATTACK) {
+                    // TODO
+                }
+            }
+            // if not valid target, just send the army back
+            else {
+                am->direction=DIRECTION_BACKWARD;
+                am->reachtime=Utils::time()+am->reachtime-am->starttime-am->resttime;
+                am->resttime=0;
+                am->starttime=Utils::time();
+                armies.Update(am);
+                if (am->hero) am->hero->m_status=DEF_HERORETURN;
+                am->client->SelfArmyUpdate();
+                return;
+            }
+        }
+        else 
+        {
+            //returning to city from attack/reinforce/etc
+
+            if (am->hero) am->hero->m_status = DEF_HEROIDLE;
+
+            ((PlayerCity*)am->city)->SettleResources(ltime);
+            am->city->m_resources += am->resources;
+            ((PlayerCity*)am->city)->m_troops += am->troops;
+            am->client->armymovement.remove(am);
+
+            if (am->hero) ((PlayerCity*)am->city)->HeroUpdate(am->hero, 2);
+
+            am->client->SelfArmyUpdate();
+            am->client->PlayerInfoUpdate();
+            ((PlayerCity*)am->city)->TroopUpdate();
+            ((PlayerCity*)am->city)->ResourceUpdate();
+
+            stReport r;
+            r.guid = Utils::generaterandomstring(28);
+            r.attack = false;
+            r.back = true;
+            r.armytype = am->missiontype;
+            r.isread = false;
+            r.reportid = fclient->currentreportid++;
+            int xid, yid;
+            GETXYFROMID4(xid,yid,am->startfieldid,mapsize);
+            std::stringstream ss;
+            ss << am->startposname << " (" << xid << "," << yid << ")";
+            r.startpos = ss.str();
+            std::stringstream ss1;
+            GETXYFROMID4(xid,yid,am->targetfieldid,mapsize);
+            ss1 << am->targetposname << " (" << xid << "," << yid << ")";
+            r.targetpos = ss1.str();
+            if (am->missiontype == MISSION_SCOUT) r.title = "Scout Returned";
+            else if (am->missiontype == MISSION_ATTACK) r.title = "Attack Returned";
+            else r.title = "Returned";
+            r.type_id = 1;
+            r.eventtime = Utils::time();
+            std::string path = reportbasepath + r.guid + ".xml";
+            std::ofstream file;
+            file.open(path, std::ios::out);
+            Writer writer(file);
+            writer.openElt("reportData").attr("reportUrl", reportbaseurl + r.guid + ".xml");
+            writer.openElt("troopMovement").attr("isBack", "true").attr("type", std::to_string(am->missiontype));
+            if (am->hero != 0) {
+                writer.attr("heroLevel", std::to_string(am->hero->m_level)).attr("heroName", am->hero->m_name).attr("heroUrl", am->hero->m_logourl);
+            }
+            stTroops st = am->troops;
+            int64_t* trc = (int64_t*)&st;
+            for (int ij = 0; ij < 12; ij++) {
+                if ((*(trc + ij)) > 0) writer.openElt("troops").attr("typeId", std::to_string(ij + 2)).attr("count", std::to_string(*(trc + ij))).closeElt();
+            }
+            writer.closeElt();
+            writer.closeAll();
+            file.close();
+            FileReport(fclient, r);
+            fclient->ReportUpdate();
+
+            armies.Remove(am);
+        }
+    }
+    else
+    {
+        // moved since it was scheduled
+        armies.Update(am);
     }
-    for (int i = 0; i < level; ++i)
-        prestige *= 2;
-    for (int i = 0; i < thlevel - 1; ++i)
-        prestige /= 2;
-    return prestige;
 }
 
-void spitfire::AddTimedEvent(stTimedEvent & te)
+void spitfire::BuffsExpired(int64_t accountid, uint64_t ltime)
 {
-    te.id = tecounter++;
-    switch (te.type)
+    Client * client = GetClient(accountid);
+    if (client == nullptr)
+        return;
+    Wake(client, ltime);
+
+    std::vector<std::string> expired;
+    for (stBuff & buff : client->bufflist)
     {
-        case DEF_TIMEDARMY:
-            armylist.push_back(te);
-            break;
-        case DEF_TIMEDBUILDING:
-            buildinglist.push_back(te);
-            break;
-        case DEF_TIMEDRESEARCH:
-            researchlist.push_back(te);
-            break;
+        if (buff.id.length() != 0 && ltime >= buff.endtime)
+            expired.push_back(buff.id);
+    }
+    for (std::string & id : expired)
+    {
+        if (id == "PlayerPeaceBuff")
+        {
+            client->SetBuff("PlayerPeaceCoolDownBuff", "Truce Agreement in cooldown.", ltime + (12 * 60 * 60 * 1000));
+        }
+        client->RemoveBuff(id);
     }
+    if (!expired.empty())
+        client->MarkDirty();
+    ScheduleBuffs(client);
 }
 
 void spitfire::MassDisconnect()
@@ -3136,46 +4555,6 @@ Hero * spitfire::CreateRandomHero(int innlevel) const
     return hero;
 }
 
-bool spitfire::compareprestige(stClientRank first, stClientRank second)
-{
-    if (first.client->prestige > second.client->prestige)
-        return true;
-    else
-        return false;
-}
-bool spitfire::comparehonor(stClientRank first, stClientRank second)
-{
-    if (first.client->honor > second.client->honor)
-        return true;
-    else
-        return false;
-}
-bool spitfire::comparetitle(stClientRank first, stClientRank second)
-{
-    if (first.client->title > second.client->title)
-        return true;
-    else
-        return false;
-}
-bool spitfire::comparepop(stClientRank first, stClientRank second)
-{
-    if (first.client->population > second.client->population)
-        return true;
-    else
-        return false;
-}
-bool spitfire::comparecities(stClientRank first, stClientRank second)
-{
-    if (first.client->citycount > second.client->citycount)
-        return true;
-    else
-        return false;
-}
-bool spitfire::comparearmies(stTimedEvent& x,stTimedEvent& y)
-{
-    return (((stArmyMovement*)x.data)->reachtime < ((stArmyMovement*)y.data)->reachtime);
-}
-
 std::string spitfire::readreport(std::string report_id)
 {
     try {
@@ -3190,411 +4569,302 @@ std::string spitfire::readreport(std::string report_id)
     }
 }
 
-void spitfire::SortPlayers()
+void spitfire::RankClient(Client * client)
 {
-    m_prestigerank.clear();
-    m_honorrank.clear();
-    m_titlerank.clear();
-    m_populationrank.clear();
-    m_citiesrank.clear();
-
-
-    std::list<Client*>::iterator playeriter;
-    for (playeriter = players.begin(); playeriter != players.end(); ++playeriter)
-    {
-        Client * client = *playeriter;
-
-        stClientRank rank = stClientRank();
-        rank.client = client;
-        rank.rank = 0;
-
-        m_prestigerank.push_back(rank);
-        m_honorrank.push_back(rank);
-        m_titlerank.push_back(rank);
-        m_populationrank.push_back(rank);
-        m_citiesrank.push_back(rank);
-    }
-
-    m_prestigerank.sort(compareprestige);
-    m_honorrank.sort(comparehonor);
-    m_titlerank.sort(comparetitle);
-    m_populationrank.sort(comparepop);
-    m_citiesrank.sort(comparecities);
-
+    m_prestigerank.Update(client, client->prestige, client->internalid);
+    m_honorrank.Update(client, client->honor, client->internalid);
+    m_titlerank.Update(client, client->title, client->internalid);
+    m_populationrank.Update(client, client->population, client->internalid);
+    m_citiesrank.Update(client, client->citycount, client->internalid);
+}
 
-    int num = 1;
-    for (stClientRank & ranklist : m_prestigerank)
-    {
-        ranklist.rank = num;
-        ranklist.client->prestigerank = num++;
-        if (ranklist.client->connected)
-            ranklist.client->PlayerInfoUpdate();
-    }
-    num = 1;
-    for (stClientRank & ranklist : m_honorrank)
-    {
-        ranklist.rank = num++;
-    }
-    num = 1;
-    for (stClientRank & ranklist : m_titlerank)
-    {
-        ranklist.rank = num++;
-    }
-    num = 1;
-    for (stClientRank & ranklist : m_populationrank)
-    {
-        ranklist.rank = num++;
-    }
-    num = 1;
-    for (stClientRank & ranklist : m_citiesrank)
+void spitfire::SortPlayers()
+{
+    // Only connected clients are shown their rank, the rest pick it up
+    // from here once they log in
+    for (Client * client : awakeplayers)
     {
-        ranklist.rank = num++;
+        if (!client->connected)
+            continue;
+        int32_t rank = m_prestigerank.Rank(client);
+        if (client->prestigerank != rank)
+        {
+            client->prestigerank = rank;
+            client->PlayerInfoUpdate();
+        }
     }
 }
 
 void spitfire::SortHeroes()
 {
-    m_herorankstratagem.clear();
-    m_herorankpower.clear();
-    m_herorankmanagement.clear();
-    m_herorankgrade.clear();
+    m_herorankstratagem.BeginSweep();
+    m_herorankpower.BeginSweep();
+    m_herorankmanagement.BeginSweep();
+    m_herorankgrade.BeginSweep();
 
-
-    std::list<Client*>::iterator playeriter;
-    for (playeriter = players.begin(); playeriter != players.end(); ++playeriter)
+    // heroes of hibernating accounts are pinned
+    for (Client * client : awakeplayers)
     {
-        Client * client = *playeriter;
-        for (uint32_t j = 0; j < client->citylist.size(); ++j)
+        for (PlayerCity * city : client->citylist)
         {
-            if (client->citylist.at(j))
+            if (!city)
+                continue;
+            for (uint32_t k = 0; k < 10; ++k)
             {
-                for (uint32_t k = 0; k < 10; ++k)
+                Hero * hero = city->m_heroes[k];
+                if (hero)
                 {
-                    if (client->citylist[j]->m_heroes[k])
-                    {
-                        Hero * hero = client->citylist[j]->m_heroes[k];
-                        stHeroRank rank = stHeroRank();
-                        assert(hero->m_level > 0);
-                        assert(hero->m_stratagem > 0);
-                        assert(hero->m_management > 0);
-                        assert(hero->m_power > 0);
-                        rank.grade = hero->m_level;
-                        rank.stratagem = hero->m_stratagem;
-                        rank.management = hero->m_management;
-                        rank.power = hero->m_power;
-                        rank.name = hero->m_name;
-                        rank.kind = client->playername;
-                        rank.rank = 0;
-                        m_herorankstratagem.push_back(rank);
-                        m_herorankpower.push_back(rank);
-                        m_herorankmanagement.push_back(rank);
-                        m_herorankgrade.push_back(rank);
-                    }
+                    assert(hero->m_level > 0);
+                    assert(hero->m_stratagem > 0);
+                    assert(hero->m_management > 0);
+                    assert(hero->m_power > 0);
+                    m_herorankstratagem.Update(hero, hero->m_stratagem, hero->m_id);
+                    m_herorankpower.Update(hero, hero->m_power, hero->m_id);
+                    m_herorankmanagement.Update(hero, hero->m_management, hero->m_id);
+                    m_herorankgrade.Update(hero, hero->m_level, hero->m_id);
+                    m_heronames.Set(hero, hero->m_name);
                 }
             }
         }
     }
 
-    m_herorankstratagem.sort(comparestratagem);
-    m_herorankpower.sort(comparepower);
-    m_herorankmanagement.sort(comparemanagement);
-    m_herorankgrade.sort(comparegrade);
-
-    std::list<stHeroRank>::iterator iter;
-    int num = 1;
-    for (iter = m_herorankstratagem.begin(); iter != m_herorankstratagem.end(); ++iter)
-    {
-        iter->rank = num++;
-    }
-    num = 1;
-    for (iter = m_herorankpower.begin(); iter != m_herorankpower.end(); ++iter)
-    {
-        iter->rank = num++;
-    }
-    num = 1;
-    for (iter = m_herorankmanagement.begin(); iter != m_herorankmanagement.end(); ++iter)
-    {
-        iter->rank = num++;
-    }
-    num = 1;
-    for (iter = m_herorankgrade.begin(); iter != m_herorankgrade.end(); ++iter)
-    {
-        iter->rank = num++;
-    }
+    m_herorankstratagem.EndSweep();
+    m_herorankpower.EndSweep();
+    m_herorankmanagement.EndSweep();
+    m_herorankgrade.EndSweep();
 }
 
-bool spitfire::comparestratagem(stHeroRank first, stHeroRank second)
+void spitfire::UnrankHero(Hero * hero)
 {
-    if (first.stratagem > second.stratagem)
-        return true;
-    else
-        return false;
+    m_herorankstratagem.Remove(hero);
+    m_herorankpower.Remove(hero);
+    m_herorankmanagement.Remove(hero);
+    m_herorankgrade.Remove(hero);
+    m_heronames.Remove(hero);
 }
-bool spitfire::comparepower(stHeroRank first, stHeroRank second)
+
+void spitfire::RankCastle(PlayerCity * city)
 {
-    if (first.power > second.power)
-        return true;
-    else
-        return false;
+    m_castleranklevel.Update(city, city->GetBuildingLevel(B_TOWNHALL), city->m_castleid);
+    m_castlerankpopulation.Update(city, city->m_population, city->m_castleid);
+    m_castlenames.Set(city, city->m_cityname);
 }
-bool spitfire::comparemanagement(stHeroRank first, stHeroRank second)
+
+void spitfire::Wake(Client * client, uint64_t ltime)
 {
-    if (first.management > second.management)
-        return true;
-    else
-        return false;
+    if (!client->hibernating)
+        return;
+    client->hibernating = false;
+    if (!client->evicted)
+        sleepers.erase(client->sleeper);
+    PinHeroes(client, false);
+
+    // The six minute stat steps that were skipped, then resources, which
+    // accrue from their own timestamp
+    uint64_t steps = (ltime - client->hibernatedat) / 360000;
+    for (PlayerCity * city : client->citylist)
+    {
+        if (city)
+            city->StepCityStats(steps);
+    }
+    client->CalculateResources();
+    awakeplayers.push_back(client);
 }
-bool spitfire::comparegrade(stHeroRank first, stHeroRank second)
+
+void spitfire::Hibernate(Client * client, uint64_t ltime)
 {
-    if (first.grade > second.grade)
-        return true;
-    else
-        return false;
+    // resources accrue lazily from their own timestamp, only the stat
+    // steps wait for Wake
+    client->hibernating = true;
+    client->hibernatedat = ltime;
+    if (!client->evicted)
+        client->sleeper = sleepers.insert(sleepers.end(), client);
+    // SortHeroes passes over the account until it wakes
+    PinHeroes(client, true);
 }
 
-void spitfire::SortCastles()
+void spitfire::PinHeroes(Client * client, bool pinned)
 {
-    m_castleranklevel.clear();
-    m_castlerankpopulation.clear();
-
-    std::list<Client*>::iterator playeriter;
-    for (playeriter = players.begin(); playeriter != players.end(); ++playeriter)
+    for (PlayerCity * city : client->citylist)
     {
-        Client * client = *playeriter;
-        for (int j = 0; j < client->citylist.size(); ++j)
+        if (!city)
+            continue;
+        for (Hero * hero : city->m_heroes)
         {
-            if (client->citylist.at(j))
+            if (hero)
             {
-                PlayerCity * city = client->citylist[j];
-                stCastleRank rank = stCastleRank();
-                std::stringstream ss;
-                std::string grade;
-                int16_t level = city->GetBuildingLevel(B_TOWNHALL);
-                ss << "Level " << level;
-                grade = ss.str();
-                if (client->HasAlliance())
-                    rank.alliance = client->GetAlliance()->m_name;
-                else
-                    rank.alliance = "";
-                rank.level = level;
-                rank.population = city->m_population;
-                rank.name = city->m_cityname;
-                rank.grade = grade;
-                rank.kind = client->playername;
-                rank.rank = 0;
-                m_castleranklevel.push_back(rank);
-                m_castlerankpopulation.push_back(rank);
+                m_herorankstratagem.Pin(hero, pinned);
+                m_herorankpower.Pin(hero, pinned);
+                m_herorankmanagement.Pin(hero, pinned);
+                m_herorankgrade.Pin(hero, pinned);
             }
         }
     }
-
-    m_castleranklevel.sort(comparelevel);
-    m_castlerankpopulation.sort(comparepopulation);
-
-    std::list<stCastleRank>::iterator iter;
-    int num = 1;
-    for (iter = m_castleranklevel.begin(); iter != m_castleranklevel.end(); ++iter)
-    {
-        iter->rank = num++;
-    }
-    num = 1;
-    for (iter = m_castlerankpopulation.begin(); iter != m_castlerankpopulation.end(); ++iter)
-    {
-        iter->rank = num++;
-    }
 }
 
-bool spitfire::comparepopulation(stCastleRank first, stCastleRank second)
-{
-    if (first.population > second.population)
-        return true;
-    else
-        return false;
-}
-bool spitfire::comparelevel(stCastleRank first, stCastleRank second)
+bool spitfire::Evict(Client * client)
 {
-    if (first.level > second.level)
-        return true;
-    else
+    // Fault reads the store, so the reports must have committed and the
+    // mail and report writes on serverdb must have run
+    if (client->evicted || client->faulting || client->reportsdirty || client->reportstamp > savedstamp || client->pendingwrites > 0)
         return false;
+    std::list<stMail>().swap(client->maillist);
+    std::list<stReport>().swap(client->reportlist);
+    client->evicted = true;
+    return true;
 }
 
-void * spitfire::DoRankSearch(std::string key, int8_t type, void * subtype, int16_t page, int16_t pagesize)
+void spitfire::Fault(Client * client, std::function<void(bool ok)> then)
 {
-    if (type == 1)//client lists
+    if (!client->evicted)
     {
-        std::list<stSearchClientRank>::iterator iter;
-        for (iter = m_searchclientranklist.begin(); iter != m_searchclientranklist.end();)
-        {
-            if (iter->rlist == subtype && iter->key == key)
-                return &iter->ranklist;
-            ++iter;
-        }
-
-        stSearchClientRank searchrank = stSearchClientRank();
-        searchrank.key = key;
-        searchrank.lastaccess = Utils::time();
-        searchrank.rlist = (std::list<stClientRank>*)subtype;
-
-        std::list<stClientRank>::iterator iterclient;
-
-        for (iterclient = ((std::list<stClientRank>*)subtype)->begin(); iterclient != ((std::list<stClientRank>*)subtype)->end();)
-        {
-            if (Utils::ci_find(iterclient->client->playername, key) != std::string::npos)
-            {
-                stClientRank clientrank;
-                clientrank.client = iterclient->client;
-                clientrank.rank = iterclient->rank;
-                searchrank.ranklist.push_back(clientrank);
-            }
-            ++iterclient;
-        }
-        m_searchclientranklist.push_back(searchrank);
-        return &m_searchclientranklist.back();
+        if (then)
+            then(true);
+        return;
     }
-    else if (type == 2)//hero lists
-    {
-        std::list<stSearchHeroRank>::iterator iter;
-        for (iter = m_searchheroranklist.begin(); iter != m_searchheroranklist.end();)
-        {
-            if (iter->rlist == subtype && iter->key == key)
-                return &iter->ranklist;
-            ++iter;
-        }
-
-        stSearchHeroRank searchrank = stSearchHeroRank();
-        searchrank.key = key;
-        searchrank.lastaccess = Utils::time();
-        searchrank.rlist = (std::list<stHeroRank>*)subtype;
-
-        std::list<stHeroRank>::iterator iterhero;
+    if (then)
+        client->faultwaiters.push_back(std::move(then));
+    if (client->faulting)
+        return;
+    client->faulting = true;
 
-        for (iterhero = ((std::list<stHeroRank>*)subtype)->begin(); iterhero != ((std::list<stHeroRank>*)subtype)->end();)
+    struct histories
+    {
+        std::vector<MailRow> mail;
+        std::vector<ReportRow> reports;
+    };
+    auto rows = std::make_shared<histories>();
+    int64_t accountid = client->accountid;
+    // keyed on the account, so every mail and report write posted for it
+    // before has run
+    serverdb->Post(uint64_t(accountid), [rows, accountid](storageconn & db)
+    {
+        db.LoadMail(accountid, rows->mail);
+        db.LoadReports(accountid, rows->reports);
+    }, [this, client, rows](bool ok)
+    {
+        std::lock_guard<std::mutex> l(worldmtx);
+        client->faulting = false;
+        if (ok)
         {
-            if (Utils::ci_find(iterhero->name, key) != std::string::npos)
+            client->maillist.clear();
+            for (const MailRow & row : rows->mail)
             {
-                stHeroRank herorank;
-                herorank.grade = iterhero->grade;
-                herorank.kind = iterhero->kind;
-                herorank.management = iterhero->management;
-                herorank.power = iterhero->power;
-                herorank.name = iterhero->name;
-                herorank.stratagem = iterhero->stratagem;
-                herorank.rank = iterhero->rank;
-                searchrank.ranklist.push_back(herorank);
+                stMail mail = MailOf(row);
+                client->maillist.push_back(mail);
+                if (client->mailpid <= mail.mailid)
+                    client->mailpid = mail.mailid + 1;
             }
-            ++iterhero;
-        }
-        m_searchheroranklist.push_back(searchrank);
-        return &m_searchheroranklist.back();
-    }
-    else if (type == 3)//castle lists
-    {
-        std::list<stSearchCastleRank>::iterator iter;
-        for (iter = m_searchcastleranklist.begin(); iter != m_searchcastleranklist.end();)
-        {
-            if (iter->rlist == subtype && iter->key == key)
-                return &iter->ranklist;
-            ++iter;
-        }
-
-        stSearchCastleRank searchrank;
-        searchrank.key = key;
-        searchrank.lastaccess = Utils::time();
-        searchrank.rlist = (std::list<stCastleRank>*)subtype;
-
-        std::list<stCastleRank>::iterator itercastle;
-
-        for (itercastle = ((std::list<stCastleRank>*)subtype)->begin(); itercastle != ((std::list<stCastleRank>*)subtype)->end();)
-        {
-            if (Utils::ci_find(itercastle->name, key) != std::string::npos)
+            // posted after the load, their inserts are still to come
+            client->maillist.splice(client->maillist.end(), client->faultmail);
+
+            client->reportlist.clear();
+            for (const ReportRow & row : rows->reports)
+                client->reportlist.push_back(ReportOf(row, client->currentreportid++));
+            bool unsaved = false;
+            for (stReport & r : client->faultreports)
             {
-                stCastleRank castlerank;
-                castlerank.grade = itercastle->grade;
-                castlerank.alliance = itercastle->alliance;
-                castlerank.kind = itercastle->kind;
-                castlerank.level = itercastle->level;
-                castlerank.name = itercastle->name;
-                castlerank.population = itercastle->population;
-                castlerank.rank = itercastle->rank;
-                searchrank.ranklist.push_back(castlerank);
+                auto same = [&](const stReport & x) { return x.guid == r.guid; };
+                if (std::none_of(client->reportlist.begin(), client->reportlist.end(), same))
+                {
+                    r.reportid = client->currentreportid++;
+                    client->reportlist.push_front(r);
+                    unsaved = true;
+                }
             }
-            ++itercastle;
+            client->faultreports.clear();
+            client->evicted = false;
+            if (unsaved)
+                client->MarkReportsDirty();
+            if (client->hibernating)
+                client->sleeper = sleepers.insert(sleepers.end(), client);
         }
-        m_searchcastleranklist.push_back(searchrank);
-        return &m_searchcastleranklist.back();
-    }
-    else// if (type == 4)//alliance lists
-    {
-        std::list<stSearchAllianceRank>::iterator iter;
-        for (iter = m_searchallianceranklist.begin(); iter != m_searchallianceranklist.end();)
+        else
         {
-            if (iter->rlist == subtype && iter->key == key)
-                return &iter->ranklist;
-            ++iter;
+            // their inserts ran or failed before the load, the next one reads
+            // back whatever made it
+            client->faultmail.clear();
+            log->error("Could not read back the mail and reports of account {}.", client->accountid);
         }
 
-        stSearchAllianceRank searchrank = stSearchAllianceRank();
-        searchrank.key = key;
-        searchrank.lastaccess = Utils::time();
-        searchrank.rlist = (std::list<stAlliance>*)subtype;
-
-        std::list<stAlliance>::iterator iteralliance;
-
-        for (iteralliance = ((std::list<stAlliance>*)subtype)->begin(); iteralliance != ((std::list<stAlliance>*)subtype)->end();)
-        {
-            if (Utils::ci_find(iteralliance->ref->m_name, key) != std::string::npos)
-            {
-                stAlliance alliancerank;
-                alliancerank.ref = iteralliance->ref;
-                alliancerank.rank = iteralliance->rank;
-                searchrank.ranklist.push_back(alliancerank);
-            }
-            ++iteralliance;
-        }
-        m_searchallianceranklist.push_back(searchrank);
-        return &m_searchallianceranklist.back();
-    }
-    return 0;
+        std::vector<std::function<void(bool)>> waiters;
+        waiters.swap(client->faultwaiters);
+        for (auto & waiter : waiters)
+            waiter(ok);
+        JournalCommit();
+    }, &io_service_);
 }
 
-void spitfire::CheckRankSearchTimeouts(uint64_t time)
+void spitfire::FileReport(Client * client, const stReport & report)
 {
-    std::list<stSearchClientRank>::iterator iterclient;
-    std::list<stSearchHeroRank>::iterator iterhero;
-    std::list<stSearchCastleRank>::iterator itercastle;
-
-    for (iterclient = m_searchclientranklist.begin(); iterclient != m_searchclientranklist.end();)
+    if (!client->evicted)
     {
-        if (iterclient->lastaccess + 30000 < time)
-        {
-            m_searchclientranklist.erase(iterclient++);
-            continue;
-        }
-        ++iterclient;
+        client->reportlist.push_front(report);
+        client->MarkReportFiled();
+        return;
     }
 
-    for (iterhero = m_searchheroranklist.begin(); iterhero != m_searchheroranklist.end();)
+    int64_t accountid = client->accountid;
+    JournalReport(accountid, report);
+    // a load already posted would miss it
+    if (client->faulting)
+        client->faultreports.push_front(report);
+    ReportRow row = ReportRowOf(accountid, report);
+    ++client->pendingwrites;
+    serverdb->Post(uint64_t(accountid), [row](storageconn & db) mutable
+    {
+        db.ReplaceReport(row);
+    }, [this, client, report](bool ok)
     {
-        if (iterhero->lastaccess + 30000 < time)
+        std::lock_guard<std::mutex> l(worldmtx);
+        --client->pendingwrites;
+        if (ok)
+            return;
+        auto same = [&](const stReport & x) { return x.guid == report.guid; };
+        if (client->evicted)
         {
-            m_searchheroranklist.erase(iterhero++);
-            continue;
+            if (std::none_of(client->faultreports.begin(), client->faultreports.end(), same))
+                client->faultreports.push_front(report);
         }
-        ++iterhero;
-    }
-
-    for (itercastle = m_searchcastleranklist.begin(); itercastle != m_searchcastleranklist.end();)
-    {
-        if (itercastle->lastaccess + 30000 < time)
+        else
         {
-            m_searchcastleranklist.erase(itercastle++);
-            continue;
+            // read back without it, the next reports save writes it
+            if (std::none_of(client->reportlist.begin(), client->reportlist.end(), same))
+                client->reportlist.push_front(report);
+            client->MarkReportsDirty();
         }
-        ++itercastle;
+        JournalCommit();
+    }, &io_service_);
+}
+
+void spitfire::EvictIdle(uint64_t ltime)
+{
+    if (evictafter == 0)
+        return;
+    auto it = sleepers.begin();
+    while (it != sleepers.end())
+    {
+        Client * client = *it;
+        // in hibernation order, so the rest are younger
+        if (sleepers.size() <= maxsleepers && ltime - client->hibernatedat < evictafter)
+            break;
+        if (Evict(client))
+            it = sleepers.erase(it);
+        else
+            ++it;
     }
 }
 
+// The in-memory side of a mail whose row is being inserted on serverdb
+static void ListMail(Client * rcv, const stMail & mail)
+{
+    if (!rcv->evicted)
+        rcv->maillist.push_back(mail);
+    else if (rcv->faulting)
+        rcv->faultmail.push_back(mail);
+    // otherwise the next Fault posts its load after the insert
+}
+
 bool spitfire::CreateMail(std::string sender, std::string receiver, std::string subject, std::string content, int8_t type)
 {
     Client * snd = this->GetClientByName(sender);
@@ -3609,8 +4879,13 @@ bool spitfire::CreateMail(std::string sender, std::string receiver, std::string
     int64_t playerid = (sender == "System") ? 0 : snd->accountid;
 
     int64_t time = Utils::time();
+    int64_t receiverid = rcv->accountid;
 
-    try
+    // The lists are updated here, the rows are written by serverdb. Both
+    // inserts are keyed on the receiver so they stay in order with any
+    // later read of the same mail, and counted until they ran so the
+    // receiver's mail is not evicted ahead of them. An evicted receiver's
+    // mail is only in the store until Fault reads it back.
     {
         stMail mail;
         mail.content = content;
@@ -3620,27 +4895,26 @@ bool spitfire::CreateMail(std::string sender, std::string receiver, std::string
         mail.mailid = rcv->mailpid;
         mail.playerid = playerid;
 
-        rcv->maillist.push_back(mail);
+        ListMail(rcv, mail);
+        JournalMail(receiverid, mail);
 
-        Poco::Data::Session ses(serverpool->get());
-        Statement stmt = (ses << "INSERT INTO `mail` (`senderid`, `receiverid`, `title`, `content`, `senttime`, `type`, `pid`) VALUES (?, ?, ?, ?, ?, ?, ?);",
-                          use(playerid), use(rcv->accountid), use(subject), use(content), use(time), use(type), use(rcv->mailpid));
-        stmt.execute();
-        rcv->mailpid++;
-        if (!stmt.done())
+        int64_t pid = rcv->mailpid++;
+        MailRow row(receiverid, subject, content, time, 0, int32_t(pid), playerid, type);
+        ++rcv->pendingwrites;
+        serverdb->Post(receiverid, [row](storageconn & db) mutable
         {
-            log->error("Unable to send mail.");
-            return false;
-        }
+            db.InsertMail(row);
+        }, [rcv](bool)
+        {
+            --rcv->pendingwrites;
+        });
     }
-    SQLCATCH(return false;);
 
     if (sender == "System")
     {
         return true;
     }
 
-    try
     {
         stMail mail;
         mail.content = content;
@@ -3651,24 +4925,20 @@ bool spitfire::CreateMail(std::string sender, std::string receiver, std::string
         mail.playerid = playerid;
         mail.readtime = time;
 
-        rcv->maillist.push_back(mail);
+        ListMail(rcv, mail);
+        JournalMail(receiverid, mail);
 
-        Poco::Data::Session ses(serverpool->get());
-        Statement stmt = (ses << "INSERT INTO `mail` (`senderid`, `receiverid`, `title`, `content`, `senttime`, `readtime`, `type`, `pid`) VALUES (?, ?, ?, ?, ?, ?, ?, ?);",
-                          use(playerid), use(rcv->accountid), use(subject), use(content), use(time), use(time), use(type), use(snd->mailpid));
-        stmt.execute();
-        snd->mailpid++;
-        if (!stmt.done())
+        int64_t pid = snd->mailpid++;
+        MailRow row(receiverid, subject, content, time, time, int32_t(pid), playerid, type);
+        ++rcv->pendingwrites;
+        serverdb->Post(receiverid, [row](storageconn & db) mutable
         {
-            log->error("Unable to send mail.");
-            return false;
-        }
+            db.InsertMail(row);
+        }, [rcv](bool)
+        {
+            --rcv->pendingwrites;
+        });
     }
-    SQLCATCH(return false;);
-
-
-
-    //rcv
 
     return true;
 }
@@ -3695,6 +4965,16 @@ bool spitfire::Init()
         maxplayers = obj["maxplayers"];
         log->info("maxplayers: {}", maxplayers);
 
+        maxpacketsize = obj.value("maxpacketsize", uint32_t(MAXPACKETSIZE));
+        log->info("maxpacketsize: {}", maxpacketsize);
+
+        networkthreads = obj.value("networkthreads", 1u);
+        log->info("networkthreads: {}", networkthreads);
+
+        if (obj.count("networkaffinity"))
+            networkaffinity = obj["networkaffinity"].get<std::vector<int32_t>>();
+        log->info("networkaffinity: {} cpu(s) pinned", networkaffinity.size());
+
         mapsize = obj["mapsize"];
         log->info("mapsize: {}", mapsize);
 
@@ -3721,6 +5001,51 @@ bool spitfire::Init()
 
         reportbaseurl = obj["reportbaseurl"];
         log->info("report base url: {}",reportbaseurl);
+
+        saveinterval = obj.value("saveinterval", uint64_t(60000));
+        log->info("saveinterval: {}ms", saveinterval);
+
+        savebatch = std::max(obj.value("savebatch", 500u), 1u);
+        log->info("savebatch: {}", savebatch);
+
+        saverows = std::max(obj.value("saverows", 200u), 1u);
+        log->info("saverows: {}", saverows);
+
+        savethreads = std::max(obj.value("savethreads", 4u), 1u);
+        log->info("savethreads: {}", savethreads);
+
+        loadchunk = std::max(obj.value("loadchunk", 10000u), 1u);
+        log->info("loadchunk: {}", loadchunk);
+
+        dbthreads = std::max(obj.value("dbthreads", 2u), 1u);
+        log->info("dbthreads: {}", dbthreads);
+
+        storagetype = obj.value("storage", std::string("mysql"));
+        log->info("storage: {}", storagetype);
+
+        snapshotfile = obj.value("snapshotfile", std::string("world.snapshot"));
+        log->info("snapshotfile: {}", snapshotfile.empty() ? "(disabled)" : snapshotfile);
+
+        snapshotfork = obj.value("snapshotfork", true);
+        log->info("snapshotfork: {}", snapshotfork);
+
+        snapshotinterval = obj.value("snapshotinterval", uint64_t(0));
+        log->info("snapshotinterval: {}ms", snapshotinterval);
+
+        journaldir = obj.value("journaldir", std::string("journal"));
+        log->info("journaldir: {}", journaldir.empty() ? "(disabled)" : journaldir);
+
+        journalsync = obj.value("journalsync", 20u);
+        log->info("journalsync: {}ms", journalsync);
+
+        hibernateafter = obj.value("hibernateafter", uint64_t(10 * 60 * 1000));
+        log->info("hibernateafter: {}", hibernateafter == 0 ? std::string("(disabled)") : std::to_string(hibernateafter) + "ms");
+
+        evictafter = obj.value("evictafter", uint64_t(24 * 60 * 60 * 1000));
+        log->info("evictafter: {}", evictafter == 0 ? std::string("(disabled)") : std::to_string(evictafter) + "ms");
+
+        maxsleepers = obj.value("maxsleepers", 10000u);
+        log->info("maxsleepers: {}", maxsleepers);
     }
     catch (std::exception& e)
     {
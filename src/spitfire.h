@@ -12,8 +12,11 @@
 #include <streambuf>
 #include <sstream>
 #include <functional>
+#include <map>
 #include <memory>
 #include <set>
+#include <unordered_map>
+#include <vector>
 
 #include <Poco/Net/HTTPRequest.h>
 #include <Poco/Net/HTTPResponse.h>
@@ -40,15 +43,28 @@
 #include <thread>
 #include <string>
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <future>
 
 #include <nlohmann/json.hpp>
 //#include "../lib/fmt/fmt/ostream.h"
 
 #include "connection.h"
+#include "bufferpool.h"
+#include "scheduler.h"
+#include "savequeue.h"
+#include "dbexecutor.h"
+#include "journal.h"
+#include "storage.h"
+#include "worldrows.h"
+#include "ranktree.h"
+#include "nameindex.h"
 #include "amf3.h"
 #include "Market.h"
 #include "Utils.h"
 #include "AllianceMgr.h"
+#include "ArmyMgr.h"
 #include "Map.h"
 #include "structs.h"
 #include <queue>
@@ -56,6 +72,26 @@
 
 using json = nlohmann::json;
 
+/// One network shard. Each shard owns an io_service with its own acceptor bound
+/// to the game port via SO_REUSEPORT and is run by exactly one thread, so every
+/// connection accepted here is read, parsed and written on this shard for life.
+struct netshard
+{
+    explicit netshard(uint32_t id)
+        : id(id)
+        , acceptor(io_service)
+        , socket(io_service)
+    {
+    }
+
+    uint32_t id;
+    asio::io_service io_service;
+    asio::ip::tcp::acceptor acceptor;
+    asio::ip::tcp::socket socket;
+    // CPU the shard thread is pinned to, -1 for no pinning
+    int32_t cpu = -1;
+};
+
 class spitfire
 {
 public:
@@ -80,6 +116,7 @@ public:
 
     void setupLogging();
     void io_thread();
+    void shard_thread(netshard & shard);
     void run();
     void stop();
     void start(connection_ptr c);
@@ -87,7 +124,7 @@ public:
     bool Init();
     void stop(connection_ptr c, bool checklock = true);
     void stop_all();
-    void do_accept();
+    void do_accept(netshard & shard);
     void do_acceptpolicy();
 
     void PlayerCount(int8_t amount)
@@ -110,12 +147,23 @@ public:
     Client * GetClientByCastle(int64_t castleid);
     int32_t  GetClientIndex(int64_t accountid);
 
+    // Lookup key setters; assign the Client field and keep the client
+    // indexes below current. Always go through these instead of writing
+    // accountid/masteraccountid/playername directly.
+    void SetClientAccountId(Client * client, int64_t accountid);
+    void SetClientParentId(Client * client, int64_t masteraccountid);
+    void SetClientName(Client * client, const std::string & name);
+    // Cities are never taken from an account, so castles are only ever
+    // added to the index
+    void IndexCastle(Client * client, int64_t castleid);
+
     std::shared_ptr<spdlog::logger> log;
     
     asio::io_service io_service_;
     asio::signal_set signals_;
-    asio::ip::tcp::acceptor acceptor_;
+    std::vector<std::unique_ptr<netshard>> shards_;
     std::set<connection_ptr> connections_;
+    std::mutex connectionsmtx;
     asio::ip::tcp::socket socket_;
     request_handler request_handler_;
     asio::ip::tcp::acceptor acceptorpolicy_;
@@ -125,6 +173,16 @@ public:
     std::list<request> packetqueue;
     std::mutex m;
 
+    // Serializes game logic between the network shards and the timer thread
+    std::mutex worldmtx;
+
+    // Wakes the timer thread early when a deadline earlier than the one it
+    // sleeps towards gets scheduled, or on shutdown
+    std::mutex timermtx;
+    std::condition_variable timercv;
+    uint64_t timerwake = 0;
+    bool timerkick = false;
+
     server_status serverstatus;
     std::string servername;
 
@@ -153,32 +211,13 @@ public:
 
     void SendObject(Client * c, const amf3object & object) const;
 
-    void SendObject(connection * s, const amf3object & object) const
-    {
-        if (s == nullptr)
-            return;
-        try
-        {
-            if (serverstatus == 0)
-                return;
-            char buffer[15000];
-            auto length = 0;
-            amf3writer writer(buffer + 4);
-
-            writer.Write(object);
+    void SendObject(connection * s, const amf3object & object) const;
 
-            (*(int32_t*)buffer) = length = (uint32_t)writer.position;
-            Utils::ByteSwap5((unsigned char *)&buffer, sizeof(*(int32_t*)buffer));
+    // Serialize an object into a framed, pooled buffer ready to be queued on any connection
+    netbuffer_ptr SerializeObject(const amf3object & object) const;
 
-            if (s != nullptr)
-                s->write(buffer, length + 4);
-        }
-        catch (std::exception& e)
-        {
-            std::cerr << s->address << "exception: " << __FILE__ << " @ " << __LINE__ << "\n";
-            std::cerr << e.what() << "\n";
-        }
-    }
+    // Serialize once and queue the same buffer on every connected recipient
+    void Broadcast(const stBroadcastTarget & target, const amf3object & object, Client * exclude = nullptr);
 
     // Parse chat for commands
     bool ParseChat(Client * client, std::string str);
@@ -188,6 +227,127 @@ public:
 
     void TimerThread();
     void SaveThread();
+    // Runs jobs [first, last) in one transaction, falling back to one
+    // transaction per job
+    void SaveBatch(std::vector<savejob> & jobs, size_t first, size_t last);
+
+    // Write-behind persistence. Mutating paths MarkDirty() entities; every
+    // saveinterval ms the timer thread turns them into savejob snapshots of
+    // up to saverows rows each and hands those to SaveThread, which writes
+    // them savebatch jobs per transaction over up to savethreads sessions.
+    std::vector<Client*> dirtyclients;
+    std::vector<PlayerCity*> dirtycities;
+    std::vector<Hero*> dirtyheroes;
+    std::vector<Alliance*> dirtyalliances;
+    savequeue saves;
+    uint64_t saveinterval = 60000;
+    uint32_t savebatch = 500;
+    uint32_t saverows = 200;
+    uint32_t savethreads = 4;
+    // Jobs that could not be committed, handed back by SaveThread so the
+    // next FlushDirty saves what they covered again. savefailures counts
+    // every job handed back, saveretried those FlushDirty took; the save
+    // marker only moves while the two agree.
+    std::mutex savefailmtx;
+    std::vector<savejob> savefailed;
+    uint64_t savefailures = 0;
+    uint64_t saveretried = 0;
+
+    // Snapshot everything dirty into the save queue; game thread only
+    void FlushDirty();
+    // Drop an entity from the dirty lists before deleting it
+    void ForgetDirty(Hero * hero);
+    void ForgetDirty(Alliance * alliance);
+    savejob ArmiesSaveJob();
+
+    // Rows fetched per round trip by the startup loader
+    uint32_t loadchunk = 10000;
+
+    // Warm restart. The world rows are written to snapshotfile at shutdown
+    // and on \snapshot; startup reads them instead of MySQL when the
+    // snapshot's flush stamp is no older than the DB's save marker, the
+    // stamp of the last flush the save thread committed. Empty disables.
+    std::string snapshotfile = "world.snapshot";
+    uint64_t flushstamp = 0;
+    // stamp of the last flush the save thread committed
+    std::atomic<uint64_t> savedstamp{ 0 };
+    std::future<bool> snapshotjob;
+    // retried is saveretried as of the flush the marker follows
+    savejob SaveMarkerJob(uint64_t stamp, uint64_t retried);
+    bool ReadSaveMarker(uint64_t & marker);
+    // Copies the world into loader rows; game thread only
+    void CollectWorld(worldrows & world);
+    // Flushes, collects and writes the snapshot in the background; wait
+    // blocks until it is on disk
+    bool WriteSnapshot(bool wait);
+    // True while a snapshot is being written; wait blocks until it is not
+    bool SnapshotBusy(bool wait);
+
+    // Snapshots taken while running are written by a fork()ed child from
+    // its copy-on-write image of the world, so the game only stalls for the
+    // fork. The timer thread forks at the end of a tick, every
+    // snapshotinterval ms (0 = only on request) or when snapshotrequested.
+    // Not available on Windows, where the snapshot is collected in place.
+    bool snapshotfork = true;
+    uint64_t snapshotinterval = 0;
+    bool snapshotrequested = false;
+    int snapshotpid = 0;
+    uint64_t snapshotstarted = 0;
+    int64_t snapshotfaults = 0;
+    // How long the last child ran and the pages the parent faulted in
+    // meanwhile, which is what the copy-on-write image cost
+    uint64_t snapshotms = 0;
+    uint64_t snapshotpages = 0;
+    bool ForkSnapshot();
+    // Collects the exit of the snapshot child, if it has exited or wait
+    void ReapSnapshot(bool wait);
+    // stamp is the flush stamp the snapshot was taken at
+    bool ReadSnapshot(worldrows & world, uint64_t savemarker, uint64_t & stamp);
+    // Queue every entity for saving
+    void MarkAllDirty();
+
+    // Crash recovery between saves. What mutating paths MarkDirty() is also
+    // queued here, and before worldmtx is released the row images of those
+    // entities go to the journal as one batch, synced within journalsync ms.
+    // Startup replays the segments started at or after the flush it loaded.
+    // Empty journaldir disables.
+    journal redolog;
+    std::string journaldir = "journal";
+    uint32_t journalsync = 20;
+    std::vector<Client*> journalclients;
+    std::vector<Client*> journalreports;
+    std::vector<PlayerCity*> journalcities;
+    std::vector<Hero*> journalheroes;
+    std::vector<Alliance*> journalalliances;
+    std::vector<stArmyMovement*> journalarmies;
+    std::vector<uint64_t> journalarmiesgone;
+    // Set when a segment starts; its first army record is then the whole set
+    bool journalarmyimage = true;
+    void Journal(Client * client) { if (redolog.IsOpen()) journalclients.push_back(client); }
+    void JournalReports(Client * client) { if (redolog.IsOpen()) journalreports.push_back(client); }
+    void Journal(PlayerCity * city) { if (redolog.IsOpen()) journalcities.push_back(city); }
+    void Journal(Hero * hero) { if (redolog.IsOpen()) journalheroes.push_back(hero); }
+    void Journal(Alliance * alliance) { if (redolog.IsOpen()) journalalliances.push_back(alliance); }
+    void Journal(stArmyMovement * am) { if (redolog.IsOpen()) journalarmies.push_back(am); }
+    void JournalGone(stArmyMovement * am) { if (redolog.IsOpen()) journalarmiesgone.push_back(ArmyMgr::Key(am)); }
+    void JournalMail(int64_t receiverid, const stMail & mail);
+    // A report just put in front of the account's reportlist
+    void JournalReport(int64_t accountid, const stReport & report);
+    // Journals everything queued above; call before releasing worldmtx
+    void JournalCommit();
+    // Applies the journal over rows loaded as of flush stamp; false if
+    // there was nothing to replay
+    bool ReplayJournal(worldrows & world, uint64_t stamp);
+
+    // Queries issued while serving players run on these instead of the
+    // calling thread, dbthreads workers each
+    dbexecutor * accountdb;
+    dbexecutor * serverdb;
+    uint32_t dbthreads = 2;
+
+    // Runs query on db, then done on c's shard under worldmtx. done is
+    // dropped if the connection closed while the query ran.
+    void Query(dbexecutor & db, uint64_t key, connection * c, dbquery query, std::function<void(bool)> done);
 
 
     // MySQL
@@ -204,6 +364,11 @@ public:
     Poco::Data::SessionPool * accountpool;
     Poco::Data::SessionPool * serverpool;
 
+    // Where accounts and the world persist: "mysql", over the pools above,
+    // or "memory". Config tables always load from accountpool.
+    std::string storagetype = "mysql";
+    storage * store;
+
     // mutexes
     //         struct mutexes
     //         {
@@ -222,6 +387,14 @@ public:
     // Max players allowed connected
     uint32_t maxplayers;
 
+    // Largest client frame accepted before the connection is dropped
+    uint32_t maxpacketsize = MAXPACKETSIZE;
+
+    // Number of network shards (0 = one per hardware thread)
+    uint32_t networkthreads = 1;
+    // CPU to pin each network shard to, indexed by shard (empty = no pinning)
+    std::vector<int32_t> networkaffinity;
+
     // Current players connected
     uint32_t currentplayersonline;
 
@@ -241,6 +414,41 @@ public:
 
     std::list<Client*> players;
 
+    // Hibernation. The periodic ticks only visit awakeplayers; an account
+    // offline for hibernateafter ms drops out and its cities and rankings
+    // stand still until Wake catches them up from their timestamps.
+    // Hibernating accounts that still hold their mail and reports wait in
+    // sleepers, least recently active first, and have those histories
+    // evicted to the store after evictafter ms, or early while there are
+    // more than maxsleepers. 0 disables either step.
+    std::vector<Client*> awakeplayers;
+    std::list<Client*> sleepers;
+    uint64_t hibernateafter = 10 * 60 * 1000;
+    uint64_t evictafter = 24 * 60 * 60 * 1000;
+    uint32_t maxsleepers = 10000;
+    // Call before reading or changing an offline account's cities
+    void Wake(Client * client, uint64_t ltime);
+    // Takes client out of the ticks; the caller drops it from awakeplayers
+    void Hibernate(Client * client, uint64_t ltime);
+    // Drops the histories once the store holds everything they do
+    bool Evict(Client * client);
+    // Call before reading an account's mail or reports. Evicted histories
+    // are read back on serverdb and then runs under worldmtx once they are
+    // in, ok false if they could not be; right away if they never left.
+    void Fault(Client * client, std::function<void(bool ok)> then);
+    void EvictIdle(uint64_t ltime);
+    // Puts a new report in front of the account's reports, or into the
+    // store while they are evicted
+    void FileReport(Client * client, const stReport & report);
+    void PinHeroes(Client * client, bool pinned);
+
+    // Client lookup indexes. Names are keyed lowercase so lookups by name
+    // are case-insensitive, matching the account table's collation.
+    std::unordered_map<int64_t, Client*> clientsbyaccount;
+    std::unordered_map<int64_t, Client*> clientsbyparent;
+    std::unordered_map<std::string, Client*> clientsbyname;
+    std::unordered_map<int64_t, Client*> clientsbycastle;
+
     uint64_t ltime;
 
     uint64_t armycounter;
@@ -255,6 +463,9 @@ public:
 #define DEF_TIMEDARMY 1
 #define DEF_TIMEDBUILDING 2
 #define DEF_TIMEDRESEARCH 3
+#define DEF_TIMEDTROOPS 4
+#define DEF_TIMEDBUFF 5
+#define DEF_TIMEDBEGINNER 6
 
     stItemConfig * GetItem(std::string name);
 
@@ -263,13 +474,43 @@ public:
 
     void MassDisconnect();
     void AddTimedEvent(stTimedEvent & te);
+    std::list<stTimedEvent>::iterator RemoveTimedEvent(std::list<stTimedEvent> & list, std::list<stTimedEvent>::iterator iter);
+
+    // Completion deadlines, keyed by DEF_TIMED* type. Must be called with worldmtx held.
+    //   DEF_TIMEDARMY - id: ArmyMgr slot
+    //   DEF_TIMEDBUILDING/DEF_TIMEDRESEARCH - id: timed event id
+    //   DEF_TIMEDTROOPS - id: castle id, param: queue position id
+    //   DEF_TIMEDBUFF/DEF_TIMEDBEGINNER - id: account id
+    void Schedule(int8_t type, int64_t id, int32_t param, double due);
+    void Unschedule(int8_t type, int64_t id, int32_t param);
+    void ScheduleTimedEvent(const stTimedEvent & te);
+    void ScheduleBuilding(PlayerCity * city, int16_t positionid);
+    // a city researches one tech at a time
+    void ScheduleResearch(PlayerCity * city);
+    void ScheduleTroopQueue(PlayerCity * city, stTroopQueue * queue);
+    void ScheduleBuffs(Client * client);
+    void ScheduleBeginner(Client * client);
+    void RunTimedEvents(uint64_t ltime);
+    void ArmyArrived(stArmyMovement * am, uint64_t ltime);
+    void BuildingComplete(std::list<stTimedEvent>::iterator iter, uint64_t ltime);
+    void ResearchComplete(std::list<stTimedEvent>::iterator iter, uint64_t ltime);
+    void TroopQueueComplete(int64_t castleid, int32_t positionid, uint64_t ltime);
+    void BuffsExpired(int64_t accountid, uint64_t ltime);
+
+    scheduler timers;
+    // Building and research events by timed event id
+    std::unordered_map<int64_t, std::list<stTimedEvent>::iterator> timedevents;
+    // Timed event ids by the building slot or researching city they finish
+    std::map<std::pair<PlayerCity*, int16_t>, int64_t> buildingevents;
+    std::unordered_map<PlayerCity*, int64_t> researchevents;
 
 
     stBuildingConfig m_buildingconfig[35][10];
     stBuildingConfig m_researchconfig[25][10];
     stBuildingConfig m_troopconfig[20];
 
-    std::list<stTimedEvent> armylist;
+    // Every army on the map
+    ArmyMgr armies;
     std::list<stTimedEvent> buildinglist;
     std::list<stTimedEvent> researchlist;
 
@@ -289,52 +530,43 @@ public:
 
 
 
-    static bool compareprestige(stClientRank first, stClientRank second);
-    static bool comparehonor(stClientRank first, stClientRank second);
-    static bool comparetitle(stClientRank first, stClientRank second);
-    static bool comparepop(stClientRank first, stClientRank second);
-    static bool comparecities(stClientRank first, stClientRank second);
+    // Rankings are ranktrees. Players and castles are repositioned by
+    // RankClient/RankCastle wherever a score changes; heroes come and go,
+    // so SortHeroes reconciles them in a sweep
+    typedef ranktree<Client*, double> clientranking;
+    typedef ranktree<Hero*> heroranking;
+    typedef ranktree<PlayerCity*> castleranking;
 
+    void RankClient(Client * client);
+    // Refreshes the prestige rank shown to connected clients
     void SortPlayers();
 
+    clientranking m_prestigerank;
+    clientranking m_honorrank;
+    clientranking m_titlerank;
+    clientranking m_populationrank;
+    clientranking m_citiesrank;
 
-    std::list<stClientRank> m_prestigerank;
-    std::list<stClientRank> m_honorrank;
-    std::list<stClientRank> m_titlerank;
-    std::list<stClientRank> m_populationrank;
-    std::list<stClientRank> m_citiesrank;
-
-
-
-    std::list<stHeroRank> m_herorankstratagem;
-    std::list<stHeroRank> m_herorankpower;
-    std::list<stHeroRank> m_herorankmanagement;
-    std::list<stHeroRank> m_herorankgrade;
+    heroranking m_herorankstratagem;
+    heroranking m_herorankpower;
+    heroranking m_herorankmanagement;
+    heroranking m_herorankgrade;
 
     void SortHeroes();
-    static bool comparestratagem(stHeroRank first, stHeroRank second);
-    static bool comparepower(stHeroRank first, stHeroRank second);
-    static bool comparemanagement(stHeroRank first, stHeroRank second);
-    static bool comparegrade(stHeroRank first, stHeroRank second);
-    static bool comparearmies(stTimedEvent& x,stTimedEvent& y);
+    // Drops a hero from the rankings; call before the hero is deleted
+    void UnrankHero(Hero * hero);
 
     static std::string readreport(std::string report_id);
 
-    std::list<stCastleRank> m_castleranklevel;
-    std::list<stCastleRank> m_castlerankpopulation;
-
-    void SortCastles();
-    static bool comparepopulation(stCastleRank first, stCastleRank second);
-    static bool comparelevel(stCastleRank first, stCastleRank second);
-
+    castleranking m_castleranklevel;
+    castleranking m_castlerankpopulation;
 
-    std::list<stSearchClientRank> m_searchclientranklist;
-    std::list<stSearchHeroRank> m_searchheroranklist;
-    std::list<stSearchCastleRank> m_searchcastleranklist;
-    std::list<stSearchAllianceRank> m_searchallianceranklist;
+    void RankCastle(PlayerCity * city);
 
-    void * DoRankSearch(std::string key, int8_t type, void * subtype, int16_t page, int16_t pagesize);
-    void CheckRankSearchTimeouts(uint64_t time);
+    // Name search over the rankings, kept in step with them
+    nameindex<Client*> m_playernames;
+    nameindex<Hero*> m_heronames;
+    nameindex<PlayerCity*> m_castlenames;
 
     // Construct an error message to send to the client
     static amf3object CreateError(std::string cmd, int32_t id, std::string message)
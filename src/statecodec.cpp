@@ -0,0 +1,108 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#include "statecodec.h"
+
+namespace
+{
+    const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    // Reverse of digits, -1 for anything that is not a base64 digit
+    struct digittable
+    {
+        int8_t values[256];
+        digittable()
+        {
+            for (int i = 0; i < 256; ++i)
+                values[i] = -1;
+            for (int i = 0; i < 64; ++i)
+                values[uint8_t(digits[i])] = int8_t(i);
+        }
+    };
+    const digittable table;
+}
+
+statewriter::statewriter(std::string & out)
+    : out(out)
+{
+    out.clear();
+    out += statecodec::marker;
+    out += statecodec::version;
+}
+
+void statewriter::Int(int64_t value)
+{
+    uint64_t v = (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+    do
+    {
+        uint32_t digit = v & 31;
+        v >>= 5;
+        if (v)
+            digit |= 32;
+        out += digits[digit];
+    } while (v);
+}
+
+void statewriter::Str(const std::string & value)
+{
+    Int(int64_t(value.size()));
+    out += value;
+}
+
+statereader::statereader(const std::string & in)
+    : pos(in.data())
+    , end(in.data() + in.size())
+    , version(0)
+    , ok(false)
+{
+    // versions newer than this build are refused rather than misread
+    if (statecodec::IsPacked(in) && in[1] >= '1' && in[1] <= statecodec::version)
+    {
+        version = in[1] - '0';
+        pos += 2;
+        ok = true;
+    }
+}
+
+bool statereader::Int(int64_t & value)
+{
+    if (AtEnd())
+        return ok = false;
+
+    uint64_t v = 0;
+    for (uint32_t shift = 0; ; shift += 5)
+    {
+        int8_t digit = (pos != end && shift < 64) ? table.values[uint8_t(*pos++)] : -1;
+        if (digit < 0)
+            return ok = false;
+        v |= uint64_t(digit & 31) << shift;
+        if (!(digit & 32))
+            break;
+    }
+    value = int64_t(v >> 1) ^ -int64_t(v & 1);
+    return true;
+}
+
+bool statereader::Time(double & ms)
+{
+    int64_t value;
+    if (!Int(value))
+        return false;
+    ms = double(value);
+    return true;
+}
+
+bool statereader::Str(std::string & value)
+{
+    int64_t length;
+    if (!Int(length))
+        return false;
+    if (length < 0 || length > end - pos)
+        return ok = false;
+    value.assign(pos, size_t(length));
+    pos += length;
+    return true;
+}
@@ -0,0 +1,71 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/// Packed form of the state columns (buildings, troops, troop queues,
+/// fortifications, research, items, buffs). A packed value is the marker
+/// '~' and a version digit, then a run of fields:
+///  - integers as zigzag base64 VLQ, five payload bits per character
+///  - strings as a VLQ length followed by the raw bytes
+/// Every character outside the strings is plain base64, so the value still
+/// fits the existing text columns. Times are stored as whole milliseconds.
+/// A value without the marker is the legacy delimited text, which the
+/// Parse* functions keep reading until every row has been saved again.
+namespace statecodec
+{
+    const char marker = '~';
+    const char version = '1';
+
+    inline bool IsPacked(const std::string & str)
+    {
+        return str.size() >= 2 && str[0] == marker;
+    }
+}
+
+/// Appends fields to a caller-owned string, clearing it first. Reusing the
+/// same string across saves avoids any allocation once it has grown.
+class statewriter
+{
+public:
+    explicit statewriter(std::string & out);
+
+    void Int(int64_t value);
+    void Time(double ms) { Int(int64_t(ms)); }
+    void Str(const std::string & value);
+
+private:
+    std::string & out;
+};
+
+/// Reads fields in place from a packed value. Every read returns false once
+/// the value is exhausted or malformed, and keeps returning false after.
+class statereader
+{
+public:
+    explicit statereader(const std::string & in);
+
+    /// Version digit of the value, 0 if it is not packed or newer than this
+    /// build understands
+    int Version() const { return version; }
+    bool AtEnd() const { return !ok || pos == end; }
+    /// False once a read ran past the end or hit a malformed field
+    bool Good() const { return ok; }
+
+    bool Int(int64_t & value);
+    bool Time(double & ms);
+    bool Str(std::string & value);
+
+private:
+    const char * pos;
+    const char * end;
+    int version;
+    bool ok;
+};
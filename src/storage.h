@@ -0,0 +1,124 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "worldrows.h"
+
+// Rows the saves write, in the column order of the MySQL schema. They are
+// wider than the loader's rows: the extra columns are read by the website
+// and tools, not by the server.
+
+//accountid, parentid, username, creation, buffs, research, items, misc, status, ipaddress, sex, flag, faceurl,
+//allianceid, alliancerank, cents, prestige, honor, lastlogin, changedface, icon, allianceapply, allianceapplytime, castlesign
+using AccountSave = Poco::Tuple<int64_t, int64_t, std::string, double, std::string, std::string, std::string, std::string, int32_t, std::string, int32_t, std::string, std::string,
+    int32_t, int16_t, uint64_t, double, double, double, bool, int8_t, std::string, int64_t, std::string>;
+//id, accountid, creation, misc, status, allowalliance, logurl, fieldid, transingtrades, troop, troopqueues, name, buildings,
+//fortification, trades, gooutforbattle, hasenemy, gold, food, wood, iron, stone
+using CitySave = Poco::Tuple<uint64_t, int64_t, double, std::string, int8_t, bool, std::string, int32_t, std::string, std::string, std::string, std::string, std::string,
+    std::string, std::string, bool, bool, double, double, double, double, double>;
+//id, basemanagement, basepower, basestratagem, power, poweradded, powerbuffadded, stratagem, stratagemadded, stratagembuffadded,
+//management, managementadded, managementbuffadded, experience, upgradeexp, itemamount, itemid, level, logurl, loyalty, troop, name,
+//castleid, ownerid, status, remainpoint
+using HeroSave = Poco::Tuple<uint64_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t,
+    double, double, int32_t, int32_t, uint32_t, std::string, int8_t, std::string, std::string, uint64_t, uint64_t, int8_t, uint32_t>;
+//id, name, founder, leader, note, intro, motd, allies, neutrals, enemies, members
+using AllianceSave = Poco::Tuple<int64_t, std::string, std::string, std::string, std::string, std::string, std::string, std::string, std::string, std::string, std::string>;
+//heroid, direction, resource, troops, starttime, reachtime, resttime, missiontype, startfieldid, targetfieldid, cityid, clientid
+using ArmySave = Poco::Tuple<int64_t, int8_t, std::string, std::string, int64_t, int64_t, int64_t, int8_t, int32_t, int32_t, int64_t, int32_t>;
+
+/// What a login finds out about the player
+struct loginrecord
+{
+    // email and password matched a master account
+    bool found = false;
+    int32_t masteraccountid = 0;
+    bool banned = false;
+    std::string banreason;
+    // account on this server, -1 if the player has none yet
+    int64_t accountid = -1;
+    bool hascities = false;
+};
+
+/// One thread's handle on the store. Not safe to share between threads;
+/// every thread that persists takes its own from storage::Connect. Failures
+/// throw, like the Poco::Data calls the MySQL backend makes.
+class storageconn
+{
+public:
+    virtual ~storageconn() {}
+
+    /// Writes between Begin and Commit land together
+    virtual void Begin() = 0;
+    virtual void Commit() = 0;
+
+    /// Upserted by id, rowsper rows per statement where that applies
+    virtual void SaveAccounts(std::vector<AccountSave> & rows, uint32_t rowsper) = 0;
+    virtual void SaveCities(std::vector<CitySave> & rows, uint32_t rowsper) = 0;
+    virtual void SaveHeroes(std::vector<HeroSave> & rows, uint32_t rowsper) = 0;
+    virtual void SaveAlliances(std::vector<AllianceSave> & rows, uint32_t rowsper) = 0;
+    /// Replace every army, and every report of one account
+    virtual void SaveArmies(std::vector<ArmySave> & rows, uint32_t rowsper) = 0;
+    virtual void SaveReports(int64_t accountid, std::vector<ReportRow> & rows, uint32_t rowsper) = 0;
+    virtual void DeleteHero(uint64_t id) = 0;
+    virtual void DeleteAlliance(int64_t id) = 0;
+
+    /// Flush stamp of the last committed save; a store that has none
+    /// starts at 0
+    virtual uint64_t ReadSaveMarker() = 0;
+    virtual void SaveMarker(uint64_t stamp) = 0;
+
+    /// Rows created by the game; these return the id the store assigned
+    virtual bool AccountExists(const std::string & username) = 0;
+    virtual int64_t CreateAccount(int64_t parentid, const std::string & username, uint64_t time, const std::string & ipaddress,
+        int32_t sex, const std::string & flag, const std::string & faceurl) = 0;
+    virtual int64_t CreateCity(int64_t accountid, const std::string & misc, int32_t fieldid, const std::string & name,
+        const std::string & buildings, uint64_t time) = 0;
+    virtual int64_t CreateAlliance(const std::string & name, const std::string & founder, const std::string & leader, int64_t time) = 0;
+
+    virtual void InsertMail(MailRow & row) = 0;
+    virtual void ReadMail(int64_t receiverid, int32_t pid, uint64_t readtime) = 0;
+    /// Insert, or overwrite the mail with the same receiver, pid and send time
+    virtual void ReplaceMail(MailRow & row) = 0;
+    /// Insert, or overwrite the report with the same account and guid
+    virtual void ReplaceReport(ReportRow & row) = 0;
+
+    /// Every mail and report of one account, for histories read back in
+    /// after they were evicted; mail in pid order, reports newest first
+    virtual void LoadMail(int64_t accountid, std::vector<MailRow> & rows) = 0;
+    virtual void LoadReports(int64_t accountid, std::vector<ReportRow> & rows) = 0;
+
+    /// Looks up the master account by email and password, creating it if
+    /// the email is new, then the player's account on this server
+    virtual void Login(const std::string & email, const std::string & password, loginrecord & result) = 0;
+};
+
+/// Where the world and the players are kept. The server only reaches its
+/// persistent state through this, so the backend is picked in config.json:
+/// "mysql" for the schema the server always used, or "memory" for a store
+/// that needs no setup and keeps nothing past the process, for tests and
+/// for measuring the save and login paths without a database.
+class storage
+{
+public:
+    virtual ~storage() {}
+
+    virtual std::unique_ptr<storageconn> Connect() = 0;
+
+    /// Reads every persisted row, chunk rows per round trip where the
+    /// backend has round trips; throws on failure. Accounts last logged in
+    /// before idlebefore come back in world.evicted instead of with their
+    /// mail and reports; 0 evicts none.
+    virtual void LoadWorld(worldrows & world, uint32_t chunk, bool tiles, uint64_t idlebefore) = 0;
+
+    /// Logs what the backend counts about its statements, if anything
+    virtual void LogStats() {}
+};
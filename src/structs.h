@@ -4,6 +4,7 @@
 #include "amf3.h"
 #include <stdint.h>
 #include <list>
+#include <vector>
 #include "Utils.h"
 #include <string.h>
 
@@ -256,21 +257,30 @@ struct stTroops
         return obj;
     }
 };
-struct stAlliance
+struct stArmyMovement;
+// Intrusive link of an army in one armylist (see armylist.h)
+struct stArmyLink
 {
-    int64_t id;
-    union
-    {
-        int32_t members;
-        double honor;
-        double prestige;
-    };
-    uint32_t rank;
-    Alliance * ref;
+    stArmyMovement * prev = nullptr;
+    stArmyMovement * next = nullptr;
+    void * list = nullptr;
 };
 struct stArmyMovement
 {
     stArmyMovement() { memset(&resources, 0, sizeof(stResources)); memset(&troops, 0, sizeof(stTroops)); }
+    // Slot in the ArmyMgr slab
+    uint32_t slot = 0;
+    // Bumped each time the slot is reused, see ArmyMgr::Key
+    uint32_t generation = 0;
+    bool active = false;
+    // Owner's Client::armymovement
+    stArmyLink ownerlink;
+    // Origin city's PlayerCity::armymovement
+    stArmyLink citylink;
+    // Target owner's Client::enemyarmymovement or friendarmymovement
+    stArmyLink targetlink;
+    // ArmyMgr per target tile index
+    stArmyLink tilelink;
     Hero * hero;
     std::string heroname;
     int16_t direction;//1 from city - 2 back to city
@@ -349,59 +359,6 @@ struct stIntRank
     uint32_t value;
     uint32_t id;
 };
-struct stClientRank
-{
-    Client * client;
-    int32_t rank;
-};
-struct stHeroRank
-{
-    int32_t stratagem;
-    int32_t power;
-    int32_t management;
-    int32_t grade;
-    std::string name;
-    std::string kind;
-    int32_t rank;
-};
-struct stCastleRank
-{
-    int16_t level;
-    int32_t population;
-    std::string name;
-    std::string grade;
-    std::string alliance;
-    std::string kind;
-    int32_t rank;
-};
-struct stSearchClientRank
-{
-    std::list<stClientRank> ranklist;
-    std::list<stClientRank> * rlist;
-    std::string key;
-    uint64_t lastaccess;
-};
-struct stSearchHeroRank
-{
-    std::list<stHeroRank> ranklist;
-    std::list<stHeroRank> * rlist;
-    std::string key;
-    uint64_t lastaccess;
-};
-struct stSearchCastleRank
-{
-    std::list<stCastleRank> ranklist;
-    std::list<stCastleRank> * rlist;
-    std::string key;
-    uint64_t lastaccess;
-};
-struct stSearchAllianceRank
-{
-    std::list<stAlliance> ranklist;
-    std::list<stAlliance> * rlist;
-    std::string key;
-    uint64_t lastaccess;
-};
 struct stPacketOut
 {
     int32_t client;
@@ -500,3 +457,28 @@ struct stCastleSign
     int32_t x;
     int32_t y;
 };
+
+// Recipient set for spitfire::Broadcast
+struct stBroadcastTarget
+{
+    enum Type
+    {
+        WORLD,      // every connected player
+        CHANNEL,    // players listening on a chat channel
+        ALLIANCE,   // members of one alliance
+        LIST        // explicit list of clients
+    };
+
+    static stBroadcastTarget World() { return stBroadcastTarget(WORLD); }
+    static stBroadcastTarget Channel(std::string channel) { stBroadcastTarget t(CHANNEL); t.channel = channel; return t; }
+    static stBroadcastTarget ToAlliance(int64_t allianceid) { stBroadcastTarget t(ALLIANCE); t.allianceid = allianceid; return t; }
+    static stBroadcastTarget List(std::vector<Client*> clients) { stBroadcastTarget t(LIST); t.clients = std::move(clients); return t; }
+
+    Type type;
+    std::string channel;
+    int64_t allianceid = 0;
+    std::vector<Client*> clients;
+
+private:
+    explicit stBroadcastTarget(Type type) : type(type) {}
+};
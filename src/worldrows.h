@@ -0,0 +1,80 @@
+/* Copyright (C) Daisy - All Rights Reserved
+* Unauthorized copying of this file, via any medium is strictly prohibited
+* Proprietary and confidential
+* Written by Daisy <daisy@spitfire.pw>, February 2018
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <Poco/Tuple.h>
+
+// Rows the world is built from at startup, in the column order the loader
+// selects them. The MySQL loader and the snapshot file both produce these,
+// so linking them into the world is the same code either way.
+using TileRow = Poco::Tuple<int64_t, int64_t, int64_t, int64_t>;
+using AccountRow = Poco::Tuple<int64_t, int64_t, std::string, std::string, std::string, int32_t, int16_t, double, double, int32_t,
+    int32_t, std::string, std::string, int32_t, double, double, std::string, std::string, std::string, std::string>;
+using MailRow = Poco::Tuple<int64_t, std::string, std::string, uint64_t, uint64_t, int32_t, int64_t, int8_t>;
+using CityRow = Poco::Tuple<int64_t, int64_t, int32_t, double, double, double, double, double, std::string, std::string,
+    double, std::string, std::string, std::string, std::string, std::string>;
+using HeroRow = Poco::Tuple<uint64_t, int64_t, int8_t, int32_t, int32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, uint32_t,
+    uint32_t, uint32_t, uint32_t, uint32_t, uint32_t, std::string, std::string, uint32_t, uint32_t, double, double, int8_t>;
+using AllianceRow = Poco::Tuple<int64_t, std::string, std::string, std::string, std::string, std::string, std::string, std::string>;
+using ArmyRow = Poco::Tuple<int64_t, int64_t, int64_t, int32_t, int16_t, std::string, std::string, int64_t, int64_t, int64_t, int32_t, int32_t>;
+using ReportRow = Poco::Tuple<int64_t, int8_t, bool, bool, int8_t, std::string, std::string, std::string, std::string, uint64_t, bool>;
+// Accounts whose mail and reports were evicted to the store, so the rows
+// above hold none for them, and the pid their next mail gets
+using EvictedRow = Poco::Tuple<int64_t, int64_t>;
+
+// Section ids of the row sets in a snapshot file; never renumber
+enum worldsection : uint32_t
+{
+    SECTION_TILES = 1,
+    SECTION_ACCOUNTS,
+    SECTION_MAIL,
+    SECTION_CITIES,
+    SECTION_HEROES,
+    SECTION_ALLIANCES,
+    SECTION_ARMIES,
+    SECTION_REPORTS,
+    SECTION_EVICTED
+};
+
+// Record types of the journal; never renumber. Entities are journaled as
+// the row image they would be saved as, so replaying is replacing rows.
+// Armies are keyed by ArmyMgr::Key, which only lives as long as the process,
+// so a segment's first army record is the whole keyed set and the records
+// after it patch that.
+enum journalrecord : uint8_t
+{
+    JOURNAL_ACCOUNT = 1,        // AccountRow
+    JOURNAL_CITY,               // CityRow
+    JOURNAL_HERO,               // HeroRow
+    JOURNAL_HERODELETED,        // uint64_t hero id
+    JOURNAL_ALLIANCE,           // AllianceRow
+    JOURNAL_ALLIANCEDELETED,    // int64_t alliance id
+    JOURNAL_REPORTS,            // int64_t account id, uint32_t count, every ReportRow of the account
+    JOURNAL_ARMIES,             // uint32_t count, every ArmyRow; no longer written
+    JOURNAL_MAIL,               // MailRow, replacing the one with the same receiver and pid
+    JOURNAL_ARMYIMAGE,          // uint32_t count, every army as uint64_t key and ArmyRow
+    JOURNAL_ARMY,               // uint64_t key, ArmyRow
+    JOURNAL_ARMYGONE,           // uint64_t key
+    JOURNAL_REPORT              // ReportRow, a new report in front of the account's others
+};
+
+struct worldrows
+{
+    std::vector<TileRow> tiles;
+    std::vector<AccountRow> accounts;
+    std::vector<MailRow> mail;
+    std::vector<CityRow> cities;
+    std::vector<HeroRow> heroes;
+    std::vector<AllianceRow> alliances;
+    std::vector<ArmyRow> armies;
+    std::vector<ReportRow> reports;
+    std::vector<EvictedRow> evicted;
+};